@@ -0,0 +1,911 @@
+// bench.c : cross-core throughput benchmarks for the v2lin primitives
+//
+// Usage: bench [iterations]
+//
+// Each benchmark pins its tasks to distinct CPUs (when more than one is
+// online) so that the numbers reflect cache line traffic between cores
+// rather than time slicing on a single core.  Run it before and after a
+// change to the control block layout or the locking paths and compare.
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "vxw_hdrs.h"
+#include "v2pthread.h"
+
+#define BENCH_DEFAULT_ITERATIONS    200000
+#define BENCH_MAX_TASKS             16
+#define BENCH_MSG_LEN               16
+#define BENCH_QUEUE_DEPTH           64
+#define BENCH_DELETE_TASKS          256
+#define BENCH_HANDOFF_WAITERS       4
+#define BENCH_PRIORITY_WAITERS      256
+#define BENCH_MANY_SEMS             20000
+#define BENCH_FLUSH_WAITERS         64
+#define BENCH_WAIT_OBJS             4
+#define BENCH_READERS               4
+#define BENCH_BURST                 16
+#define BENCH_EV_PING               0x1
+#define BENCH_EV_PONG               0x2
+
+static int      g_iterations;
+static int      g_ncpus;
+static SEM_ID   g_done;
+
+static SEM_ID   g_ping;
+static SEM_ID   g_pong;
+static MSG_Q_ID g_queue;
+static SEM_ID   g_private[BENCH_MAX_TASKS];
+static SEM_ID   g_never;
+static volatile int g_jobs_run;
+static int      g_victims[BENCH_DELETE_TASKS];
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void PinToCpu( int cpu )
+{
+    cpu_set_t set;
+
+    CPU_ZERO( &set );
+    CPU_SET( cpu % g_ncpus, &set );
+    pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
+}
+
+static double NowNs( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec );
+}
+
+static void WaitForTasks( int ntasks )
+{
+    int i;
+
+    for( i = 0; i < ntasks; i++ )
+        if( semTake( g_done, WAIT_FOREVER ) != OK )
+            perror( "Error waiting for benchmark task" );
+}
+
+static void Report( const char *name, double elapsed_ns, double ops )
+{
+    printf( "%-34s %10.1f ns/op %12.0f ops/s\n", name, elapsed_ns / ops,
+            ops * 1e9 / elapsed_ns );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Semaphore ping-pong: two tasks on different CPUs hand a token back and
+// forth through a pair of binary semaphores.
+
+int PingTask( int cpu, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    int i;
+
+    PinToCpu( cpu );
+    for( i = 0; i < g_iterations; i++ )
+    {
+        semGive( g_ping );
+        semTake( g_pong, WAIT_FOREVER );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+int PongTask( int cpu, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    int i;
+
+    PinToCpu( cpu );
+    for( i = 0; i < g_iterations; i++ )
+    {
+        semTake( g_ping, WAIT_FOREVER );
+        semGive( g_pong );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchSemPingPong( void )
+{
+    double start;
+
+    g_ping = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    g_pong = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+
+    start = NowNs();
+    taskSpawn( "tPong", 10, 0, 0, PongTask, 1, 0,0,0,0,0,0,0,0,0 );
+    taskSpawn( "tPing", 10, 0, 0, PingTask, 0, 0,0,0,0,0,0,0,0,0 );
+    WaitForTasks( 2 );
+    Report( "semaphore ping-pong (round trip)", NowNs() - start, g_iterations );
+
+    semDelete( g_ping );
+    semDelete( g_pong );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Event ping-pong: the same round trip through eventSend / eventReceive,
+// with no semaphores in between.
+
+static volatile int g_ev_ping_tid;
+
+int EvPingTask( int cpu, int pong_tid, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    unsigned int got;
+    int i;
+
+    PinToCpu( cpu );
+    g_ev_ping_tid = taskIdSelf();
+    for( i = 0; i < g_iterations; i++ )
+    {
+        eventSend( pong_tid, BENCH_EV_PING );
+        eventReceive( BENCH_EV_PONG, EVENTS_WAIT_ANY, WAIT_FOREVER, &got );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+int EvPongTask( int cpu, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    unsigned int got;
+    int i;
+
+    PinToCpu( cpu );
+    for( i = 0; i < g_iterations; i++ )
+    {
+        eventReceive( BENCH_EV_PING, EVENTS_WAIT_ANY, WAIT_FOREVER, &got );
+        eventSend( g_ev_ping_tid, BENCH_EV_PONG );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchEventPingPong( void )
+{
+    double start;
+    int pong_tid;
+
+    start = NowNs();
+    pong_tid = taskSpawn( "tEvPong", 10, 0, 0, EvPongTask, 1,
+                          0,0,0,0,0,0,0,0,0 );
+    taskSpawn( "tEvPing", 10, 0, 0, EvPingTask, 0, pong_tid,
+               0,0,0,0,0,0,0,0 );
+    WaitForTasks( 2 );
+    Report( "event ping-pong (round trip)", NowNs() - start, g_iterations );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Named semaphore ping-pong: the same round trip between two processes,
+// through a pair of named binary semaphores.  The pong side is this program
+// run again with "-pong" and the semaphore names; it gives the pong
+// semaphore once when it is ready, so that its startup is not timed.
+
+static void NamedPong( const char *ping_name, const char *pong_name )
+{
+    SEM_ID ping, pong;
+    int i;
+
+    ping = semOpen( ping_name, SEM_TYPE_BINARY, SEM_EMPTY, SEM_Q_FIFO, 0,
+                    NULL );
+    pong = semOpen( pong_name, SEM_TYPE_BINARY, SEM_EMPTY, SEM_Q_FIFO, 0,
+                    NULL );
+    if( (ping == NULL) || (pong == NULL) )
+    {
+        perror( "Error opening named semaphores" );
+        return;
+    }
+
+    PinToCpu( 1 );
+    semGive( pong );
+    for( i = 0; i < g_iterations; i++ )
+    {
+        semTake( ping, WAIT_FOREVER );
+        semGive( pong );
+    }
+    semClose( ping );
+    semClose( pong );
+}
+
+static void BenchNamedPingPong( void )
+{
+    char ping_name[32], pong_name[32], count[16];
+    double start;
+    pid_t child;
+    int mode;
+
+    sprintf( ping_name, "benchPing.%d", (int)getpid() );
+    sprintf( pong_name, "benchPong.%d", (int)getpid() );
+    sprintf( count, "%d", g_iterations );
+    mode = OM_CREATE | OM_EXCL | OM_DELETE_ON_LAST_CLOSE;
+    g_ping = semOpen( ping_name, SEM_TYPE_BINARY, SEM_EMPTY, SEM_Q_FIFO,
+                      mode, NULL );
+    g_pong = semOpen( pong_name, SEM_TYPE_BINARY, SEM_EMPTY, SEM_Q_FIFO,
+                      mode, NULL );
+    if( (g_ping == NULL) || (g_pong == NULL) )
+    {
+        perror( "Error creating named semaphores" );
+        return;
+    }
+
+    child = fork();
+    if( child == 0 )
+    {
+        execl( "/proc/self/exe", "bench", count, "-pong", ping_name,
+               pong_name, (char *)NULL );
+        _exit( 1 );
+    }
+    if( (child < 0) || (semTake( g_pong, 500 ) != OK) )
+        printf( "Error: pong process did not start\n" );
+    else
+    {
+        start = NowNs();
+        taskSpawn( "tPing", 10, 0, 0, PingTask, 0, 0,0,0,0,0,0,0,0,0 );
+        WaitForTasks( 1 );
+        Report( "named sem ping-pong, 2 processes", NowNs() - start,
+                g_iterations );
+    }
+    if( child > 0 )
+        waitpid( child, NULL, 0 );
+
+    semClose( g_ping );
+    semClose( g_pong );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Message queue stream: one producer and one consumer on different CPUs.
+// Senders and receivers touch opposite ends of the queue control block.
+
+int ProducerTask( int cpu, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    char msg[BENCH_MSG_LEN];
+    int i;
+
+    PinToCpu( cpu );
+    memset( msg, 0, sizeof( msg ) );
+    for( i = 0; i < g_iterations; i++ )
+    {
+        *(int *)msg = i;
+        msgQSend( g_queue, msg, sizeof( msg ), WAIT_FOREVER, MSG_PRI_NORMAL );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+int ConsumerTask( int cpu, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    char msg[BENCH_MSG_LEN];
+    int i;
+
+    PinToCpu( cpu );
+    for( i = 0; i < g_iterations; i++ )
+        msgQReceive( g_queue, msg, sizeof( msg ), WAIT_FOREVER );
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchMsgQStream( void )
+{
+    double start;
+
+    g_queue = msgQCreate( BENCH_QUEUE_DEPTH, BENCH_MSG_LEN, MSG_Q_FIFO );
+
+    start = NowNs();
+    taskSpawn( "tConsumer", 10, 0, 0, ConsumerTask, 1, 0,0,0,0,0,0,0,0,0 );
+    taskSpawn( "tProducer", 10, 0, 0, ProducerTask, 0, 0,0,0,0,0,0,0,0,0 );
+    WaitForTasks( 2 );
+    Report( "msgQ producer/consumer (message)", NowNs() - start, g_iterations );
+
+    msgQDelete( g_queue );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Private semaphores: one task per CPU, each giving and taking a semaphore
+// nobody else uses.  The semaphores are created back to back, so any
+// false sharing between neighbouring control blocks shows up here.
+
+int PrivateTask( int cpu, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    int i;
+
+    PinToCpu( cpu );
+    for( i = 0; i < g_iterations; i++ )
+    {
+        semGive( g_private[cpu] );
+        semTake( g_private[cpu], WAIT_FOREVER );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchPrivateSems( void )
+{
+    double start;
+    int i, ntasks;
+
+    ntasks = g_ncpus < BENCH_MAX_TASKS ? g_ncpus : BENCH_MAX_TASKS;
+    for( i = 0; i < ntasks; i++ )
+        g_private[i] = semCCreate( SEM_Q_FIFO, 0 );
+
+    start = NowNs();
+    for( i = 0; i < ntasks; i++ )
+        taskSpawn( NULL, 10, 0, 0, PrivateTask, i, 0,0,0,0,0,0,0,0,0 );
+    WaitForTasks( ntasks );
+    Report( "private semaphores (give+take)", NowNs() - start,
+            (double)g_iterations * ntasks );
+
+    for( i = 0; i < ntasks; i++ )
+        semDelete( g_private[i] );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Uncontended mutex: one task takes and gives a mutex semaphore nobody
+// else uses, as a lock around a short critical section would.  An
+// inversion-safe mutex should cost no system call when uncontended; a
+// ceiling mutex costs two, to raise the owner's priority and restore it.
+
+static SEM_ID g_mutex;
+
+int MutexTask( int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    int i;
+
+    for( i = 0; i < g_iterations; i++ )
+    {
+        semTake( g_mutex, WAIT_FOREVER );
+        semGive( g_mutex );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchMutex( const char *name, int opt )
+{
+    double start;
+
+    if( opt & SEM_PRIO_CEILING )
+        g_mutex = semMCeilingCreate( opt & ~SEM_PRIO_CEILING, 5 );
+    else
+        g_mutex = semMCreate( opt );
+
+    start = NowNs();
+    taskSpawn( "tMutex", 10, 0, 0, MutexTask, 0,0,0,0,0,0,0,0,0,0 );
+    WaitForTasks( 1 );
+    Report( name, NowNs() - start, g_iterations );
+
+    semDelete( g_mutex );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Contended mutex: two tasks on different CPUs share one mutex around a
+// critical section of a few hundred nanoseconds.  A SEM_ADAPTIVE mutex
+// should mostly be taken by spinning rather than by blocking.
+
+static volatile unsigned long g_shared_data;
+
+int ContendTask( int cpu, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    int i, j;
+
+    PinToCpu( cpu );
+    for( i = 0; i < g_iterations; i++ )
+    {
+        semTake( g_mutex, WAIT_FOREVER );
+        for( j = 0; j < 50; j++ )
+            g_shared_data++;
+        semGive( g_mutex );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchContendedMutex( const char *name, int opt )
+{
+    unsigned long spun, blocked;
+    double start;
+
+    g_mutex = semMCreate( opt );
+
+    start = NowNs();
+    taskSpawn( "tContend0", 10, 0, 0, ContendTask, 0,0,0,0,0,0,0,0,0,0 );
+    taskSpawn( "tContend1", 10, 0, 0, ContendTask, 1,0,0,0,0,0,0,0,0,0 );
+    WaitForTasks( 2 );
+    Report( name, NowNs() - start, 2.0 * g_iterations );
+    if( (opt & SEM_ADAPTIVE) &&
+        (semMSpinStats( g_mutex, &spun, &blocked, FALSE ) == OK) )
+        printf( "%-34s %10lu spun %10lu blocked\n", "  contended takes",
+                spun, blocked );
+
+    semDelete( g_mutex );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Many semaphores: with a large population of semaphores in existence,
+// a take on an empty semaphore (which finds no token and so goes through
+// the full validation path) should cost no more than with a handful.
+
+static SEM_ID g_many[BENCH_MANY_SEMS];
+
+static void BenchManySems( void )
+{
+    double start;
+    int i;
+
+    for( i = 0; i < BENCH_MANY_SEMS; i++ )
+        g_many[i] = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+
+    start = NowNs();
+    for( i = 0; i < g_iterations; i++ )
+        semTake( g_many[(i * 7919) % BENCH_MANY_SEMS], NO_WAIT );
+    Report( "empty take, 20000 semaphores", NowNs() - start, g_iterations );
+
+    for( i = 0; i < BENCH_MANY_SEMS; i++ )
+        semDelete( g_many[i] );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Semaphore churn: several tasks create and delete short-lived semaphores
+// as a per-request handshake would, so the cost is that of creation and
+// deletion alone.  Given a storage number, each task builds its semaphores
+// in caller storage of its own with semBInitialize instead.
+
+static VX_BINARY_SEMAPHORE( g_churn_mem[4] );
+
+int ChurnTask( int opt, int storage, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    SEM_ID sem;
+    int i;
+
+    for( i = 0; i < g_iterations; i++ )
+    {
+        if( storage )
+            sem = semBInitialize( g_churn_mem[storage - 1], opt, SEM_EMPTY );
+        else
+            sem = semBCreate( opt, SEM_EMPTY );
+        semGive( sem );
+        semTake( sem, NO_WAIT );
+        semDelete( sem );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchChurn( const char *name, int opt, int use_storage )
+{
+    double start;
+    int i;
+
+    start = NowNs();
+    for( i = 0; i < 4; i++ )
+        taskSpawn( NULL, 10, 0, 0, ChurnTask, opt,
+                   use_storage ? i + 1 : 0,0,0,0,0,0,0,0,0 );
+    WaitForTasks( 4 );
+    Report( name, NowNs() - start, 4.0 * g_iterations );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Handoff with several waiters: a few tasks stay pended on one semaphore
+// while a giver hands out tokens one at a time and waits for each to be
+// acknowledged.  Every give has to wake exactly one waiter.  With
+// SEM_Q_PRIORITY the waiters are spread over many priority levels, and
+// the cost of picking the highest should not grow with their number.
+
+static SEM_ID g_shared;
+static SEM_ID g_ack;
+
+int HandoffWaiterTask( int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    while( semTake( g_shared, WAIT_FOREVER ) == OK )
+        semGive( g_ack );
+    semGive( g_done );
+    return 0;
+}
+
+int HandoffGiverTask( int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    int i;
+
+    for( i = 0; i < g_iterations; i++ )
+    {
+        semGive( g_shared );
+        semTake( g_ack, WAIT_FOREVER );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchHandoff( const char *name, int opt, int nwaiters )
+{
+    double start;
+    int i;
+
+    g_shared = semCCreate( opt, 0 );
+    g_ack = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    for( i = 0; i < nwaiters; i++ )
+        taskSpawn( NULL, (opt & SEM_Q_PRIORITY) ? 11 + (i % 200) : 10, 0, 0,
+                   HandoffWaiterTask, 0,0,0,0,0,0,0,0,0,0 );
+    taskDelay( 10 );
+
+    start = NowNs();
+    taskSpawn( "tGiver", 10, 0, 0, HandoffGiverTask, 0,0,0,0,0,0,0,0,0,0 );
+    WaitForTasks( 1 );
+    Report( name, NowNs() - start, g_iterations );
+
+    semDelete( g_shared );
+    WaitForTasks( nwaiters );
+    semDelete( g_ack );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Readers: several tasks on different CPUs take a lock for reading around a
+// short critical section.  Readers of a semRWCreate semaphore count on their
+// own CPU's cache line and should scale; a mutex serializes them.
+
+int ReaderTask( int cpu, int rw, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    unsigned long sum;
+    int i, j;
+
+    PinToCpu( cpu );
+    sum = 0;
+    for( i = 0; i < g_iterations; i++ )
+    {
+        if( rw )
+            semRTake( g_mutex, WAIT_FOREVER );
+        else
+            semTake( g_mutex, WAIT_FOREVER );
+        for( j = 0; j < 50; j++ )
+            sum += g_shared_data;
+        semGive( g_mutex );
+    }
+    g_shared_data += sum & 1;
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchReaders( const char *name, int rw )
+{
+    double start;
+    int i;
+
+    if( rw )
+        g_mutex = semRWCreate( SEM_Q_FIFO, BENCH_READERS );
+    else
+        g_mutex = semMCreate( SEM_Q_FIFO );
+
+    start = NowNs();
+    for( i = 0; i < BENCH_READERS; i++ )
+        taskSpawn( NULL, 10, 0, 0, ReaderTask, i,rw,0,0,0,0,0,0,0,0 );
+    WaitForTasks( BENCH_READERS );
+    Report( name, NowNs() - start, (double)BENCH_READERS * g_iterations );
+
+    semDelete( g_mutex );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Bursts: a producer releases BENCH_BURST buffers at a time to a consumer
+// through a counting semaphore, one token per semGive and semTake, or all
+// at once with semCGiveN and semCTakeN.
+
+int BurstTask( int batch, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    int i, left;
+
+    PinToCpu( 1 );
+    for( i = 0; i < g_iterations / BENCH_BURST; i++ )
+    {
+        for( left = BENCH_BURST; left > 0; )
+        {
+            if( batch )
+                left -= semCTakeN( g_shared, left, WAIT_FOREVER );
+            else if( semTake( g_shared, WAIT_FOREVER ) == OK )
+                left--;
+        }
+        semGive( g_ack );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchBurst( const char *name, int batch )
+{
+    double start;
+    int i, j;
+
+    g_shared = semCCreate( SEM_Q_FIFO, 0 );
+    g_ack = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+
+    start = NowNs();
+    taskSpawn( "tBurst", 10, 0, 0, BurstTask, batch,0,0,0,0,0,0,0,0,0 );
+    for( i = 0; i < g_iterations / BENCH_BURST; i++ )
+    {
+        if( batch )
+            semCGiveN( g_shared, BENCH_BURST );
+        else
+            for( j = 0; j < BENCH_BURST; j++ )
+                semGive( g_shared );
+        semTake( g_ack, WAIT_FOREVER );
+    }
+    WaitForTasks( 1 );
+    Report( name, NowNs() - start,
+            (double)(g_iterations / BENCH_BURST) * BENCH_BURST );
+
+    semDelete( g_shared );
+    semDelete( g_ack );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// objWaitAny: one task waits on several semaphores at once, and another
+// gives each in turn and waits for an acknowledgement.  Compare with the
+// ping-pong round trip on a single semaphore.
+
+static SEM_ID g_wait_sems[BENCH_WAIT_OBJS];
+
+int WaitAnyTask( int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    WAIT_OBJ objs[BENCH_WAIT_OBJS];
+    int i;
+
+    memset( objs, 0, sizeof( objs ) );
+    for( i = 0; i < BENCH_WAIT_OBJS; i++ )
+    {
+        objs[i].type = WAIT_OBJ_SEM;
+        objs[i].id = g_wait_sems[i];
+    }
+    for( i = 0; i < g_iterations; i++ )
+    {
+        if( objWaitAny( objs, BENCH_WAIT_OBJS, WAIT_FOREVER ) == ERROR )
+            perror( "Error in objWaitAny" );
+        semGive( g_ack );
+    }
+    semGive( g_done );
+    return 0;
+}
+
+static void BenchWaitAny( void )
+{
+    double start;
+    int i;
+
+    for( i = 0; i < BENCH_WAIT_OBJS; i++ )
+        g_wait_sems[i] = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    g_ack = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    taskSpawn( "tWaitAny", 10, 0, 0, WaitAnyTask, 0,0,0,0,0,0,0,0,0,0 );
+    taskDelay( 10 );
+
+    start = NowNs();
+    for( i = 0; i < g_iterations; i++ )
+    {
+        semGive( g_wait_sems[i % BENCH_WAIT_OBJS] );
+        semTake( g_ack, WAIT_FOREVER );
+    }
+    WaitForTasks( 1 );
+    Report( "objWaitAny, 4 sems (round trip)", NowNs() - start,
+            g_iterations );
+
+    for( i = 0; i < BENCH_WAIT_OBJS; i++ )
+        semDelete( g_wait_sems[i] );
+    semDelete( g_ack );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// semFlush: release many pended tasks at once.  Only the flushing call is
+// timed; it should not depend on how soon the released tasks get to run.
+
+static void BenchFlush( void )
+{
+    double elapsed;
+    double start;
+    int rounds;
+    int i, j;
+
+    g_shared = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    g_ack = semCCreate( SEM_Q_FIFO, 0 );
+    for( i = 0; i < BENCH_FLUSH_WAITERS; i++ )
+        taskSpawn( NULL, 20, 0, 0, HandoffWaiterTask, 0,0,0,0,0,0,0,0,0,0 );
+    taskDelay( 10 );
+
+    rounds = g_iterations / 100 + 1;
+    elapsed = 0;
+    for( i = 0; i < rounds; i++ )
+    {
+        start = NowNs();
+        semFlush( g_shared );
+        elapsed += NowNs() - start;
+        for( j = 0; j < BENCH_FLUSH_WAITERS; j++ )
+            semTake( g_ack, WAIT_FOREVER );
+        taskDelay( 1 );
+    }
+    Report( "semFlush, 64 waiters", elapsed, rounds );
+
+    semDelete( g_shared );
+    WaitForTasks( BENCH_FLUSH_WAITERS );
+    semDelete( g_ack );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Sub-tick timeouts: semTakeNs on a semaphore that is never given.  The
+// time per call is the real length of a 100 microsecond timeout, which a
+// tick-based semTake could only round up to a whole tick.
+
+static void BenchTimeout( void )
+{
+    SEM_ID empty;
+    double start;
+    int rounds;
+    int i;
+
+    empty = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    rounds = g_iterations / 50 + 1;
+    start = NowNs();
+    for( i = 0; i < rounds; i++ )
+        semTakeNs( empty, 100000 );
+    Report( "semTakeNs 100 us timeout (wait)", NowNs() - start, rounds );
+    semDelete( empty );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Rate limiter: takes from a bucket that always has a token due, then
+// takes throttled to 10000 per second, each of which should wait 100 us.
+
+static void BenchRateLimit( void )
+{
+    SEM_ID bucket;
+    double start;
+    int rounds;
+    int i;
+
+    bucket = semRateCreate( SEM_Q_FIFO, 1000000000, 1000000 );
+    start = NowNs();
+    for( i = 0; i < g_iterations; i++ )
+        semTake( bucket, NO_WAIT );
+    Report( "rate limiter take (token due)", NowNs() - start, g_iterations );
+    semDelete( bucket );
+
+    bucket = semRateCreate( SEM_Q_FIFO, 10000, 1 );
+    semTake( bucket, NO_WAIT );
+    rounds = g_iterations / 50 + 1;
+    start = NowNs();
+    for( i = 0; i < rounds; i++ )
+        semTake( bucket, WAIT_FOREVER );
+    Report( "rate limiter 10000/s (throttled)", NowNs() - start, rounds );
+    semDelete( bucket );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Task deletion: delete tasks pended on a semaphore that is never given,
+// and report the longest time the scheduler lock was held meanwhile.
+
+int VictimTask( int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    semTake( g_never, WAIT_FOREVER );
+    return 0;
+}
+
+static void BenchTaskDelete( void )
+{
+    double start;
+    int i;
+
+    g_never = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    for( i = 0; i < BENCH_DELETE_TASKS; i++ )
+        g_victims[i] = taskSpawn( NULL, 20, 0, 0, VictimTask, 0,0,0,0,0,0,0,0,0,0 );
+    taskDelay( 10 );
+
+    taskLockHoldMax( TRUE );
+    start = NowNs();
+    for( i = 0; i < BENCH_DELETE_TASKS; i++ )
+        if( taskDelete( g_victims[i] ) != OK )
+            perror( "Error deleting benchmark task" );
+    Report( "taskDelete (pended victim)", NowNs() - start, BENCH_DELETE_TASKS );
+    printf( "%-34s %10.1f us\n", "worst-case taskLock hold",
+            taskLockHoldMax( FALSE ) / 1e3 );
+
+    semDelete( g_never );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Exception jobs: one task queues jobs with excJobAdd as fast as it can;
+// the last job to run signals completion.
+
+static void CountJob( int last, int p2, int p3, int p4, int p5, int p6 )
+{
+    g_jobs_run++;
+    if( last )
+        semGive( g_done );
+}
+
+int JobProducerTask( int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10 )
+{
+    int i;
+
+    for( i = 0; i < g_iterations; i++ )
+        while( excJobAdd( CountJob, i == g_iterations - 1,
+                          0, 0, 0, 0, 0 ) != OK )
+            usleep( 100 );
+    return 0;
+}
+
+static void BenchExcJobs( void )
+{
+    double start;
+
+    g_jobs_run = 0;
+    start = NowNs();
+    taskSpawn( "tJobProducer", 10, 0, 0, JobProducerTask, 0,0,0,0,0,0,0,0,0,0 );
+    WaitForTasks( 1 );
+    Report( "excJobAdd (queue and run)", NowNs() - start, g_iterations );
+    if( g_jobs_run != g_iterations )
+        printf( "Error: %d of %d jobs ran\n", g_jobs_run, g_iterations );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main( int argc, char **argv )
+{
+    v2lin_init();
+
+    g_iterations = (argc > 1) ? atoi( argv[1] ) : BENCH_DEFAULT_ITERATIONS;
+    if( g_iterations <= 0 )
+        g_iterations = BENCH_DEFAULT_ITERATIONS;
+    g_ncpus = (int)sysconf( _SC_NPROCESSORS_ONLN );
+    if( g_ncpus < 1 )
+        g_ncpus = 1;
+
+    if( (argc == 5) && (strcmp( argv[2], "-pong" ) == 0) )
+    {
+        NamedPong( argv[3], argv[4] );
+        return 0;
+    }
+
+    printf( "v2lin benchmarks: %d iterations, %d CPUs online\n\n",
+            g_iterations, g_ncpus );
+
+    g_done = semCCreate( SEM_Q_FIFO, 0 );
+
+    BenchSemPingPong();
+    BenchEventPingPong();
+    BenchNamedPingPong();
+    BenchMsgQStream();
+    BenchPrivateSems();
+    BenchMutex( "uncontended mutex (take+give)", SEM_Q_FIFO );
+    BenchMutex( "uncontended delete-safe mutex", SEM_Q_FIFO | SEM_DELETE_SAFE );
+    BenchMutex( "uncontended inversion-safe mutex",
+                SEM_Q_PRIORITY | SEM_INVERSION_SAFE );
+    BenchMutex( "uncontended ceiling mutex",
+                SEM_Q_PRIORITY | SEM_PRIO_CEILING );
+    BenchContendedMutex( "contended mutex (take+give)", SEM_Q_FIFO );
+    BenchContendedMutex( "contended adaptive mutex",
+                         SEM_Q_FIFO | SEM_ADAPTIVE );
+    semStatsEnable( TRUE );
+    BenchMutex( "uncontended mutex, statistics on", SEM_Q_FIFO );
+    BenchContendedMutex( "contended mutex, statistics on", SEM_Q_FIFO );
+    semStatsEnable( FALSE );
+    BenchReaders( "mutex, 4 readers", FALSE );
+    BenchReaders( "rw semaphore, 4 readers", TRUE );
+    BenchHandoff( "handoff, 4 waiters (round trip)", SEM_Q_FIFO,
+                  BENCH_HANDOFF_WAITERS );
+    BenchHandoff( "handoff, 256 by priority", SEM_Q_PRIORITY,
+                  BENCH_PRIORITY_WAITERS );
+    BenchManySems();
+    BenchChurn( "semBCreate+semDelete churn", SEM_Q_FIFO, 0 );
+    BenchChurn( "churn, priority-queued", SEM_Q_PRIORITY, 0 );
+    BenchChurn( "semBInitialize+semDelete churn", SEM_Q_FIFO, 1 );
+    BenchBurst( "burst of 16, one token per call", FALSE );
+    BenchBurst( "burst of 16, semCGiveN/semCTakeN", TRUE );
+    BenchWaitAny();
+    BenchFlush();
+    BenchTimeout();
+    BenchRateLimit();
+    BenchTaskDelete();
+    BenchExcJobs();
+
+    semDelete( g_done );
+    return 0;
+}
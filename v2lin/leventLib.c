@@ -0,0 +1,373 @@
+/*****************************************************************************
+ * eventLib.c - defines the wrapper functions and data structures needed
+ *              to implement Wind River VxWorks (R) task events in a POSIX
+ *              Threads environment.
+ *
+ * Copyright (C) 2000, 2001  MontaVista Software Inc.
+ *
+ * Author : Gary S. Robertson
+ *
+ * VxWorks is a registered trademark of Wind River Systems, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ ****************************************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include "v2pthread.h"
+#include "vxw_defs.h"
+
+/*****************************************************************************
+**  External function and data references
+*****************************************************************************/
+extern v2pthread_cb_t *
+   my_tcb( void );
+extern v2pthread_cb_t *
+   tcb_for( int taskid );
+extern void
+   deadline_after_ticks( int ticks, struct timespec *deadline );
+
+/*
+**  task_list_lock is a mutex used to serialize access to the task list
+*/
+extern pthread_mutex_t
+    task_list_lock;
+
+/*****************************************************************************
+** events_ready - indicates whether the events in an event word satisfy an
+**                eventReceive for the specified events and options.
+*****************************************************************************/
+static int
+   events_ready( unsigned int word, unsigned int events, int options )
+{
+    if ( options & EVENTS_WAIT_ANY )
+        return( (word & events) != 0 );
+    return( (word & events) == events );
+}
+
+/*****************************************************************************
+** send_events - sets the specified events in a task's event word, and wakes
+**               the task if it waits in eventReceive.  The events are set
+**               before events_wanted is read (and events_wanted is set
+**               before the event word is read in eventReceive) so that
+**               either the receiver sees the events or we see the
+**               receiver.  The caller must hold task_list_lock, so that
+**               the tcb cannot be freed meanwhile.
+*****************************************************************************/
+static void
+   send_events( v2pthread_cb_t *tcb, unsigned int events )
+{
+    __atomic_or_fetch( &(tcb->events), events, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &(tcb->events_wanted), __ATOMIC_SEQ_CST ) != 0 )
+    {
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nevents %x wake task @ %p", events, tcb );
+#endif
+        pthread_mutex_lock( &(tcb->wake_lock) );
+        pthread_cond_signal( &(tcb->wake_cond) );
+        pthread_mutex_unlock( &(tcb->wake_lock) );
+    }
+}
+
+/*****************************************************************************
+** abandon_receive - withdraws the calling task's wait in eventReceive and
+**                   lets go of its wake_lock.  Also the cleanup handler for
+**                   a task killed while waiting for events.
+*****************************************************************************/
+static void
+   abandon_receive( void *arg )
+{
+    v2pthread_cb_t *tcb;
+
+    tcb = (v2pthread_cb_t *)arg;
+    __atomic_store_n( &(tcb->events_wanted), 0, __ATOMIC_SEQ_CST );
+    pthread_mutex_unlock( &(tcb->wake_lock) );
+}
+
+/*****************************************************************************
+** register_events - registers the calling task with an object, to be sent
+**                   the specified events whenever the object becomes
+**                   available.  ready indicates whether the object is
+**                   available now, for EVENTS_SEND_IF_FREE.  The caller
+**                   must hold the object's lock.  Returns OK, or an error
+**                   code for the caller to put in errno.
+*****************************************************************************/
+STATUS
+   register_events( v2pt_ev_reg_t *reg, unsigned int events, int options,
+                    int ready )
+{
+    v2pthread_cb_t *our_tcb;
+
+    our_tcb = my_tcb();
+    if ( our_tcb == (v2pthread_cb_t *)NULL )
+        return( S_objLib_OBJ_ID_ERROR );     /* Caller is not a task */
+
+    if ( events == 0 )
+        return( S_eventLib_ZERO_EVENTS );
+
+    if ( (reg->taskid != 0) && (reg->taskid != our_tcb->taskid) &&
+         !(options & EVENTS_ALLOW_OVERWRITE) )
+        return( S_eventLib_ALREADY_REGISTERED );
+
+    /*
+    **  An object already available sends its events at once if asked; a
+    **  once-only registration is then used up.
+    */
+    if ( ready && (options & EVENTS_SEND_IF_FREE) )
+    {
+        __atomic_or_fetch( &(our_tcb->events), events, __ATOMIC_SEQ_CST );
+        if ( options & EVENTS_SEND_ONCE )
+        {
+            if ( reg->taskid == our_tcb->taskid )
+                reg->taskid = 0;
+            return( OK );
+        }
+    }
+
+    reg->taskid = our_tcb->taskid;
+    reg->events = events;
+    reg->options = options;
+    return( OK );
+}
+
+/*****************************************************************************
+** unregister_events - ends the calling task's registration with an object.
+**                     The caller must hold the object's lock.  Returns OK,
+**                     or an error code for the caller to put in errno.
+*****************************************************************************/
+STATUS
+   unregister_events( v2pt_ev_reg_t *reg )
+{
+    v2pthread_cb_t *our_tcb;
+
+    our_tcb = my_tcb();
+    if ( (our_tcb == (v2pthread_cb_t *)NULL) ||
+         (reg->taskid != our_tcb->taskid) )
+        return( S_eventLib_TASK_NOT_REGISTERED );
+
+    reg->taskid = 0;
+    return( OK );
+}
+
+/*****************************************************************************
+** post_events - sends the registered task its events, for an object which
+**               has just become available with no task pended on it.  A
+**               once-only registration, or one whose task has been deleted,
+**               is dropped.  The caller must hold the object's lock.
+**               Returns TRUE if the registration was dropped.
+*****************************************************************************/
+int
+   post_events( v2pt_ev_reg_t *reg )
+{
+    v2pthread_cb_t *tcb;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&task_list_lock );
+    pthread_mutex_lock( &task_list_lock );
+    tcb = tcb_for( reg->taskid );
+    if ( tcb != (v2pthread_cb_t *)NULL )
+        send_events( tcb, reg->events );
+    pthread_cleanup_pop( 1 );
+
+    if ( (tcb == (v2pthread_cb_t *)NULL) ||
+         (reg->options & EVENTS_SEND_ONCE) )
+    {
+        reg->taskid = 0;
+        return( TRUE );
+    }
+    return( FALSE );
+}
+
+/*****************************************************************************
+** eventSend - sets the specified events for the specified task, waking it
+**             if it waits in eventReceive for them.
+*****************************************************************************/
+STATUS
+   eventSend( int taskid, unsigned int events )
+{
+    v2pthread_cb_t *tcb;
+    STATUS error;
+
+    error = OK;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&task_list_lock );
+    pthread_mutex_lock( &task_list_lock );
+
+    if ( taskid == 0 )
+        /*
+        **  NULL taskid specifies current task - get TCB for current task
+        */
+        tcb = my_tcb();
+    else
+        /*
+        **  Get TCB for task specified by taskid
+        */
+        tcb = tcb_for( taskid );
+
+    if ( tcb != (v2pthread_cb_t *)NULL )
+        send_events( tcb, events );
+    else
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid task specified */
+
+    pthread_cleanup_pop( 1 );
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+
+    return( error );
+}
+
+/*****************************************************************************
+** eventReceive - blocks the calling task until all (or, with
+**                EVENTS_WAIT_ANY, any) of the specified events have been
+**                sent to it, or max_wait ticks pass.  The events received
+**                (or, with EVENTS_RETURN_ALL, all events pending) are
+**                returned in *received and cleared, along with every other
+**                pending event unless EVENTS_KEEP_UNWANTED is given.
+**                EVENTS_FETCH returns the pending events at once without
+**                clearing any.  Only the task itself clears its event
+**                word, and senders only ever set bits in it, so the word
+**                is checked and cleared without a lock; the task takes
+**                wake_lock only to sleep.
+*****************************************************************************/
+STATUS
+   eventReceive( unsigned int events, int options, int max_wait,
+                 unsigned int *received )
+{
+    v2pthread_cb_t *our_tcb;
+    struct timespec timeout;
+    unsigned int word;
+    int retcode;
+    STATUS error;
+
+    error = OK;
+
+    our_tcb = my_tcb();
+    if ( our_tcb == (v2pthread_cb_t *)NULL )
+    {
+        errno = S_objLib_OBJ_ID_ERROR;       /* Caller is not a task */
+        return( ERROR );
+    }
+
+    if ( options & EVENTS_FETCH )
+    {
+        if ( received != (unsigned int *)NULL )
+            *received = __atomic_load_n( &(our_tcb->events),
+                                         __ATOMIC_ACQUIRE );
+        return( OK );
+    }
+
+    if ( events == 0 )
+    {
+        errno = S_eventLib_ZERO_EVENTS;
+        return( ERROR );
+    }
+
+    word = __atomic_load_n( &(our_tcb->events), __ATOMIC_ACQUIRE );
+    if ( !events_ready( word, events, options ) && (max_wait != NO_WAIT) )
+    {
+        /*
+        **  Calculate the CLOCK_MONOTONIC deadline, if one applies.
+        */
+        if ( max_wait != WAIT_FOREVER )
+            deadline_after_ticks( max_wait, &timeout );
+
+        /*
+        **  Announce the wait before looking at the event word again, so
+        **  that a sender either sees us waiting and signals wake_cond, or
+        **  sets its events before we look (see send_events).  The wait
+        **  is on a condition variable, so that taskDelete can cancel the
+        **  task while it waits.
+        */
+        retcode = 0;
+        pthread_cleanup_push( abandon_receive, (void *)our_tcb );
+        pthread_mutex_lock( &(our_tcb->wake_lock) );
+        __atomic_store_n( &(our_tcb->events_wanted), events,
+                          __ATOMIC_SEQ_CST );
+        word = __atomic_load_n( &(our_tcb->events), __ATOMIC_SEQ_CST );
+        while ( !events_ready( word, events, options ) &&
+                (retcode != ETIMEDOUT) )
+        {
+            if ( max_wait == WAIT_FOREVER )
+                pthread_cond_wait( &(our_tcb->wake_cond),
+                                   &(our_tcb->wake_lock) );
+            else
+                retcode = pthread_cond_timedwait( &(our_tcb->wake_cond),
+                                                  &(our_tcb->wake_lock),
+                                                  &timeout );
+            word = __atomic_load_n( &(our_tcb->events), __ATOMIC_SEQ_CST );
+        }
+        pthread_cleanup_pop( 1 );
+    }
+
+    if ( !events_ready( word, events, options ) )
+    {
+        /*
+        **  Report whichever of the events did arrive, without clearing
+        **  them.
+        */
+        if ( received != (unsigned int *)NULL )
+            *received = word & events;
+        if ( max_wait == NO_WAIT )
+            error = S_eventLib_NOT_ALL_EVENTS;
+        else
+            error = S_eventLib_TIMEOUT;
+        errno = (int)error;
+        return( ERROR );
+    }
+
+    /*
+    **  Clear the events received (or all of them), picking up any sent
+    **  since the word was read.
+    */
+    if ( options & EVENTS_KEEP_UNWANTED )
+        word = __atomic_fetch_and( &(our_tcb->events), ~events,
+                                   __ATOMIC_ACQ_REL );
+    else
+        word = __atomic_exchange_n( &(our_tcb->events), 0,
+                                    __ATOMIC_ACQ_REL );
+
+    if ( received != (unsigned int *)NULL )
+    {
+        if ( options & EVENTS_RETURN_ALL )
+            *received = word;
+        else
+            *received = word & events;
+    }
+
+    return( error );
+}
+
+/*****************************************************************************
+** eventClear - clears every event pending for the calling task.
+*****************************************************************************/
+STATUS
+   eventClear( void )
+{
+    v2pthread_cb_t *our_tcb;
+
+    our_tcb = my_tcb();
+    if ( our_tcb == (v2pthread_cb_t *)NULL )
+    {
+        errno = S_objLib_OBJ_ID_ERROR;       /* Caller is not a task */
+        return( ERROR );
+    }
+
+    __atomic_store_n( &(our_tcb->events), 0, __ATOMIC_RELEASE );
+    return( OK );
+}
@@ -27,9 +27,34 @@
 #include <signal.h>
 #include <sys/time.h>
 #include <string.h>
+#include <semaphore.h>
 #include "v2pthread.h"
 #include "vxw_defs.h"
 
+/*
+**  V2LIN_INIT_OPTIONS supplies the v2lin_init_opts option flags for builds in
+**  which main() is provided here (_USR_SYS_INIT_KILL).
+*/
+#ifndef V2LIN_INIT_OPTIONS
+#define V2LIN_INIT_OPTIONS 0
+#endif
+
+/*
+**  V2LIN_EXC_JOB_WORKERS is the number of tasks which run the jobs queued by
+**                        excJobAdd, and V2LIN_EXC_JOB_SLOTS the number of
+**                        jobs which may be queued at once (a power of two).
+*/
+#ifndef V2LIN_EXC_JOB_WORKERS
+#define V2LIN_EXC_JOB_WORKERS 1
+#endif
+#ifndef V2LIN_EXC_JOB_SLOTS
+#define V2LIN_EXC_JOB_SLOTS 128
+#endif
+
+#if (V2LIN_EXC_JOB_SLOTS & (V2LIN_EXC_JOB_SLOTS - 1)) != 0
+#error V2LIN_EXC_JOB_SLOTS must be a power of two
+#endif
+
 #ifdef _USR_SYS_INIT_KILL
 /*
 **  user_sysinit is a user-defined function.  It contains all initialization
@@ -99,6 +124,77 @@ extern v2pthread_cb_t *
 extern pthread_mutex_t
     task_list_lock;
 
+/*
+**  Task control blocks for the exception job worker tasks.
+*/
+static v2pthread_cb_t
+    excjob_tcb[V2LIN_EXC_JOB_WORKERS];
+
+/*****************************************************************************
+**  Exception job queue
+**
+**  excJobAdd queues a function call to be made from task level by one of
+**  the exception job worker tasks.  The queue is a bounded ring of slots,
+**  each tagged with a sequence number, so that any number of producers and
+**  workers can claim slots with a single compare-and-swap and no lock:
+**  a slot whose sequence equals the enqueue position is free, and one
+**  whose sequence is one past the dequeue position holds a job.  Workers
+**  sleep on a counting semaphore which is posted once per queued job.
+**  A worker which finds the oldest slot claimed but not yet filled counts
+**  itself as stalled and sleeps on a second semaphore, posted by the
+**  producer which fills a slot while any worker is stalled.
+*****************************************************************************/
+typedef struct v2pt_exc_job
+{
+        /*
+        ** Ring position for which this slot is next free (== position)
+        ** or full (== position + 1).
+        */
+    unsigned long
+        sequence;
+
+        /*
+        ** Function to be called and its arguments.
+        */
+    void (*func)( int, int, int, int, int, int );
+    int
+        arg[6];
+} v2pt_exc_job_t;
+
+static v2pt_exc_job_t
+    exc_job_ring[V2LIN_EXC_JOB_SLOTS];
+
+/*
+**  exc_job_enqueue_pos and exc_job_dequeue_pos are the free-running ring
+**  positions of the next slot to be filled and emptied.  They sit on
+**  separate cache lines so producers and workers do not contend for one.
+*/
+static unsigned long
+    exc_job_enqueue_pos V2PT_CACHE_ALIGNED;
+static unsigned long
+    exc_job_dequeue_pos V2PT_CACHE_ALIGNED;
+
+/*
+**  exc_job_ready counts queued jobs not yet claimed by a worker.
+*/
+static sem_t
+    exc_job_ready;
+
+/*
+**  exc_job_stalled counts workers waiting on exc_job_filled for the oldest
+**  queued job to be filled in by its producer.
+*/
+static int
+    exc_job_stalled;
+static sem_t
+    exc_job_filled;
+
+/*
+**  exc_job_queue_ok is set once the ring and semaphore are initialized.
+*/
+static int
+    exc_job_queue_ok = 0;
+
 /*
 **  round_robin_enabled is a system-wide mode flag indicating whether the
 **                      v2pthread scheduler is to use FIFO or Round Robin
@@ -107,6 +203,15 @@ extern pthread_mutex_t
 static unsigned char
     round_robin_enabled = 0;
 
+/*
+**  unprivileged_mode is a system-wide mode flag, fixed at initialization,
+**                    indicating that tasks run under SCHED_OTHER with nice
+**                    values in place of real-time priorities, and that
+**                    taskLock does not boost the caller's priority.
+*/
+static unsigned char
+    unprivileged_mode = 0;
+
 /*****************************************************************************
 ** round-robin control 
 *****************************************************************************/
@@ -126,6 +231,15 @@ BOOL
     return( (BOOL)round_robin_enabled );
 }
 
+/*****************************************************************************
+** unprivileged mode query
+*****************************************************************************/
+BOOL
+   unprivilegedModeIsEnabled( void )
+{
+    return( (BOOL)unprivileged_mode );
+}
+
 /*****************************************************************************
 ** kernelTimeSlice - turns Round-Robin Timeslicing on or off in the scheduler
 *****************************************************************************/
@@ -161,7 +275,11 @@ STATUS
         sched_policy = SCHED_RR;
     }
 
-    if ( task_list != (v2pthread_cb_t *)NULL )
+    /*
+    **  SCHED_OTHER tasks are always time-sliced by the kernel, so in
+    **  unprivileged mode there is no per-task policy to change.
+    */
+    if ( (task_list != (v2pthread_cb_t *)NULL) && !unprivileged_mode )
     {
         struct sched_param schedparam;
         /*
@@ -180,8 +298,11 @@ STATUS
 
 	    pthread_attr_getschedparam( &(tcb->attr), &schedparam );
             /*
-            **  Activate the new scheduling policy
+            **  Activate the new scheduling policy (SCHED_DEADLINE tasks pick
+            **  it up if they ever fall back to their fixed priority).
             */
+            if ( tcb->dl_active )
+                continue;
             if (0 != pthread_setschedparam( tcb->pthrid, sched_policy,
 					   &schedparam ))
 	          {
@@ -195,12 +316,227 @@ STATUS
     return( OK );
 }
 
+/*****************************************************************************
+** excJobAdd - queues a call to func (with up to six arguments) to be made
+**             from task level by an exception job worker task.  Never
+**             blocks, so it may be called from watchdog timeout functions
+**             and while the scheduler is locked.
+*****************************************************************************/
+STATUS
+   excJobAdd( void (*func)( int, int, int, int, int, int ), int arg1,
+              int arg2, int arg3, int arg4, int arg5, int arg6 )
+{
+    v2pt_exc_job_t *job;
+    unsigned long pos, seq;
+    long diff;
+    STATUS error;
+
+    error = OK;
+
+    if ( func == NULL )
+        error = S_objLib_OBJ_ID_ERROR;
+    else if ( !exc_job_queue_ok )
+        error = S_objLib_OBJ_UNAVAILABLE;
+    else
+    {
+        /*
+        **  Claim the slot at the enqueue position.  If another producer
+        **  takes it first the compare-and-swap fails and reloads pos.
+        */
+        pos = __atomic_load_n( &exc_job_enqueue_pos, __ATOMIC_RELAXED );
+        for ( ;; )
+        {
+            job = &exc_job_ring[pos & (V2LIN_EXC_JOB_SLOTS - 1)];
+            seq = __atomic_load_n( &(job->sequence), __ATOMIC_ACQUIRE );
+            diff = (long)seq - (long)pos;
+            if ( diff == 0 )
+            {
+                if ( __atomic_compare_exchange_n( &exc_job_enqueue_pos,
+                                                  &pos, pos + 1, 1,
+                                                  __ATOMIC_RELAXED,
+                                                  __ATOMIC_RELAXED ) )
+                    break;
+            }
+            else if ( diff < 0 )
+            {
+                /*
+                **  The slot still holds a job from the previous lap.
+                */
+                error = S_objLib_OBJ_UNAVAILABLE;
+                break;
+            }
+            else
+                pos = __atomic_load_n( &exc_job_enqueue_pos,
+                                       __ATOMIC_RELAXED );
+        }
+
+        if ( error == OK )
+        {
+            job->func = func;
+            job->arg[0] = arg1;
+            job->arg[1] = arg2;
+            job->arg[2] = arg3;
+            job->arg[3] = arg4;
+            job->arg[4] = arg5;
+            job->arg[5] = arg6;
+            __atomic_store_n( &(job->sequence), pos + 1, __ATOMIC_RELEASE );
+            sem_post( &exc_job_ready );
+
+            /*
+            **  Wake a worker stalled on this (or an earlier) slot.  The
+            **  fence pairs with the one in exc_job_task so that either the
+            **  worker sees the filled slot or we see it stalled.
+            */
+            __atomic_thread_fence( __ATOMIC_SEQ_CST );
+            if ( __atomic_load_n( &exc_job_stalled, __ATOMIC_RELAXED ) > 0 )
+                sem_post( &exc_job_filled );
+        }
+    }
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+    return( error );
+}
+
+/*****************************************************************************
+** exc_job_take - removes the oldest job from the exception job queue and
+**                copies it to the caller.  Returns FALSE if the queue is
+**                empty.
+*****************************************************************************/
+static int
+   exc_job_take( v2pt_exc_job_t *taken )
+{
+    v2pt_exc_job_t *job;
+    unsigned long pos, seq;
+    long diff;
+
+    pos = __atomic_load_n( &exc_job_dequeue_pos, __ATOMIC_RELAXED );
+    for ( ;; )
+    {
+        job = &exc_job_ring[pos & (V2LIN_EXC_JOB_SLOTS - 1)];
+        seq = __atomic_load_n( &(job->sequence), __ATOMIC_ACQUIRE );
+        diff = (long)seq - (long)(pos + 1);
+        if ( diff == 0 )
+        {
+            if ( __atomic_compare_exchange_n( &exc_job_dequeue_pos,
+                                              &pos, pos + 1, 1,
+                                              __ATOMIC_RELAXED,
+                                              __ATOMIC_RELAXED ) )
+                break;
+        }
+        else if ( diff < 0 )
+            return( FALSE );
+        else
+            pos = __atomic_load_n( &exc_job_dequeue_pos, __ATOMIC_RELAXED );
+    }
+
+    *taken = *job;
+
+    /*
+    **  Hand the slot back to producers for the next lap of the ring.
+    */
+    __atomic_store_n( &(job->sequence), pos + V2LIN_EXC_JOB_SLOTS,
+                      __ATOMIC_RELEASE );
+    return( TRUE );
+}
+
+/*****************************************************************************
+**  exception job worker task
+**
+**  Each worker sleeps until a job is queued, then runs it.  Jobs queued by
+**  one producer start in the order queued, but with more than one worker
+**  they may run concurrently.
+*****************************************************************************/
+int exc_job_task( int dummy0, int dummy1, int dummy2, int dummy3,
+                  int dummy4, int dummy5, int dummy6, int dummy7,
+                  int dummy8, int dummy9 )
+{
+    v2pt_exc_job_t job;
+    int taken;
+
+    while ( 1 )
+    {
+        if ( sem_wait( &exc_job_ready ) != 0 )
+            continue;
+
+        /*
+        **  Each post follows a published job, but the oldest slot may
+        **  belong to a producer that was preempted between claiming it
+        **  and filling it.  Block (rather than yield, which would not let
+        **  a lower-priority producer run) until a producer fills a slot.
+        */
+        for ( taken = exc_job_take( &job ); !taken; )
+        {
+            __atomic_add_fetch( &exc_job_stalled, 1, __ATOMIC_RELAXED );
+            __atomic_thread_fence( __ATOMIC_SEQ_CST );
+            taken = exc_job_take( &job );
+            if ( !taken )
+                sem_wait( &exc_job_filled );
+            __atomic_sub_fetch( &exc_job_stalled, 1, __ATOMIC_RELAXED );
+        }
+
+        /*
+        **  One fill may release several stalled workers' jobs, so pass
+        **  the wakeup on to the next stalled worker, if any.
+        */
+        if ( __atomic_load_n( &exc_job_stalled, __ATOMIC_RELAXED ) > 0 )
+            sem_post( &exc_job_filled );
+
+        (*(job.func))( job.arg[0], job.arg[1], job.arg[2],
+                       job.arg[3], job.arg[4], job.arg[5] );
+    }
+
+    return( 0 );
+}
+
+/*****************************************************************************
+** start_exc_jobs - initializes the exception job queue and starts its worker
+**                  tasks, just below the exception task in priority.
+*****************************************************************************/
+static void
+   start_exc_jobs( void )
+{
+    char name[16];
+    int max_priority;
+    int i;
+
+    for ( i = 0; i < V2LIN_EXC_JOB_SLOTS; i++ )
+        exc_job_ring[i].sequence = (unsigned long)i;
+    exc_job_enqueue_pos = 0;
+    exc_job_dequeue_pos = 0;
+    exc_job_stalled = 0;
+    if ( sem_init( &exc_job_ready, 0, 0 ) != 0 )
+        return;
+    if ( sem_init( &exc_job_filled, 0, 0 ) != 0 )
+        return;
+    exc_job_queue_ok = 1;
+
+    for ( i = 0; i < V2LIN_EXC_JOB_WORKERS; i++ )
+    {
+        sprintf( name, "tExcJob%d", i );
+        taskInit( &excjob_tcb[i], name, 0, 0, 0, 0, exc_job_task,
+                  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 );
+        if ( !unprivileged_mode )
+        {
+            max_priority = sched_get_priority_max( SCHED_FIFO );
+            (excjob_tcb[i].prv_priority).sched_priority = (max_priority - 2);
+            pthread_attr_setschedparam( &(excjob_tcb[i].attr),
+                                        &(excjob_tcb[i].prv_priority) );
+        }
+        taskActivate( excjob_tcb[i].taskid );
+    }
+}
+
 /*****************************************************************************
 **  system exception task
 **
 **  In the v2pthreads environment, the exception task serves only to
-**  handle watchdog timer functions and to allow self-restarting of other
-**  v2pthread tasks.
+**  service watchdog timers once per tick.  Watchdog timeout functions and
+**  task self-restarts are handed to the exception job workers through
+**  excJobAdd, so a slow timeout function does not delay the tick.
 *****************************************************************************/
 int exception_task( int dummy0, int dummy1, int dummy2, int dummy3,
                     int dummy4, int dummy5, int dummy6, int dummy7,
@@ -213,8 +549,8 @@ int exception_task( int dummy0, int dummy1, int dummy2, int dummy3,
         **  Process system watchdog timers (if any are defined).
         **  NOTE that since ALL timers must be handled during a single
         **  10 msec system clock tick, timers should be used sparingly.
-        **  In addition, the timeout functions called by watchdog timers
-        **  should be "short and sweet".
+        **  Expired timers queue their timeout functions for the exception
+        **  job workers rather than calling them here.
         */
         process_timer_list();
 
@@ -257,11 +593,16 @@ int root_task( int dummy0, int dummy1, int dummy2, int dummy3, int dummy4,
     **  Get the maximum permissible priority level for a pthread
     **  and make that the pthreads priority for the exception task.
     */
-    max_priority = sched_get_priority_max( SCHED_FIFO );
-    (excp_tcb.prv_priority).sched_priority = (max_priority - 1);
-    pthread_attr_setschedparam( &(excp_tcb.attr), &(excp_tcb.prv_priority) );
+    if ( !unprivileged_mode )
+    {
+        max_priority = sched_get_priority_max( SCHED_FIFO );
+        (excp_tcb.prv_priority).sched_priority = (max_priority - 1);
+        pthread_attr_setschedparam( &(excp_tcb.attr),
+                                    &(excp_tcb.prv_priority) );
+    }
 
     taskActivate( excp_tcb.taskid );
+    start_exc_jobs();
 
     user_sysinit();
 
@@ -289,14 +630,25 @@ void *init_system( void *dummy )
 **  that thread to the highest allowable value.  This allows the initialization
 **  thread to complete its work without being preempted by any of the task
 **  threads it creates.
+**
+**  The option flags (V2LIN_INIT_xxx) select system-wide modes which cannot
+**  be changed once tasks exist.  V2LIN_INIT_UNPRIVILEGED runs every task
+**  under SCHED_OTHER, mapping VxWorks priorities onto nice values, so that
+**  no CAP_SYS_NICE privilege is needed.
 *****************************************************************************/
 #ifdef _USR_SYS_INIT_KILL
 int main( int argc, char **argv )
 #else
-int v2lin_init(void)
+int v2lin_init_opts( int options )
 #endif
 {
     int max_priority;
+#ifdef _USR_SYS_INIT_KILL
+    int options = V2LIN_INIT_OPTIONS;
+#endif
+
+    if ( options & V2LIN_INIT_UNPRIVILEGED )
+        unprivileged_mode = 1;
 
     /*
     **  Set up a v2pthread task and TCB for the system root task.
@@ -316,9 +668,13 @@ int v2lin_init(void)
     **  Get the maximum permissible priority level for the current OS
     **  and make that the pthreads priority for the root task.
     */
-    max_priority = sched_get_priority_max( SCHED_FIFO );
-    (root_tcb.prv_priority).sched_priority = max_priority;
-    pthread_attr_setschedparam( &(root_tcb.attr), &(root_tcb.prv_priority) );
+    if ( !unprivileged_mode )
+    {
+        max_priority = sched_get_priority_max( SCHED_FIFO );
+        (root_tcb.prv_priority).sched_priority = max_priority;
+        pthread_attr_setschedparam( &(root_tcb.attr),
+                                    &(root_tcb.prv_priority) );
+    }
 #ifdef _USR_SYS_INIT_KILL
     
     taskActivate( root_tcb.taskid );
@@ -339,10 +695,15 @@ int v2lin_init(void)
     **  Get the maximum permissible priority level for a pthread
     **  and make that the pthreads priority for the exception task.
     */
-    max_priority = sched_get_priority_max( SCHED_FIFO );
-    (excp_tcb.prv_priority).sched_priority = (max_priority - 1);
-    pthread_attr_setschedparam( &(excp_tcb.attr), &(excp_tcb.prv_priority) );
+    if ( !unprivileged_mode )
+    {
+        max_priority = sched_get_priority_max( SCHED_FIFO );
+        (excp_tcb.prv_priority).sched_priority = (max_priority - 1);
+        pthread_attr_setschedparam( &(excp_tcb.attr),
+                                    &(excp_tcb.prv_priority) );
+    }
     taskActivate( excp_tcb.taskid );
+    start_exc_jobs();
 #endif
 
     errno = 0;
@@ -358,3 +719,13 @@ int v2lin_init(void)
     return errno;
 #endif
 }
+
+#ifndef _USR_SYS_INIT_KILL
+/*****************************************************************************
+**  v2lin_init - initializes v2pthreads with the default (privileged) modes
+*****************************************************************************/
+int v2lin_init( void )
+{
+    return( v2lin_init_opts( 0 ) );
+}
+#endif
@@ -34,6 +34,13 @@
 #define URGNT 1
 #define KILLD 2
 
+/*
+**  max_wait passed down by msgQReceiveNs and msgQReceiveUntil along with a
+**  deadline: any value other than NO_WAIT and WAIT_FOREVER means a timed
+**  wait, and the deadline then takes the place of the ticks.
+*/
+#define WAIT_DEADLINE 1
+
 /*****************************************************************************
 **  v2pthread queue message type
 *****************************************************************************/
@@ -53,9 +60,18 @@ typedef struct q_msg
 **  to ensure room for urgent messages even when the queue is 'full' for
 **  normal messages.
 **
+**  Fields written by senders and fields written by receivers are kept in
+**  separate cache-aligned sections, so that a producer and a consumer on
+**  different CPUs only contend for the line holding the queue lock and
+**  message count.  Extent geometry, which every operation reads but only
+**  msgQCreate writes, sits on a line of its own.
+**
 *****************************************************************************/
 typedef struct v2pt_mqueue
 {
+    /*
+    **  ---- Shared section (written by both senders and receivers) ----
+    */
         /*
         ** Mutex and Condition variable for queue send/pend
         */
@@ -65,12 +81,32 @@ typedef struct v2pt_mqueue
         queue_send;
 
         /*
-        ** Mutex and Condition variable for queue delete
+        ** Total number of messages currently sent to queue
         */
-    pthread_mutex_t
-        qdlet_lock;
-    pthread_cond_t
-        qdlet_cmplt;
+    int
+        msg_count;
+
+        /*
+        ** Type of send operation last performed on queue
+        */
+    int
+        send_type;
+
+    /*
+    **  ---- Producer section (written by senders) ----
+    */
+        /*
+        **  Pointer to last message pointer sent to queue
+        */
+    q_msg_t *
+        queue_tail V2PT_CACHE_ALIGNED;
+
+        /*
+        ** List of tasks waiting for space to post messages to queue,
+        ** guarded by queue_lock
+        */
+    v2pt_pend_list_t
+        write_pend_list;
 
         /*
         ** Mutex and Condition variable for queue-full pend 
@@ -80,29 +116,44 @@ typedef struct v2pt_mqueue
     pthread_cond_t
         queue_space;
 
+    /*
+    **  ---- Consumer section (written by receivers) ----
+    */
         /*
         **  Pointer to next message pointer to be fetched from queue
         */
     q_msg_t *
-        queue_head;
+        queue_head V2PT_CACHE_ALIGNED;
 
         /*
-        **  Pointer to last message pointer sent to queue
+        ** List of tasks waiting to receive a message from queue, guarded
+        ** by queue_lock
         */
-    q_msg_t *
-        queue_tail;
+    v2pt_pend_list_t
+        pend_list;
 
         /*
-        ** Type of send operation last performed on queue
+        ** First watch record in list of tasks in objWaitAny watching the
+        ** queue for messages
         */
-    int
-        send_type;
+    v2pt_watch_t *
+        first_watch;
 
+        /*
+        ** Task registered by msgQEvStart to be sent events when a message
+        ** arrives
+        */
+    v2pt_ev_reg_t
+        ev_reg;
+
+    /*
+    **  ---- Geometry section (read-mostly, shared by all CPUs) ----
+    */
         /*
         **  Pointer to first message in queue
         */
     q_msg_t *
-        first_msg_in_queue;
+        first_msg_in_queue V2PT_CACHE_ALIGNED;
 
         /*
         **  Pointer to last message in queue
@@ -111,30 +162,10 @@ typedef struct v2pt_mqueue
         last_msg_in_queue;
 
         /*
-        **  Pointer to next queue control block in queue list
-        */
-    struct v2pt_mqueue *
-        nxt_queue;
-
-        /*
-        ** First task control block in list of tasks waiting to receive
-        ** a message from queue
-        */
-    v2pthread_cb_t *
-        first_susp;
-
-        /*
-        ** First task control block in list of tasks waiting for space to
-        ** post messages to queue
-        */
-    v2pthread_cb_t *
-        first_write_susp;
-
-        /*
-        ** Total number of messages currently sent to queue
+        ** sizeof( each element in queue ) used for subscript incr/decr.
         */
-    int
-        msg_count;
+    size_t
+        vmsg_len;
 
         /*
         ** Total (max) messages per queue
@@ -148,17 +179,28 @@ typedef struct v2pt_mqueue
     uint
         msg_len;
 
-        /*
-        ** sizeof( each element in queue ) used for subscript incr/decr.
-        */
-    size_t
-        vmsg_len;
-
         /*
         ** Task pend order (FIFO or Priority) for queue
         */
     int
         order;
+
+    /*
+    **  ---- Cold section (delete / list maintenance) ----
+    */
+        /*
+        ** Mutex and Condition variable for queue delete
+        */
+    pthread_mutex_t
+        qdlet_lock V2PT_CACHE_ALIGNED;
+    pthread_cond_t
+        qdlet_cmplt;
+
+        /*
+        **  Pointer to next queue control block in queue list
+        */
+    struct v2pt_mqueue *
+        nxt_queue;
 } v2pt_mqueue_t;
 
 /*****************************************************************************
@@ -177,11 +219,34 @@ extern void
 extern STATUS
    taskDelay( int interval );
 extern void
-   link_susp_tcb( v2pthread_cb_t **list_head, v2pthread_cb_t *new_entry );
+   deadline_after_ns( long long ns, struct timespec *deadline );
 extern void
-   unlink_susp_tcb( v2pthread_cb_t **list_head, v2pthread_cb_t *entry );
+   deadline_after_ticks( int ticks, struct timespec *deadline );
 extern int
-   signal_for_my_task( v2pthread_cb_t **list_head, int pend_order );
+   deadline_passed( const struct timespec *deadline );
+extern void
+   init_monotonic_cond( pthread_cond_t *cond );
+extern void
+   link_susp_tcb( v2pt_pend_list_t *list, v2pthread_cb_t *new_entry );
+extern void
+   unlink_susp_tcb( v2pt_pend_list_t *list, v2pthread_cb_t *entry );
+extern int
+   signal_for_my_task( v2pt_pend_list_t *list, int pend_order );
+extern void
+   link_watch( v2pt_watch_t **list_head, v2pt_watch_t *watch );
+extern int
+   unlink_watch( v2pt_watch_t **list_head, v2pt_watch_t *watch );
+extern void
+   wake_watchers( v2pt_watch_t **list_head );
+extern void
+   drop_watchers( v2pt_watch_t **list_head );
+extern STATUS
+   register_events( v2pt_ev_reg_t *reg, unsigned int events, int options,
+                    int ready );
+extern STATUS
+   unregister_events( v2pt_ev_reg_t *reg );
+extern int
+   post_events( v2pt_ev_reg_t *reg );
 
 /*****************************************************************************
 **  v2pthread Global Data Structures
@@ -437,6 +502,16 @@ static void
     ** Indicate type of send operation last performed on queue
     */
     queue->send_type = URGNT;
+
+    /*
+    **  Wake any tasks watching the queue from objWaitAny, and send any
+    **  registered task its events unless a receiver is waiting already.
+    */
+    if ( queue->first_watch != (v2pt_watch_t *)NULL )
+        wake_watchers( &(queue->first_watch) );
+    if ( (queue->ev_reg.taskid != 0) &&
+         (queue->pend_list.head == (v2pthread_cb_t *)NULL) )
+        post_events( &(queue->ev_reg) );
 }
 
 /*****************************************************************************
@@ -503,6 +578,16 @@ static void
     **  Signal the condition variable for the queue
     */
     pthread_cond_broadcast( &(queue->queue_send) );
+
+    /*
+    **  Wake any tasks watching the queue from objWaitAny, and send any
+    **  registered task its events unless a receiver is waiting already.
+    */
+    if ( queue->first_watch != (v2pt_watch_t *)NULL )
+        wake_watchers( &(queue->first_watch) );
+    if ( (queue->ev_reg.taskid != 0) &&
+         (queue->pend_list.head == (v2pthread_cb_t *)NULL) )
+        post_events( &(queue->ev_reg) );
 }
 
 /*****************************************************************************
@@ -517,8 +602,8 @@ static void
     **  If the calling task was the last task pending on the queue,
     **  signal the deletion-complete condition variable.
     */
-    if ( (queue->first_susp == (v2pthread_cb_t *)NULL) &&
-         (queue->first_write_susp == (v2pthread_cb_t *)NULL) )
+    if ( (queue->pend_list.head == (v2pthread_cb_t *)NULL) &&
+         (queue->write_pend_list.head == (v2pthread_cb_t *)NULL) )
     {
         /*
         ** Lock mutex for queue delete completion
@@ -611,14 +696,14 @@ static uint
     **  Now see if adequate space was freed in the queue and alert any tasks
     **  waiting for message space if adequate space now exists.
     */
-    if ( queue->first_write_susp != (v2pthread_cb_t *)NULL )
+    if ( queue->write_pend_list.head != (v2pthread_cb_t *)NULL )
     {
         if ( queue->msg_count <= (queue->msgs_per_queue - 1) )
         {
 
 #ifdef DIAG_PRINTFS 
             printf( "\r\nqueue @ %p freed msg space for queue list @ %p",
-                    queue, &(queue->first_write_susp) );
+                    queue, &(queue->write_pend_list) );
 #endif
             /*
             **  Lock mutex for queue space
@@ -741,8 +826,7 @@ v2pt_mqueue_t *
             */
             pthread_mutex_init( &(queue->queue_lock),
                                 (pthread_mutexattr_t *)NULL );
-            pthread_cond_init( &(queue->queue_send),
-                               (pthread_condattr_t *)NULL );
+            init_monotonic_cond( &(queue->queue_send) );
 
             /*
             ** Mutex and Condition variable for queue delete
@@ -757,8 +841,7 @@ v2pt_mqueue_t *
             */
             pthread_mutex_init( &(queue->qfull_lock),
                                 (pthread_mutexattr_t *)NULL );
-            pthread_cond_init( &(queue->queue_space),
-                               (pthread_condattr_t *)NULL );
+            init_monotonic_cond( &(queue->queue_space) );
 
             /*
             ** Pointer to next message pointer to be fetched from queue
@@ -776,16 +859,28 @@ v2pt_mqueue_t *
             queue->send_type = SEND;
 
             /*
-            ** First task control block in list of tasks waiting to receive
-            ** a message from queue
+            ** List of tasks waiting to receive a message from queue
             */
-            queue->first_susp = (v2pthread_cb_t *)NULL;
+            queue->pend_list.head = (v2pthread_cb_t *)NULL;
+            queue->pend_list.tail = (v2pthread_cb_t *)NULL;
+            queue->pend_list.lock = &(queue->queue_lock);
 
             /*
-            ** First task control block in list of tasks waiting for space to
-            ** post messages to queue
+            ** List of tasks waiting for space to post messages to queue
             */
-            queue->first_write_susp = (v2pthread_cb_t *)NULL;
+            queue->write_pend_list.head = (v2pthread_cb_t *)NULL;
+            queue->write_pend_list.tail = (v2pthread_cb_t *)NULL;
+            queue->write_pend_list.lock = &(queue->queue_lock);
+
+            /*
+            ** First watch record in list of tasks watching the queue
+            */
+            queue->first_watch = (v2pt_watch_t *)NULL;
+
+            /*
+            ** No task registered for events from the queue
+            */
+            queue->ev_reg.taskid = 0;
 
             /*
             ** Total number of messages currently sent to queue
@@ -851,12 +946,10 @@ v2pt_mqueue_t *
 **                          (2) the queue is deleted
 *****************************************************************************/
 static int
-    waiting_on_q_space( v2pt_mqueue_t *queue, struct timespec *timeout,
-                        int *retcode )
+    waiting_on_q_space( v2pt_mqueue_t *queue,
+                        const struct timespec *timeout, int *retcode )
 {
     int result;
-    struct timeval now;
-    ulong usec;
 
     if ( queue->send_type & KILLD )
     {
@@ -884,12 +977,12 @@ static int
         */
         while ( (queue->msg_count <= (queue->msgs_per_queue - 1)) ||
                 ((queue->msgs_per_queue == 0) &&
-                 (queue->first_susp != (v2pthread_cb_t *)NULL)) )
+                 (queue->pend_list.head != (v2pthread_cb_t *)NULL)) )
         {
             /*
             **  Message slot available... see if it's for our task.
             */
-            if ( signal_for_my_task( &(queue->first_write_susp),
+            if ( signal_for_my_task( &(queue->write_pend_list),
                                      queue->order ) )
             {
                 /*
@@ -916,30 +1009,9 @@ static int
             **  If a timeout was specified, make sure we respect it and
             **  exit this loop if it expires.
             */
-            if ( timeout != (struct timespec *)NULL )
-            {
-                gettimeofday( &now, (struct timezone *)NULL );
-                if ( timeout->tv_nsec > (now.tv_usec * 1000) )
-                {
-                    usec = (timeout->tv_nsec - (now.tv_usec * 1000)) / 1000;
-                    if ( timeout->tv_sec < now.tv_sec )
-                        usec = 0;
-                    else
-                        usec += ((timeout->tv_sec - now.tv_sec) * 1000000);
-                }
-                else
-                {
-                    usec = ((timeout->tv_nsec + 1000000000) -
-                            (now.tv_usec * 1000)) / 1000;
-                    if ( (timeout->tv_sec - 1) < now.tv_sec )
-                        usec = 0;
-                    else
-                        usec += (((timeout->tv_sec - 1) - now.tv_sec)
-                                 * 1000000);
-                }
-                if ( usec == 0 )
-                    break;
-            }
+            if ( (timeout != (const struct timespec *)NULL) &&
+                 deadline_passed( timeout ) )
+                break;
         }
     }
 
@@ -954,10 +1026,8 @@ STATUS
    waitToSend( v2pt_mqueue_t *queue, char *msg, uint msglen, int wait, int pri )
 {
     v2pthread_cb_t *our_tcb;
-    struct timeval now;
     struct timespec timeout;
     int retcode;
-    long sec, usec;
     STATUS error;
 
     error = OK;
@@ -970,10 +1040,10 @@ STATUS
         our_tcb = my_tcb();
 #ifdef DIAG_PRINTFS 
         printf( "\r\ntask @ %p wait on queue space list @ %p", our_tcb,
-                &(queue->first_write_susp) );
+                &(queue->write_pend_list) );
 #endif
 
-        link_susp_tcb( &(queue->first_write_susp), our_tcb );
+        link_susp_tcb( &(queue->write_pend_list), our_tcb );
 
         retcode = 0;
 
@@ -1000,19 +1070,9 @@ STATUS
         {
             /*
             **  Wait on queue message space with timeout...
-            **  Calculate timeout delay in seconds and microseconds.
+            **  queue_space takes CLOCK_MONOTONIC deadlines.
             */
-            sec = 0;
-            usec = wait * V2PT_TICK * 1000;
-            gettimeofday( &now, (struct timezone *)NULL );
-            usec += now.tv_usec;
-            if ( usec > 1000000 )
-            {
-                sec = usec / 1000000;
-                usec = usec % 1000000;
-            }
-            timeout.tv_sec = now.tv_sec + sec;
-            timeout.tv_nsec = usec * 1000;
+            deadline_after_ticks( wait, &timeout );
 
             /*
             **  Wait for queue message space for the current task or for the
@@ -1039,8 +1099,8 @@ STATUS
         **  for the queue.  Clear our TCB's suspend list pointer in
         **  case the queue was killed & its ctrl blk deallocated.
         */
-        unlink_susp_tcb( &(queue->first_write_susp), our_tcb );
-        our_tcb->suspend_list = (v2pthread_cb_t **)NULL;
+        unlink_susp_tcb( &(queue->write_pend_list), our_tcb );
+        our_tcb->suspend_list = (v2pt_pend_list_t *)NULL;
 
         /*
         **  See if we were awakened due to a msgQDelete on the queue.
@@ -1144,10 +1204,10 @@ STATUS
             our_tcb = my_tcb();
             if ( pri == MSG_PRI_URGENT )
                 printf( "\r\ntask @ %p urgent send to queue list @ %p",
-                        our_tcb, &(queue->first_susp) );
+                        our_tcb, &(queue->pend_list) );
             else
                 printf( "\r\ntask @ %p send to queue list @ %p", our_tcb,
-                        &(queue->first_susp) );
+                        &(queue->pend_list) );
 #endif
 
             /*
@@ -1167,7 +1227,7 @@ STATUS
                 if ( queue->msg_count == queue->msgs_per_queue )
                 {
                     if ( (queue->msgs_per_queue == 0) &&
-                         (queue->first_susp != (v2pthread_cb_t *)NULL) )
+                         (queue->pend_list.head != (v2pthread_cb_t *)NULL) )
                     {
                         /*
                         **  Special case... Send the new message.
@@ -1279,6 +1339,12 @@ STATUS
 
     error = OK;
 
+    /*
+    **  Lock the scheduler before the queue, as taskDelete does when it
+    **  takes a pended task off the queue's lists.
+    */
+    taskLock();
+
     /*
     **  First ensure that the specified queue exists and that we have
     **  exclusive access to it.
@@ -1293,12 +1359,18 @@ STATUS
         */
         queue->send_type = KILLD;
 
+        /*
+        **  Let go of any tasks watching the queue from objWaitAny, and of
+        **  any task registered for its events.
+        */
+        drop_watchers( &(queue->first_watch) );
+        queue->ev_reg.taskid = 0;
+
         /*
         **  Block while any tasks are still pended on the queue
         */
-        taskLock();
-        if ( (queue->first_susp != (v2pthread_cb_t *)NULL) ||
-             (queue->first_write_susp != (v2pthread_cb_t *)NULL) )
+        if ( (queue->pend_list.head != (v2pthread_cb_t *)NULL) ||
+             (queue->write_pend_list.head != (v2pthread_cb_t *)NULL) )
         {
             /*
             ** Lock mutex for queue delete completion
@@ -1341,8 +1413,8 @@ STATUS
             **  The last task to receive the deletion signal will signal the
             **  deletion-complete condition variable.
             */
-            while ( (queue->first_susp != (v2pthread_cb_t *)NULL) &&
-                    (queue->first_write_susp != (v2pthread_cb_t *)NULL) )
+            while ( (queue->pend_list.head != (v2pthread_cb_t *)NULL) ||
+                    (queue->write_pend_list.head != (v2pthread_cb_t *)NULL) )
             {
                 pthread_cond_wait( &(queue->qdlet_cmplt),
                                    &(queue->qdlet_lock) );
@@ -1352,6 +1424,14 @@ STATUS
             **  Unlock the queue delete completion mutex. 
             */
             pthread_cleanup_pop( 1 );
+
+            /*
+            **  The last task awakened signals completion while still
+            **  holding the queue mutex... cycle the mutex so that task
+            **  is done with the queue before its memory is released.
+            */
+            pthread_mutex_lock( &(queue->queue_lock) );
+            pthread_mutex_unlock( &(queue->queue_lock) );
         }
         else
         {
@@ -1366,7 +1446,6 @@ STATUS
         **  Now physically delete the queue.
         */
         delete_mqueue( queue );
-        taskUnlock();
     }
     else
     {
@@ -1378,6 +1457,8 @@ STATUS
     */
     pthread_cleanup_pop( 0 );
 
+    taskUnlock();
+
     if ( error != OK )
     {
         errno = (int)error;
@@ -1397,12 +1478,10 @@ STATUS
 **                        (2) the queue is deleted
 *****************************************************************************/
 static int
-    waiting_on_q_msg( v2pt_mqueue_t *queue, struct timespec *timeout,
+    waiting_on_q_msg( v2pt_mqueue_t *queue, const struct timespec *timeout,
                        int *retcode )
 {
     int result;
-    struct timeval now;
-    ulong usec;
 
     if ( queue->send_type & KILLD )
     {
@@ -1431,7 +1510,7 @@ static int
             /*
             **  Message arrived... see if it's for our task.
             */
-            if ( signal_for_my_task( &(queue->first_susp), queue->order ) )
+            if ( signal_for_my_task( &(queue->pend_list), queue->order ) )
             {
                 /*
                 **  Message was  destined for our task... waiting is over.
@@ -1457,30 +1536,9 @@ static int
             **  If a timeout was specified, make sure we respect it and
             **  exit this loop if it expires.
             */
-            if ( timeout != (struct timespec *)NULL )
-            {
-                gettimeofday( &now, (struct timezone *)NULL );
-                if ( timeout->tv_nsec > (now.tv_usec * 1000) )
-                {
-                    usec = (timeout->tv_nsec - (now.tv_usec * 1000)) / 1000;
-                    if ( timeout->tv_sec < now.tv_sec )
-                        usec = 0;
-                    else
-                        usec += ((timeout->tv_sec - now.tv_sec) * 1000000);
-                }
-                else
-                {
-                    usec = ((timeout->tv_nsec + 1000000000) -
-                            (now.tv_usec * 1000)) / 1000;
-                    if ( (timeout->tv_sec - 1) < now.tv_sec )
-                        usec = 0;
-                    else
-                        usec += (((timeout->tv_sec - 1) - now.tv_sec)
-                                 * 1000000);
-                }
-                if ( usec == 0 )
-                    break;
-            }
+            if ( (timeout != (const struct timespec *)NULL) &&
+                 deadline_passed( timeout ) )
+                break;
         }
     }
 
@@ -1488,18 +1546,18 @@ static int
 }
 
 /*****************************************************************************
-** msgQReceive - blocks the calling task until a message is available in the
-**               specified v2pthread queue.
+** receive_msg - blocks the calling task until a message is available in the
+**               specified v2pthread queue, for up to max_wait ticks or
+**               until the CLOCK_MONOTONIC deadline if one is given.
 *****************************************************************************/
-int
-   msgQReceive( v2pt_mqueue_t *queue, char *msgbuf, uint buflen, int max_wait )
+static int
+   receive_msg( v2pt_mqueue_t *queue, char *msgbuf, uint buflen, int max_wait,
+                const struct timespec *deadline )
 {
     v2pthread_cb_t *our_tcb;
-    struct timeval now;
     struct timespec timeout;
     int retcode;
     int msglen;
-    long sec, usec;
     STATUS error;
 
     error = OK;
@@ -1530,17 +1588,17 @@ int
             our_tcb = my_tcb();
 #ifdef DIAG_PRINTFS 
             printf( "\r\ntask @ %p wait on queue list @ %p", our_tcb,
-                    &(queue->first_susp) );
+                    &(queue->pend_list) );
 #endif
 
-            link_susp_tcb( &(queue->first_susp), our_tcb );
+            link_susp_tcb( &(queue->pend_list), our_tcb );
 
             /*
             **  If tasks waiting to write to a zero-length queue, notify
             **  waiting task that we're ready to receive a message.
             */
             if ( ((queue->msgs_per_queue == 0) &&
-                 (queue->first_write_susp != (v2pthread_cb_t *)NULL)) )
+                 (queue->write_pend_list.head != (v2pthread_cb_t *)NULL)) )
             {
                 /*
                 **  Lock mutex for queue space
@@ -1568,9 +1626,7 @@ int
                 **  Caller specified no wait on queue message...
                 **  Check the condition variable with an immediate timeout.
                 */
-                gettimeofday( &now, (struct timezone *)NULL );
-                timeout.tv_sec = now.tv_sec;
-                timeout.tv_nsec = now.tv_usec * 1000;
+                clock_gettime( CLOCK_MONOTONIC, &timeout );
                 while ( (waiting_on_q_msg( queue, &timeout, &retcode )) &&
                         (retcode != ETIMEDOUT) )
                 {
@@ -1599,19 +1655,13 @@ int
                 {
                     /*
                     **  Wait on queue message arrival with timeout...
-                    **  Calculate timeout delay in seconds and microseconds.
+                    **  queue_send takes CLOCK_MONOTONIC deadlines.
                     */
-                    sec = 0;
-                    usec = max_wait * V2PT_TICK * 1000;
-                    gettimeofday( &now, (struct timezone *)NULL );
-                    usec += now.tv_usec;
-                    if ( usec > 1000000 )
+                    if ( deadline == (const struct timespec *)NULL )
                     {
-                        sec = usec / 1000000;
-                        usec = usec % 1000000;
+                        deadline_after_ticks( max_wait, &timeout );
+                        deadline = &timeout;
                     }
-                    timeout.tv_sec = now.tv_sec + sec;
-                    timeout.tv_nsec = usec * 1000;
 
                     /*
                     **  Wait for a queue message for the current task or for the
@@ -1619,12 +1669,12 @@ int
                     **  may be awakened by signals for messages which are
                     **  not ours, or for signals other than from a message send.
                     */
-                    while ( (waiting_on_q_msg( queue, &timeout, &retcode )) &&
+                    while ( (waiting_on_q_msg( queue, deadline, &retcode )) &&
                             (retcode != ETIMEDOUT) )
                     {
                         retcode = pthread_cond_timedwait( &(queue->queue_send),
                                                           &(queue->queue_lock),
-                                                          &timeout );
+                                                          deadline );
                     }
                 }
             }
@@ -1634,8 +1684,8 @@ int
             **  for the queue.  Clear our TCB's suspend list pointer in
             **  case the queue was killed & its ctrl blk deallocated.
             */
-            unlink_susp_tcb( &(queue->first_susp), our_tcb );
-            our_tcb->suspend_list = (v2pthread_cb_t **)NULL;
+            unlink_susp_tcb( &(queue->pend_list), our_tcb );
+            our_tcb->suspend_list = (v2pt_pend_list_t *)NULL;
 
             /*
             **  See if we were awakened due to a msgQDelete on the queue.
@@ -1707,6 +1757,58 @@ int
     return( msglen );
 }
 
+/*****************************************************************************
+** msgQReceive - blocks the calling task until a message is available in the
+**               specified v2pthread queue.
+*****************************************************************************/
+int
+   msgQReceive( v2pt_mqueue_t *queue, char *msgbuf, uint buflen, int max_wait )
+{
+    return( receive_msg( queue, msgbuf, buflen, max_wait,
+                         (const struct timespec *)NULL ) );
+}
+
+/*****************************************************************************
+** msgQReceiveNs - like msgQReceive, but waits for up to timeout_ns
+**                 nanoseconds rather than whole ticks.  A timeout of zero
+**                 does not wait, and a negative one waits forever.
+*****************************************************************************/
+int
+   msgQReceiveNs( v2pt_mqueue_t *queue, char *msgbuf, uint buflen,
+                  long long timeout_ns )
+{
+    struct timespec deadline;
+
+    if ( timeout_ns < 0 )
+        return( receive_msg( queue, msgbuf, buflen, WAIT_FOREVER,
+                             (const struct timespec *)NULL ) );
+    if ( timeout_ns == 0 )
+        return( receive_msg( queue, msgbuf, buflen, NO_WAIT,
+                             (const struct timespec *)NULL ) );
+    deadline_after_ns( timeout_ns, &deadline );
+    return( receive_msg( queue, msgbuf, buflen, WAIT_DEADLINE, &deadline ) );
+}
+
+/*****************************************************************************
+** msgQReceiveUntil - like msgQReceive, but waits until an absolute
+**                    CLOCK_MONOTONIC deadline, or forever if deadline is
+**                    NULL.
+*****************************************************************************/
+int
+   msgQReceiveUntil( v2pt_mqueue_t *queue, char *msgbuf, uint buflen,
+                     const struct timespec *deadline )
+{
+    if ( deadline == (const struct timespec *)NULL )
+        return( receive_msg( queue, msgbuf, buflen, WAIT_FOREVER,
+                             (const struct timespec *)NULL ) );
+    if ( (deadline->tv_nsec < 0) || (deadline->tv_nsec >= 1000000000L) )
+    {
+        errno = EINVAL;
+        return( (int)ERROR );
+    }
+    return( receive_msg( queue, msgbuf, buflen, WAIT_DEADLINE, deadline ) );
+}
+
 /*****************************************************************************
 ** msgQNumMsgs - returns the number of messages currently posted to the
 **               specified queue.
@@ -1747,3 +1849,122 @@ int
 
     return( num_msgs );
 }
+
+/*****************************************************************************
+** msgQEvStart - registers the calling task to be sent the specified events
+**               whenever a message is sent to the specified queue and no
+**               task is pended on it.
+*****************************************************************************/
+STATUS
+   msgQEvStart( v2pt_mqueue_t *queue, unsigned int events, int options )
+{
+    STATUS error;
+
+    error = OK;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(queue->queue_lock));
+    if ( queue_valid( queue ) )
+    {
+        error = register_events( &(queue->ev_reg), events, options,
+                                 (queue->msg_count > 0) );
+        pthread_mutex_unlock( &(queue->queue_lock) );
+    }
+    else
+    {
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid queue specified */
+    }
+    pthread_cleanup_pop( 0 );
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+
+    return( error );
+}
+
+/*****************************************************************************
+** msgQEvStop - ends the calling task's registration for events from the
+**              specified queue.
+*****************************************************************************/
+STATUS
+   msgQEvStop( v2pt_mqueue_t *queue )
+{
+    STATUS error;
+
+    error = OK;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(queue->queue_lock));
+    if ( queue_valid( queue ) )
+    {
+        error = unregister_events( &(queue->ev_reg) );
+        pthread_mutex_unlock( &(queue->queue_lock) );
+    }
+    else
+    {
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid queue specified */
+    }
+    pthread_cleanup_pop( 0 );
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+
+    return( error );
+}
+
+/*****************************************************************************
+** mqueue_watch - adds a task in objWaitAny to the specified queue's watch
+**                list, so that it is woken when a message is sent.
+**                Returns OK, or S_objLib_OBJ_ID_ERROR for an invalid queue.
+*****************************************************************************/
+STATUS
+   mqueue_watch( v2pt_mqueue_t *queue, v2pt_watch_t *watch )
+{
+    STATUS error;
+
+    error = OK;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(queue->queue_lock));
+    if ( queue_valid( queue ) )
+    {
+        watch->object = (void *)queue;
+        link_watch( &(queue->first_watch), watch );
+        pthread_mutex_unlock( &(queue->queue_lock) );
+    }
+    else
+    {
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid queue specified */
+    }
+    pthread_cleanup_pop( 0 );
+
+    return( error );
+}
+
+/*****************************************************************************
+** mqueue_unwatch - takes a task leaving objWaitAny off the queue's watch
+**                  list, unless msgQDelete has already let go of it.
+**                  A queue which has been deleted is not touched, and a new
+**                  queue at the same address has not got the record.
+*****************************************************************************/
+void
+   mqueue_unwatch( v2pt_mqueue_t *queue, v2pt_watch_t *watch )
+{
+    if ( __atomic_load_n( &(watch->object), __ATOMIC_ACQUIRE ) == NULL )
+        return;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(queue->queue_lock));
+    if ( queue_valid( queue ) )
+    {
+        unlink_watch( &(queue->first_watch), watch );
+        pthread_mutex_unlock( &(queue->queue_lock) );
+    }
+    pthread_cleanup_pop( 0 );
+}
@@ -25,23 +25,172 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <signal.h>
 #include <semaphore.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/time.h>
 #include "v2pthread.h"
 #include "vxw_defs.h"
 
-#define SEM_OPT_MASK       0x0f
+#define SEM_OPT_MASK       0xff0f
 #define SEM_TYPE_MASK      0xf0
 
 #define BINARY_SEMA4       0x00
 #define MUTEX_SEMA4        0x10
 #define COUNTING_SEMA4     0x20
+#define RW_SEMA4           0x30
+#define NAMED_SEMA4        0x40
+#define RATE_SEMA4         0x50
 
 #define SEND  0
 #define FLUSH 1
 #define KILLD 2
 
+/*
+**  Options of a mutex which is the pthreads mutex pi_lock itself
+*/
+#define PI_LOCK_OPTS       (SEM_INVERSION_SAFE | SEM_PRIO_CEILING)
+
+/*
+**  max_wait passed down by semTakeNs and semTakeUntil along with a
+**  deadline: any value other than NO_WAIT and WAIT_FOREVER means a timed
+**  wait, and the deadline then takes the place of the ticks.
+*/
+#define WAIT_DEADLINE      1
+
+/*
+**  Semaphore IDs
+**
+**  The SEM_ID handed to the application is a handle rather than the address
+**  of the control block.  Its low SEMA4_INDEX_BITS select a slot in
+**  sema4_table, and the bits above them hold the generation of the slot's
+**  current semaphore.  Slot zero is never used, so no ID is ever zero.
+**  The table is built of pages of SEMA4_PAGE_SLOTS slots, allocated as the
+**  number of semaphores grows, and holds up to SEMA4_MAX_SLOTS - 1 of them.
+*/
+#define SEMA4_INDEX_BITS   20
+#define SEMA4_PAGE_BITS    10
+#define SEMA4_MAX_SLOTS    (1 << SEMA4_INDEX_BITS)
+#define SEMA4_PAGE_SLOTS   (1 << SEMA4_PAGE_BITS)
+#define SEMA4_PAGES        (1 << (SEMA4_INDEX_BITS - SEMA4_PAGE_BITS))
+#define SEMA4_INDEX_MASK   ((uintptr_t)(SEMA4_MAX_SLOTS - 1))
+
+/*
+**  Control blocks are carved from slabs of SEMA4_SLAB_BLOCKS blocks, and
+**  each thread keeps up to SEMA4_CACHE_SLOTS free slots (with their blocks)
+**  of its own, moving SEMA4_CACHE_BATCH at a time to or from the shared
+**  free slot list.
+*/
+#define SEMA4_SLAB_BLOCKS  64
+#define SEMA4_CACHE_SLOTS  32
+#define SEMA4_CACHE_BATCH  (SEMA4_CACHE_SLOTS / 2)
+
+/*
+**  A semaphore built in caller storage (semBInitialize etc.) has its
+**  control block at the start of the VX_SEMAPHORE_SIZE bytes and, if its
+**  tasks pend in priority order, its priority index straight after it.
+*/
+#if V2PT_CACHE_LINE > VX_SEMAPHORE_ALIGN
+#error "VX_SEMAPHORE_ALIGN must be at least V2PT_CACHE_LINE"
+#endif
+
+/*
+**  Once a slot has held caller storage, its users word counts the tasks
+**  using its control block (see sema4_for).  SLOT_CALLER_STORAGE marks
+**  such a slot for good, and SLOT_DRAINING is set while semDelete waits
+**  for the count to fall to zero before handing the storage back.
+*/
+#define SLOT_CALLER_STORAGE 0x80000000U
+#define SLOT_DRAINING       0x40000000U
+#define SLOT_USERS          0x3fffffffU
+
+/*
+**  V2LIN_MUTEX_SPIN_LIMIT is the number of times a semTake on a contended
+**                         SEM_ADAPTIVE mutex polls the mutex before it
+**                         blocks, while no other task is pended on it.
+*/
+#ifndef V2LIN_MUTEX_SPIN_LIMIT
+#define V2LIN_MUTEX_SPIN_LIMIT 200
+#endif
+
+/*
+**  V2LIN_RW_READER_SLOTS is the number of reader counts (a power of two),
+**                        each on a cache line of its own, kept by a
+**                        reader-writer semaphore.  A reader counts itself
+**                        in the one picked by the CPU it runs on.
+**  V2LIN_RW_HOLDS is the number of reader-writer semaphores which one task
+**                 can hold for reading at the same time.
+*/
+#ifndef V2LIN_RW_READER_SLOTS
+#define V2LIN_RW_READER_SLOTS 16
+#endif
+#ifndef V2LIN_RW_HOLDS
+#define V2LIN_RW_HOLDS 16
+#endif
+
+/*
+**  CPU_RELAX eases the spinning CPU's claim on the pipeline (and on a
+**  hyperthreaded core, yields it to the sibling) between polls.
+*/
+#if defined(__i386__) || defined(__x86_64__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__( "yield" ::: "memory" )
+#else
+#define CPU_RELAX() __asm__ __volatile__( "" ::: "memory" )
+#endif
+
+/*****************************************************************************
+**  Reader count for a reader-writer semaphore, alone on its cache line
+*****************************************************************************/
+typedef struct v2pt_rw_count
+{
+    int
+        readers V2PT_CACHE_ALIGNED;
+} v2pt_rw_count_t;
+
+/*****************************************************************************
+**  Statistics kept for a semaphore while semStatsEnable is on.  The counts
+**  are changed only with relaxed atomic operations; hold_start is written
+**  only as a mutex changes owner.
+*****************************************************************************/
+typedef struct v2pt_sema4_stats
+{
+        /*
+        **  Successful takes, takes which had to wait, and timed-out waits
+        */
+    unsigned long
+        takes;
+    unsigned long
+        contended;
+    unsigned long
+        timeouts;
+
+        /*
+        **  Most tasks ever waiting at once
+        */
+    int
+        max_waiters;
+
+        /*
+        **  Time (in ns) at which the current owner of a mutex took it,
+        **  or zero if it was taken while statistics were off
+        */
+    long long
+        hold_start;
+
+        /*
+        **  Histograms of wait and mutex hold times (see stats_bucket)
+        */
+    unsigned long
+        wait_hist[SEM_HIST_BUCKETS];
+    unsigned long
+        hold_hist[SEM_HIST_BUCKETS];
+} v2pt_sema4_stats_t;
+
 /*****************************************************************************
 **  Control block for v2pthread semaphore
 **
@@ -50,9 +199,40 @@
 **  waiting.  This 'wrapper' extends the POSIX pthreads semaphore to include
 **  the attributes of a v2pthread semaphore.
 **
+**  Every give and take by any CPU reads or writes the token count, the
+**  waiter and watcher counts and the owner fields, so these lead the
+**  control block, on the same cache line as the front of sema4_lock.
+**
+**  The token count is also the fast-path word: while no task is waiting,
+**  semTake claims a token with one compare-and-swap on it and semGive
+**  returns one with one atomic add, without taking sema4_lock.  The wait
+**  machinery (sema4_lock and the pended task list) only comes into play
+**  once a task has to wait.  A waiting task sleeps on its own tcb's
+**  pend_wake condition; semGive hands the token directly to the selected
+**  waiter and wakes that task alone.
+**  State used only by some types of semaphore (the inversion-safe mutex,
+**  adaptive spin counters, reader-writer and rate-limiter state) and by
+**  objWaitAny and semEvStart follows on a cache line of its own, so that
+**  it does not push the hot fields apart for the types which never use it.
+**  The delete handshake and slot index are touched only by semDelete and
+**  semFlush and are moved onto a cache line of their own.  Statistics,
+**  written only while semStatsEnable is on, follow on lines of their own
+**  so that they do not burden the hot section otherwise.  The control
+**  block as a whole is cache-aligned so that two semaphores used by tasks
+**  on different CPUs never share a line.
+**
 *****************************************************************************/
 typedef struct v2pt_sema4
 {
+    /*
+    **  ---- Hot section (every give / take) ----
+    */
+        /*
+        ** ID of the semaphore while it is in service, NULL once deleted.
+        */
+    void *
+        sema4_id;
+
         /*
         ** Option and Type Flags for semaphore
         */
@@ -60,26 +240,27 @@ typedef struct v2pt_sema4
         flags;
 
         /*
-        ** Mutex and Condition variable for semaphore post/pend
+        **  Count of available 'tokens' for semaphore.  Changed only with
+        **  atomic operations.
         */
-    pthread_mutex_t
-        sema4_lock;
-    pthread_cond_t
-        sema4_send;
+    int
+        token_count;
 
         /*
-        ** Mutex and Condition variable for semaphore delete
+        **  Number of tasks in wait_for_token (pi_take for an inversion-safe
+        **  mutex).  While non-zero, tokens are only taken through the wait
+        **  machinery, in pend order.
         */
-    pthread_mutex_t
-        smdel_lock;
-    pthread_cond_t
-        smdel_cplt;
+    int
+        waiters;
 
         /*
-        **  Count of available 'tokens' for semaphore.
+        **  Number of tasks in objWaitAny watching the semaphore, plus one
+        **  for a semEvStart registration.  While non-zero, gives take
+        **  sema4_lock so that the watchers can be woken.
         */
     int
-        token_count;
+        watchers;
 
         /*
         ** Type of send operation last performed on semaphore
@@ -100,530 +281,4182 @@ typedef struct v2pt_sema4
         current_owner;
 
         /*
-        **  Pointer to next semaphore control block in semaphore list.
+        ** Mutex for semaphore post/pend
         */
-    struct v2pt_sema4 *
-        nxt_sema4;
+    pthread_mutex_t
+        sema4_lock;
 
         /*
-        ** First task control block in list of tasks waiting on semaphore
+        ** List of tasks waiting on semaphore, guarded by sema4_lock
         */
-    v2pthread_cb_t *
-        first_susp;
-} v2pt_sema4_t;
-
-/*****************************************************************************
-**  External function and data references
-*****************************************************************************/
-extern void *
-    ts_malloc( size_t blksize );
-extern void
-    ts_free( void *blkaddr );
-extern v2pthread_cb_t *
-   my_tcb( void );
-extern void
-   taskLock( void );
-extern void
-   taskUnlock( void );
-extern STATUS
-   taskDelay( int interval );
-extern STATUS
-   taskSafe( void );
-extern STATUS
-   taskUnsafe( void );
-extern void
-   link_susp_tcb( v2pthread_cb_t **list_head, v2pthread_cb_t *new_entry );
-extern void
-   unlink_susp_tcb( v2pthread_cb_t **list_head, v2pthread_cb_t *entry );
-extern int
-   signal_for_my_task( v2pthread_cb_t **list_head, int pend_order );
-
-/*****************************************************************************
-**  v2pthread Global Data Structures
-*****************************************************************************/
-
-/*
-**  sema4_list is a linked list of semaphore control blocks.  It is used to
-**             validate semaphores by their ID numbers.
-*/
-static v2pt_sema4_t *
-    sema4_list;
-
-/*
-**  sema4_list_lock is a mutex used to serialize access to the semaphore list
-*/
-static pthread_mutex_t
-    sema4_list_lock = PTHREAD_MUTEX_INITIALIZER;
-
-
-/*****************************************************************************
-**  sema4_valid - verifies whether the specified semaphore still exists, and if
-**                so, locks exclusive access to the semaphore for the caller.
-*****************************************************************************/
-static int
-   sema4_valid( v2pt_sema4_t *sema4 )
-{
-    
-    v2pt_sema4_t *current_smcb;
-    int found_sema4;
+    v2pt_pend_list_t
+        pend_list;
 
-    found_sema4 = FALSE;
+        /*
+        ** Priority index for the waiting task list (used for SEM_Q_PRIORITY
+        ** only, but kept with the control block once allocated)
+        */
+    v2pt_prio_index_t *
+        pend_index;
 
     /*
-    **  Protect the semaphore list while we examine and modify it.
+    **  ---- Per-type section (only the semaphore types which use it) ----
     */
-    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                          (void *)&sema4_list_lock );
-    pthread_mutex_lock( &sema4_list_lock );
+        /*
+        ** Priority-inheritance (or priority-ceiling) mutex which is the lock
+        ** itself for an inversion-safe (or ceiling) mutex semaphore (unused
+        ** otherwise)
+        */
+    pthread_mutex_t
+        pi_lock V2PT_CACHE_ALIGNED;
 
-    if ( sema4_list != (v2pt_sema4_t *)NULL )
-    {
         /*
-        **  One or more semaphores already exist in the semaphore list...
-        **  Scan the existing semaphores for a matching ID.
+        **  SEM_ADAPTIVE mutex counters: contended takes which got the mutex
+        **  while spinning, and those which had to block.  Changed only with
+        **  atomic operations.
         */
-        for ( current_smcb = sema4_list; 
-              current_smcb != (v2pt_sema4_t *)NULL;
-              current_smcb = current_smcb->nxt_sema4 )
-        {
-            if ( current_smcb == sema4 )
-            {
-                /*
-                ** Lock mutex for semaphore access (it is assumed that a
-                ** 'pthread_cleanup_push()' has already been performed
-                **  by the caller in case of unexpected thread termination.)
-                */
-                pthread_mutex_lock( &(sema4->sema4_lock) );
+    unsigned long
+        spin_acquired;
+    unsigned long
+        spin_blocked;
 
-                found_sema4 = TRUE;
-                break;
-            }
-        }
-    }
- 
-    /*
-    **  Re-enable access to the semaphore list by other threads.
-    */
-    pthread_mutex_unlock( &sema4_list_lock );
-    pthread_cleanup_pop( 0 );
- 
-    return( found_sema4 );
-}
+        /*
+        **  Mutex owner-running flag, set as a task becomes owner and cleared
+        **  as it gives up ownership, so that spin_take can tell whether to
+        **  keep polling without looking at the owner's task control block.
+        **  An owner blocked elsewhere still shows as running; the spin limit
+        **  bounds what that costs.  Changed only with atomic operations.
+        */
+    int
+        owner_running;
 
+        /*
+        **  Reader-writer semaphore state: the reader counts (allocated by
+        **  semRWCreate, and kept with the control block like pend_index),
+        **  the gate, which is non-zero while new readers must wait under
+        **  sema4_lock, and the number of writers waiting.  The gate and
+        **  the writer count change only under sema4_lock, and are read
+        **  without it by readers.
+        */
+    v2pt_rw_count_t *
+        rw_counts;
+    int
+        rw_gate;
+    int
+        rw_writers;
 
-/*****************************************************************************
-** link_smcb - appends a new semaphore control block pointer to the sema4_list
-*****************************************************************************/
-static void
-   link_smcb( v2pt_sema4_t *new_sema4 )
-{
-    v2pt_sema4_t *current_smcb;
+        /*
+        **  Reader-writer semaphore limit (max_readers), the number of
+        **  readers admitted against it, and the number of readers waiting
+        **  under sema4_lock for the gate to open or for room under the
+        **  limit.  rw_admitted is changed only with atomic operations, and
+        **  rw_read_waiters only under sema4_lock.
+        */
+    int
+        rw_max_readers;
+    int
+        rw_admitted;
+    int
+        rw_read_waiters;
 
-    /*
-    **  Protect the semaphore list while we examine and modify it.
-    */
-    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                          (void *)&sema4_list_lock );
-    pthread_mutex_lock( &sema4_list_lock );
+        /*
+        **  Rate-limiter semaphore state (see semRateCreate): the time in ns
+        **  between tokens, the time by which the bucket may run ahead of
+        **  the clock (burst - 1 intervals), and the theoretical arrival
+        **  time of the next token on the monotonic clock.  rate_tat is
+        **  changed only with atomic operations.
+        */
+    long long
+        rate_interval;
+    long long
+        rate_burst_ns;
+    long long
+        rate_tat;
 
-    new_sema4->nxt_sema4 = (v2pt_sema4_t *)NULL;
-    if ( sema4_list != (v2pt_sema4_t *)NULL )
-    {
         /*
-        **  One or more semaphores already exist in the semaphore list...
-        **  Insert the new entry at the tail of the list.
+        **  Tasks in objWaitAny watching the semaphore (counted in watchers).
         */
-        for ( current_smcb = sema4_list; 
-              current_smcb->nxt_sema4 != (v2pt_sema4_t *)NULL;
-              current_smcb = current_smcb->nxt_sema4 );
-        current_smcb->nxt_sema4 = new_sema4;
-#ifdef DIAG_PRINTFS 
-        printf( "\r\nadd semaphore cb @ %p to list @ %p", new_sema4,
-                current_smcb );
-#endif
-    }
-    else
-    {
+    v2pt_watch_t *
+        first_watch;
+
         /*
-        **  this is the first semaphore being added to the semaphore list.
+        **  Task registered by semEvStart to be sent events when the
+        **  semaphore becomes available.  A registration counts as one
+        **  more watcher, so that gives take sema4_lock to send them.
         */
-        sema4_list = new_sema4;
-#ifdef DIAG_PRINTFS 
-        printf( "\r\nadd semaphore cb @ %p to list @ %p", new_sema4,
-                &sema4_list );
-#endif
-    }
- 
+    v2pt_ev_reg_t
+        ev_reg;
+
     /*
-    **  Re-enable access to the semaphore list by other threads.
+    **  ---- Cold section (delete / flush / slot maintenance) ----
     */
-    pthread_mutex_unlock( &sema4_list_lock );
-    pthread_cleanup_pop( 0 );
-}
-
-/*****************************************************************************
-** unlink_smcb - removes a semaphore control block pointer from the sema4_list
-*****************************************************************************/
-static v2pt_sema4_t *
-   unlink_smcb( v2pt_sema4_t *smid )
-{
-    v2pt_sema4_t *current_smcb;
-    v2pt_sema4_t *selected_smcb;
+        /*
+        ** Mutex and Condition variable for semaphore delete
+        */
+    pthread_mutex_t
+        smdel_lock V2PT_CACHE_ALIGNED;
+    pthread_cond_t
+        smdel_cplt;
 
-    selected_smcb =  (v2pt_sema4_t *)NULL;
+        /*
+        ** Condition variables on which readers wait for the gate of a
+        ** reader-writer semaphore to open, and writers wait for ownership
+        */
+    pthread_cond_t
+        rw_read_cond;
+    pthread_cond_t
+        rw_write_cond;
 
-    if ( sema4_list != (v2pt_sema4_t *)NULL )
-    {
         /*
-        **  One or more semaphores exist in the semaphore list...
-        **  Protect the semaphore list while we examine and modify it.
+        **  Index of the sema4_table slot which owns this control block.
         */
-        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                              (void *)&sema4_list_lock );
-        pthread_mutex_lock( &sema4_list_lock );
+    unsigned int
+        slot;
 
         /*
-        **  Scan the semaphore list for an smcb with a matching semaphore ID
+        **  Flag indicating if the control block was carved from a slab
+        **  ( == 0 ) or lives in storage provided by the caller ( == 1 )
         */
-        if ( sema4_list == smid )
-        {
-            /*
-            **  The first semaphore in the list matches the selected ID
-            */
-            selected_smcb = sema4_list; 
-            sema4_list = selected_smcb->nxt_sema4;
-#ifdef DIAG_PRINTFS 
-            printf( "\r\ndel semaphore cb @ %p from list @ %p", selected_smcb,
-                    &sema4_list );
-#endif
-        }
-        else
-        {
-            /*
-            **  Scan the next smcb for a matching smid while retaining a
-            **  pointer to the current smcb.  If the next smcb matches,
-            **  select it and then unlink it from the semaphore list.
-            */
-            for ( current_smcb = sema4_list; 
-                  current_smcb->nxt_sema4 != (v2pt_sema4_t *)NULL;
-                  current_smcb = current_smcb->nxt_sema4 )
-            {
-                if ( current_smcb->nxt_sema4 == smid )
-                {
-                    /*
-                    **  Semaphore ID of next smcb matches...
-                    **  Select the smcb and then unlink it by linking
-                    **  the selected smcb's next smcb into the current smcb.
-                    */
-                    selected_smcb = current_smcb->nxt_sema4;
-                    current_smcb->nxt_sema4 = selected_smcb->nxt_sema4;
-#ifdef DIAG_PRINTFS 
-                    printf( "\r\ndel semaphore cb @ %p from list @ %p",
-                            selected_smcb, current_smcb );
-#endif
-                    break;
-                }
-            }
-        }
+    int
+        static_sema4;
 
         /*
-        **  Re-enable access to the semaphore list by other threads.
+        **  Next block in the list of slab blocks displaced from their slots
+        **  by control blocks in caller storage.
         */
-        pthread_mutex_unlock( &sema4_list_lock );
-        pthread_cleanup_pop( 0 );
-    }
+    struct v2pt_sema4 *
+        nxt_spare;
 
-    return( selected_smcb );
-}
+        /*
+        **  Named semaphore (see semOpen) for which this control block stands
+        **  in the calling process.  Once set it always points to one.
+        */
+    void *
+        named;
 
-/*****************************************************************************
-** new_sema4 - creates a new v2pthread semaphore using pthreads resources
-*****************************************************************************/
-v2pt_sema4_t *
-    new_sema4( int count )
-{
-    v2pt_sema4_t *semaphore;
+        /*
+        **  pthreads priority ceiling with which pi_lock was initialized, or
+        **  -1 if it was initialized for priority inheritance.
+        */
+    int
+        pi_ceiling;
 
     /*
-    **  First allocate memory for the semaphore control block
+    **  ---- Statistics section (every take while statistics are on) ----
     */
-    semaphore = (v2pt_sema4_t *)ts_malloc( sizeof( v2pt_sema4_t ) );
-    if ( semaphore != (v2pt_sema4_t *)NULL )
-    {
-        /*
-        **  Ok... got a control block.
-        **  Initialize the token count.
-        */
-        semaphore->token_count = count;
+    v2pt_sema4_stats_t
+        stats V2PT_CACHE_ALIGNED;
+} v2pt_sema4_t;
 
+/*
+**  Caller storage must hold a control block and a priority index.
+*/
+typedef char v2pt_sema4_storage_check[( (sizeof( v2pt_sema4_t ) +
+                                         sizeof( v2pt_prio_index_t )) <=
+                                        VX_SEMAPHORE_SIZE ) ? 1 : -1];
+
+/*****************************************************************************
+**  Slot in the semaphore ID table
+**
+**  A control block, once allocated, stays with its slot for the life of the
+**  process and is reused by each semaphore later created in the slot.  A
+**  task holding a stale ID therefore only ever reads a semaphore control
+**  block, whose sema4_id tells it the semaphore is gone; there is no need
+**  to defer reclaiming the memory until such tasks are done with it.  The
+**  exception is caller storage, which is handed back only once the tasks
+**  counted in users are done with it.
+*****************************************************************************/
+typedef struct v2pt_sema4_slot
+{
         /*
-        ** Mutex and Condition variable for semaphore send/pend
+        ** Control block belonging to the slot (NULL until first used)
         */
-        pthread_mutex_init( &(semaphore->sema4_lock),
-                            (pthread_mutexattr_t *)NULL );
-        pthread_cond_init( &(semaphore->sema4_send),
-                           (pthread_condattr_t *)NULL );
+    v2pt_sema4_t *
+        sema4;
 
         /*
-        ** Mutex and Condition variable for semaphore delete/delete
+        ** Generation of the slot's current (or next) semaphore
         */
-        pthread_mutex_init( &(semaphore->smdel_lock),
-                            (pthread_mutexattr_t *)NULL );
-        pthread_cond_init( &(semaphore->smdel_cplt),
-                           (pthread_condattr_t *)NULL );
+    uintptr_t
+        generation;
 
         /*
-        ** Type of send operation last performed on semaphore
+        ** Index of the next slot in the free slot list (zero ends the list)
         */
-        semaphore->send_type = SEND;
+    unsigned int
+        nxt_free;
 
         /*
-        **  Ownership nesting level for mutual exclusion semaphore.
+        ** Tasks using the slot's control block, and SLOT_* flags
         */
-        semaphore->recursion_level = 0;
+    unsigned int
+        users;
+} v2pt_sema4_slot_t;
 
+/*****************************************************************************
+**  Per-thread cache of free semaphore slots
+*****************************************************************************/
+typedef struct v2pt_sema4_cache
+{
         /*
-        ** Task control block ptr for task which currently owns semaphore
+        ** Number of slots in the cache
         */
-        semaphore->current_owner = (v2pthread_cb_t *)NULL;
+    unsigned int
+        count;
 
         /*
-        ** First task control block in list of tasks waiting on semaphore
+        ** Indexes of the cached slots, each of which has its control block
         */
-        semaphore->first_susp = (v2pthread_cb_t *)NULL;
-    }
+    unsigned int
+        slot[SEMA4_CACHE_SLOTS];
+} v2pt_sema4_cache_t;
 
-    return( semaphore );
-}
+/*
+**  Semaphore ID as seen by the application (SEM_ID in vxw_hdrs.h)
+*/
+typedef void *v2pt_sema4_id_t;
 
 /*****************************************************************************
-** semBCreate - creates a v2pthread binary semaphore
+**  Record of a reader-writer semaphore held for reading by the calling
+**  thread: the reader count it was counted in, and its nesting level.
 *****************************************************************************/
-v2pt_sema4_t *
-    semBCreate( int opt, int initial_state )
+typedef struct v2pt_rw_hold
 {
-    v2pt_sema4_t *semaphore;
+    v2pt_sema4_t *
+        sema4;
+    v2pt_sema4_id_t
+        semid;
+    unsigned int
+        slot;
+    int
+        count;
+} v2pt_rw_hold_t;
 
-    if ( (opt & SEM_Q_PRIORITY)
-    	||(opt & SEM_DELETE_SAFE)
-	||(opt & SEM_INVERSION_SAFE) )
-    {
-    	errno = ENOSYS;
+/*****************************************************************************
+**  Pend record for a task in wait_for_token, passed to its cleanup handler
+*****************************************************************************/
+typedef struct v2pt_sema4_pend
+{
+    v2pt_sema4_t *
+        sema4;
+    v2pthread_cb_t *
+        tcb;
+    v2pt_sema4_id_t
+        semid;
+} v2pt_sema4_pend_t;
+
+/*****************************************************************************
+**  State and statistics of a semaphore (SEM_INFO in vxw_hdrs.h)
+*****************************************************************************/
+typedef struct v2pt_sema4_info
+{
+        /*
+        ** Semaphore type (SEM_TYPE_BINARY etc.) and options
+        */
+    int
+        type;
+    int
+        options;
+
+        /*
+        ** Tokens available (readers holding a reader-writer semaphore), and
+        ** task ID of the mutex owner or writer (zero if none)
+        */
+    int
+        count;
+    int
+        owner;
+
+        /*
+        ** Tasks waiting now, and the most ever waiting at once
+        */
+    int
+        pended;
+    int
+        max_pended;
+
+        /*
+        ** Successful takes, takes which had to wait, and timed-out waits
+        */
+    unsigned long
+        takes;
+    unsigned long
+        contended;
+    unsigned long
+        timeouts;
+
+        /*
+        ** Histograms of wait and mutex hold times
+        */
+    unsigned long
+        wait_hist[SEM_HIST_BUCKETS];
+    unsigned long
+        hold_hist[SEM_HIST_BUCKETS];
+} v2pt_sema4_info_t;
+
+/*****************************************************************************
+**  External function and data references
+*****************************************************************************/
+extern void *
+    ts_malloc( size_t blksize );
+extern void
+    ts_free( void *blkaddr );
+extern v2pthread_cb_t *
+   my_tcb( void );
+extern void
+   delete_protect( v2pthread_cb_t *tcb );
+extern void
+   delete_unprotect( v2pthread_cb_t *tcb );
+extern void
+   link_susp_tcb( v2pt_pend_list_t *list, v2pthread_cb_t *new_entry );
+extern void
+   link_prio_susp_tcb( v2pt_pend_list_t *list, v2pt_prio_index_t *index,
+                       v2pthread_cb_t *new_entry );
+extern void
+   unlink_susp_tcb( v2pt_pend_list_t *list, v2pthread_cb_t *entry );
+extern v2pthread_cb_t *
+   select_susp_tcb( v2pt_pend_list_t *list, int pend_order );
+extern int
+   release_susp_tcbs( v2pt_pend_list_t *list, int release );
+extern void
+   link_watch( v2pt_watch_t **list_head, v2pt_watch_t *watch );
+extern int
+   unlink_watch( v2pt_watch_t **list_head, v2pt_watch_t *watch );
+extern void
+   wake_watchers( v2pt_watch_t **list_head );
+extern void
+   drop_watchers( v2pt_watch_t **list_head );
+extern STATUS
+   register_events( v2pt_ev_reg_t *reg, unsigned int events, int options,
+                    int ready );
+extern STATUS
+   unregister_events( v2pt_ev_reg_t *reg );
+extern int
+   post_events( v2pt_ev_reg_t *reg );
+extern int
+   task_sched_priority( int v2pthread_priority );
+extern BOOL
+   unprivilegedModeIsEnabled( void );
+extern void
+   deadline_after_ns( long long ns, struct timespec *deadline );
+extern void
+   deadline_after_ticks( int ticks, struct timespec *deadline );
+extern int
+   deadline_passed( const struct timespec *deadline );
+extern void
+   init_monotonic_cond( pthread_cond_t *cond );
+extern int
+   lock_mutex_until( pthread_mutex_t *mutex,
+                     const struct timespec *deadline );
+extern STATUS
+   named_sema4_take( void *named_sema4, v2pt_sema4_id_t semid, int max_wait,
+                     const struct timespec *deadline );
+extern STATUS
+   named_sema4_give( void *named_sema4, v2pt_sema4_id_t semid );
+extern void
+   named_sema4_state( void *named_sema4, int *type, int *options, int *count,
+                      int *pended );
+
+/*****************************************************************************
+**  v2pthread Global Data Structures
+*****************************************************************************/
+
+/*
+**  sema4_table is the two-level table of semaphore slots which is used to
+**              validate semaphores by their IDs.  Its pages are never
+**              freed, so it is read without locking.
+*/
+static v2pt_sema4_slot_t *
+    sema4_table[SEMA4_PAGES];
+
+/*
+**  sema4_free_slot heads the list of slots free for reuse, and
+**  sema4_next_slot is the lowest slot never yet used.
+*/
+static unsigned int
+    sema4_free_slot = 0;
+static unsigned int
+    sema4_next_slot = 1;
+
+/*
+**  sema4_spare heads the list of slab control blocks displaced from their
+**  slots by semaphores built in caller storage, kept for those slots when
+**  the storage is handed back.
+*/
+static v2pt_sema4_t *
+    sema4_spare = (v2pt_sema4_t *)NULL;
+
+/*
+**  sema4_table_lock is a mutex used to serialize semaphore creation and
+**  deletion (changes to the slot table); validation does not take it.
+**  sema4_drained signals semDelete that the last task using a control
+**  block in caller storage is done with it.
+*/
+static pthread_mutex_t
+    sema4_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t
+    sema4_drained = PTHREAD_COND_INITIALIZER;
+
+/*
+**  sema4_slab points to the next control block not yet carved from the
+**             current slab, and sema4_slab_left counts those remaining.
+*/
+static v2pt_sema4_t *
+    sema4_slab = (v2pt_sema4_t *)NULL;
+static unsigned int
+    sema4_slab_left = 0;
+
+/*
+**  sema4_cache is the calling thread's cache of free slots.  sema4_cache_key
+**              exists only so that its destructor returns the cache to the
+**              shared free slot list when the thread exits (and lets go of
+**              sema4_user, should the thread be deleted while using one).
+**  sema4_user is the slot in which the calling thread is counted as using
+**             caller storage, if any.
+*/
+static __thread v2pt_sema4_cache_t
+    sema4_cache;
+static __thread v2pt_sema4_slot_t *
+    sema4_user = (v2pt_sema4_slot_t *)NULL;
+static pthread_key_t
+    sema4_cache_key;
+static pthread_once_t
+    sema4_cache_once = PTHREAD_ONCE_INIT;
+
+/*
+**  rw_holds records the reader-writer semaphores which the calling thread
+**             holds for reading.
+*/
+static __thread v2pt_rw_hold_t
+    rw_holds[V2LIN_RW_HOLDS];
+
+/*
+**  sema4_stats_on is non-zero while semStatsEnable has statistics kept.
+*/
+static int
+    sema4_stats_on = FALSE;
+
+
+/*****************************************************************************
+** sema4_slot - returns the slot with the specified index, or NULL if the
+**              page holding it has not been allocated.
+*****************************************************************************/
+static v2pt_sema4_slot_t *
+   sema4_slot( uintptr_t index )
+{
+    v2pt_sema4_slot_t *page;
+
+    page = __atomic_load_n( &(sema4_table[index >> SEMA4_PAGE_BITS]),
+                            __ATOMIC_ACQUIRE );
+    if ( page == (v2pt_sema4_slot_t *)NULL )
+        return( (v2pt_sema4_slot_t *)NULL );
+    return( &(page[index & (SEMA4_PAGE_SLOTS - 1)]) );
+}
+
+/*****************************************************************************
+**  sema4_valid - verifies whether the specified semaphore still exists, and if
+**                so, locks exclusive access to the semaphore for the caller.
+**                The caller passes the control block found by sema4_for,
+**                and the ID is checked again once the lock is held, since
+**                the semaphore may have been deleted meanwhile.
+*****************************************************************************/
+static int
+   sema4_valid( v2pt_sema4_t *sema4, v2pt_sema4_id_t semid )
+{
+    if ( sema4 == (v2pt_sema4_t *)NULL )
+        return( FALSE );
+
+    /*
+    ** Lock mutex for semaphore access (it is assumed that a
+    ** 'pthread_cleanup_push()' has already been performed
+    **  by the caller in case of unexpected thread termination.)
+    */
+    pthread_mutex_lock( &(sema4->sema4_lock) );
+    if ( sema4->sema4_id != semid )
+    {
+        pthread_mutex_unlock( &(sema4->sema4_lock) );
+        return( FALSE );
+    }
+
+    return( TRUE );
+}
+
+/*****************************************************************************
+** reset_pi_lock - initializes the pthreads mutex which is the lock itself
+**                 for an inversion-safe mutex or, given a pthreads priority
+**                 ceiling rather than -1, for a ceiling mutex.  A priority-
+**                 inheritance mutex is robust, so that deleting a task which
+**                 owns it cannot leave the mutex locked forever; the C
+**                 library does not support robust priority-ceiling mutexes.
+*****************************************************************************/
+static void
+   reset_pi_lock( v2pt_sema4_t *sema4, int ceiling )
+{
+    pthread_mutexattr_t pi_attr;
+
+    pthread_mutexattr_init( &pi_attr );
+    if ( ceiling < 0 )
+    {
+        pthread_mutexattr_setprotocol( &pi_attr, PTHREAD_PRIO_INHERIT );
+        pthread_mutexattr_setrobust( &pi_attr, PTHREAD_MUTEX_ROBUST );
+    }
+    else
+    {
+        pthread_mutexattr_setprotocol( &pi_attr, PTHREAD_PRIO_PROTECT );
+        pthread_mutexattr_setprioceiling( &pi_attr, ceiling );
+    }
+    pthread_mutex_init( &(sema4->pi_lock), &pi_attr );
+    pthread_mutexattr_destroy( &pi_attr );
+    sema4->pi_ceiling = ceiling;
+}
+
+/*****************************************************************************
+** prepare_pi_lock - readies pi_lock for a new inversion-safe mutex (ceiling
+**                   -1) or ceiling mutex.  An earlier semaphore may have
+**                   been deleted while another task owned it, or have used
+**                   another protocol or ceiling, so start it afresh unless
+**                   it is free and already as wanted.
+*****************************************************************************/
+static void
+   prepare_pi_lock( v2pt_sema4_t *sema4, int ceiling )
+{
+    if ( (sema4->pi_ceiling == ceiling) &&
+         (pthread_mutex_trylock( &(sema4->pi_lock) ) == 0) )
+        pthread_mutex_unlock( &(sema4->pi_lock) );
+    else
+        reset_pi_lock( sema4, ceiling );
+}
+
+/*****************************************************************************
+** init_sema4_cb - initializes every lock and condition variable in a new
+**                 control block, which starts out of service.
+*****************************************************************************/
+static void
+   init_sema4_cb( v2pt_sema4_t *sema4 )
+{
+    sema4->sema4_id = NULL;
+    sema4->pend_index = (v2pt_prio_index_t *)NULL;
+    sema4->named = NULL;
+    pthread_mutex_init( &(sema4->sema4_lock), (pthread_mutexattr_t *)NULL );
+    sema4->pend_list.head = (v2pthread_cb_t *)NULL;
+    sema4->pend_list.tail = (v2pthread_cb_t *)NULL;
+    sema4->pend_list.lock = &(sema4->sema4_lock);
+    pthread_mutex_init( &(sema4->smdel_lock), (pthread_mutexattr_t *)NULL );
+    pthread_cond_init( &(sema4->smdel_cplt), (pthread_condattr_t *)NULL );
+    sema4->rw_counts = (v2pt_rw_count_t *)NULL;
+    init_monotonic_cond( &(sema4->rw_read_cond) );
+    init_monotonic_cond( &(sema4->rw_write_cond) );
+    reset_pi_lock( sema4, -1 );
+}
+
+/*****************************************************************************
+** carve_sema4 - takes a new control block from the current slab, allocating
+**               a new slab when it is used up.  Every lock and condition
+**               variable in the block is initialized here, once: the block
+**               is recycled without further initialization, and a task
+**               holding a stale ID may still be blocked on its sema4_lock.
+**               The caller must hold sema4_table_lock.
+*****************************************************************************/
+static v2pt_sema4_t *
+   carve_sema4( void )
+{
+    v2pt_sema4_t *sema4;
+
+    if ( sema4_slab_left == 0 )
+    {
+        sema4_slab = (v2pt_sema4_t *)ts_malloc( SEMA4_SLAB_BLOCKS *
+                                                sizeof( v2pt_sema4_t ) );
+        if ( sema4_slab == (v2pt_sema4_t *)NULL )
+            return( (v2pt_sema4_t *)NULL );
+        sema4_slab_left = SEMA4_SLAB_BLOCKS;
+    }
+    sema4 = sema4_slab++;
+    sema4_slab_left--;
+
+    init_sema4_cb( sema4 );
+    sema4->static_sema4 = FALSE;
+
+    return( sema4 );
+}
+
+/*****************************************************************************
+** drain_sema4_cache - moves slots from the calling thread's cache to the
+**                     shared free slot list until count remain.
+*****************************************************************************/
+static void
+   drain_sema4_cache( v2pt_sema4_cache_t *cache, unsigned int count )
+{
+    v2pt_sema4_slot_t *slot;
+    unsigned int index;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&sema4_table_lock );
+    pthread_mutex_lock( &sema4_table_lock );
+
+    while ( cache->count > count )
+    {
+        index = cache->slot[--(cache->count)];
+        slot = sema4_slot( index );
+        slot->nxt_free = sema4_free_slot;
+        sema4_free_slot = index;
+    }
+
+    pthread_mutex_unlock( &sema4_table_lock );
+    pthread_cleanup_pop( 0 );
+}
+
+/*****************************************************************************
+** sema4_unuse - stops counting one user of a slot, waking a semDelete
+**               waiting to hand back the caller storage if that was the
+**               last one.
+*****************************************************************************/
+static void
+   sema4_unuse( v2pt_sema4_slot_t *slot )
+{
+    if ( __atomic_sub_fetch( &(slot->users), 1, __ATOMIC_SEQ_CST ) ==
+         (SLOT_CALLER_STORAGE | SLOT_DRAINING) )
+    {
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&sema4_table_lock );
+        pthread_mutex_lock( &sema4_table_lock );
+        pthread_cond_broadcast( &sema4_drained );
+        pthread_cleanup_pop( 1 );
+    }
+}
+
+/*****************************************************************************
+** sema4_done - ends the calling thread's use of a semaphore, begun by
+**              sema4_for.  Every caller of sema4_for calls it before
+**              returning.
+*****************************************************************************/
+static void
+   sema4_done( void )
+{
+    v2pt_sema4_slot_t *slot;
+
+    slot = sema4_user;
+    if ( slot != (v2pt_sema4_slot_t *)NULL )
+    {
+        sema4_user = (v2pt_sema4_slot_t *)NULL;
+        sema4_unuse( slot );
+    }
+}
+
+/*****************************************************************************
+** exit_sema4_cache - returns an exiting thread's cached slots to the shared
+**                    free slot list, and ends its use of any semaphore.
+*****************************************************************************/
+static void
+   exit_sema4_cache( void *cache )
+{
+    sema4_done();
+    drain_sema4_cache( (v2pt_sema4_cache_t *)cache, 0 );
+}
+
+/*****************************************************************************
+** make_sema4_cache_key - creates the key whose destructor drains the caches
+**                        of exiting threads.
+*****************************************************************************/
+static void
+   make_sema4_cache_key( void )
+{
+    pthread_key_create( &sema4_cache_key, exit_sema4_cache );
+}
+
+/*****************************************************************************
+** sema4_use - counts the calling thread as using the control block of a
+**             slot which has held caller storage, until sema4_done.
+**             Returns FALSE, counting nothing, if semDelete is handing the
+**             storage back: the slot then has no semaphore in service,
+**             and tasks still trying the old ID must not hold it up.
+*****************************************************************************/
+static int
+   sema4_use( v2pt_sema4_slot_t *slot )
+{
+    if ( sema4_user != (v2pt_sema4_slot_t *)NULL )
+        return( TRUE );
+
+    pthread_once( &sema4_cache_once, make_sema4_cache_key );
+    pthread_setspecific( sema4_cache_key, (void *)&sema4_cache );
+    if ( __atomic_add_fetch( &(slot->users), 1, __ATOMIC_SEQ_CST ) &
+         SLOT_DRAINING )
+    {
+        sema4_unuse( slot );
+        return( FALSE );
+    }
+    sema4_user = slot;
+    return( TRUE );
+}
+
+/*****************************************************************************
+** sema4_for - returns the control block for the specified semaphore ID, or
+**             NULL if the ID does not belong to a semaphore in service.
+**             Takes constant time and no lock; an ID which is garbage or
+**             belongs to a deleted semaphore selects no slot, an empty
+**             slot, or a control block whose sema4_id does not match.
+**             If the slot has held caller storage, the calling thread is
+**             counted as using it until sema4_done, so that semDelete does
+**             not hand the storage back while the thread may touch it.
+*****************************************************************************/
+static v2pt_sema4_t *
+   sema4_for( v2pt_sema4_id_t semid )
+{
+    v2pt_sema4_slot_t *slot;
+    v2pt_sema4_t *sema4;
+
+    slot = sema4_slot( (uintptr_t)semid & SEMA4_INDEX_MASK );
+    if ( slot == (v2pt_sema4_slot_t *)NULL )
+        return( (v2pt_sema4_t *)NULL );
+
+    sema4 = __atomic_load_n( &(slot->sema4), __ATOMIC_ACQUIRE );
+    if ( (sema4 != (v2pt_sema4_t *)NULL) &&
+         (__atomic_load_n( &(slot->users), __ATOMIC_RELAXED ) &
+          SLOT_CALLER_STORAGE) )
+    {
+        if ( !sema4_use( slot ) )
+            return( (v2pt_sema4_t *)NULL );
+        sema4 = __atomic_load_n( &(slot->sema4), __ATOMIC_SEQ_CST );
+    }
+    if ( (sema4 == (v2pt_sema4_t *)NULL) || (semid == NULL) ||
+         (__atomic_load_n( &(sema4->sema4_id), __ATOMIC_ACQUIRE ) != semid) )
+        return( (v2pt_sema4_t *)NULL );
+
+    return( sema4 );
+}
+
+/*****************************************************************************
+** fill_sema4_cache - moves up to SEMA4_CACHE_BATCH free slots into the
+**                    calling thread's cache, taking freed slots first and
+**                    then slots never yet used.  Allocates table pages and
+**                    control blocks as needed.
+*****************************************************************************/
+static void
+   fill_sema4_cache( v2pt_sema4_cache_t *cache )
+{
+    v2pt_sema4_slot_t *page;
+    v2pt_sema4_slot_t *slot;
+    v2pt_sema4_t *sema4;
+    unsigned int index;
+
+    pthread_once( &sema4_cache_once, make_sema4_cache_key );
+    pthread_setspecific( sema4_cache_key, (void *)cache );
+
+    /*
+    **  Protect the slot table while we examine and modify it.
+    */
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&sema4_table_lock );
+    pthread_mutex_lock( &sema4_table_lock );
+
+    while ( cache->count < SEMA4_CACHE_BATCH )
+    {
+        index = sema4_free_slot;
+        if ( index != 0 )
+        {
+            /*
+            **  A slot freed by semDelete, which still has its block.
+            */
+            slot = sema4_slot( index );
+            sema4_free_slot = slot->nxt_free;
+        }
+        else
+        {
+            /*
+            **  The next slot never used, allocating a new page of the
+            **  table and a control block for it.
+            */
+            if ( sema4_next_slot >= SEMA4_MAX_SLOTS )
+                break;
+            index = sema4_next_slot;
+            slot = sema4_slot( index );
+            if ( slot == (v2pt_sema4_slot_t *)NULL )
+            {
+                page = (v2pt_sema4_slot_t *)ts_malloc( SEMA4_PAGE_SLOTS *
+                                               sizeof( v2pt_sema4_slot_t ) );
+                if ( page == (v2pt_sema4_slot_t *)NULL )
+                    break;
+                memset( page, 0, SEMA4_PAGE_SLOTS *
+                                 sizeof( v2pt_sema4_slot_t ) );
+                __atomic_store_n( &(sema4_table[index >> SEMA4_PAGE_BITS]),
+                                  page, __ATOMIC_RELEASE );
+                slot = sema4_slot( index );
+            }
+            sema4 = carve_sema4();
+            if ( sema4 == (v2pt_sema4_t *)NULL )
+                break;
+            sema4->slot = index;
+            slot->generation = 1;
+            __atomic_store_n( &(slot->sema4), sema4, __ATOMIC_RELEASE );
+            sema4_next_slot++;
+        }
+        cache->slot[(cache->count)++] = index;
+    }
+
+    /*
+    **  Re-enable access to the slot table by other threads.
+    */
+    pthread_mutex_unlock( &sema4_table_lock );
+    pthread_cleanup_pop( 0 );
+}
+
+/*****************************************************************************
+** alloc_sema4 - claims a free slot in the semaphore ID table and returns its
+**               control block, ready initialized.  Most calls take a slot
+**               from the calling thread's cache with no lock at all.
+**               Returns NULL if the table is full or memory is exhausted.
+*****************************************************************************/
+static v2pt_sema4_t *
+   alloc_sema4( void )
+{
+    v2pt_sema4_cache_t *cache;
+    unsigned int index;
+
+    cache = &sema4_cache;
+    if ( cache->count == 0 )
+        fill_sema4_cache( cache );
+    if ( cache->count == 0 )
+        return( (v2pt_sema4_t *)NULL );
+
+    index = cache->slot[--(cache->count)];
+#ifdef DIAG_PRINTFS 
+    printf( "\r\nsemaphore cb @ %p in slot %u", sema4_slot( index )->sema4,
+            index );
+#endif
+    return( sema4_slot( index )->sema4 );
+}
+
+/*****************************************************************************
+** unbind_static_sema4 - hands caller storage back to the caller, giving its
+**                       slot a spare slab control block in its place, or a
+**                       new one if no spare is left.  If none can be had,
+**                       the slot is retired for good.  Tasks already using
+**                       the storage (woken waiters among them) may still
+**                       touch it, so the caller is kept waiting until they
+**                       are done with it.
+**                       Returns the slot's new control block, or NULL.
+*****************************************************************************/
+static v2pt_sema4_t *
+   unbind_static_sema4( v2pt_sema4_slot_t *slot, unsigned int index )
+{
+    v2pt_sema4_t *sema4;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&sema4_table_lock );
+    pthread_mutex_lock( &sema4_table_lock );
+
+    sema4 = sema4_spare;
+    if ( sema4 != (v2pt_sema4_t *)NULL )
+        sema4_spare = sema4->nxt_spare;
+    else
+        sema4 = carve_sema4();
+    if ( sema4 != (v2pt_sema4_t *)NULL )
+        sema4->slot = index;
+    __atomic_store_n( &(slot->sema4), sema4, __ATOMIC_SEQ_CST );
+
+    /*
+    **  Tasks which find the slot from now on find the new block.
+    */
+    __atomic_or_fetch( &(slot->users), SLOT_DRAINING, __ATOMIC_SEQ_CST );
+    while ( __atomic_load_n( &(slot->users), __ATOMIC_SEQ_CST ) & SLOT_USERS )
+        pthread_cond_wait( &sema4_drained, &sema4_table_lock );
+    __atomic_and_fetch( &(slot->users), ~SLOT_DRAINING, __ATOMIC_SEQ_CST );
+
+    pthread_mutex_unlock( &sema4_table_lock );
+    pthread_cleanup_pop( 0 );
+
+    return( sema4 );
+}
+
+/*****************************************************************************
+** free_sema4 - returns a control block's slot to the calling thread's cache
+**              of free slots, passing half of them on to the shared list
+**              when the cache is full.  The slot's generation is advanced
+**              first, so that no ID issued for an earlier semaphore in the
+**              slot can match again.  A slot whose control block is in
+**              caller storage lets go of the storage first.
+*****************************************************************************/
+static void
+   free_sema4( v2pt_sema4_t *sema4 )
+{
+    v2pt_sema4_cache_t *cache;
+    v2pt_sema4_slot_t *slot;
+    uintptr_t generation;
+
+    slot = sema4_slot( sema4->slot );
+    generation = slot->generation + 1;
+    if ( ((generation << SEMA4_INDEX_BITS) >> SEMA4_INDEX_BITS) !=
+         generation )
+        generation = 1;
+    __atomic_store_n( &(slot->generation), generation, __ATOMIC_RELEASE );
+
+    if ( sema4->static_sema4 )
+    {
+        sema4 = unbind_static_sema4( slot, sema4->slot );
+        if ( sema4 == (v2pt_sema4_t *)NULL )
+            return;
+    }
+
+    cache = &sema4_cache;
+    if ( cache->count == SEMA4_CACHE_SLOTS )
+        drain_sema4_cache( cache, SEMA4_CACHE_BATCH );
+    if ( cache->count == 0 )
+    {
+        pthread_once( &sema4_cache_once, make_sema4_cache_key );
+        pthread_setspecific( sema4_cache_key, (void *)cache );
+    }
+    cache->slot[(cache->count)++] = sema4->slot;
+}
+
+/*****************************************************************************
+** bind_static_sema4 - builds a control block in caller storage and binds it
+**                     to a free slot, whose slab block is set aside on the
+**                     spare list until the storage is handed back.  The
+**                     slot's generation was advanced when it was freed, so
+**                     no stale ID can lead to the storage.  Storage already
+**                     holding a semaphore in service is refused: only its
+**                     own slot can point at it.  Returns NULL, with errno
+**                     set, on failure.
+*****************************************************************************/
+static v2pt_sema4_t *
+   bind_static_sema4( char *storage, int opt )
+{
+    v2pt_sema4_slot_t *slot;
+    v2pt_sema4_t *spare;
+    v2pt_sema4_t *sema4;
+
+    sema4 = (v2pt_sema4_t *)storage;
+    if ( (sema4 == (v2pt_sema4_t *)NULL) ||
+         ((uintptr_t)storage & (V2PT_CACHE_LINE - 1)) )
+    {
+        errno = EINVAL;
+        return( (v2pt_sema4_t *)NULL );
+    }
+
+    /*
+    **  Claim a slot the usual way, mostly from the thread's own cache.
+    */
+    spare = alloc_sema4();
+    if ( spare == (v2pt_sema4_t *)NULL )
+    {
+        errno = S_memLib_NOT_ENOUGH_MEMORY;
+        return( (v2pt_sema4_t *)NULL );
+    }
+    slot = sema4_slot( spare->slot );
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&sema4_table_lock );
+    pthread_mutex_lock( &sema4_table_lock );
+
+    if ( (sema4->slot > 0) && (sema4->slot < sema4_next_slot) &&
+         (__atomic_load_n( &(sema4_slot( sema4->slot )->sema4),
+                           __ATOMIC_ACQUIRE ) == sema4) )
+    {
+        errno = EINVAL;                      /* Semaphore still in service */
+        sema4 = (v2pt_sema4_t *)NULL;
+    }
+    else
+    {
+        init_sema4_cb( sema4 );
+        sema4->static_sema4 = TRUE;
+        sema4->slot = spare->slot;
+
+        /*
+        **  The priority index, if any, follows the control block.
+        */
+        if ( opt & SEM_Q_PRIORITY )
+        {
+            sema4->pend_index =
+                (v2pt_prio_index_t *)(storage + sizeof( v2pt_sema4_t ));
+            memset( sema4->pend_index, 0, sizeof( v2pt_prio_index_t ) );
+        }
+        spare->nxt_spare = sema4_spare;
+        sema4_spare = spare;
+        __atomic_or_fetch( &(slot->users), SLOT_CALLER_STORAGE,
+                           __ATOMIC_RELAXED );
+        __atomic_store_n( &(slot->sema4), sema4, __ATOMIC_RELEASE );
+    }
+
+    pthread_mutex_unlock( &sema4_table_lock );
+    pthread_cleanup_pop( 0 );
+
+    /*
+    **  Storage in service: the slot goes back to the cache unused.
+    */
+    if ( sema4 == (v2pt_sema4_t *)NULL )
+        free_sema4( spare );
+
+    return( sema4 );
+}
+
+/*****************************************************************************
+** issue_sema4_id - puts a newly created semaphore into service and returns
+**                  its ID.
+*****************************************************************************/
+static v2pt_sema4_id_t
+   issue_sema4_id( v2pt_sema4_t *sema4 )
+{
+    v2pt_sema4_slot_t *slot;
+    v2pt_sema4_id_t semid;
+
+    slot = sema4_slot( sema4->slot );
+    semid = (v2pt_sema4_id_t)((slot->generation << SEMA4_INDEX_BITS) |
+                              (uintptr_t)sema4->slot);
+    __atomic_store_n( &(sema4->sema4_id), semid, __ATOMIC_RELEASE );
+#ifdef DIAG_PRINTFS 
+    printf( "\r\nsemaphore cb @ %p issued id %p", sema4, semid );
+#endif
+
+    return( semid );
+}
+
+/*****************************************************************************
+** sema4_in_service - checks without locking that the control block found
+**                    by sema4_for is still in service under semid, and has
+**                    not been deleted and its slot reused since.  Used only
+**                    to qualify a fast-path operation; anything it rejects
+**                    goes through sema4_valid.
+*****************************************************************************/
+static int
+   sema4_in_service( v2pt_sema4_t *sema4, v2pt_sema4_id_t semid )
+{
+    return( (sema4 != (v2pt_sema4_t *)NULL) &&
+            (__atomic_load_n( &(sema4->sema4_id), __ATOMIC_ACQUIRE ) ==
+             semid) );
+}
+
+/*****************************************************************************
+** sema4_is_named - checks without locking whether the specified ID is that
+**                  of a named semaphore (see semOpen), on which only takes
+**                  and gives are supported.  Its type cannot change while
+**                  the ID remains in service.
+*****************************************************************************/
+static int
+   sema4_is_named( v2pt_sema4_t *sema4, v2pt_sema4_id_t semid )
+{
+    return( (sema4 != (v2pt_sema4_t *)NULL) &&
+            (__atomic_load_n( &(sema4->sema4_id), __ATOMIC_ACQUIRE ) ==
+             semid) &&
+            ((sema4->flags & SEM_TYPE_MASK) == NAMED_SEMA4) );
+}
+
+/*****************************************************************************
+** sema4_is_rate - checks without locking whether the specified ID is that
+**                 of a rate-limiter semaphore (see semRateCreate), whose
+**                 tokens come from the clock rather than from semGive.
+*****************************************************************************/
+static int
+   sema4_is_rate( v2pt_sema4_t *sema4, v2pt_sema4_id_t semid )
+{
+    return( (sema4 != (v2pt_sema4_t *)NULL) &&
+            (__atomic_load_n( &(sema4->sema4_id), __ATOMIC_ACQUIRE ) ==
+             semid) &&
+            ((sema4->flags & SEM_TYPE_MASK) == RATE_SEMA4) );
+}
+
+/*****************************************************************************
+** Semaphore statistics
+**
+** While sema4_stats_on is set, the take paths count into the stats section
+** of the control block.  Every successful take is counted by the public
+** function which made it.  A take which has to wait is counted where it
+** starts waiting, which notes the time with stats_since, and again where
+** the wait ends, in count_wait.  Mutex hold times run from begin_hold,
+** where a task becomes owner, to end_hold, where it gives up ownership.
+*****************************************************************************/
+
+/*****************************************************************************
+** stats_clock - returns the time in nanoseconds on the monotonic clock.
+*****************************************************************************/
+static long long
+   stats_clock( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return( (long long)now.tv_sec * 1000000000LL + (long long)now.tv_nsec );
+}
+
+/*****************************************************************************
+** stats_since - returns the time at which a wait starts, or zero if no
+**               statistics are being kept.
+*****************************************************************************/
+static long long
+   stats_since( void )
+{
+    if ( !__atomic_load_n( &sema4_stats_on, __ATOMIC_RELAXED ) )
+        return( 0 );
+    return( stats_clock() );
+}
+
+/*****************************************************************************
+** stats_bucket - returns the histogram bucket for an interval: bucket 0 for
+**                under one microsecond, bucket n for 2^(n-1) up to 2^n
+**                microseconds, and the last bucket for anything longer.
+*****************************************************************************/
+static int
+   stats_bucket( long long ns )
+{
+    long long usec;
+    int bucket;
+
+    usec = ns / 1000;
+    for ( bucket = 0; (usec > 0) && (bucket < SEM_HIST_BUCKETS - 1);
+          bucket++ )
+        usec >>= 1;
+    return( bucket );
+}
+
+/*****************************************************************************
+** count_takes - counts successful takes of the semaphore.
+*****************************************************************************/
+static void
+   count_takes( v2pt_sema4_t *sema4, int count )
+{
+    if ( __atomic_load_n( &sema4_stats_on, __ATOMIC_RELAXED ) )
+        __atomic_add_fetch( &(sema4->stats.takes), count, __ATOMIC_RELAXED );
+}
+
+/*****************************************************************************
+** count_waiters - notes the number of tasks now waiting on the semaphore
+**                 if it is the most yet.
+*****************************************************************************/
+static void
+   count_waiters( v2pt_sema4_t *sema4, int waiters )
+{
+    int most;
+
+    if ( !__atomic_load_n( &sema4_stats_on, __ATOMIC_RELAXED ) )
+        return;
+    most = __atomic_load_n( &(sema4->stats.max_waiters), __ATOMIC_RELAXED );
+    while ( (waiters > most) &&
+            !__atomic_compare_exchange_n( &(sema4->stats.max_waiters), &most,
+                                          waiters, 1, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED ) )
+        ;
+}
+
+/*****************************************************************************
+** count_wait - counts a take which had to wait from the time since (as
+**              returned by stats_since, so zero if statistics were off),
+**              with the outcome of the wait.
+*****************************************************************************/
+static void
+   count_wait( v2pt_sema4_t *sema4, long long since, STATUS error )
+{
+    /*
+    **  The control block of a semaphore deleted during the wait may
+    **  already belong to another one.
+    */
+    if ( (since == 0) || (error == S_objLib_OBJ_ID_ERROR) )
+        return;
+    __atomic_add_fetch( &(sema4->stats.contended), 1, __ATOMIC_RELAXED );
+    if ( error == OK )
+        __atomic_add_fetch( &(sema4->stats.wait_hist[stats_bucket(
+                                 stats_clock() - since )]),
+                            1, __ATOMIC_RELAXED );
+    else if ( error == S_objLib_OBJ_TIMEOUT )
+        __atomic_add_fetch( &(sema4->stats.timeouts), 1, __ATOMIC_RELAXED );
+}
+
+/*****************************************************************************
+** begin_hold - notes the time at which a task became owner of a mutex.
+*****************************************************************************/
+static void
+   begin_hold( v2pt_sema4_t *sema4 )
+{
+    if ( __atomic_load_n( &sema4_stats_on, __ATOMIC_RELAXED ) )
+        sema4->stats.hold_start = stats_clock();
+}
+
+/*****************************************************************************
+** end_hold - counts the time for which the owner of a mutex held it, unless
+**            statistics were off when it was taken or are off now.  The
+**            owner calls this before giving up ownership.
+*****************************************************************************/
+static void
+   end_hold( v2pt_sema4_t *sema4 )
+{
+    if ( sema4->stats.hold_start == 0 )
+        return;
+    if ( __atomic_load_n( &sema4_stats_on, __ATOMIC_RELAXED ) )
+        __atomic_add_fetch( &(sema4->stats.hold_hist[stats_bucket(
+                                 stats_clock() - sema4->stats.hold_start )]),
+                            1, __ATOMIC_RELAXED );
+    sema4->stats.hold_start = 0;
+}
+
+/*****************************************************************************
+** claim_token - atomically takes one token from the semaphore if any are
+**               available.  Returns TRUE if a token was taken.
+*****************************************************************************/
+static int
+   claim_token( v2pt_sema4_t *sema4 )
+{
+    int count;
+
+    count = __atomic_load_n( &(sema4->token_count), __ATOMIC_RELAXED );
+    while ( count > 0 )
+    {
+        if ( __atomic_compare_exchange_n( &(sema4->token_count), &count,
+                                          count - 1, 1, __ATOMIC_ACQUIRE,
+                                          __ATOMIC_RELAXED ) )
+            return( TRUE );
+    }
+    return( FALSE );
+}
+
+/*****************************************************************************
+** claim_tokens - atomically takes up to max_count tokens from the semaphore.
+**                Returns the number of tokens taken, which may be zero.
+*****************************************************************************/
+static int
+   claim_tokens( v2pt_sema4_t *sema4, int max_count )
+{
+    int count, taken;
+
+    count = __atomic_load_n( &(sema4->token_count), __ATOMIC_RELAXED );
+    while ( count > 0 )
+    {
+        taken = (count < max_count) ? count : max_count;
+        if ( __atomic_compare_exchange_n( &(sema4->token_count), &count,
+                                          count - taken, 1, __ATOMIC_ACQUIRE,
+                                          __ATOMIC_RELAXED ) )
+            return( taken );
+    }
+    return( 0 );
+}
+
+/*****************************************************************************
+** sema4_ready - wakes the tasks watching the semaphore from objWaitAny, and
+**               sends its events to any task registered by semEvStart, once
+**               the semaphore is available with no task pended on it.
+**               The caller must hold sema4_lock.
+*****************************************************************************/
+static void
+   sema4_ready( v2pt_sema4_t *sema4 )
+{
+    if ( sema4->first_watch != (v2pt_watch_t *)NULL )
+        wake_watchers( &(sema4->first_watch) );
+    if ( (sema4->ev_reg.taskid != 0) && post_events( &(sema4->ev_reg) ) )
+        __atomic_sub_fetch( &(sema4->watchers), 1, __ATOMIC_SEQ_CST );
+}
+
+/*****************************************************************************
+** dispatch_tokens - hands available tokens directly to pended tasks, in pend
+**                   order, and wakes each receiving task individually.  A
+**                   mutex changes owner here, so that no other task can
+**                   slip in between the give and the new owner running.
+**                   Each receiving task stops counting as a waiter here
+**                   too, so that it need not touch the semaphore again.
+**                   The caller must hold sema4_lock.
+*****************************************************************************/
+static void
+   dispatch_tokens( v2pt_sema4_t *sema4 )
+{
+    v2pthread_cb_t *tcb;
+
+    while ( (sema4->pend_list.head != (v2pthread_cb_t *)NULL) &&
+            claim_token( sema4 ) )
+    {
+        tcb = select_susp_tcb( &(sema4->pend_list),
+                               (sema4->flags & SEM_Q_PRIORITY) );
+        if ( tcb == (v2pthread_cb_t *)NULL )
+        {
+            __atomic_add_fetch( &(sema4->token_count), 1, __ATOMIC_SEQ_CST );
+            break;
+        }
+        if ( (sema4->flags & SEM_TYPE_MASK) == MUTEX_SEMA4 )
+        {
+            sema4->current_owner = tcb;
+            sema4->recursion_level = 1;
+            __atomic_store_n( &(sema4->owner_running), TRUE,
+                              __ATOMIC_RELAXED );
+            begin_hold( sema4 );
+        }
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nsemaphore list @ %p token to task @ %p",
+                &(sema4->pend_list), tcb );
+#endif
+        tcb->pend_granted = TRUE;
+        __atomic_sub_fetch( &(sema4->waiters), 1, __ATOMIC_SEQ_CST );
+        pthread_cond_signal( &(tcb->pend_wake) );
+    }
+
+    /*
+    **  Any token left over is there for the taking by a watching task.
+    */
+    if ( __atomic_load_n( &(sema4->token_count), __ATOMIC_SEQ_CST ) > 0 )
+        sema4_ready( sema4 );
+}
+
+/*****************************************************************************
+** dispatch_released - hands tokens just returned to the semaphore one each
+**                     to as many waiters as there are tokens, in pend order,
+**                     if any tasks are waiting for them, and tells any
+**                     watchers.  The caller must not hold sema4_lock.
+*****************************************************************************/
+static void
+   dispatch_released( v2pt_sema4_t *sema4 )
+{
+    if ( (__atomic_load_n( &(sema4->waiters), __ATOMIC_SEQ_CST ) > 0) ||
+         (__atomic_load_n( &(sema4->watchers), __ATOMIC_SEQ_CST ) > 0) )
+    {
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&(sema4->sema4_lock) );
+        pthread_mutex_lock( &(sema4->sema4_lock) );
+        dispatch_tokens( sema4 );
+        pthread_cleanup_pop( 1 );
+    }
+}
+
+/*****************************************************************************
+** release_tokens - atomically returns count tokens to the semaphore and, if
+**                  any tasks are waiting for them, hands one each to as many
+**                  waiters as there are tokens, in pend order.  The tokens
+**                  are added before waiters is read (and waiters is raised
+**                  before the token count is read in wait_for_token) so
+**                  that either the waiter sees the token or we see the
+**                  waiter.  Watchers are counted and seen the same way.
+**                  The caller must not hold sema4_lock.
+*****************************************************************************/
+static void
+   release_tokens( v2pt_sema4_t *sema4, int count )
+{
+    __atomic_add_fetch( &(sema4->token_count), count, __ATOMIC_SEQ_CST );
+    dispatch_released( sema4 );
+}
+
+/*****************************************************************************
+** release_tokens_bounded - as release_tokens, unless count more tokens would
+**                          take the token count past INT_MAX, in which case
+**                          no token is returned.  Returns FALSE if none was.
+*****************************************************************************/
+static int
+   release_tokens_bounded( v2pt_sema4_t *sema4, int count )
+{
+    int tokens;
+
+    tokens = __atomic_load_n( &(sema4->token_count), __ATOMIC_RELAXED );
+    do
+    {
+        if ( tokens > INT_MAX - count )
+            return( FALSE );
+    } while ( !__atomic_compare_exchange_n( &(sema4->token_count), &tokens,
+                                            tokens + count, 1,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED ) );
+    dispatch_released( sema4 );
+    return( TRUE );
+}
+
+/*****************************************************************************
+** fast_take - takes a token from the semaphore with no locking, provided
+**             the semaphore is in service, no task is waiting on it, and a
+**             token is available (or the caller already owns the mutex).
+**             Returns FALSE if the caller must use the full semTake path.
+**             Inversion-safe mutexes never come here (see pi_take).
+*****************************************************************************/
+static int
+   fast_take( v2pt_sema4_t *sema4, v2pt_sema4_id_t semid )
+{
+    v2pthread_cb_t *our_tcb;
+
+    if ( !sema4_in_service( sema4, semid ) )
+        return( FALSE );
+
+    if ( (sema4->flags & SEM_TYPE_MASK) != MUTEX_SEMA4 )
+    {
+        if ( __atomic_load_n( &(sema4->waiters), __ATOMIC_ACQUIRE ) > 0 )
+            return( FALSE );
+        return( claim_token( sema4 ) );
+    }
+
+    our_tcb = my_tcb();
+    if ( our_tcb == (v2pthread_cb_t *)NULL )
+        return( FALSE );
+
+    /*
+    **  Only the owner ever finds itself in current_owner, so a recursive
+    **  take needs no lock.
+    */
+    if ( sema4->current_owner == our_tcb )
+    {
+        sema4->recursion_level++;
+        return( TRUE );
+    }
+
+    if ( (__atomic_load_n( &(sema4->waiters), __ATOMIC_ACQUIRE ) > 0) ||
+         !claim_token( sema4 ) )
+        return( FALSE );
+
+    sema4->current_owner = our_tcb;
+    sema4->recursion_level = 1;
+    __atomic_store_n( &(sema4->owner_running), TRUE, __ATOMIC_RELAXED );
+    begin_hold( sema4 );
+    if ( sema4->flags & SEM_DELETE_SAFE )
+        delete_protect( our_tcb );
+    return( TRUE );
+}
+
+/*****************************************************************************
+** fast_give - returns a token to the semaphore with no list scan, provided
+**             the semaphore is in service.  Returns FALSE if the caller must
+**             use the full semGive path; otherwise *error holds the result.
+**             Inversion-safe mutexes never come here (see pi_give).
+*****************************************************************************/
+static int
+   fast_give( v2pt_sema4_t *sema4, v2pt_sema4_id_t semid, STATUS *error )
+{
+    v2pthread_cb_t *our_tcb;
+
+    if ( !sema4_in_service( sema4, semid ) )
+        return( FALSE );
+
+    *error = OK;
+    if ( (sema4->flags & SEM_TYPE_MASK) == MUTEX_SEMA4 )
+    {
+        our_tcb = my_tcb();
+        if ( (our_tcb == (v2pthread_cb_t *)NULL) ||
+             (sema4->current_owner != our_tcb) ||
+             (sema4->recursion_level < 1) )
+        {
+            *error = S_semLib_INVALID_OPERATION;  /* Not owner of mutex */
+            return( TRUE );
+        }
+
+        if ( (--(sema4->recursion_level)) > 0 )
+            return( TRUE );
+
+        /*
+        **  Relinquish ownership before the token becomes visible.
+        */
+        end_hold( sema4 );
+        sema4->current_owner = (v2pthread_cb_t *)NULL;
+        __atomic_store_n( &(sema4->owner_running), FALSE, __ATOMIC_RELAXED );
+        release_tokens( sema4, 1 );
+        if ( sema4->flags & SEM_DELETE_SAFE )
+            delete_unprotect( our_tcb );
+        return( TRUE );
+    }
+
+    release_tokens( sema4, 1 );
+    return( TRUE );
+}
+
+/*****************************************************************************
+** spin_take - for a SEM_ADAPTIVE mutex which fast_take could not get, polls
+**             the mutex for a while before the caller blocks, so that a
+**             short critical section on another CPU costs no context
+**             switches.  Spinning stops as soon as it cannot pay off: on a
+**             single CPU, or once other tasks are pended on the mutex.
+**             The owner is known only by the semaphore's owner_running
+**             flag, since its task control block may be freed at any time.
+**             Returns TRUE if the mutex was taken.
+*****************************************************************************/
+static int
+   spin_take( v2pt_sema4_t *sema4, v2pt_sema4_id_t semid )
+{
+    static int ncpus = 0;
+    long long since;
+    int spins;
+
+    if ( ncpus == 0 )
+        ncpus = (int)sysconf( _SC_NPROCESSORS_ONLN );
+
+    if ( ncpus > 1 )
+    {
+        since = stats_since();
+        for ( spins = 0; spins < V2LIN_MUTEX_SPIN_LIMIT; spins++ )
+        {
+            if ( __atomic_load_n( &(sema4->waiters), __ATOMIC_RELAXED ) > 0 )
+                break;
+            CPU_RELAX();
+            if ( __atomic_load_n( &(sema4->owner_running),
+                                  __ATOMIC_RELAXED ) )
+                continue;
+            if ( fast_take( sema4, semid ) )
+            {
+                __atomic_add_fetch( &(sema4->spin_acquired), 1,
+                                    __ATOMIC_RELAXED );
+                count_wait( sema4, since, OK );
+                return( TRUE );
+            }
+        }
+    }
+
+    __atomic_add_fetch( &(sema4->spin_blocked), 1, __ATOMIC_RELAXED );
+    return( FALSE );
+}
+
+/*****************************************************************************
+** sema4_deadline - returns the CLOCK_MONOTONIC deadline for a timed take:
+**                  the one given by semTakeNs or semTakeUntil, or else one
+**                  max_wait ticks from now, worked out in space.  Takes
+**                  which never wait need not read the clock at all.
+*****************************************************************************/
+static const struct timespec *
+   sema4_deadline( int max_wait, const struct timespec *deadline,
+                   struct timespec *space )
+{
+    if ( deadline == (const struct timespec *)NULL )
+    {
+        deadline_after_ticks( max_wait, space );
+        deadline = space;
+    }
+    return( deadline );
+}
+
+/*****************************************************************************
+** Inversion-safe mutexes
+**
+** A SEM_INVERSION_SAFE mutex is built on a priority-inheritance pthreads
+** mutex (pi_lock), so the kernel boosts the owner to the priority of its
+** highest-priority waiter, follows chains of owners blocked on further
+** such mutexes, and drops each boost as the mutex is given.  Taking and
+** giving an uncontended one costs one compare-and-swap in the C library
+** with no system call.  These mutexes do not use the token count nor the
+** pended task list; waiters counts the tasks in pi_take, so that semDelete
+** knows when every one of them has seen the deletion.
+**
+** A SEM_PRIO_CEILING mutex (semMCeilingCreate) is taken and given the same
+** way, but its pi_lock is a priority-ceiling pthreads mutex.  The C library
+** raises the owner to the ceiling as it takes the mutex and restores it as
+** it gives it, whoever else waits, so there are no chains of boosts.  This
+** costs a system call each way, and a task whose priority is above the
+** ceiling may not take the mutex.
+*****************************************************************************/
+
+/*****************************************************************************
+** pi_unlock_owned - cleanup handler which gives up a just-acquired pi_lock
+**                   if the owning task is cancelled before pi_take returns.
+*****************************************************************************/
+static void
+   pi_unlock_owned( void *sema4 )
+{
+    ((v2pt_sema4_t *)sema4)->current_owner = (v2pthread_cb_t *)NULL;
+    ((v2pt_sema4_t *)sema4)->recursion_level = 0;
+    pthread_mutex_unlock( &(((v2pt_sema4_t *)sema4)->pi_lock) );
+}
+
+/*****************************************************************************
+** pi_leave - withdraws a task from pi_take, signalling a semDelete waiting
+**            for the last task to leave.
+*****************************************************************************/
+static void
+   pi_leave( void *sema4 )
+{
+    v2pt_sema4_t *semaphore;
+
+    semaphore = (v2pt_sema4_t *)sema4;
+    if ( (__atomic_sub_fetch( &(semaphore->waiters), 1,
+                              __ATOMIC_SEQ_CST ) == 0) &&
+         (__atomic_load_n( &(semaphore->send_type), __ATOMIC_SEQ_CST ) &
+          KILLD) )
+    {
+        pthread_mutex_lock( &(semaphore->smdel_lock) );
+        pthread_cond_broadcast( &(semaphore->smdel_cplt) );
+        pthread_mutex_unlock( &(semaphore->smdel_lock) );
+    }
+}
+
+/*****************************************************************************
+** pi_take - takes an inversion-safe or ceiling mutex, blocking in the kernel
+**           (with the owner boosted as needed) for up to max_wait ticks,
+**           or until deadline if one is given.
+*****************************************************************************/
+static STATUS
+   pi_take( v2pt_sema4_t *semaphore, int max_wait,
+            const struct timespec *deadline )
+{
+    v2pthread_cb_t *our_tcb;
+    struct timespec timeout;
+    long long since;
+    STATUS error;
+    int retcode;
+
+    error = OK;
+
+    /*
+    **  Only the owner ever finds itself in current_owner, so a recursive
+    **  take needs no lock.
+    */
+    our_tcb = my_tcb();
+    if ( (our_tcb != (v2pthread_cb_t *)NULL) &&
+         (semaphore->current_owner == our_tcb) )
+    {
+        semaphore->recursion_level++;
+        return( error );
+    }
+
+    __atomic_add_fetch( &(semaphore->waiters), 1, __ATOMIC_SEQ_CST );
+    pthread_cleanup_push( pi_leave, (void *)semaphore );
+
+    /*
+    **  Every take tries the mutex first.  One which finds it taken waits
+    **  for it in slices, so that the task can still be deleted meanwhile.
+    */
+    since = 0;
+    retcode = pthread_mutex_trylock( &(semaphore->pi_lock) );
+    if ( (retcode == EBUSY) && (max_wait != NO_WAIT) )
+    {
+        since = stats_since();
+        count_waiters( semaphore, __atomic_load_n( &(semaphore->waiters),
+                                                   __ATOMIC_RELAXED ) );
+        if ( max_wait != WAIT_FOREVER )
+            deadline = sema4_deadline( max_wait, deadline, &timeout );
+        retcode = lock_mutex_until( &(semaphore->pi_lock), deadline );
+    }
+
+    /*
+    **  A task deleted while owning the mutex leaves it to the next taker.
+    */
+    if ( retcode == EOWNERDEAD )
+    {
+        pthread_mutex_consistent( &(semaphore->pi_lock) );
+        retcode = 0;
+    }
+
+    if ( retcode == 0 )
+    {
+        if ( __atomic_load_n( &(semaphore->send_type), __ATOMIC_SEQ_CST ) &
+             KILLD )
+        {
+            /*
+            **  Semaphore is being deleted... pass the mutex on to the
+            **  next waiter, if any, so that it learns of the deletion too.
+            */
+            pthread_mutex_unlock( &(semaphore->pi_lock) );
+            error = S_objLib_OBJ_ID_ERROR;
+        }
+        else
+        {
+            semaphore->current_owner = our_tcb;
+            semaphore->recursion_level = 1;
+            begin_hold( semaphore );
+
+            /*
+            **  Pending task deletion may not take effect while the mutex
+            **  would be left locked.  A ceiling mutex is not robust, so
+            **  its owner is always deletion-safe.
+            */
+            pthread_cleanup_push( pi_unlock_owned, (void *)semaphore );
+            if ( semaphore->flags & (SEM_DELETE_SAFE | SEM_PRIO_CEILING) )
+                delete_protect( our_tcb );
+            pthread_testcancel();
+            pthread_cleanup_pop( 0 );
+        }
+    }
+    else if ( (retcode == EINVAL) && (semaphore->flags & SEM_PRIO_CEILING) )
+        error = S_semLib_INVALID_OPERATION;  /* Caller above the ceiling */
+    else if ( max_wait == NO_WAIT )
+        error = S_objLib_OBJ_UNAVAILABLE;
+    else
+        error = S_objLib_OBJ_TIMEOUT;
+
+    count_wait( semaphore, since, error );
+    pthread_cleanup_pop( 1 );
+
+    return( error );
+}
+
+/*****************************************************************************
+** pi_give - gives an inversion-safe or ceiling mutex owned by the calling
+**           task.  Any priority boost is dropped when pi_lock is released.
+*****************************************************************************/
+static STATUS
+   pi_give( v2pt_sema4_t *semaphore )
+{
+    v2pthread_cb_t *our_tcb;
+
+    our_tcb = my_tcb();
+    if ( (our_tcb == (v2pthread_cb_t *)NULL) ||
+         (semaphore->current_owner != our_tcb) ||
+         (semaphore->recursion_level < 1) )
+        return( S_semLib_INVALID_OPERATION );  /* Not owner of mutex */
+
+    if ( (--(semaphore->recursion_level)) == 0 )
+    {
+        end_hold( semaphore );
+        semaphore->current_owner = (v2pthread_cb_t *)NULL;
+        pthread_mutex_unlock( &(semaphore->pi_lock) );
+        if ( semaphore->flags & (SEM_DELETE_SAFE | SEM_PRIO_CEILING) )
+            delete_unprotect( our_tcb );
+
+        /*
+        **  semDelete of a ceiling mutex waits for its owner to give it.
+        */
+        if ( __atomic_load_n( &(semaphore->send_type), __ATOMIC_SEQ_CST ) &
+             KILLD )
+        {
+            pthread_mutex_lock( &(semaphore->smdel_lock) );
+            pthread_cond_broadcast( &(semaphore->smdel_cplt) );
+            pthread_mutex_unlock( &(semaphore->smdel_lock) );
+        }
+
+        /*
+        **  Tasks in objWaitAny, and any task registered for events, learn
+        **  of the give only from us.
+        */
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+        if ( __atomic_load_n( &(semaphore->watchers), __ATOMIC_SEQ_CST ) > 0 )
+        {
+            pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                                  (void *)&(semaphore->sema4_lock) );
+            pthread_mutex_lock( &(semaphore->sema4_lock) );
+            if ( semaphore->current_owner == (v2pthread_cb_t *)NULL )
+                sema4_ready( semaphore );
+            pthread_cleanup_pop( 1 );
+        }
+    }
+    return( OK );
+}
+
+/*****************************************************************************
+** Reader-writer semaphores
+**
+** A RW_SEMA4 semaphore is held either by any number of readers (semRTake)
+** or by one writer (semWTake or semTake).  Readers do not take sema4_lock
+** on the way in or out while no writer is about: each counts itself in
+** the reader count picked by its CPU and then checks rw_gate, backing out
+** to wait under sema4_lock if a writer has closed the gate.  A writer
+** closes the gate under sema4_lock and waits until the reader counts add
+** up to zero; each reader leaving while a writer waits signals it.
+** Under the default (writer priority) policy the gate stays closed while
+** any writer waits, so that a stream of readers cannot starve writers.
+** With SEM_RW_READER_PRIORITY a writer which finds readers in reopens the
+** gate at once, and gets in only when the readers happen to drain.
+** Each thread records the semaphores it holds for reading in rw_holds,
+** so that a nested semRTake only counts up, even while a writer waits,
+** and semGive knows which reader count to release.  The writer owns the
+** semaphore as current_owner, and its nested takes of either kind count
+** in recursion_level.  The max_readers limit is kept by one shared count
+** of admitted readers besides the per-CPU ones; a reader which finds no
+** room waits under sema4_lock as it would for a closed gate.
+*****************************************************************************/
+
+/*****************************************************************************
+** rw_hold_for - returns the calling thread's record of holding the specified
+**               semaphore for reading, or NULL if it does not hold it.
+*****************************************************************************/
+static v2pt_rw_hold_t *
+   rw_hold_for( v2pt_sema4_id_t semid )
+{
+    int i;
+
+    for ( i = 0; i < V2LIN_RW_HOLDS; i++ )
+    {
+        if ( (rw_holds[i].count > 0) && (rw_holds[i].semid == semid) )
+            return( &(rw_holds[i]) );
+    }
+    return( (v2pt_rw_hold_t *)NULL );
+}
+
+/*****************************************************************************
+** rw_free_hold - returns a free record in rw_holds, reclaiming those left
+**                for semaphores deleted while still held, or NULL if the
+**                calling thread already holds V2LIN_RW_HOLDS semaphores.
+*****************************************************************************/
+static v2pt_rw_hold_t *
+   rw_free_hold( void )
+{
+    v2pt_sema4_slot_t *slot;
+    uintptr_t index;
+    int i;
+
+    for ( i = 0; i < V2LIN_RW_HOLDS; i++ )
+    {
+        /*
+        **  A held semaphore is known gone by its slot's generation, since
+        **  its control block may be caller storage already handed back.
+        */
+        index = (uintptr_t)rw_holds[i].semid & SEMA4_INDEX_MASK;
+        slot = sema4_slot( index );
+        if ( (rw_holds[i].count == 0) ||
+             (((__atomic_load_n( &(slot->generation), __ATOMIC_ACQUIRE ) <<
+                SEMA4_INDEX_BITS) | index) != (uintptr_t)rw_holds[i].semid) )
+        {
+            rw_holds[i].count = 0;
+            return( &(rw_holds[i]) );
+        }
+    }
+    return( (v2pt_rw_hold_t *)NULL );
+}
+
+/*****************************************************************************
+** rw_reader_slot - picks the reader count for a reader on the current CPU.
+*****************************************************************************/
+static unsigned int
+   rw_reader_slot( void )
+{
+    int cpu;
+
+    cpu = sched_getcpu();
+    if ( cpu < 0 )
+        cpu = 0;
+    return( (unsigned int)cpu & (V2LIN_RW_READER_SLOTS - 1) );
+}
+
+/*****************************************************************************
+** rw_readers - returns the number of readers holding the semaphore.
+*****************************************************************************/
+static int
+   rw_readers( v2pt_sema4_t *sema4 )
+{
+    int readers;
+    int i;
+
+    readers = 0;
+    for ( i = 0; i < V2LIN_RW_READER_SLOTS; i++ )
+        readers += __atomic_load_n( &(sema4->rw_counts[i].readers),
+                                    __ATOMIC_SEQ_CST );
+    return( readers );
+}
+
+/*****************************************************************************
+** rw_leave - removes a reader from its reader count and from the admitted
+**            count, signalling any writer waiting for the readers to drain
+**            and any reader waiting for room.  The count is dropped before
+**            the gate is read (and the gate is closed before the counts are
+**            read in rw_write_take) so that either the writer sees the
+**            count gone or we see the writer.
+*****************************************************************************/
+static void
+   rw_leave( v2pt_sema4_t *sema4, unsigned int slot )
+{
+    __atomic_sub_fetch( &(sema4->rw_counts[slot].readers), 1,
+                        __ATOMIC_SEQ_CST );
+    __atomic_sub_fetch( &(sema4->rw_admitted), 1, __ATOMIC_SEQ_CST );
+    if ( (__atomic_load_n( &(sema4->rw_gate), __ATOMIC_SEQ_CST ) != 0) ||
+         (__atomic_load_n( &(sema4->rw_writers), __ATOMIC_SEQ_CST ) > 0) ||
+         (__atomic_load_n( &(sema4->rw_read_waiters), __ATOMIC_SEQ_CST ) > 0) )
+    {
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&(sema4->sema4_lock) );
+        pthread_mutex_lock( &(sema4->sema4_lock) );
+        pthread_cond_broadcast( &(sema4->rw_write_cond) );
+        if ( sema4->rw_read_waiters > 0 )
+            pthread_cond_broadcast( &(sema4->rw_read_cond) );
+        pthread_cleanup_pop( 1 );
+    }
+}
+
+/*****************************************************************************
+** rw_admit - admits a reader against the max_readers limit.  Returns FALSE
+**            if there is no room for it.
+*****************************************************************************/
+static int
+   rw_admit( v2pt_sema4_t *sema4 )
+{
+    if ( __atomic_add_fetch( &(sema4->rw_admitted), 1, __ATOMIC_SEQ_CST ) <=
+         sema4->rw_max_readers )
+        return( TRUE );
+
+    __atomic_sub_fetch( &(sema4->rw_admitted), 1, __ATOMIC_SEQ_CST );
+    return( FALSE );
+}
+
+/*****************************************************************************
+** rw_try_enter - counts a reader in and returns TRUE if the gate is open
+**                and there is room under the limit; otherwise backs the
+**                reader out again and returns FALSE.
+*****************************************************************************/
+static int
+   rw_try_enter( v2pt_sema4_t *sema4, unsigned int slot )
+{
+    if ( !rw_admit( sema4 ) )
+        return( FALSE );
+    __atomic_add_fetch( &(sema4->rw_counts[slot].readers), 1,
+                        __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &(sema4->rw_gate), __ATOMIC_SEQ_CST ) == 0 )
+        return( TRUE );
+
+    rw_leave( sema4, slot );
+    return( FALSE );
+}
+
+/*****************************************************************************
+** rw_open_gate - lets readers in again once no writer owns the semaphore,
+**                unless writers wait and readers do not have priority.
+**                The caller must hold sema4_lock.
+*****************************************************************************/
+static void
+   rw_open_gate( v2pt_sema4_t *sema4 )
+{
+    if ( (sema4->current_owner == (v2pthread_cb_t *)NULL) &&
+         ((sema4->rw_writers == 0) ||
+          (sema4->flags & SEM_RW_READER_PRIORITY)) )
+    {
+        __atomic_store_n( &(sema4->rw_gate), 0, __ATOMIC_SEQ_CST );
+        pthread_cond_broadcast( &(sema4->rw_read_cond) );
+    }
+    if ( sema4->rw_writers > 0 )
+        pthread_cond_broadcast( &(sema4->rw_write_cond) );
+}
+
+/*****************************************************************************
+** rw_read_abandon - cleanup handler for a task killed while waiting in
+**                   rw_read_take.  Runs with sema4_lock held.
+*****************************************************************************/
+static void
+   rw_read_abandon( void *arg )
+{
+    v2pt_sema4_pend_t *pend;
+
+    pend = (v2pt_sema4_pend_t *)arg;
+    if ( pend->sema4->sema4_id == pend->semid )
+        __atomic_sub_fetch( &(pend->sema4->rw_read_waiters), 1,
+                            __ATOMIC_SEQ_CST );
+}
+
+/*****************************************************************************
+** rw_read_take - takes a reader-writer semaphore for reading.
+*****************************************************************************/
+static STATUS
+   rw_read_take( v2pt_sema4_t *semaphore, v2pt_sema4_id_t semid,
+                 int max_wait, const struct timespec *deadline )
+{
+    v2pthread_cb_t *our_tcb;
+    v2pt_sema4_pend_t pend;
+    v2pt_rw_hold_t *hold;
+    struct timespec timeout;
+    unsigned int slot;
+    long long since;
+    int retcode;
+    STATUS error;
+
+    error = OK;
+
+    /*
+    **  A reader already in only counts up, whatever writers are waiting,
+    **  and so does the writer.
+    */
+    hold = rw_hold_for( semid );
+    if ( hold != (v2pt_rw_hold_t *)NULL )
+    {
+        hold->count++;
+        return( error );
+    }
+    our_tcb = my_tcb();
+    if ( (our_tcb != (v2pthread_cb_t *)NULL) &&
+         (semaphore->current_owner == our_tcb) )
+    {
+        semaphore->recursion_level++;
+        return( error );
+    }
+
+    hold = rw_free_hold();
+    if ( hold == (v2pt_rw_hold_t *)NULL )
+        return( S_semLib_INVALID_OPERATION );  /* Too many held for reading */
+
+    slot = rw_reader_slot();
+    if ( !rw_try_enter( semaphore, slot ) )
+    {
+        /*
+        **  A writer owns the semaphore or is waiting for it, or max_readers
+        **  readers are in... wait for the gate to open and for room under
+        **  sema4_lock.  Writers close the gate only under the same lock, so
+        **  once we see it open and are admitted we are in.  Readers leaving
+        **  see us counted in rw_read_waiters before we look for room.
+        */
+        if ( max_wait == NO_WAIT )
+            return( S_objLib_OBJ_UNAVAILABLE );
+        if ( max_wait != WAIT_FOREVER )
+            deadline = sema4_deadline( max_wait, deadline, &timeout );
+        since = stats_since();
+
+        retcode = 0;
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&(semaphore->sema4_lock));
+        if ( sema4_valid( semaphore, semid ) )
+        {
+            __atomic_add_fetch( &(semaphore->rw_read_waiters), 1,
+                                __ATOMIC_SEQ_CST );
+            pend.sema4 = semaphore;
+            pend.tcb = our_tcb;
+            pend.semid = semid;
+            pthread_cleanup_push( rw_read_abandon, (void *)&pend );
+            for ( ;; )
+            {
+                if ( semaphore->sema4_id != semid )
+                {
+                    error = S_objLib_OBJ_ID_ERROR;   /* Semaphore deleted */
+                    break;
+                }
+                if ( (semaphore->rw_gate == 0) && rw_admit( semaphore ) )
+                {
+                    __atomic_add_fetch( &(semaphore->rw_counts[slot].readers),
+                                        1, __ATOMIC_SEQ_CST );
+                    break;
+                }
+                if ( retcode == ETIMEDOUT )
+                {
+                    error = S_objLib_OBJ_TIMEOUT;
+                    break;
+                }
+                if ( max_wait == WAIT_FOREVER )
+                    pthread_cond_wait( &(semaphore->rw_read_cond),
+                                       &(semaphore->sema4_lock) );
+                else
+                    retcode = pthread_cond_timedwait(
+                                  &(semaphore->rw_read_cond),
+                                  &(semaphore->sema4_lock), deadline );
+            }
+            pthread_cleanup_pop( 0 );
+
+            /*
+            **  Stop counting as a waiting reader (unless the semaphore has
+            **  been deleted, and the control block perhaps reused).
+            */
+            if ( error != S_objLib_OBJ_ID_ERROR )
+                __atomic_sub_fetch( &(semaphore->rw_read_waiters), 1,
+                                    __ATOMIC_SEQ_CST );
+            pthread_mutex_unlock( &(semaphore->sema4_lock) );
+        }
+        else
+        {
+            error = S_objLib_OBJ_ID_ERROR;
+        }
+        pthread_cleanup_pop( 0 );
+        count_wait( semaphore, since, error );
+    }
+
+    if ( error == OK )
+    {
+        hold->sema4 = semaphore;
+        hold->semid = semid;
+        hold->slot = slot;
+        hold->count = 1;
+    }
+    return( error );
+}
+
+/*****************************************************************************
+** rw_write_abandon - cleanup handler for a task killed while waiting in
+**                    rw_write_take.  Runs with sema4_lock held.
+*****************************************************************************/
+static void
+   rw_write_abandon( void *arg )
+{
+    v2pt_sema4_pend_t *pend;
+
+    pend = (v2pt_sema4_pend_t *)arg;
+    if ( pend->sema4->sema4_id == pend->semid )
+    {
+        pend->sema4->rw_writers--;
+        rw_open_gate( pend->sema4 );
+    }
+}
+
+/*****************************************************************************
+** rw_write_take - takes a reader-writer semaphore for writing.
+*****************************************************************************/
+static STATUS
+   rw_write_take( v2pt_sema4_t *semaphore, v2pt_sema4_id_t semid,
+                  int max_wait, const struct timespec *deadline )
+{
+    v2pthread_cb_t *our_tcb;
+    v2pt_sema4_pend_t pend;
+    struct timespec timeout;
+    long long since;
+    int retcode;
+    STATUS error;
+
+    error = OK;
+    since = 0;
+
+    /*
+    **  Only the owner ever finds itself in current_owner, so a recursive
+    **  take needs no lock.  A reader may not also become the writer; it
+    **  would wait for itself to leave.
+    */
+    our_tcb = my_tcb();
+    if ( (our_tcb != (v2pthread_cb_t *)NULL) &&
+         (semaphore->current_owner == our_tcb) )
+    {
+        semaphore->recursion_level++;
+        return( error );
+    }
+    if ( rw_hold_for( semid ) != (v2pt_rw_hold_t *)NULL )
+        return( S_semLib_INVALID_OPERATION );
+
+    if ( (max_wait != NO_WAIT) && (max_wait != WAIT_FOREVER) )
+        deadline = sema4_deadline( max_wait, deadline, &timeout );
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock));
+    if ( sema4_valid( semaphore, semid ) )
+    {
+        semaphore->rw_writers++;
+        pend.sema4 = semaphore;
+        pend.tcb = our_tcb;
+        pend.semid = semid;
+        pthread_cleanup_push( rw_write_abandon, (void *)&pend );
+
+        retcode = 0;
+        for ( ;; )
+        {
+            if ( semaphore->sema4_id != semid )
+            {
+                error = S_objLib_OBJ_ID_ERROR;   /* Semaphore deleted */
+                break;
+            }
+            if ( semaphore->current_owner == (v2pthread_cb_t *)NULL )
+            {
+                /*
+                **  Close the gate, then see whether the readers are gone.
+                */
+                __atomic_store_n( &(semaphore->rw_gate), 1,
+                                  __ATOMIC_SEQ_CST );
+                if ( rw_readers( semaphore ) == 0 )
+                {
+                    semaphore->current_owner = our_tcb;
+                    semaphore->recursion_level = 1;
+                    break;
+                }
+                if ( semaphore->flags & SEM_RW_READER_PRIORITY )
+                {
+                    __atomic_store_n( &(semaphore->rw_gate), 0,
+                                      __ATOMIC_SEQ_CST );
+                    pthread_cond_broadcast( &(semaphore->rw_read_cond) );
+                }
+            }
+            if ( max_wait == NO_WAIT )
+            {
+                error = S_objLib_OBJ_UNAVAILABLE;
+                break;
+            }
+            if ( retcode == ETIMEDOUT )
+            {
+                error = S_objLib_OBJ_TIMEOUT;
+                break;
+            }
+            if ( since == 0 )
+            {
+                since = stats_since();
+                count_waiters( semaphore, semaphore->rw_writers );
+            }
+            if ( max_wait == WAIT_FOREVER )
+                pthread_cond_wait( &(semaphore->rw_write_cond),
+                                   &(semaphore->sema4_lock) );
+            else
+                retcode = pthread_cond_timedwait( &(semaphore->rw_write_cond),
+                                                  &(semaphore->sema4_lock),
+                                                  deadline );
+        }
+
+        /*
+        **  Stop counting as a waiting writer (unless the semaphore has been
+        **  deleted, and the control block perhaps reused).  A writer which
+        **  gives up lets the readers back in if no other writer waits.
+        */
+        pthread_cleanup_pop( 0 );
+        if ( error != S_objLib_OBJ_ID_ERROR )
+        {
+            semaphore->rw_writers--;
+            if ( error != OK )
+                rw_open_gate( semaphore );
+        }
+        count_wait( semaphore, since, error );
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+    }
+    else
+    {
+        error = S_objLib_OBJ_ID_ERROR;
+    }
+    pthread_cleanup_pop( 0 );
+
+    return( error );
+}
+
+/*****************************************************************************
+** rw_give - releases a reader-writer semaphore held by the calling task,
+**           for writing or for reading.
+*****************************************************************************/
+static STATUS
+   rw_give( v2pt_sema4_t *semaphore, v2pt_sema4_id_t semid )
+{
+    v2pthread_cb_t *our_tcb;
+    v2pt_rw_hold_t *hold;
+
+    our_tcb = my_tcb();
+    if ( (our_tcb != (v2pthread_cb_t *)NULL) &&
+         (semaphore->current_owner == our_tcb) )
+    {
+        if ( (--(semaphore->recursion_level)) > 0 )
+            return( OK );
+
+        /*
+        **  Hand over to a waiting writer, or let the readers in.
+        */
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&(semaphore->sema4_lock) );
+        pthread_mutex_lock( &(semaphore->sema4_lock) );
+        semaphore->current_owner = (v2pthread_cb_t *)NULL;
+        rw_open_gate( semaphore );
+        sema4_ready( semaphore );
+        pthread_cleanup_pop( 1 );
+        return( OK );
+    }
+
+    hold = rw_hold_for( semid );
+    if ( hold == (v2pt_rw_hold_t *)NULL )
+        return( S_semLib_INVALID_OPERATION );  /* Not held by caller */
+
+    if ( (--(hold->count)) == 0 )
+        rw_leave( semaphore, hold->slot );
+    return( OK );
+}
+
+/*****************************************************************************
+** Rate-limiter semaphores
+**
+** A RATE_SEMA4 semaphore (semRateCreate) is a token bucket: tokens accrue
+** at a fixed rate up to the burst size, and no task ever gives one.  No
+** timer refills the bucket.  It is kept as rate_tat, the theoretical
+** arrival time of the token after those already taken, and the next token
+** is due rate_burst_ns before that.  A take which finds a token due moves
+** rate_tat one interval on, from itself or from now if the bucket has
+** been full for a while, with one compare-and-swap; the tokens are thus
+** counted lazily by whichever task next takes one.  While no task waits,
+** takes do not take sema4_lock.  A task which must wait pends in the
+** usual order, but only the task at the head of the pend list sleeps
+** until the next token is due; the others sleep until their timeouts.
+** Each task leaving the list wakes the one then at its head to take over.
+*****************************************************************************/
+
+/*****************************************************************************
+** rate_due - returns the time (in ns on the monotonic clock) at which the
+**            next token from a rate-limiter semaphore is due.
+*****************************************************************************/
+static long long
+   rate_due( v2pt_sema4_t *sema4 )
+{
+    return( __atomic_load_n( &(sema4->rate_tat), __ATOMIC_ACQUIRE ) -
+            sema4->rate_burst_ns );
+}
+
+/*****************************************************************************
+** rate_claim - atomically takes one token from a rate-limiter semaphore if
+**              one is due at time now.  Returns TRUE if a token was taken.
+*****************************************************************************/
+static int
+   rate_claim( v2pt_sema4_t *sema4, long long now )
+{
+    long long tat;
+    long long next;
+
+    tat = __atomic_load_n( &(sema4->rate_tat), __ATOMIC_RELAXED );
+    while ( (tat - sema4->rate_burst_ns) <= now )
+    {
+        next = ((tat > now) ? tat : now) + sema4->rate_interval;
+        if ( __atomic_compare_exchange_n( &(sema4->rate_tat), &tat, next, 1,
+                                          __ATOMIC_ACQUIRE,
+                                          __ATOMIC_RELAXED ) )
+            return( TRUE );
+    }
+    return( FALSE );
+}
+
+/*****************************************************************************
+** rate_tokens - returns the number of tokens a rate-limiter semaphore holds
+**               now.
+*****************************************************************************/
+static int
+   rate_tokens( v2pt_sema4_t *sema4 )
+{
+    long long elapsed;
+    long long burst;
+
+    elapsed = stats_clock() - rate_due( sema4 );
+    if ( elapsed < 0 )
+        return( 0 );
+    burst = (sema4->rate_burst_ns / sema4->rate_interval) + 1;
+    if ( (elapsed / sema4->rate_interval) + 1 >= burst )
+        return( (int)burst );
+    return( (int)(elapsed / sema4->rate_interval) + 1 );
+}
+
+/*****************************************************************************
+** rate_pass_on - wakes the task now at the head of a rate-limiter
+**                semaphore's pend list, so that it waits for the next
+**                token in place of the task which has just left the list.
+**                The caller must hold sema4_lock.
+*****************************************************************************/
+static void
+   rate_pass_on( v2pt_sema4_t *sema4 )
+{
+    if ( sema4->pend_list.head != (v2pthread_cb_t *)NULL )
+        pthread_cond_signal( &(sema4->pend_list.head->pend_wake) );
+}
+
+/*****************************************************************************
+** rate_abandon - cleanup handler for a task killed while in rate_take.
+**                Runs with sema4_lock held.
+*****************************************************************************/
+static void
+   rate_abandon( void *arg )
+{
+    v2pt_sema4_pend_t *pend;
+    v2pt_sema4_t *sema4;
+
+    pend = (v2pt_sema4_pend_t *)arg;
+    sema4 = pend->sema4;
+    if ( !pend->tcb->pend_release )
+    {
+        unlink_susp_tcb( &(sema4->pend_list), pend->tcb );
+        pend->tcb->suspend_list = (v2pt_pend_list_t *)NULL;
+        __atomic_sub_fetch( &(sema4->waiters), 1, __ATOMIC_SEQ_CST );
+        rate_pass_on( sema4 );
+    }
+}
+
+/*****************************************************************************
+** rate_take - takes a token from a rate-limiter semaphore, blocking the
+**             calling task until the next token is due if none is due now,
+**             for up to max_wait ticks or until deadline if one is given.
+*****************************************************************************/
+static STATUS
+   rate_take( v2pt_sema4_t *semaphore, v2pt_sema4_id_t semid, int max_wait,
+              const struct timespec *deadline )
+{
+    struct timespec timeout;
+    struct timespec due_time;
+    const struct timespec *wake;
+    v2pt_sema4_pend_t pend;
+    v2pthread_cb_t *our_tcb;
+    long long since;
+    long long due;
+    int granted;
+    STATUS error;
+
+    /*
+    **  While no task waits, a token which is due is taken without locking.
+    */
+    if ( (__atomic_load_n( &(semaphore->waiters), __ATOMIC_SEQ_CST ) == 0) &&
+         rate_claim( semaphore, stats_clock() ) )
+        return( OK );
+
+    error = OK;
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock) );
+    if ( !sema4_valid( semaphore, semid ) )
+    {
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    }
+    else if ( (__atomic_load_n( &(semaphore->waiters),
+                                __ATOMIC_SEQ_CST ) == 0) &&
+              rate_claim( semaphore, stats_clock() ) )
+    {
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+    }
+    else if ( max_wait == NO_WAIT )
+    {
+        error = S_objLib_OBJ_UNAVAILABLE;
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+    }
+    else
+    {
+        if ( max_wait != WAIT_FOREVER )
+            deadline = sema4_deadline( max_wait, deadline, &timeout );
+
+        /*
+        **  Join the pend list behind any tasks already waiting.
+        */
+        our_tcb = my_tcb();
+        pend.sema4 = semaphore;
+        pend.tcb = our_tcb;
+        pend.semid = semid;
+        count_waiters( semaphore,
+                       __atomic_add_fetch( &(semaphore->waiters), 1,
+                                           __ATOMIC_SEQ_CST ) );
+        pthread_cleanup_push( rate_abandon, (void *)&pend );
+        our_tcb->pend_release = SEND;
+        if ( semaphore->flags & SEM_Q_PRIORITY )
+            link_prio_susp_tcb( &(semaphore->pend_list),
+                                semaphore->pend_index, our_tcb );
+        else
+            link_susp_tcb( &(semaphore->pend_list), our_tcb );
+        since = stats_since();
+
+        /*
+        **  At the head of the list, sleep until the next token is due (or
+        **  the timeout, if sooner); elsewhere, until the timeout or until
+        **  woken to take over at the head.
+        */
+        granted = FALSE;
+        while ( !our_tcb->pend_release )
+        {
+            wake = deadline;
+            if ( semaphore->pend_list.head == our_tcb )
+            {
+                if ( rate_claim( semaphore, stats_clock() ) )
+                {
+                    granted = TRUE;
+                    break;
+                }
+                due = rate_due( semaphore );
+                due_time.tv_sec = (time_t)(due / 1000000000LL);
+                due_time.tv_nsec = (long)(due % 1000000000LL);
+                if ( (deadline == (const struct timespec *)NULL) ||
+                     (due_time.tv_sec < deadline->tv_sec) ||
+                     ((due_time.tv_sec == deadline->tv_sec) &&
+                      (due_time.tv_nsec < deadline->tv_nsec)) )
+                    wake = &due_time;
+            }
+            if ( (deadline != (const struct timespec *)NULL) &&
+                 deadline_passed( deadline ) )
+                break;
+
+            if ( wake == (const struct timespec *)NULL )
+                pthread_cond_wait( &(our_tcb->pend_wake),
+                                   &(semaphore->sema4_lock) );
+            else
+                pthread_cond_timedwait( &(our_tcb->pend_wake),
+                                        &(semaphore->sema4_lock), wake );
+        }
+
+        /*
+        **  Unless semDelete already took us off the list, leave it and
+        **  hand the wait for the next token to the new head.
+        */
+        if ( !our_tcb->pend_release )
+        {
+            unlink_susp_tcb( &(semaphore->pend_list), our_tcb );
+            __atomic_sub_fetch( &(semaphore->waiters), 1, __ATOMIC_SEQ_CST );
+            rate_pass_on( semaphore );
+        }
+        our_tcb->suspend_list = (v2pt_pend_list_t *)NULL;
+        pthread_cleanup_pop( 0 );
+
+        if ( our_tcb->pend_release == KILLD )
+            error = S_objLib_OBJ_ID_ERROR;       /* Semaphore deleted */
+        else if ( !granted )
+            error = S_objLib_OBJ_TIMEOUT;
+        count_wait( semaphore, since, error );
+
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+    }
+    pthread_cleanup_pop( 0 );
+
+    return( error );
+}
+
+/*****************************************************************************
+** release_waiters - releases every task pended on the semaphore without a
+**                   token, stamping each with the reason (FLUSH or KILLD).
+**                   The released tasks learn the reason from their own tcbs
+**                   when they run, and do not touch the semaphore again, so
+**                   the caller need not wait for them.  The caller must
+**                   hold sema4_lock.
+*****************************************************************************/
+static void
+   release_waiters( v2pt_sema4_t *sema4, int release )
+{
+    int count;
+
+    count = release_susp_tcbs( &(sema4->pend_list), release );
+    __atomic_sub_fetch( &(sema4->waiters), count, __ATOMIC_SEQ_CST );
+#ifdef DIAG_PRINTFS 
+    printf( "\r\nsemaphore list @ %p released %d tasks",
+            &(sema4->pend_list), count );
+#endif
+}
+
+/*****************************************************************************
+** new_sema4 - creates a new v2pthread semaphore using pthreads resources
+**             A semaphore whose waiters pend in priority order also gets a
+**             priority index for its waiting task list.  The control block
+**             comes from the semaphore ID table (see alloc_sema4), unless
+**             the caller provides storage for it (see bind_static_sema4).
+*****************************************************************************/
+v2pt_sema4_t *
+    new_sema4( char *storage, int count, int opt )
+{
+    v2pt_sema4_t *semaphore;
+
+    /*
+    **  First claim a semaphore control block
+    */
+    if ( storage == (char *)NULL )
+        semaphore = alloc_sema4();
+    else
+        semaphore = bind_static_sema4( storage, opt );
+    if ( semaphore != (v2pt_sema4_t *)NULL )
+    {
+        /*
+        **  Ok... got a control block.
+        **  Initialize the token count.
+        */
+        semaphore->token_count = count;
+        semaphore->waiters = 0;
+
+        /*
+        ** The priority-inheritance mutex of an inversion-safe mutex was
+        ** initialized with the control block, but may need starting afresh.
+        ** (semMCeilingCreate prepares that of a ceiling mutex itself.)
+        */
+        if ( opt & SEM_INVERSION_SAFE )
+            prepare_pi_lock( semaphore, -1 );
+
+        /*
+        ** Type of send operation last performed on semaphore
+        */
+        semaphore->send_type = SEND;
+
+        /*
+        **  Ownership nesting level for mutual exclusion semaphore.
+        */
+        semaphore->recursion_level = 0;
+
+        /*
+        ** Task control block ptr for task which currently owns semaphore
+        */
+        semaphore->current_owner = (v2pthread_cb_t *)NULL;
+
+        /*
+        ** List of tasks waiting on semaphore
+        */
+        semaphore->pend_list.head = (v2pthread_cb_t *)NULL;
+        semaphore->pend_list.tail = (v2pthread_cb_t *)NULL;
+
+        /*
+        ** SEM_ADAPTIVE mutex counters
+        */
+        semaphore->spin_acquired = 0;
+        semaphore->spin_blocked = 0;
+        semaphore->owner_running = FALSE;
+
+        /*
+        ** Statistics start afresh with each semaphore
+        */
+        memset( &(semaphore->stats), 0, sizeof( v2pt_sema4_stats_t ) );
+
+        /*
+        ** No task watches the new semaphore or is registered for its
+        ** events yet
+        */
+        semaphore->first_watch = (v2pt_watch_t *)NULL;
+        semaphore->watchers = 0;
+        semaphore->ev_reg.taskid = 0;
+
+        /*
+        ** Priority index for the waiting task list.  One left by an earlier
+        ** semaphore is empty, since no task remains pended on it.
+        */
+        if ( (opt & SEM_Q_PRIORITY) &&
+             (semaphore->pend_index == (v2pt_prio_index_t *)NULL) )
+        {
+            semaphore->pend_index =
+                (v2pt_prio_index_t *)ts_malloc( sizeof( v2pt_prio_index_t ) );
+            if ( semaphore->pend_index == (v2pt_prio_index_t *)NULL )
+            {
+                free_sema4( semaphore );
+                return( (v2pt_sema4_t *)NULL );
+            }
+            memset( semaphore->pend_index, 0, sizeof( v2pt_prio_index_t ) );
+        }
+    }
+
+    return( semaphore );
+}
+
+/*****************************************************************************
+** new_bsema4 - creates a v2pthread binary semaphore, in caller storage if
+**              any is provided
+*****************************************************************************/
+static v2pt_sema4_id_t
+    new_bsema4( char *storage, int opt, int initial_state )
+{
+    v2pt_sema4_t *semaphore;
+    v2pt_sema4_id_t semid;
+
+    semid = (v2pt_sema4_id_t)NULL;
+
+    if ( (opt & SEM_DELETE_SAFE)
+	||(opt & SEM_INVERSION_SAFE)
+	||(opt & SEM_ADAPTIVE) )
+    {
+    	errno = ENOSYS;
+		return( NULL );
+    }
+
+    /*
+    **  First allocate memory for the semaphore control block
+    */
+    if ( initial_state == 0 )
+        semaphore = new_sema4( storage, 0, opt );
+    else
+        semaphore = new_sema4( storage, 1, opt );
+
+    if ( semaphore != (v2pt_sema4_t *)NULL )
+    {
+        /*
+        **  Ok... got a control block.  Initialize it.
+        */
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nCreating binary semaphore - id %p", semaphore );
+#endif
+
+        /*
+        ** Option and Type Flags for semaphore
+        */
+        semaphore->flags = (opt & SEM_Q_PRIORITY) | BINARY_SEMA4;
+
+        /*
+        **  Put the new semaphore into service.
+        */
+        semid = issue_sema4_id( semaphore );
+    }
+
+    return( semid );
+}
+
+/*****************************************************************************
+** new_csema4 - creates a v2pthread counting semaphore, in caller storage if
+**              any is provided
+*****************************************************************************/
+static v2pt_sema4_id_t
+    new_csema4( char *storage, int opt, int initial_count )
+{
+    v2pt_sema4_t *semaphore;
+    v2pt_sema4_id_t semid;
+
+    semid = (v2pt_sema4_id_t)NULL;
+
+    if ( (opt & SEM_DELETE_SAFE)
+	||(opt & SEM_INVERSION_SAFE)
+	||(opt & SEM_ADAPTIVE) )
+    {
+    	errno = ENOSYS;
+		return( NULL );
+    }
+
+    /*
+    **  First allocate memory for the semaphore control block
+    */
+    semaphore = new_sema4( storage, initial_count, opt );
+
+    if ( semaphore != (v2pt_sema4_t *)NULL )
+    {
+        /*
+        **  Ok... got a control block.  Initialize it.
+        */
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nCreating counting semaphore - id %p", semaphore );
+#endif
+
+        /*
+        ** Option and Type Flags for semaphore
+        */
+        semaphore->flags = (opt & SEM_Q_PRIORITY) | COUNTING_SEMA4;
+
+        /*
+        **  Put the new semaphore into service.
+        */
+        semid = issue_sema4_id( semaphore );
+    }
+
+    return( semid );
+}
+
+/*****************************************************************************
+** new_msema4 - creates a v2pthread mutual exclusion semaphore, in caller
+**              storage if any is provided
+*****************************************************************************/
+static v2pt_sema4_id_t
+    new_msema4( char *storage, int opt )
+{
+    v2pt_sema4_t *semaphore;
+    v2pt_sema4_id_t semid;
+
+    semid = (v2pt_sema4_id_t)NULL;
+
+    /*
+    **  A ceiling mutex needs its ceiling (see semMCeilingCreate).
+    */
+    if ( opt & SEM_PRIO_CEILING )
+    {
+        errno = ENOSYS;
+        return( NULL );
+    }
+
+    /*
+    **  First allocate memory for the semaphore control block
+    */
+    semaphore = new_sema4( storage, 1, opt );
+
+    if ( semaphore != (v2pt_sema4_t *)NULL )
+    {
+        /*
+        **  Ok... got a control block.  Initialize it.
+        */
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nCreating mutex semaphore - id %p", semaphore );
+#endif
+
+        /*
+        ** Option and Type Flags for semaphore
+        */
+        semaphore->flags = (opt & SEM_OPT_MASK) | MUTEX_SEMA4;
+
+        /*
+        **  Put the new semaphore into service.
+        */
+        semid = issue_sema4_id( semaphore );
+    }
+
+    return( semid );
+}
+
+/*****************************************************************************
+** bind_named_sema4 - gives a named semaphore just opened by this process (see
+**                    semOpen) a local control block, which stands for it
+**                    in semTake and semGive, and returns its ID.
+*****************************************************************************/
+v2pt_sema4_id_t
+    bind_named_sema4( void *named, int opt )
+{
+    v2pt_sema4_t *semaphore;
+    v2pt_sema4_id_t semid;
+
+    semid = (v2pt_sema4_id_t)NULL;
+
+    semaphore = new_sema4( (char *)NULL, 0, 0 );
+    if ( semaphore != (v2pt_sema4_t *)NULL )
+    {
+        /*
+        ** Option and Type Flags for semaphore.  The named semaphore keeps
+        ** its own options; those here only show in semInfoGet.
+        */
+        semaphore->flags = (opt & SEM_Q_PRIORITY) | NAMED_SEMA4;
+        semaphore->named = named;
+
+        /*
+        **  Put the new semaphore into service.
+        */
+        semid = issue_sema4_id( semaphore );
+    }
+
+    return( semid );
+}
+
+/*****************************************************************************
+** named_sema4_for - returns the named semaphore for which the specified ID
+**                   stands, or NULL (with errno set) if it is not the ID of
+**                   a named semaphore in service.
+*****************************************************************************/
+void *
+   named_sema4_for( v2pt_sema4_id_t semid )
+{
+    v2pt_sema4_t *semaphore;
+    void *named;
+
+    named = NULL;
+    semaphore = sema4_for( semid );
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock));
+    if ( sema4_valid( semaphore, semid ) )
+    {
+        if ( (semaphore->flags & SEM_TYPE_MASK) == NAMED_SEMA4 )
+            named = semaphore->named;
+        else
+            errno = S_semLib_INVALID_OPERATION;  /* Not a named semaphore */
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+    }
+    else
+    {
+        errno = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    }
+    pthread_cleanup_pop( 0 );
+    sema4_done();
+
+    return( named );
+}
+
+/*****************************************************************************
+** release_named_sema4 - takes the local control block of a named semaphore
+**                       out of service when this process closes it for the
+**                       last time, and returns the block to its slot.
+*****************************************************************************/
+void
+   release_named_sema4( v2pt_sema4_id_t semid )
+{
+    v2pt_sema4_t *semaphore;
+
+    semaphore = sema4_for( semid );
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock));
+    if ( sema4_valid( semaphore, semid ) )
+    {
+        __atomic_store_n( &(semaphore->sema4_id), NULL, __ATOMIC_RELEASE );
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+        sema4_done();
+        free_sema4( semaphore );
+    }
+    pthread_cleanup_pop( 0 );
+    sema4_done();
+}
+
+/*****************************************************************************
+** semBCreate - creates a v2pthread binary semaphore
+*****************************************************************************/
+v2pt_sema4_id_t
+    semBCreate( int opt, int initial_state )
+{
+    return( new_bsema4( (char *)NULL, opt, initial_state ) );
+}
+
+/*****************************************************************************
+** semBInitialize - creates a v2pthread binary semaphore in the storage
+**                  provided by the caller, allocating nothing
+*****************************************************************************/
+v2pt_sema4_id_t
+    semBInitialize( char *storage, int opt, int initial_state )
+{
+    if ( storage == (char *)NULL )
+    {
+        errno = EINVAL;
+        return( NULL );
+    }
+    return( new_bsema4( storage, opt, initial_state ) );
+}
+
+/*****************************************************************************
+** semCCreate - creates a v2pthread counting semaphore
+*****************************************************************************/
+v2pt_sema4_id_t
+    semCCreate( int opt, int initial_count )
+{
+    return( new_csema4( (char *)NULL, opt, initial_count ) );
+}
+
+/*****************************************************************************
+** semCInitialize - creates a v2pthread counting semaphore in the storage
+**                  provided by the caller, allocating nothing
+*****************************************************************************/
+v2pt_sema4_id_t
+    semCInitialize( char *storage, int opt, int initial_count )
+{
+    if ( storage == (char *)NULL )
+    {
+        errno = EINVAL;
+        return( NULL );
+    }
+    return( new_csema4( storage, opt, initial_count ) );
+}
+
+/*****************************************************************************
+** semMCreate - creates a v2pthread mutual exclusion semaphore
+*****************************************************************************/
+v2pt_sema4_id_t
+    semMCreate( int opt )
+{
+    return( new_msema4( (char *)NULL, opt ) );
+}
+
+/*****************************************************************************
+** semMInitialize - creates a v2pthread mutual exclusion semaphore in the
+**                  storage provided by the caller, allocating nothing
+*****************************************************************************/
+v2pt_sema4_id_t
+    semMInitialize( char *storage, int opt )
+{
+    if ( storage == (char *)NULL )
+    {
+        errno = EINVAL;
+        return( NULL );
+    }
+    return( new_msema4( storage, opt ) );
+}
+
+/*****************************************************************************
+** semMCeilingCreate - creates a v2pthread mutual exclusion semaphore which
+**                     runs its owner at (at least) the ceiling priority.
+*****************************************************************************/
+v2pt_sema4_id_t
+    semMCeilingCreate( int opt, int ceiling )
+{
+    v2pt_sema4_t *semaphore;
+    v2pt_sema4_id_t semid;
+
+    semid = (v2pt_sema4_id_t)NULL;
+
+    /*
+    **  A ceiling mutex does not also inherit priority, and needs real-time
+    **  task priorities to raise its owner to.
+    */
+    if ( (opt & SEM_INVERSION_SAFE) || unprivilegedModeIsEnabled() )
+    {
+        errno = ENOSYS;
+        return( NULL );
+    }
+    if ( (ceiling < MAX_V2PT_PRIORITY) || (ceiling > MIN_V2PT_PRIORITY) )
+    {
+        errno = S_taskLib_ILLEGAL_PRIORITY;
+        return( NULL );
+    }
+
+    /*
+    **  First allocate memory for the semaphore control block
+    */
+    semaphore = new_sema4( (char *)NULL, 1, opt );
+
+    if ( semaphore != (v2pt_sema4_t *)NULL )
+    {
+        /*
+        **  Ok... got a control block.  Initialize it.
+        */
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nCreating ceiling mutex semaphore - id %p", semaphore );
+#endif
+
+        /*
+        **  The ceiling is held by pi_lock, in pthreads terms.
+        */
+        prepare_pi_lock( semaphore, task_sched_priority( ceiling ) );
+
+        /*
+        ** Option and Type Flags for semaphore
+        */
+        semaphore->flags = (opt & SEM_OPT_MASK) | SEM_PRIO_CEILING |
+                           MUTEX_SEMA4;
+
+        /*
+        **  Put the new semaphore into service.
+        */
+        semid = issue_sema4_id( semaphore );
+    }
+
+    return( semid );
+}
+
+/*****************************************************************************
+** semRWCreate - creates a v2pthread reader-writer semaphore which up to
+**               max_readers tasks may hold for reading at once.
+*****************************************************************************/
+v2pt_sema4_id_t
+    semRWCreate( int opt, int max_readers )
+{
+    v2pt_sema4_t *semaphore;
+    v2pt_sema4_id_t semid;
+
+    semid = (v2pt_sema4_id_t)NULL;
+
+    if ( (opt & SEM_DELETE_SAFE)
+	||(opt & SEM_INVERSION_SAFE)
+	||(opt & SEM_ADAPTIVE) )
+    {
+    	errno = ENOSYS;
 		return( NULL );
     }
 
+    if ( max_readers < 1 )
+    {
+        errno = EINVAL;
+        return( NULL );
+    }
+
+    /*
+    **  First allocate memory for the semaphore control block
+    */
+    semaphore = new_sema4( (char *)NULL, 0, opt );
+
+    if ( semaphore != (v2pt_sema4_t *)NULL )
+    {
+        /*
+        **  Ok... got a control block.  Initialize it.
+        */
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nCreating reader-writer semaphore - id %p", semaphore );
+#endif
+
+        /*
+        **  Reader counts.  Those left by an earlier semaphore are kept
+        **  with the control block, but cleared.
+        */
+        if ( semaphore->rw_counts == (v2pt_rw_count_t *)NULL )
+        {
+            semaphore->rw_counts =
+                (v2pt_rw_count_t *)ts_malloc( V2LIN_RW_READER_SLOTS *
+                                              sizeof( v2pt_rw_count_t ) );
+            if ( semaphore->rw_counts == (v2pt_rw_count_t *)NULL )
+            {
+                free_sema4( semaphore );
+                errno = S_memLib_NOT_ENOUGH_MEMORY;
+                return( NULL );
+            }
+        }
+        memset( semaphore->rw_counts, 0,
+                V2LIN_RW_READER_SLOTS * sizeof( v2pt_rw_count_t ) );
+        semaphore->rw_gate = 0;
+        semaphore->rw_writers = 0;
+        semaphore->rw_max_readers = max_readers;
+        semaphore->rw_admitted = 0;
+        semaphore->rw_read_waiters = 0;
+
+        /*
+        ** Option and Type Flags for semaphore
+        */
+        semaphore->flags = (opt & (SEM_Q_PRIORITY | SEM_RW_READER_PRIORITY)) |
+                           RW_SEMA4;
+
+        /*
+        **  Put the new semaphore into service.
+        */
+        semid = issue_sema4_id( semaphore );
+    }
+
+    return( semid );
+}
+
+/*****************************************************************************
+** semRateCreate - creates a v2pthread rate-limiter semaphore, from which
+**                 tasks may take rate tokens per second on average, and up
+**                 to burst tokens at once.  It starts with burst tokens.
+*****************************************************************************/
+v2pt_sema4_id_t
+    semRateCreate( int opt, int rate, int burst )
+{
+    v2pt_sema4_t *semaphore;
+    v2pt_sema4_id_t semid;
+
+    semid = (v2pt_sema4_id_t)NULL;
+
+    if ( opt & (SEM_DELETE_SAFE | SEM_INVERSION_SAFE | SEM_ADAPTIVE |
+                SEM_PRIO_CEILING) )
+    {
+        errno = ENOSYS;
+        return( NULL );
+    }
+    if ( (rate < 1) || (rate > 1000000000) || (burst < 1) )
+    {
+        errno = EINVAL;
+        return( NULL );
+    }
+
+    /*
+    **  First allocate memory for the semaphore control block
+    */
+    semaphore = new_sema4( (char *)NULL, 0, opt );
+
+    if ( semaphore != (v2pt_sema4_t *)NULL )
+    {
+        /*
+        **  Ok... got a control block.  Initialize it.
+        */
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nCreating rate-limiter semaphore - id %p", semaphore );
+#endif
+
+        /*
+        **  The bucket starts full: burst tokens are due now.
+        */
+        semaphore->rate_interval = 1000000000LL / rate;
+        semaphore->rate_burst_ns = (long long)(burst - 1) *
+                                   semaphore->rate_interval;
+        semaphore->rate_tat = stats_clock();
+
+        /*
+        ** Option and Type Flags for semaphore
+        */
+        semaphore->flags = (opt & SEM_Q_PRIORITY) | RATE_SEMA4;
+
+        /*
+        **  Put the new semaphore into service.
+        */
+        semid = issue_sema4_id( semaphore );
+    }
+
+    return( semid );
+}
+
+/*****************************************************************************
+** semRTake - takes a reader-writer semaphore for reading, blocking the
+**            calling task while a writer owns it (or, unless readers have
+**            priority, waits for it).
+*****************************************************************************/
+STATUS
+   semRTake( v2pt_sema4_id_t semid, int max_wait )
+{
+    v2pt_sema4_t *semaphore;
+    STATUS error;
+
+    semaphore = sema4_for( semid );
+    if ( !sema4_in_service( semaphore, semid ) )
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    else if ( (semaphore->flags & SEM_TYPE_MASK) != RW_SEMA4 )
+        error = S_semLib_INVALID_OPERATION;  /* Not a reader-writer sema4 */
+    else
+        error = rw_read_take( semaphore, semid, max_wait,
+                              (const struct timespec *)NULL );
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+    else
+        count_takes( semaphore, 1 );
+    sema4_done();
+
+    return( error );
+}
+
+/*****************************************************************************
+** semWTake - takes a reader-writer semaphore for writing, blocking the
+**            calling task until no reader or other writer holds it.
+*****************************************************************************/
+STATUS
+   semWTake( v2pt_sema4_id_t semid, int max_wait )
+{
+    v2pt_sema4_t *semaphore;
+    STATUS error;
+
+    semaphore = sema4_for( semid );
+    if ( !sema4_in_service( semaphore, semid ) )
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    else if ( (semaphore->flags & SEM_TYPE_MASK) != RW_SEMA4 )
+        error = S_semLib_INVALID_OPERATION;  /* Not a reader-writer sema4 */
+    else
+        error = rw_write_take( semaphore, semid, max_wait,
+                               (const struct timespec *)NULL );
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+    else
+        count_takes( semaphore, 1 );
+    sema4_done();
+
+    return( error );
+}
+
+/*****************************************************************************
+** semDelete - takes the specified semaphore out of service and frees its
+**             slot (and control block) for reuse by a later semaphore.
+*****************************************************************************/
+STATUS
+   semDelete( v2pt_sema4_id_t semid )
+{
+#ifdef DIAG_PRINTFS 
+    v2pthread_cb_t *our_tcb;
+#endif
+    v2pt_sema4_t *semaphore;
+    STATUS error;
+
+    error = OK;
+    semaphore = sema4_for( semid );
+
+    /*
+    **  A named semaphore is ended by semClose, not deleted.
+    */
+    if ( sema4_is_named( semaphore, semid ) )
+    {
+        sema4_done();
+        errno = S_semLib_INVALID_OPERATION;
+        return( ERROR );
+    }
+
+    /*
+    **  First ensure that the specified semaphore exists and that we have
+    **  exclusive access to it.
+    */
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock));
+    if ( sema4_valid( semaphore, semid ) )
+    {
+#ifdef DIAG_PRINTFS 
+        our_tcb = my_tcb();
+        printf( "\r\ntask @ %p delete semaphore @ %p", our_tcb, semaphore );
+#endif
+        if ( semaphore->flags & PI_LOCK_OPTS )
+        {
+            /*
+            **  Tasks pended on an inversion-safe mutex wait in the kernel,
+            **  so they can only be released through the mutex itself.
+            **  Declare the deletion, give up the mutex if we own it, and
+            **  wait while each waiter in turn acquires it, sees the
+            **  deletion and passes it on.  If another task owns the mutex,
+            **  this lasts until the owner gives it: pi_lock must be free
+            **  before the control block is reused.
+            */
+            pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                                  (void *)&(semaphore->smdel_lock) );
+            pthread_mutex_lock( &(semaphore->smdel_lock) );
+            __atomic_store_n( &(semaphore->send_type), KILLD,
+                              __ATOMIC_SEQ_CST );
+            if ( (semaphore->current_owner != (v2pthread_cb_t *)NULL) &&
+                 (semaphore->current_owner == my_tcb()) )
+            {
+                semaphore->current_owner = (v2pthread_cb_t *)NULL;
+                semaphore->recursion_level = 0;
+                pthread_mutex_unlock( &(semaphore->pi_lock) );
+                if ( semaphore->flags & (SEM_DELETE_SAFE | SEM_PRIO_CEILING) )
+                    delete_unprotect( my_tcb() );
+            }
+            else if ( semaphore->flags & SEM_INVERSION_SAFE )
+            {
+                /*
+                **  Take the mutex ourselves once any other owner gives it
+                **  (or, being robust, once an owner deleted with it taken
+                **  is gone).  Whoever takes it after us sees the deletion.
+                */
+                if ( lock_mutex_until( &(semaphore->pi_lock),
+                                       (const struct timespec *)NULL ) ==
+                     EOWNERDEAD )
+                    pthread_mutex_consistent( &(semaphore->pi_lock) );
+                semaphore->current_owner = (v2pthread_cb_t *)NULL;
+                semaphore->recursion_level = 0;
+                pthread_mutex_unlock( &(semaphore->pi_lock) );
+            }
+
+            /*
+            **  The owner of a ceiling mutex cannot be deleted, and wakes
+            **  us as it gives the mutex (see pi_give).
+            */
+            while ( (__atomic_load_n( &(semaphore->waiters),
+                                      __ATOMIC_SEQ_CST ) > 0) ||
+                    (__atomic_load_n( &(semaphore->current_owner),
+                                      __ATOMIC_SEQ_CST ) !=
+                     (v2pthread_cb_t *)NULL) )
+                pthread_cond_wait( &(semaphore->smdel_cplt),
+                                   &(semaphore->smdel_lock) );
+
+            /*
+            **  Unlock the semaphore delete completion mutex. 
+            */
+            pthread_cleanup_pop( 1 );
+        }
+        else
+        {
+            /*
+            **  Release every task pended on the semaphore.  Each learns of
+            **  the deletion from its own tcb when it runs; we need not wait
+            **  for it.
+            */
+            release_waiters( semaphore, KILLD );
+
+            /*
+            **  Readers and writers waiting for a reader-writer semaphore
+            **  find it gone once they get sema4_lock back.
+            */
+            if ( (semaphore->flags & SEM_TYPE_MASK) == RW_SEMA4 )
+            {
+                pthread_cond_broadcast( &(semaphore->rw_read_cond) );
+                pthread_cond_broadcast( &(semaphore->rw_write_cond) );
+            }
+        }
+
+        /*
+        **  Let go of any tasks watching the semaphore from objWaitAny, and
+        **  of any task registered for its events.
+        */
+        drop_watchers( &(semaphore->first_watch) );
+        semaphore->ev_reg.taskid = 0;
+        __atomic_store_n( &(semaphore->watchers), 0, __ATOMIC_SEQ_CST );
+
+        /*
+        **  First take the semaphore out of service, so that its ID no
+        **  longer validates, then let go of the semaphore mutex; any task
+        **  blocked on it will find the ID gone.
+        */
+        __atomic_store_n( &(semaphore->sema4_id), NULL, __ATOMIC_RELEASE );
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+
+        /*
+        **  Finally return the semaphore control block to its slot, with
+        **  its locks and priority index ready for reuse.  Caller storage
+        **  is handed back once every other task is done with it.
+        */
+        sema4_done();
+        free_sema4( semaphore );
+    }
+    else
+    {
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    }
+
+    /*
+    **  Clean up the opening pthread_cleanup_push()
+    */
+    pthread_cleanup_pop( 0 );
+    sema4_done();
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+
+    return( error );
+}
+
+/*****************************************************************************
+** semFlush - unblocks all tasks waiting on the specified semaphore
+*****************************************************************************/
+STATUS
+   semFlush( v2pt_sema4_id_t semid )
+{
+#ifdef DIAG_PRINTFS 
+    v2pthread_cb_t *our_tcb;
+#endif
+    v2pt_sema4_t *semaphore;
+    STATUS error;
+
+    error = OK;
+    semaphore = sema4_for( semid );
+
+    /*
+    **  A named semaphore cannot be flushed.
+    */
+    if ( sema4_is_named( semaphore, semid ) )
+    {
+        sema4_done();
+        errno = S_semLib_INVALID_OPERATION;
+        return( ERROR );
+    }
+
+    /*
+    **  First ensure that the specified semaphore exists and that we have
+    **  exclusive access to it.
+    */
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock));
+    if ( sema4_valid( semaphore, semid ) )
+    {
+        if ( ((semaphore->flags & SEM_TYPE_MASK) != MUTEX_SEMA4) &&
+             ((semaphore->flags & SEM_TYPE_MASK) != RW_SEMA4) &&
+             ((semaphore->flags & SEM_TYPE_MASK) != RATE_SEMA4) )
+        {
+#ifdef DIAG_PRINTFS 
+            our_tcb = my_tcb();
+            printf( "\r\ntask @ %p flush semaphore list @ %p", our_tcb,
+                    &(semaphore->pend_list) );
+#endif
+            /*
+            **  Release every task pended on the semaphore.  Each learns of
+            **  the flush from its own tcb when it runs; we need not wait
+            **  for it.
+            */
+            release_waiters( semaphore, FLUSH );
+
+            /*
+            **  Unlock the semaphore mutex. 
+            */
+            pthread_mutex_unlock( &(semaphore->sema4_lock) );
+        }
+        else
+        {
+            error = S_semLib_INVALID_OPERATION;  /* Mutex, RW or rate */
+
+            /*
+            **  Unlock the semaphore mutex. 
+            */
+            pthread_mutex_unlock( &(semaphore->sema4_lock) );
+        }
+    }
+    else
+    {
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    }
+
+    /*
+    **  Clean up the opening pthread_cleanup_push()
+    */
+    pthread_cleanup_pop( 0 );
+    sema4_done();
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+
+    return( error );
+}
+
+/*****************************************************************************
+** semGive - releases a v2pthread semaphore token and awakens the first
+**           selected task waiting on the semaphore.
+*****************************************************************************/
+STATUS
+   semGive( v2pt_sema4_id_t semid )
+{
+    v2pthread_cb_t *our_tcb;
+    v2pt_sema4_t *semaphore;
+    STATUS error;
+
+    error = OK;
+    semaphore = sema4_for( semid );
+
+    /*
+    **  An inversion-safe or ceiling mutex is given by releasing its pthreads
+    **  mutex.
+    */
+    if ( sema4_in_service( semaphore, semid ) &&
+         (semaphore->flags & PI_LOCK_OPTS) )
+    {
+        error = pi_give( semaphore );
+        if ( error != OK )
+        {
+            errno = (int)error;
+            error = ERROR;
+        }
+        sema4_done();
+        return( error );
+    }
+
+    /*
+    **  A reader-writer semaphore is released by its writer or a reader.
+    */
+    if ( sema4_in_service( semaphore, semid ) &&
+         ((semaphore->flags & SEM_TYPE_MASK) == RW_SEMA4) )
+    {
+        error = rw_give( semaphore, semid );
+        if ( error != OK )
+        {
+            errno = (int)error;
+            error = ERROR;
+        }
+        sema4_done();
+        return( error );
+    }
+
+    /*
+    **  No task gives a rate-limiter semaphore; its tokens come from the
+    **  clock.
+    */
+    if ( sema4_is_rate( semaphore, semid ) )
+    {
+        sema4_done();
+        errno = S_semLib_INVALID_OPERATION;
+        return( ERROR );
+    }
+
+    /*
+    **  A named semaphore is given in the memory shared between processes.
+    */
+    if ( sema4_in_service( semaphore, semid ) &&
+         ((semaphore->flags & SEM_TYPE_MASK) == NAMED_SEMA4) )
+    {
+        error = named_sema4_give( semaphore->named, semid );
+        if ( error != OK )
+        {
+            errno = (int)error;
+            error = ERROR;
+        }
+        sema4_done();
+        return( error );
+    }
+
+    /*
+    **  Most gives need nothing more than an atomic add to the token count.
+    */
+    if ( fast_give( semaphore, semid, &error ) )
+    {
+        if ( error != OK )
+        {
+            errno = (int)error;
+            error = ERROR;
+        }
+        sema4_done();
+        return( error );
+    }
+
+    /*
+    **  First ensure that the specified semaphore exists and that we have
+    **  exclusive access to it.
+    */
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock));
+    if ( sema4_valid( semaphore, semid ) )
+    {
+        /*
+        **  If semaphore is a mutex, make sure we own it before giving up
+        **  the token.
+        */
+        our_tcb = my_tcb();
+        if ( ((semaphore->flags & SEM_TYPE_MASK) == MUTEX_SEMA4) &&
+             (semaphore->current_owner != our_tcb) )
+        {
+            error = S_semLib_INVALID_OPERATION;  /* Not owner of mutex */
+        }
+        else
+        {
+            /*
+            **  Either semaphore isn't a mutex or we currently own the mutex.
+            **  If semaphore is a mutex, recursion level should be > zero.
+            **  In this case, decrement recursion level, and if level == zero
+            **  after decrement, relinquish mutex ownership.
+            */
+#ifdef DIAG_PRINTFS 
+            printf( "\r\nSemaphore list @ %p recursion level = %d",
+                    &(semaphore->pend_list), semaphore->recursion_level );
+#endif
+            if ( semaphore->recursion_level > 0 )
+            {
+                if ( (--(semaphore->recursion_level)) == 0 )
+                {
+                    end_hold( semaphore );
+                    __atomic_add_fetch( &(semaphore->token_count), 1,
+                                        __ATOMIC_SEQ_CST );
+                    semaphore->current_owner = (v2pthread_cb_t *)NULL;
+                    __atomic_store_n( &(semaphore->owner_running), FALSE,
+                                      __ATOMIC_RELAXED );
+                    if ( semaphore->flags & SEM_DELETE_SAFE )
+                        /*
+                        **  Task was made deletion-safe when mutex acquired...
+                        **  Remove deletion safety now.
+                        */
+                        delete_unprotect( our_tcb );
+                }
+            }
+            else
+                __atomic_add_fetch( &(semaphore->token_count), 1,
+                                    __ATOMIC_SEQ_CST );
+
+#ifdef DIAG_PRINTFS 
+            printf( "\r\ntask @ %p post to semaphore list @ %p", our_tcb,
+                    &(semaphore->pend_list) );
+#endif
+
+            /*
+            **  Hand the token to the selected waiting task, if any.
+            */
+            dispatch_tokens( semaphore );
+        }
+
+        /*
+        **  Unlock the semaphore mutex. 
+        */
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+    }
+    else
+    {
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    }
+
+    /*
+    **  Clean up the opening pthread_cleanup_push()
+    */
+    pthread_cleanup_pop( 0 );
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+    sema4_done();
+
+    return( error );
+}
+
+/*****************************************************************************
+** semCGiveN - returns count tokens to the specified counting semaphore at
+**             once, waking as many pended tasks as there are tokens for.
+*****************************************************************************/
+STATUS
+   semCGiveN( v2pt_sema4_id_t semid, int count )
+{
+    v2pt_sema4_t *semaphore;
+    STATUS error;
+
+    error = OK;
+    semaphore = sema4_for( semid );
+    if ( !sema4_in_service( semaphore, semid ) )
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    else if ( (semaphore->flags & SEM_TYPE_MASK) != COUNTING_SEMA4 )
+        error = S_semLib_INVALID_OPERATION;  /* Not a counting semaphore */
+    else if ( count < 1 )
+        error = EINVAL;
+    else if ( !release_tokens_bounded( semaphore, count ) )
+        error = S_semLib_INVALID_OPERATION;  /* Token count would overflow */
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+    sema4_done();
+
+    return( error );
+}
+
+/*****************************************************************************
+** abandon_wait - cleanup handler for a task killed in wait_for_token.
+**                Runs with sema4_lock held.  A token already handed to the
+**                task is passed on to the next waiter rather than lost,
+**                unless the semaphore has been deleted meanwhile.
+*****************************************************************************/
+static void
+   abandon_wait( void *arg )
+{
+    v2pt_sema4_pend_t *pend;
+    v2pt_sema4_t *sema4;
+
+    pend = (v2pt_sema4_pend_t *)arg;
+    sema4 = pend->sema4;
+    if ( pend->tcb->pend_granted )
+    {
+        pend->tcb->pend_granted = FALSE;
+        if ( sema4->sema4_id == pend->semid )
+        {
+            if ( sema4->current_owner == pend->tcb )
+            {
+                sema4->current_owner = (v2pthread_cb_t *)NULL;
+                sema4->recursion_level = 0;
+                __atomic_store_n( &(sema4->owner_running), FALSE,
+                                  __ATOMIC_RELAXED );
+            }
+            __atomic_add_fetch( &(sema4->token_count), 1, __ATOMIC_SEQ_CST );
+            dispatch_tokens( sema4 );
+        }
+    }
+    else if ( !pend->tcb->pend_release )
+    {
+        unlink_susp_tcb( &(sema4->pend_list), pend->tcb );
+        pend->tcb->suspend_list = (v2pt_pend_list_t *)NULL;
+        __atomic_sub_fetch( &(sema4->waiters), 1, __ATOMIC_SEQ_CST );
+    }
+}
+
+/*****************************************************************************
+** wait_for_token - blocks the calling task until a token is available on the
+**                  specified v2pthread semaphore.  If a token is acquired and
+**                  the semaphore is a mutex type, this function also handles
+**                  deletion safety as needed.
+**                  The task sleeps on its own pend_wake condition until a
+**                  giver hands it a token (see dispatch_tokens), the
+**                  semaphore is flushed or deleted (see release_waiters),
+**                  or the timeout (max_wait ticks, or the deadline if one
+**                  is given) expires.  Once handed a token or released,
+**                  the task reads only its own tcb, since a deleted
+**                  semaphore's control block may already be reused.
+*****************************************************************************/
+STATUS
+   wait_for_token( v2pt_sema4_t *semaphore, int max_wait,
+                   const struct timespec *deadline, v2pthread_cb_t *our_tcb )
+{
+    struct timespec timeout;
+    v2pt_sema4_pend_t pend;
+    int retcode;
+    long long since;
+    int flags;
+    STATUS error;
+
+    error = OK;
+    flags = semaphore->flags;
+    since = 0;
+
     /*
-    **  First allocate memory for the semaphore control block
+    **  Announce our task as a waiter before looking for a token, so that
+    **  fast-path takers defer to the pend order and fast-path givers hand
+    **  their tokens to us.  The cleanup handler withdraws the announcement
+    **  (and passes on any token we were handed) if our task is killed
+    **  while waiting.
     */
-    if ( initial_state == 0 )
-        semaphore = new_sema4( 0 );
+    pend.sema4 = semaphore;
+    pend.tcb = our_tcb;
+    pend.semid = semaphore->sema4_id;
+    count_waiters( semaphore, __atomic_add_fetch( &(semaphore->waiters), 1,
+                                                  __ATOMIC_SEQ_CST ) );
+    pthread_cleanup_push( abandon_wait, (void *)&pend );
+
+    /*
+    **  Add tcb for task to list of tasks waiting on semaphore, then hand
+    **  out any tokens already available.  Our task receives one only if it
+    **  is first in pend order.
+    */
+#ifdef DIAG_PRINTFS 
+    printf( "\r\ntask @ %p wait on semaphore list @ %p", our_tcb,
+            &(semaphore->pend_list) );
+#endif
+
+    our_tcb->pend_granted = FALSE;
+    our_tcb->pend_release = SEND;
+    if ( semaphore->flags & SEM_Q_PRIORITY )
+        link_prio_susp_tcb( &(semaphore->pend_list), semaphore->pend_index,
+                            our_tcb );
     else
-        semaphore = new_sema4( 1 );
+        link_susp_tcb( &(semaphore->pend_list), our_tcb );
+    dispatch_tokens( semaphore );
 
-    if ( semaphore != (v2pt_sema4_t *)NULL )
+    retcode = 0;
+
+    if ( max_wait == NO_WAIT )
     {
         /*
-        **  Ok... got a control block.  Initialize it.
+        **  Caller specified no wait on semaphore token...
+        **  Either we were handed a token just now or we time out at once.
+        */
+        if ( !our_tcb->pend_granted )
+            retcode = ETIMEDOUT;
+    }
+    else
+    {
+        /*
+        **  Caller expects to wait on semaphore, with or without a timeout.
+        **  (Inversion-safe mutexes wait in pi_take instead, where the
+        **  kernel boosts the owner.)
+        */
+        if ( !our_tcb->pend_granted )
+            since = stats_since();
+
+        if ( max_wait == WAIT_FOREVER )
+        {
+            /*
+            **  Infinite wait was specified... wait without timeout.
+            */
+            while ( !our_tcb->pend_granted && !our_tcb->pend_release )
+            {
+                pthread_cond_wait( &(our_tcb->pend_wake),
+                                   &(semaphore->sema4_lock) );
+            }
+        }
+        else
+        {
+            /*
+            **  Wait on semaphore message arrival with timeout...
+            **  pend_wake takes CLOCK_MONOTONIC deadlines.
+            */
+            deadline = sema4_deadline( max_wait, deadline, &timeout );
+
+            /*
+            **  Wait for a token to be handed to the current task or for
+            **  the timeout to expire.  The loop guards against spurious
+            **  wakeups; a token handed over just as the timeout expires
+            **  is still ours, since pend_granted is checked under the lock.
+            */
+            while ( !our_tcb->pend_granted && !our_tcb->pend_release &&
+                    (retcode != ETIMEDOUT) )
+            {
+                retcode = pthread_cond_timedwait( &(our_tcb->pend_wake),
+                                                  &(semaphore->sema4_lock),
+                                                  deadline );
+            }
+        }
+    }
+
+    /*
+    **  Unless a giver, semFlush or semDelete already took us off the
+    **  waiting task list (and stopped counting us as a waiter), remove the
+    **  calling task's tcb from it now.
+    */
+    if ( !our_tcb->pend_granted && !our_tcb->pend_release )
+    {
+        unlink_susp_tcb( &(semaphore->pend_list), our_tcb );
+        __atomic_sub_fetch( &(semaphore->waiters), 1, __ATOMIC_SEQ_CST );
+    }
+    our_tcb->suspend_list = (v2pt_pend_list_t *)NULL;
+    pthread_cleanup_pop( 0 );
+
+    if ( our_tcb->pend_granted )
+    {
+        /*
+        **  Just received a token from the semaphore...  If the semaphore
+        **  is a mutex, the giver has already made the current task the
+        **  owner; see if the task owning the token is to be made
+        **  deletion-safe.
         */
+        our_tcb->pend_granted = FALSE;
+        if ( ((flags & SEM_TYPE_MASK) == MUTEX_SEMA4) &&
+             (flags & SEM_DELETE_SAFE) )
+            delete_protect( our_tcb );
+
 #ifdef DIAG_PRINTFS 
-        printf( "\r\nCreating binary semaphore - id %p", semaphore );
+        printf( "...rcvd semaphore token" );
 #endif
-
+    }
+    else if ( our_tcb->pend_release )
+    {
         /*
-        ** Option and Type Flags for semaphore
+        **  We were awakened due to a semDelete or a semFlush.
         */
-        semaphore->flags = (opt & SEM_Q_PRIORITY) | BINARY_SEMA4;
+        if ( our_tcb->pend_release == KILLD )
+        {
+            error = S_objLib_OBJ_ID_ERROR;       /* Semaphore deleted */
 
+#ifdef DIAG_PRINTFS 
+            printf( "...semaphore deleted" );
+#endif
+        }
+        else
+        {
+#ifdef DIAG_PRINTFS 
+            printf( "...semaphore flushed" );
+#endif
+        }
+    }
+    else
+    {
         /*
-        **  Link the new semaphore into the semaphore list.
+        **  Timed out without a token
         */
-        link_smcb( semaphore );
+        if ( max_wait == NO_WAIT )
+        {
+            error = S_objLib_OBJ_UNAVAILABLE;
+#ifdef DIAG_PRINTFS 
+            printf( "...no token available" );
+#endif
+        }
+        else
+        {
+            error = S_objLib_OBJ_TIMEOUT;
+#ifdef DIAG_PRINTFS 
+            printf( "...timed out" );
+#endif
+        }
     }
 
-    return( semaphore );
+    count_wait( semaphore, since, error );
+    return( error );
 }
 
 /*****************************************************************************
-** semCCreate - creates a v2pthread counting semaphore
+** take_sema4 - blocks the calling task until a token is available on the
+**              specified v2pthread semaphore, for up to max_wait ticks or
+**              until deadline if one is given.  Returns the error number,
+**              for semTake, semTakeNs and semTakeUntil to report.
 *****************************************************************************/
-v2pt_sema4_t *
-    semCCreate( int opt, int initial_count )
+static STATUS
+   take_sema4( v2pt_sema4_id_t semid, int max_wait,
+               const struct timespec *deadline )
 {
+    v2pthread_cb_t *our_tcb;
     v2pt_sema4_t *semaphore;
+    STATUS error;
+
+    error = OK;
+    semaphore = sema4_for( semid );
 
-    if ( (opt & SEM_Q_PRIORITY)
-    	||(opt & SEM_DELETE_SAFE)
-	||(opt & SEM_INVERSION_SAFE) )
+    /*
+    **  An inversion-safe or ceiling mutex is taken by locking its pthreads
+    **  mutex.
+    */
+    if ( sema4_in_service( semaphore, semid ) &&
+         (semaphore->flags & PI_LOCK_OPTS) )
     {
-    	errno = ENOSYS;
-		return( NULL );
+        error = pi_take( semaphore, max_wait, deadline );
+        if ( error == OK )
+            count_takes( semaphore, 1 );
+        return( error );
     }
 
     /*
-    **  First allocate memory for the semaphore control block
+    **  semTake of a reader-writer semaphore takes it for writing.
     */
-    semaphore = new_sema4( initial_count );
+    if ( sema4_in_service( semaphore, semid ) &&
+         ((semaphore->flags & SEM_TYPE_MASK) == RW_SEMA4) )
+    {
+        error = rw_write_take( semaphore, semid, max_wait, deadline );
+        if ( error == OK )
+            count_takes( semaphore, 1 );
+        return( error );
+    }
 
-    if ( semaphore != (v2pt_sema4_t *)NULL )
+    /*
+    **  A rate-limiter semaphore's tokens come from the clock.
+    */
+    if ( sema4_in_service( semaphore, semid ) &&
+         ((semaphore->flags & SEM_TYPE_MASK) == RATE_SEMA4) )
+    {
+        error = rate_take( semaphore, semid, max_wait, deadline );
+        if ( error == OK )
+            count_takes( semaphore, 1 );
+        return( error );
+    }
+
+    /*
+    **  A named semaphore is taken in the memory shared between processes.
+    */
+    if ( sema4_in_service( semaphore, semid ) &&
+         ((semaphore->flags & SEM_TYPE_MASK) == NAMED_SEMA4) )
+    {
+        error = named_sema4_take( semaphore->named, semid, max_wait,
+                                  deadline );
+        if ( error == OK )
+            count_takes( semaphore, 1 );
+        return( error );
+    }
+
+    /*
+    **  If no task is waiting and a token is available, claim it directly.
+    */
+    if ( fast_take( semaphore, semid ) )
+    {
+        count_takes( semaphore, 1 );
+        return( OK );
+    }
+
+    /*
+    **  An adaptive mutex held by a running task is likely to be given soon.
+    */
+    if ( (max_wait != NO_WAIT) && sema4_in_service( semaphore, semid ) &&
+         (semaphore->flags & SEM_ADAPTIVE) && spin_take( semaphore, semid ) )
+    {
+        count_takes( semaphore, 1 );
+        return( OK );
+    }
+
+    /*
+    **  First ensure that the specified semaphore exists and that we have
+    **  exclusive access to it.
+    */
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock));
+    if ( sema4_valid( semaphore, semid ) )
     {
         /*
-        **  Ok... got a control block.  Initialize it.
+        **  If the semaphore is a mutex, check to see if this task already
+        **  owns the token.
         */
+        our_tcb = my_tcb();
+        if ( ((semaphore->flags & SEM_TYPE_MASK) == MUTEX_SEMA4) &&
+             (semaphore->current_owner == our_tcb) )
+        {
+            /*
+            **  Current task already owns the mutex... simply increment the
+            **  ownership recursion level and return.
+            */
+            semaphore->recursion_level++;
 #ifdef DIAG_PRINTFS 
-        printf( "\r\nCreating counting semaphore - id %p", semaphore );
+            printf( "... recursion level = %d", semaphore->recursion_level );
 #endif
+        }
+        else
+        {
+            /*
+            **  Either semaphore is not a mutex or current task doesn't own it
+            **  Wait for timeout or acquisition of token
+            */
+            error = wait_for_token( semaphore, max_wait, deadline,
+                                    our_tcb );
+        } 
+        if ( error == OK )
+            count_takes( semaphore, 1 );
 
         /*
-        ** Option and Type Flags for semaphore
+        **  Unlock the mutex for the condition variable and clean up.
         */
-        semaphore->flags = (opt & SEM_Q_PRIORITY) | COUNTING_SEMA4;
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+    }
+    else
+    {
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    }
 
-        /*
-        **  Link the new semaphore into the semaphore list.
-        */
-        link_smcb( semaphore );
+    /*
+    **  Clean up the opening pthread_cleanup_push()
+    */
+    pthread_cleanup_pop( 0 );
+
+    return( error );
+}
+
+/*****************************************************************************
+** semTake - blocks the calling task until a token is available on the
+**           specified v2pthread semaphore.
+*****************************************************************************/
+STATUS
+   semTake( v2pt_sema4_id_t semid, int max_wait )
+{
+    STATUS error;
+
+    error = take_sema4( semid, max_wait, (const struct timespec *)NULL );
+    sema4_done();
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+    return( error );
+}
+
+/*****************************************************************************
+** semTakeNs - like semTake, but waits for up to timeout_ns nanoseconds
+**             rather than whole ticks.  A timeout of zero does not wait,
+**             and a negative one waits forever.
+*****************************************************************************/
+STATUS
+   semTakeNs( v2pt_sema4_id_t semid, long long timeout_ns )
+{
+    struct timespec deadline;
+    STATUS error;
+
+    if ( timeout_ns < 0 )
+        error = take_sema4( semid, WAIT_FOREVER,
+                            (const struct timespec *)NULL );
+    else if ( timeout_ns == 0 )
+        error = take_sema4( semid, NO_WAIT, (const struct timespec *)NULL );
+    else
+    {
+        deadline_after_ns( timeout_ns, &deadline );
+        error = take_sema4( semid, WAIT_DEADLINE, &deadline );
+    }
+    sema4_done();
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+    return( error );
+}
+
+/*****************************************************************************
+** semTakeUntil - like semTake, but waits until an absolute CLOCK_MONOTONIC
+**                deadline, or forever if deadline is NULL.  A deadline
+**                already past still takes a token which is available.
+*****************************************************************************/
+STATUS
+   semTakeUntil( v2pt_sema4_id_t semid, const struct timespec *deadline )
+{
+    STATUS error;
+
+    if ( deadline == (const struct timespec *)NULL )
+        error = take_sema4( semid, WAIT_FOREVER,
+                            (const struct timespec *)NULL );
+    else if ( (deadline->tv_nsec < 0) || (deadline->tv_nsec >= 1000000000L) )
+        error = EINVAL;
+    else
+        error = take_sema4( semid, WAIT_DEADLINE, deadline );
+    sema4_done();
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
     }
-
-    return( semaphore );
+    return( error );
 }
 
 /*****************************************************************************
-** semMCreate - creates a v2pthread mutual exclusion semaphore
+** semCTakeN - takes up to count tokens from the specified counting semaphore
+**             at once.  Blocks like semTake until at least one token can be
+**             taken, then takes as many more as are available then, without
+**             waiting for them.  Returns the number of tokens taken, or
+**             ERROR if none could be.
 *****************************************************************************/
-v2pt_sema4_t *
-    semMCreate( int opt )
+int
+   semCTakeN( v2pt_sema4_id_t semid, int count, int max_wait )
 {
     v2pt_sema4_t *semaphore;
+    STATUS error;
+    int taken;
 
-    if ( (opt & SEM_Q_PRIORITY)
-    	||(opt & SEM_DELETE_SAFE)
-	||(opt & SEM_INVERSION_SAFE) )
-    {
-    	errno = ENOSYS;
-		return( NULL );
-    }
-    /*
-    **  First allocate memory for the semaphore control block
-    */
-    semaphore = new_sema4( 1 );
-
-    if ( semaphore != (v2pt_sema4_t *)NULL )
+    error = OK;
+    taken = 0;
+    semaphore = sema4_for( semid );
+    if ( !sema4_in_service( semaphore, semid ) )
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    else if ( (semaphore->flags & SEM_TYPE_MASK) != COUNTING_SEMA4 )
+        error = S_semLib_INVALID_OPERATION;  /* Not a counting semaphore */
+    else if ( count < 1 )
+        error = EINVAL;
+    else if ( __atomic_load_n( &(semaphore->waiters), __ATOMIC_ACQUIRE ) == 0 )
     {
         /*
-        **  Ok... got a control block.  Initialize it.
+        **  No task is waiting, so whatever tokens are there are ours.
         */
-#ifdef DIAG_PRINTFS 
-        printf( "\r\nCreating mutex semaphore - id %p", semaphore );
-#endif
+        taken = claim_tokens( semaphore, count );
+    }
 
-        /*
-        ** Option and Type Flags for semaphore
-        */
-        semaphore->flags = (opt & SEM_OPT_MASK) | MUTEX_SEMA4;
+    if ( (error == OK) && (taken == 0) )
+    {
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&(semaphore->sema4_lock));
+        if ( sema4_valid( semaphore, semid ) )
+        {
+            /*
+            **  Wait in pend order for one token.  Any others left once we
+            **  have it were not wanted by another waiter, so take them too.
+            */
+            error = wait_for_token( semaphore, max_wait,
+                                    (const struct timespec *)NULL, my_tcb() );
+            if ( error == OK )
+            {
+                taken = 1;
+                if ( (count > 1) &&
+                     (semaphore->pend_list.head == (v2pthread_cb_t *)NULL) )
+                    taken += claim_tokens( semaphore, count - 1 );
+            }
+            pthread_mutex_unlock( &(semaphore->sema4_lock) );
+        }
+        else
+        {
+            error = S_objLib_OBJ_ID_ERROR;   /* Invalid semaphore specified */
+        }
+        pthread_cleanup_pop( 0 );
+    }
 
-        /*
-        **  Link the new semaphore into the semaphore list.
-        */
-        link_smcb( semaphore );
+    if ( error != OK )
+    {
+        errno = (int)error;
+        taken = ERROR;
     }
+    else
+        count_takes( semaphore, taken );
+    sema4_done();
 
-    return( semaphore );
+    return( taken );
 }
 
 /*****************************************************************************
-** semDelete - removes the specified semaphore from the semaphore list and
-**             frees the memory allocated for the semaphore control block.
+** semMSpinStats - reports how many contended semTake calls on a SEM_ADAPTIVE
+**                 mutex took it while spinning and how many had to block,
+**                 and optionally restarts the counts.
 *****************************************************************************/
 STATUS
-   semDelete( v2pt_sema4_t *semaphore )
+   semMSpinStats( v2pt_sema4_id_t semid, unsigned long *spun,
+                  unsigned long *blocked, int reset )
 {
-#ifdef DIAG_PRINTFS 
-    v2pthread_cb_t *our_tcb;
-#endif
+    v2pt_sema4_t *semaphore;
     STATUS error;
 
     error = OK;
+    semaphore = sema4_for( semid );
 
-    /*
-    **  First ensure that the specified semaphore exists and that we have
-    **  exclusive access to it.
-    */
     pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
                           (void *)&(semaphore->sema4_lock));
-    if ( sema4_valid( semaphore ) )
+    if ( sema4_valid( semaphore, semid ) )
     {
-#ifdef DIAG_PRINTFS 
-        our_tcb = my_tcb();
-        printf( "\r\ntask @ %p delete semaphore @ %p", our_tcb, semaphore );
-#endif
-        /*
-        **  Send signal and block while any tasks are still waiting
-        **  on the semaphore
-        */
-        taskLock();
-        if ( semaphore->first_susp != (v2pthread_cb_t *)NULL )
+        if ( (semaphore->flags & SEM_TYPE_MASK) != MUTEX_SEMA4 )
+            error = S_semLib_INVALID_OPERATION;
+        else
         {
-#ifdef DIAG_PRINTFS 
-            printf( "\r\nisemDelete - tasks pending on semaphore list @ %p",
-                    semaphore->first_susp );
-#endif
-            /*
-            ** Lock mutex for semaphore delete completion
-            */
-            pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                                  (void *)&(semaphore->smdel_lock) );
-            pthread_mutex_lock( &(semaphore->smdel_lock) );
-
-            /*
-            **  Declare the send type
-            */
-            semaphore->send_type = KILLD;
-
-            /*
-            **  Signal the condition variable for the semaphore
-            */
-            pthread_cond_broadcast( &(semaphore->sema4_send) );
-
-            /*
-            **  Unlock the semaphore mutex. 
-            */
-            pthread_mutex_unlock( &(semaphore->sema4_lock) );
-
-            /*
-            **  Wait for all pended tasks to receive delete message.
-            **  The last task to receive the message will signal the
-            **  delete-complete condition variable.
-            */
-            while ( semaphore->first_susp != (v2pthread_cb_t *)NULL )
-                pthread_cond_wait( &(semaphore->smdel_cplt),
-                                   &(semaphore->smdel_lock) );
-
-            /*
-            **  (No need to unlock the semaphore delete completion mutex.) 
-            */
-            pthread_cleanup_pop( 0 );
+            if ( reset )
+            {
+                if ( spun != (unsigned long *)NULL )
+                    *spun = __atomic_exchange_n( &(semaphore->spin_acquired),
+                                                 0, __ATOMIC_RELAXED );
+                else
+                    __atomic_store_n( &(semaphore->spin_acquired), 0,
+                                      __ATOMIC_RELAXED );
+                if ( blocked != (unsigned long *)NULL )
+                    *blocked = __atomic_exchange_n( &(semaphore->spin_blocked),
+                                                    0, __ATOMIC_RELAXED );
+                else
+                    __atomic_store_n( &(semaphore->spin_blocked), 0,
+                                      __ATOMIC_RELAXED );
+            }
+            else
+            {
+                if ( spun != (unsigned long *)NULL )
+                    *spun = __atomic_load_n( &(semaphore->spin_acquired),
+                                             __ATOMIC_RELAXED );
+                if ( blocked != (unsigned long *)NULL )
+                    *blocked = __atomic_load_n( &(semaphore->spin_blocked),
+                                                __ATOMIC_RELAXED );
+            }
         }
-
-        /*
-        **  First remove the semaphore from the semaphore list
-        */
-        unlink_smcb( semaphore );
-
-        /*
-        **  Finally delete the semaphore control block itself;
-        */
-        ts_free( (void *)semaphore );
-
-        taskUnlock();
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
     }
     else
     {
         error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
     }
-
-    /*
-    **  Clean up the opening pthread_cleanup_push()
-    */
     pthread_cleanup_pop( 0 );
 
     if ( error != OK )
@@ -631,102 +4464,97 @@ STATUS
         errno = (int)error;
         error = ERROR;
     }
+    sema4_done();
 
     return( error );
 }
 
 /*****************************************************************************
-** semFlush - unblocks all tasks waiting on the specified semaphore
+** semStatsEnable - turns the keeping of semaphore statistics on or off, and
+**                  returns the previous setting.
+*****************************************************************************/
+BOOL
+   semStatsEnable( BOOL enable )
+{
+    return( __atomic_exchange_n( &sema4_stats_on, (enable ? TRUE : FALSE),
+                                 __ATOMIC_RELAXED ) );
+}
+
+/*****************************************************************************
+** semInfoGet - fills in a SEM_INFO with the state and statistics of the
+**              specified semaphore.
 *****************************************************************************/
 STATUS
-   semFlush( v2pt_sema4_t *semaphore )
+   semInfoGet( v2pt_sema4_id_t semid, v2pt_sema4_info_t *info )
 {
-#ifdef DIAG_PRINTFS 
-    v2pthread_cb_t *our_tcb;
-#endif
+    v2pt_sema4_t *semaphore;
     STATUS error;
+    int i;
 
     error = OK;
+    semaphore = sema4_for( semid );
 
-    /*
-    **  First ensure that the specified semaphore exists and that we have
-    **  exclusive access to it.
-    */
     pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
                           (void *)&(semaphore->sema4_lock));
-    if ( sema4_valid( semaphore ) )
+    if ( info == (v2pt_sema4_info_t *)NULL )
     {
-        if ( (semaphore->flags & SEM_TYPE_MASK) != MUTEX_SEMA4 )
+        error = EINVAL;
+    }
+    else if ( sema4_valid( semaphore, semid ) )
+    {
+        info->type = (semaphore->flags & SEM_TYPE_MASK) >> 4;
+        info->options = semaphore->flags & SEM_OPT_MASK;
+        if ( (semaphore->flags & SEM_TYPE_MASK) == NAMED_SEMA4 )
+            named_sema4_state( semaphore->named, &(info->type),
+                               &(info->options), &(info->count),
+                               &(info->pended) );
+        else if ( (semaphore->flags & SEM_TYPE_MASK) == RW_SEMA4 )
         {
-#ifdef DIAG_PRINTFS 
-            our_tcb = my_tcb();
-            printf( "\r\ntask @ %p flush semaphore list @ %p", our_tcb,
-                    &(semaphore->first_susp) );
-#endif
-            /*
-            **  Send signal and block while any tasks are still waiting
-            **  on the semaphore
-            */
-            taskLock();
-            if ( semaphore->first_susp != (v2pthread_cb_t *)NULL )
-            {
-                /*
-                ** Lock mutex for semaphore delete completion
-                */
-                pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                                      (void *)&(semaphore->smdel_lock) );
-                pthread_mutex_lock( &(semaphore->smdel_lock) );
-
-                /*
-                **  Declare the send type
-                */
-                semaphore->send_type = FLUSH;
-
-                /*
-                **  Signal the condition variable for the semaphore
-                */
-                pthread_cond_broadcast( &(semaphore->sema4_send) );
-
-                /*
-                **  Unlock the semaphore mutex. 
-                */
-                pthread_mutex_unlock( &(semaphore->sema4_lock) );
-
-                /*
-                **  Wait for all pended tasks to receive delete message.
-                **  The last task to receive the message will signal the
-                **  delete-complete condition variable.
-                */
-                while ( semaphore->first_susp != (v2pthread_cb_t *)NULL )
-                    pthread_cond_wait( &(semaphore->smdel_cplt),
-                                       &(semaphore->smdel_lock) );
-
-                /*
-                **  Unlock the semaphore delete completion mutex. 
-                */
-                pthread_mutex_unlock( &(semaphore->smdel_lock) );
-                pthread_cleanup_pop( 0 );
-            }
-            taskUnlock();
+            info->count = rw_readers( semaphore );
+            info->pended = semaphore->rw_writers;
+        }
+        else if ( (semaphore->flags & SEM_TYPE_MASK) == RATE_SEMA4 )
+        {
+            info->type = SEM_TYPE_RATE;
+            info->count = rate_tokens( semaphore );
+            info->pended = __atomic_load_n( &(semaphore->waiters),
+                                            __ATOMIC_RELAXED );
         }
         else
         {
-            error = S_semLib_INVALID_OPERATION;  /* Flush invalid for mutex */
-
-            /*
-            **  Unlock the semaphore mutex. 
-            */
-            pthread_mutex_unlock( &(semaphore->sema4_lock) );
+            info->count = __atomic_load_n( &(semaphore->token_count),
+                                           __ATOMIC_RELAXED );
+            info->pended = __atomic_load_n( &(semaphore->waiters),
+                                            __ATOMIC_RELAXED );
+        }
+        if ( semaphore->current_owner != (v2pthread_cb_t *)NULL )
+            info->owner = semaphore->current_owner->taskid;
+        else
+            info->owner = 0;
+
+        info->max_pended = __atomic_load_n( &(semaphore->stats.max_waiters),
+                                            __ATOMIC_RELAXED );
+        info->takes = __atomic_load_n( &(semaphore->stats.takes),
+                                       __ATOMIC_RELAXED );
+        info->contended = __atomic_load_n( &(semaphore->stats.contended),
+                                           __ATOMIC_RELAXED );
+        info->timeouts = __atomic_load_n( &(semaphore->stats.timeouts),
+                                          __ATOMIC_RELAXED );
+        for ( i = 0; i < SEM_HIST_BUCKETS; i++ )
+        {
+            info->wait_hist[i] =
+                __atomic_load_n( &(semaphore->stats.wait_hist[i]),
+                                 __ATOMIC_RELAXED );
+            info->hold_hist[i] =
+                __atomic_load_n( &(semaphore->stats.hold_hist[i]),
+                                 __ATOMIC_RELAXED );
         }
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
     }
     else
     {
         error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
     }
-
-    /*
-    **  Clean up the opening pthread_cleanup_push()
-    */
     pthread_cleanup_pop( 0 );
 
     if ( error != OK )
@@ -734,538 +4562,386 @@ STATUS
         errno = (int)error;
         error = ERROR;
     }
+    sema4_done();
 
     return( error );
 }
 
 /*****************************************************************************
-** semGive - releases a v2pthread semaphore token and awakens the first
-**           selected task waiting on the semaphore.
+** show_sema4_hist - prints the non-empty buckets of a statistics histogram.
 *****************************************************************************/
-STATUS
-   semGive( v2pt_sema4_t *semaphore )
+static void
+   show_sema4_hist( const char *title, unsigned long *hist )
 {
-    v2pthread_cb_t *our_tcb;
-    STATUS error;
-
-    error = OK;
+    char range[32];
+    int i;
 
-    /*
-    **  First ensure that the specified semaphore exists and that we have
-    **  exclusive access to it.
-    */
-    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                          (void *)&(semaphore->sema4_lock));
-    if ( sema4_valid( semaphore ) )
+    printf( "%s\n", title );
+    for ( i = 0; i < SEM_HIST_BUCKETS; i++ )
     {
-        /*
-        **  If semaphore is a mutex, make sure we own it before giving up
-        **  the token.
-        */
-        our_tcb = my_tcb();
-        if ( ((semaphore->flags & SEM_TYPE_MASK) == MUTEX_SEMA4) &&
-             (semaphore->current_owner != our_tcb) )
-        {
-            error = S_semLib_INVALID_OPERATION;  /* Not owner of mutex */
-        }
+        if ( hist[i] == 0 )
+            continue;
+        if ( i == 0 )
+            sprintf( range, "under 1 us" );
+        else if ( i == SEM_HIST_BUCKETS - 1 )
+            sprintf( range, "%ld us and over", 1L << (i - 1) );
         else
-        {
-            /*
-            **  Either semaphore isn't a mutex or we currently own the mutex.
-            **  If semaphore is a mutex, recursion level should be > zero.
-            **  In this case, decrement recursion level, and if level == zero
-            **  after decrement, relinquish mutex ownership.
-            */
-#ifdef DIAG_PRINTFS 
-            printf( "\r\nSemaphore list @ %p recursion level = %d",
-                    &(semaphore->first_susp), semaphore->recursion_level );
-#endif
-            if ( semaphore->recursion_level > 0 )
-            {
-                if ( (--(semaphore->recursion_level)) == 0 )
-                {
-                    semaphore->token_count++;
-                    semaphore->current_owner = (v2pthread_cb_t *)NULL;
-                    if ( semaphore->flags & SEM_DELETE_SAFE )
-                        /*
-                        **  Task was made deletion-safe when mutex acquired...
-                        **  Remove deletion safety now.
-                        */
-                        taskUnsafe();
-                    if ( semaphore->flags & SEM_INVERSION_SAFE )
-                    {
-                        /*
-                        **  Task priority may have been boosted during
-                        **  ownership of semaphore...
-                        **  Restore to original priority now.  Call taskLock
-                        **  so taskUnlock can be called to restore priority.
-                        */
-#ifdef DIAG_PRINTFS 
-                        printf( "\r\nRestoring task priority for owner of semaphore list @ %p", 
-                                &(semaphore->first_susp) );
-#endif
-                        taskLock();
-                        taskUnlock();
-                    }
-                }
-            }
-            else
-                semaphore->token_count++;
+            sprintf( range, "%ld - %ld us", 1L << (i - 1), 1L << i );
+        printf( "    %-18s: %lu\n", range, hist[i] );
+    }
+}
 
-#ifdef DIAG_PRINTFS 
-            printf( "\r\ntask @ %p post to semaphore list @ %p", our_tcb,
-                    &(semaphore->first_susp) );
-#endif
+/*****************************************************************************
+** semShow - prints the state and statistics of the specified semaphore, and
+**           if level is 1 or more, its wait and hold time histograms.
+*****************************************************************************/
+STATUS
+   semShow( v2pt_sema4_id_t semid, int level )
+{
+    static const char *type_names[] =
+        { "BINARY", "MUTEX", "COUNTING", "READER-WRITER", "RATE-LIMITER" };
+    v2pt_sema4_info_t info;
+
+    if ( semInfoGet( semid, &info ) != OK )
+        return( ERROR );
+
+    printf( "\nSemaphore Id        : %p\n", semid );
+    printf( "Semaphore Type      : %s\n", type_names[info.type] );
+    printf( "Task Queuing        : %s\n",
+            (info.options & SEM_Q_PRIORITY) ? "PRIORITY" : "FIFO" );
+    printf( "Pended Tasks        : %d\n", info.pended );
+    if ( info.type == SEM_TYPE_MUTEX )
+        printf( "Owner               : 0x%x\n", info.owner );
+    else if ( info.type == SEM_TYPE_RW )
+        printf( "Readers / Writer    : %d / 0x%x\n", info.count, info.owner );
+    else
+        printf( "Count               : %d\n", info.count );
+    printf( "Takes               : %lu\n", info.takes );
+    printf( "Contended Takes     : %lu\n", info.contended );
+    printf( "Timeouts            : %lu\n", info.timeouts );
+    printf( "Most Pended Tasks   : %d\n", info.max_pended );
+    if ( level > 0 )
+    {
+        show_sema4_hist( "Wait Times", info.wait_hist );
+        if ( info.type == SEM_TYPE_MUTEX )
+            show_sema4_hist( "Hold Times", info.hold_hist );
+    }
 
-            if ( semaphore->first_susp != (v2pthread_cb_t *)NULL )
-                /*
-                **  Signal the condition variable for the semaphore
-                */
-                pthread_cond_broadcast( &(semaphore->sema4_send) );
-        }
+    return( OK );
+}
 
-        /*
-        **  Unlock the semaphore mutex. 
-        */
-        pthread_mutex_unlock( &(semaphore->sema4_lock) );
+/*****************************************************************************
+** semTopShow - prints the (up to) max_sems semaphores in service with the
+**              most contended takes, most contended first.  Semaphores with
+**              no contended takes are left out.
+*****************************************************************************/
+STATUS
+   semTopShow( int max_sems )
+{
+    v2pt_sema4_slot_t *slot;
+    v2pt_sema4_id_t *top_ids;
+    v2pt_sema4_t *sema4;
+    v2pt_sema4_id_t semid;
+    v2pt_sema4_info_t *top;
+    v2pt_sema4_info_t info;
+    unsigned int next_slot;
+    unsigned int index;
+    int count;
+    int i;
+
+    if ( max_sems < 1 )
+    {
+        errno = EINVAL;
+        return( ERROR );
     }
-    else
+    top = (v2pt_sema4_info_t *)ts_malloc( max_sems *
+                                          sizeof( v2pt_sema4_info_t ) );
+    top_ids = (v2pt_sema4_id_t *)ts_malloc( max_sems *
+                                            sizeof( v2pt_sema4_id_t ) );
+    if ( (top == (v2pt_sema4_info_t *)NULL) ||
+         (top_ids == (v2pt_sema4_id_t *)NULL) )
     {
-        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+        if ( top != (v2pt_sema4_info_t *)NULL )
+            ts_free( (void *)top );
+        if ( top_ids != (v2pt_sema4_id_t *)NULL )
+            ts_free( (void *)top_ids );
+        errno = S_memLib_NOT_ENOUGH_MEMORY;
+        return( ERROR );
     }
 
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&sema4_table_lock );
+    pthread_mutex_lock( &sema4_table_lock );
+    next_slot = sema4_next_slot;
+    pthread_mutex_unlock( &sema4_table_lock );
+    pthread_cleanup_pop( 0 );
+
     /*
-    **  Clean up the opening pthread_cleanup_push()
+    **  Keep the max_sems most contended semaphores seen so far in order,
+    **  most contended first.
     */
-    pthread_cleanup_pop( 0 );
+    count = 0;
+    for ( index = 1; index < next_slot; index++ )
+    {
+        /*
+        **  The ID of the slot's semaphore, if it has one in service, comes
+        **  from the slot alone.  A slab block is looked at without locking,
+        **  but one which may be in caller storage is only touched through
+        **  semInfoGet, which keeps it from being handed back meanwhile.
+        */
+        slot = sema4_slot( index );
+        if ( slot == (v2pt_sema4_slot_t *)NULL )
+            continue;
+        sema4 = __atomic_load_n( &(slot->sema4), __ATOMIC_ACQUIRE );
+        if ( sema4 == (v2pt_sema4_t *)NULL )
+            continue;
+        if ( !(__atomic_load_n( &(slot->users), __ATOMIC_RELAXED ) &
+               SLOT_CALLER_STORAGE) &&
+             (__atomic_load_n( &(sema4->stats.contended),
+                               __ATOMIC_RELAXED ) == 0) )
+            continue;
+        semid = (v2pt_sema4_id_t)((__atomic_load_n( &(slot->generation),
+                                                    __ATOMIC_ACQUIRE ) <<
+                                   SEMA4_INDEX_BITS) | (uintptr_t)index);
+        if ( (semInfoGet( semid, &info ) != OK) || (info.contended == 0) )
+            continue;
+        if ( (count == max_sems) &&
+             (info.contended <= top[count - 1].contended) )
+            continue;
+
+        if ( count < max_sems )
+            count++;
+        for ( i = count - 1;
+              (i > 0) && (top[i - 1].contended < info.contended); i-- )
+        {
+            top[i] = top[i - 1];
+            top_ids[i] = top_ids[i - 1];
+        }
+        top[i] = info;
+        top_ids[i] = semid;
+    }
 
-    if ( error != OK )
+    printf( "\n%-18s %-13s %12s %12s %10s %6s\n", "Semaphore Id", "Type",
+            "Takes", "Contended", "Timeouts", "Most" );
+    for ( i = 0; i < count; i++ )
     {
-        errno = (int)error;
-        error = ERROR;
+        printf( "%-18p %-13s %12lu %12lu %10lu %6d\n", top_ids[i],
+                (top[i].type == SEM_TYPE_BINARY) ? "BINARY" :
+                (top[i].type == SEM_TYPE_MUTEX) ? "MUTEX" :
+                (top[i].type == SEM_TYPE_COUNTING) ? "COUNTING" :
+                (top[i].type == SEM_TYPE_RW) ? "READER-WRITER" :
+                "RATE-LIMITER",
+                top[i].takes, top[i].contended, top[i].timeouts,
+                top[i].max_pended );
     }
 
-    return( error );
+    ts_free( (void *)top_ids );
+    ts_free( (void *)top );
+
+    return( OK );
 }
 
 /*****************************************************************************
-** waiting_on_sema4 - returns a nonzero result unless a qualifying event
-**                    occurs on the specified semaphore which should cause the
-**                    pended task to be awakened.  The qualifying events
-**                    are:
-**                        (1) a token is returned to the semaphore and the
-**                            current task is selected to receive it
-**                        (2) the semaphore is deleted or flushed
+** sema4_free - indicates whether the semaphore could be taken at once.  The
+**              caller must hold sema4_lock.
 *****************************************************************************/
 static int
-    waiting_on_sema4( v2pt_sema4_t *semaphore, struct timespec *timeout,
-                      int *retcode )
+   sema4_free( v2pt_sema4_t *sema4 )
 {
-    int result;
-    struct timeval now;
-    ulong usec;
-
-    if ( (semaphore->send_type & KILLD) || (semaphore->send_type & FLUSH) )
-    {
-        /*
-        **  Semaphore has been killed... waiting is over.
-        */
-        result = 0;
-        *retcode = 0;
-    }
-    else
-    {
-        /*
-        **  Semaphore still in service... check for token availability.
-        **  Initially assume no token available for our task
-        */
-        result = 1;
-
-        /*
-        **  Multiple posts to the semaphore may be represented by only
-        **  a single signal to the condition variable, so continue
-        **  checking for a token for our task as long as more tokens
-        **  are available.
-        */
-        while ( semaphore->token_count > 0 )
-        {
-            /*
-            **  Available token arrived... see if it's for our task.
-            */
-            if ( (signal_for_my_task( &(semaphore->first_susp),
-                                      (semaphore->flags & SEM_Q_PRIORITY) )) )
-            {
-                /*
-                **  Token was destined for our task specifically...
-                **  waiting is over.
-                */
-                semaphore->token_count--;
-                result = 0;
-                *retcode = 0;
-                break;
-            }
-            else
-            {
-                /*
-                **  Token isn't for our task...  Sleep awhile to
-                **  allow other tasks ahead of ours in the queue of tasks
-                **  waiting on the semaphore to get their tokens, bringing
-                **  our task to the head of the list.
-                */
-                pthread_mutex_unlock( &(semaphore->sema4_lock) );
-                taskDelay( 1 );
-                pthread_mutex_lock( &(semaphore->sema4_lock) );
-            }
+    if ( sema4->flags & PI_LOCK_OPTS )
+        return( sema4->current_owner == (v2pthread_cb_t *)NULL );
 
-            /*
-            **  If a timeout was specified, make sure we respect it and
-            **  exit this loop if it expires.
-            */
-            if ( timeout != (struct timespec *)NULL )
-            {
-                gettimeofday( &now, (struct timezone *)NULL );
-                if ( timeout->tv_nsec > (now.tv_usec * 1000) )
-                {
-                    usec = (timeout->tv_nsec - (now.tv_usec * 1000)) / 1000;
-                    if ( timeout->tv_sec < now.tv_sec )
-                        usec = 0;
-                    else
-                        usec += ((timeout->tv_sec - now.tv_sec) * 1000000);
-                }
-                else
-                {
-                    usec = ((timeout->tv_nsec + 1000000000) -
-                            (now.tv_usec * 1000)) / 1000;
-                    if ( (timeout->tv_sec - 1) < now.tv_sec )
-                        usec = 0;
-                    else
-                        usec += (((timeout->tv_sec - 1) - now.tv_sec)
-                                 * 1000000);
-                }
-                if ( usec == 0 )
-                    break;
-            }
-        }
-    }
+    if ( (sema4->flags & SEM_TYPE_MASK) == RW_SEMA4 )
+        return( (sema4->current_owner == (v2pthread_cb_t *)NULL) &&
+                (rw_readers( sema4 ) == 0) );
 
-    return( result );
+    return( __atomic_load_n( &(sema4->token_count), __ATOMIC_SEQ_CST ) > 0 );
 }
 
 /*****************************************************************************
-** wait_for_token - blocks the calling task until a token is available on the
-**                  specified v2pthread semaphore.  If a token is acquired and
-**                  the semaphore is a mutex type, this function also handles
-**                  priority inversion and deletion safety issues as needed.
+** semEvStart - registers the calling task to be sent the specified events
+**              whenever the specified semaphore is given and no task is
+**              pended on it.
 *****************************************************************************/
 STATUS
-   wait_for_token( v2pt_sema4_t *semaphore, int max_wait,
-                   v2pthread_cb_t *our_tcb )
+   semEvStart( v2pt_sema4_id_t semid, unsigned int events, int options )
 {
-    struct timeval now;
-    struct timespec timeout;
-    int retcode;
-    long sec, usec;
+    v2pt_sema4_t *semaphore;
+    int registered;
     STATUS error;
-    v2pthread_cb_t *tcb;
-    int my_priority, owners_priority, sched_policy;
 
     error = OK;
+    semaphore = sema4_for( semid );
 
     /*
-    **  Add tcb for task to list of tasks waiting on semaphore
+    **  No events are sent for a named semaphore, nor for a rate-limiter
+    **  semaphore, which is never given.
     */
-#ifdef DIAG_PRINTFS 
-    printf( "\r\ntask @ %p wait on semaphore list @ %p", our_tcb,
-            &(semaphore->first_susp) );
-#endif
-
-    link_susp_tcb( &(semaphore->first_susp), our_tcb );
-
-    retcode = 0;
+    if ( sema4_is_named( semaphore, semid ) ||
+         sema4_is_rate( semaphore, semid ) )
+    {
+        sema4_done();
+        errno = S_semLib_INVALID_OPERATION;
+        return( ERROR );
+    }
 
-    if ( max_wait == NO_WAIT )
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock));
+    if ( sema4_valid( semaphore, semid ) )
     {
+        registered = (semaphore->ev_reg.taskid != 0);
+        error = register_events( &(semaphore->ev_reg), events, options,
+                                 sema4_free( semaphore ) );
+
         /*
-        **  Caller specified no wait on semaphore token...
-        **  Check the condition variable with an immediate timeout.
+        **  Count a new registration as a watcher (see release_tokens).
         */
-        gettimeofday( &now, (struct timezone *)NULL );
-        timeout.tv_sec = now.tv_sec;
-        timeout.tv_nsec = now.tv_usec * 1000;
-        while ( (waiting_on_sema4( semaphore, &timeout, &retcode )) &&
-                (retcode != ETIMEDOUT) )
-        {
-            retcode = pthread_cond_timedwait( &(semaphore->sema4_send),
-                                              &(semaphore->sema4_lock),
-                                              &timeout );
-        }
+        if ( !registered && (semaphore->ev_reg.taskid != 0) )
+            __atomic_add_fetch( &(semaphore->watchers), 1,
+                                __ATOMIC_SEQ_CST );
+        else if ( registered && (semaphore->ev_reg.taskid == 0) )
+            __atomic_sub_fetch( &(semaphore->watchers), 1,
+                                __ATOMIC_SEQ_CST );
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
     }
     else
     {
-        /*
-        **  Caller expects to wait on semaphore, with or without a timeout.
-        **  If the semaphore is a mutex type, check for and handle any
-        **  priority inversion issues.
-        */
-        if ( (semaphore->flags & SEM_INVERSION_SAFE) &&
-             (semaphore->current_owner != (v2pthread_cb_t *)NULL) )
-        {
-            /*
-            **  Ensure against preemption by other tasks
-            */
-            taskLock();
-
-            /*
-            **  Get pthreads priority of current task
-            */
-            my_priority = our_tcb->prv_priority.sched_priority;
-
-            /*
-            **  Get pthreads priority of task which owns mutex
-            */
-            tcb = semaphore->current_owner;
-            owners_priority = tcb->prv_priority.sched_priority;
-
-#ifdef DIAG_PRINTFS 
-            printf( "\r\nTask @ %p priority %d owns mutex", tcb,
-                    owners_priority );
-            printf( "\r\nCalling task @ %p priority %d wants mutex", our_tcb,
-                    my_priority );
-#endif
-            /*
-            **  If mutex owner's priority is lower than ours, boost it
-            **  to our priority level tempororily until owner releases mutex.
-            **  This avoids 'priority inversion'.
-            */
-            if ( owners_priority < my_priority )
-            {
-		struct sched_param schedparam;
-                pthread_attr_getschedpolicy( &(tcb->attr), &sched_policy );
-                pthread_attr_getschedparam( &(tcb->attr), &schedparam );
-                schedparam.sched_priority = my_priority;
-                pthread_attr_setschedparam( &(tcb->attr), &schedparam );
-                pthread_setschedparam( tcb->pthrid, sched_policy, &schedparam );
-            }
-
-            /*
-            **  Re-enable preemption by other tasks
-            */
-            taskUnlock();
-        }
-
-        if ( max_wait == WAIT_FOREVER )
-        {
-            /*
-            **  Infinite wait was specified... wait without timeout.
-            */
-            while ( waiting_on_sema4( semaphore, 0, &retcode ) )
-            {
-                pthread_cond_wait( &(semaphore->sema4_send),
-                                   &(semaphore->sema4_lock) );
-            }
-        }
-        else
-        {
-            /*
-            **  Wait on semaphore message arrival with timeout...
-            **  Calculate timeout delay in seconds and microseconds.
-            */
-            sec = 0;
-            usec = max_wait * V2PT_TICK * 1000;
-            gettimeofday( &now, (struct timezone *)NULL );
-            usec += now.tv_usec;
-            if ( usec > 1000000 )
-            {
-                sec = usec / 1000000;
-                usec = usec % 1000000;
-            }
-            timeout.tv_sec = now.tv_sec + sec;
-            timeout.tv_nsec = usec * 1000;
-
-            /*
-            **  Wait for a semaphore message for the current task or
-            **  for the timeout to expire.  The loop is required since
-            **  the task may be awakened by signals for semaphore
-            **  tokens which are not ours, or for signals other than
-            **  from a semaphore token being returned.
-            */
-            while ( (waiting_on_sema4( semaphore, &timeout, &retcode )) &&
-                    (retcode != ETIMEDOUT) )
-            {
-                retcode = pthread_cond_timedwait( &(semaphore->sema4_send),
-                                                  &(semaphore->sema4_lock),
-                                                  &timeout );
-            }
-        }
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
     }
+    pthread_cleanup_pop( 0 );
 
-    /*
-    **  Remove the calling task's tcb from the waiting task list
-    **  for the semaphore.  Clear our TCB's suspend list pointer in
-    **  case the semaphore was killed & its ctrl blk deallocated.
-    */
-    unlink_susp_tcb( &(semaphore->first_susp), our_tcb );
-    our_tcb->suspend_list = (v2pthread_cb_t **)NULL;
-
-    /*
-    **  See if we were awakened due to a semDelete or a semFlush.
-    */
-    if ( (semaphore->send_type & KILLD) || (semaphore->send_type & FLUSH) )
+    if ( error != OK )
     {
-        if ( semaphore->send_type & KILLD )
-        {
-            error = S_objLib_OBJ_ID_ERROR;       /* Semaphore deleted */
-
-#ifdef DIAG_PRINTFS 
-            printf( "...semaphore deleted" );
-#endif
-        }
-        else
-        {
-#ifdef DIAG_PRINTFS 
-            printf( "...semaphore flushed" );
-#endif
-        }
+        errno = (int)error;
+        error = ERROR;
+    }
+    sema4_done();
 
-        if ( semaphore->first_susp == (v2pthread_cb_t *)NULL )
-        {
-            /*
-            ** Lock mutex for semaphore delete completion
-            */
-            pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                                  (void *)&(semaphore->smdel_lock) );
-            pthread_mutex_lock( &(semaphore->smdel_lock) );
+    return( error );
+}
 
-            /*
-            **  Signal the delete-complete condition variable
-            **  for the semaphore
-            */
-            pthread_cond_broadcast( &(semaphore->smdel_cplt) );
+/*****************************************************************************
+** semEvStop - ends the calling task's registration for events from the
+**             specified semaphore.
+*****************************************************************************/
+STATUS
+   semEvStop( v2pt_sema4_id_t semid )
+{
+    v2pt_sema4_t *semaphore;
+    STATUS error;
 
-            semaphore->send_type = SEND;
+    error = OK;
+    semaphore = sema4_for( semid );
 
-            /*
-            **  Unlock the semaphore delete completion mutex. 
-            */
-            pthread_cleanup_pop( 1 );
-        }
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(semaphore->sema4_lock));
+    if ( sema4_valid( semaphore, semid ) )
+    {
+        error = unregister_events( &(semaphore->ev_reg) );
+        if ( error == OK )
+            __atomic_sub_fetch( &(semaphore->watchers), 1,
+                                __ATOMIC_SEQ_CST );
+        pthread_mutex_unlock( &(semaphore->sema4_lock) );
     }
     else
     {
-        /*
-        **  See if we timed out or if we got a token
-        */
-        if ( retcode == ETIMEDOUT )
-        {
-            /*
-            **  Timed out without a token
-            */
-            if ( max_wait == NO_WAIT )
-            {
-                error = S_objLib_OBJ_UNAVAILABLE;
-#ifdef DIAG_PRINTFS 
-                printf( "...no token available" );
-#endif
-            }
-            else
-            {
-                error = S_objLib_OBJ_TIMEOUT;
-#ifdef DIAG_PRINTFS 
-                printf( "...timed out" );
-#endif
-            }
-        }
-        else
-        {
-            /*
-            **  Just received a token from the semaphore...
-            **  If the semaphore is a mutex, indicate the mutex is now owned
-            **  by the current task, and then see if the task owning the
-            **  token is to be made deletion-safe.  
-            */
-            if ( (semaphore->flags & SEM_TYPE_MASK) == MUTEX_SEMA4 )
-            {
-                semaphore->current_owner = our_tcb;
-                semaphore->recursion_level++;
-                if ( semaphore->flags & SEM_DELETE_SAFE )
-                    taskSafe();
-            }
+        error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
+    }
+    pthread_cleanup_pop( 0 );
 
-#ifdef DIAG_PRINTFS 
-            printf( "...rcvd semaphore token" );
-#endif
-        }
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
     }
+    sema4_done();
 
     return( error );
 }
 
 /*****************************************************************************
-** semTake - blocks the calling task until a token is available on the
-**           specified v2pthread semaphore.
+** sema4_watch - adds a task in objWaitAny to the specified semaphore's watch
+**               list, so that it is woken when a token may be available.
+**               Returns OK, or S_objLib_OBJ_ID_ERROR for an invalid ID.
 *****************************************************************************/
 STATUS
-   semTake( v2pt_sema4_t *semaphore, int max_wait )
+   sema4_watch( v2pt_sema4_id_t semid, v2pt_watch_t *watch )
 {
-    v2pthread_cb_t *our_tcb;
+    v2pt_sema4_t *semaphore;
     STATUS error;
 
     error = OK;
+    semaphore = sema4_for( semid );
 
     /*
-    **  First ensure that the specified semaphore exists and that we have
-    **  exclusive access to it.
+    **  objWaitAny cannot watch a named semaphore, nor a rate-limiter
+    **  semaphore, which is never given.
     */
+    if ( sema4_is_named( semaphore, semid ) ||
+         sema4_is_rate( semaphore, semid ) )
+    {
+        sema4_done();
+        return( S_semLib_INVALID_OPERATION );
+    }
+
     pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
                           (void *)&(semaphore->sema4_lock));
-    if ( sema4_valid( semaphore ) )
+    if ( sema4_valid( semaphore, semid ) )
     {
-        /*
-        **  If the semaphore is a mutex, check to see if this task already
-        **  owns the token.
-        */
-        our_tcb = my_tcb();
-        if ( ((semaphore->flags & SEM_TYPE_MASK) == MUTEX_SEMA4) &&
-             (semaphore->current_owner == our_tcb) )
-        {
-            /*
-            **  Current task already owns the mutex... simply increment the
-            **  ownership recursion level and return.
-            */
-            semaphore->recursion_level++;
-#ifdef DIAG_PRINTFS 
-            printf( "... recursion level = %d", semaphore->recursion_level );
-#endif
-        }
-        else
-        {
-            /*
-            **  Either semaphore is not a mutex or current task doesn't own it
-            **  Wait for timeout or acquisition of token
-            */
-            error = wait_for_token( semaphore, max_wait, our_tcb );
-        } 
+        watch->object = (void *)semaphore;
+        link_watch( &(semaphore->first_watch), watch );
 
         /*
-        **  Unlock the mutex for the condition variable and clean up.
+        **  Count the watcher before the task next looks for a token (see
+        **  release_tokens).
         */
+        __atomic_add_fetch( &(semaphore->watchers), 1, __ATOMIC_SEQ_CST );
         pthread_mutex_unlock( &(semaphore->sema4_lock) );
     }
     else
     {
         error = S_objLib_OBJ_ID_ERROR;       /* Invalid semaphore specified */
     }
+    pthread_cleanup_pop( 0 );
+    sema4_done();
+
+    return( error );
+}
+
+/*****************************************************************************
+** sema4_unwatch - takes a task leaving objWaitAny off the semaphore's watch
+**                 list, unless semDelete has already let go of it.  A slab
+**                 control block may be locked even after semDelete, since
+**                 it is never freed; caller storage is kept from being
+**                 handed back meanwhile by counting the task as using it.
+*****************************************************************************/
+void
+   sema4_unwatch( v2pt_sema4_id_t semid, v2pt_watch_t *watch )
+{
+    v2pt_sema4_slot_t *slot;
+    v2pt_sema4_t *semaphore;
 
     /*
-    **  Clean up the opening pthread_cleanup_push()
+    **  Once semDelete is handing the storage back, it has already let go
+    **  of every watch record.
     */
-    pthread_cleanup_pop( 0 );
-
-    if ( error != OK )
+    slot = sema4_slot( (uintptr_t)semid & SEMA4_INDEX_MASK );
+    semaphore = (v2pt_sema4_t *)NULL;
+    if ( (slot == (v2pt_sema4_slot_t *)NULL) ||
+         !(__atomic_load_n( &(slot->users), __ATOMIC_RELAXED ) &
+           SLOT_CALLER_STORAGE) ||
+         sema4_use( slot ) )
+        semaphore = (v2pt_sema4_t *)__atomic_load_n( &(watch->object),
+                                                     __ATOMIC_SEQ_CST );
+    if ( semaphore != (v2pt_sema4_t *)NULL )
     {
-        errno = (int)error;
-        error = ERROR;
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&(semaphore->sema4_lock));
+        pthread_mutex_lock( &(semaphore->sema4_lock) );
+        if ( unlink_watch( &(semaphore->first_watch), watch ) )
+            __atomic_sub_fetch( &(semaphore->watchers), 1,
+                                __ATOMIC_SEQ_CST );
+        pthread_cleanup_pop( 1 );
     }
-
-    return( error );
+    sema4_done();
 }
@@ -0,0 +1,1127 @@
+/*****************************************************************************
+ * semOpenLib.c - defines the wrapper functions and data structures needed
+ *                to implement Wind River VxWorks (R) named semaphores,
+ *                shared between processes, in a POSIX Threads environment.
+ *
+ * Copyright (C) 2000, 2001  MontaVista Software Inc.
+ *
+ * Author : Gary S. Robertson
+ *
+ * VxWorks is a registered trademark of Wind River Systems, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ ****************************************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/futex.h>
+#include "v2pthread.h"
+#include "vxw_defs.h"
+
+/*
+**  The shared memory object holding a named semaphore is called SHM_PREFIX
+**  followed by the semaphore name, less any leading '/'.  Its creator sets
+**  SHM_MAGIC in it last of all, holding an flock on it until then; a
+**  process opening it waits up to SHM_OPEN_TRIES milliseconds for that.
+**  If the magic is still missing and the flock is free, the creator died
+**  part way, and the object is unlinked so that the name can be reused.
+*/
+#define SHM_PREFIX         "/v2lin.sem."
+#define SHM_MAGIC          0x76326c73
+#define SHM_OPEN_TRIES     1000
+
+/*
+**  V2LIN_SEM_OPENERS is the number of opens, by all processes together,
+**                    which one named semaphore can have at the same time.
+**                    A process counts once however often it opens it.
+*/
+#ifndef V2LIN_SEM_OPENERS
+#define V2LIN_SEM_OPENERS 64
+#endif
+
+/*
+**  Semaphore ID as seen by the application (SEM_ID in vxw_hdrs.h)
+*/
+typedef void *v2pt_sema4_id_t;
+
+/*****************************************************************************
+**  Named semaphore, in a shared memory object mapped by each process which
+**  has it open.  Its locks are robust and shared between processes, so one
+**  left locked by a process which died is recovered by the next taker.
+*****************************************************************************/
+typedef struct v2pt_shm_sema4
+{
+        /*
+        ** SHM_MAGIC once the creator has initialized the rest
+        */
+    unsigned int
+        magic;
+
+        /*
+        ** Semaphore type (SEM_TYPE_BINARY, _MUTEX or _COUNTING) and options
+        */
+    int
+        type;
+    int
+        options;
+
+        /*
+        ** Tokens available from a binary or counting semaphore.  Tasks wait
+        ** for tokens on this word, as a futex shared between processes.
+        */
+    int
+        token_count;
+
+        /*
+        ** Tasks in all processes waiting for tokens
+        */
+    int
+        waiters;
+
+        /*
+        ** The mutex itself for a mutex semaphore: recursive, robust and
+        ** (with SEM_INVERSION_SAFE) priority-inheriting
+        */
+    pthread_mutex_t
+        mutex;
+
+        /*
+        ** Mutex serializing opens, closes and unlinks of the semaphore
+        */
+    pthread_mutex_t
+        open_lock;
+
+        /*
+        ** Flag set once the name is removed, and flag indicating if the
+        ** last close removes it (OM_DELETE_ON_LAST_CLOSE)
+        */
+    int
+        unlinked;
+    int
+        delete_on_last_close;
+
+        /*
+        ** Process ID of each process which has the semaphore open (zero if
+        ** the entry is free)
+        */
+    pid_t
+        opener[V2LIN_SEM_OPENERS];
+} v2pt_shm_sema4_t;
+
+/*****************************************************************************
+**  Named semaphore as opened by this process.  These are never freed, only
+**  reused, so that a task holding a stale SEM_ID can still look one over
+**  and find its ID gone.
+*****************************************************************************/
+typedef struct v2pt_named_sema4
+{
+        /*
+        ** Next named semaphore opened by this process
+        */
+    struct v2pt_named_sema4 *
+        nxt_named;
+
+        /*
+        ** Name of the shared memory object
+        */
+    char
+        shm_name[NAME_MAX + 1];
+
+        /*
+        ** Mapping of the shared memory object, or NULL if the entry is free
+        */
+    v2pt_shm_sema4_t *
+        shm;
+
+        /*
+        ** Entry of the opener table held by this process
+        */
+    int
+        opener;
+
+        /*
+        ** ID of the local control block standing for the semaphore, or NULL
+        ** once it is closed
+        */
+    v2pt_sema4_id_t
+        semid;
+
+        /*
+        ** semOpen calls not yet matched by semClose
+        */
+    int
+        opens;
+
+        /*
+        ** Tasks of this process inside a take or give of the semaphore
+        */
+    int
+        users;
+} v2pt_named_sema4_t;
+
+/*****************************************************************************
+**  External function and data references
+*****************************************************************************/
+extern void *
+    ts_malloc( size_t blksize );
+extern void
+   deadline_after_ticks( int ticks, struct timespec *deadline );
+extern int
+   lock_mutex_until( pthread_mutex_t *mutex,
+                     const struct timespec *deadline );
+extern v2pt_sema4_id_t
+   bind_named_sema4( void *named, int opt );
+extern void *
+   named_sema4_for( v2pt_sema4_id_t semid );
+extern void
+   release_named_sema4( v2pt_sema4_id_t semid );
+
+/*****************************************************************************
+**  Module variables
+*****************************************************************************/
+
+/*
+**  named_list heads the list of named semaphores opened by this process,
+**  and named_list_lock serializes opens and closes of them.
+*/
+static v2pt_named_sema4_t *
+    named_list = (v2pt_named_sema4_t *)NULL;
+static pthread_mutex_t
+    named_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*****************************************************************************
+** shm_name_for - forms the shared memory object name for a named semaphore.
+**                Returns FALSE if the semaphore name is not valid.
+*****************************************************************************/
+static int
+   shm_name_for( const char *name, char *shm_name )
+{
+    if ( name == (const char *)NULL )
+        return( FALSE );
+    if ( *name == '/' )
+        name++;
+    if ( (*name == '\0') || (strchr( name, '/' ) != (char *)NULL) ||
+         (strlen( SHM_PREFIX ) + strlen( name ) > NAME_MAX) )
+        return( FALSE );
+
+    strcpy( shm_name, SHM_PREFIX );
+    strcat( shm_name, name );
+    return( TRUE );
+}
+
+/*****************************************************************************
+** lock_shm_sema4 - locks the open_lock of a named semaphore, recovering it
+**                  if a process died holding it.  (It is assumed that a
+**                  'pthread_cleanup_push()' has already been performed.)
+*****************************************************************************/
+static void
+   lock_shm_sema4( v2pt_shm_sema4_t *shm )
+{
+    if ( pthread_mutex_lock( &(shm->open_lock) ) == EOWNERDEAD )
+        pthread_mutex_consistent( &(shm->open_lock) );
+}
+
+/*****************************************************************************
+** reap_openers - frees the opener table entries of processes which died
+**                without closing the semaphore.  The caller must hold
+**                open_lock.  Returns the number of entries left in use.
+*****************************************************************************/
+static int
+   reap_openers( v2pt_shm_sema4_t *shm )
+{
+    int openers;
+    int i;
+
+    openers = 0;
+    for ( i = 0; i < V2LIN_SEM_OPENERS; i++ )
+    {
+        if ( shm->opener[i] == 0 )
+            continue;
+        if ( (kill( shm->opener[i], 0 ) != 0) && (errno == ESRCH) )
+            shm->opener[i] = 0;
+        else
+            openers++;
+    }
+
+    return( openers );
+}
+
+/*****************************************************************************
+** init_shm_sema4 - initializes a named semaphore just created in shared
+**                  memory, and marks it ready for other processes.
+*****************************************************************************/
+static void
+   init_shm_sema4( v2pt_shm_sema4_t *shm, int type, int state, int opt )
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+    pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+    pthread_mutex_init( &(shm->open_lock), &attr );
+
+    if ( type == SEM_TYPE_MUTEX )
+    {
+        pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+        if ( opt & SEM_INVERSION_SAFE )
+            pthread_mutexattr_setprotocol( &attr, PTHREAD_PRIO_INHERIT );
+        pthread_mutex_init( &(shm->mutex), &attr );
+        shm->token_count = 0;
+    }
+    else if ( type == SEM_TYPE_BINARY )
+        shm->token_count = (state == 0) ? 0 : 1;
+    else
+        shm->token_count = state;
+    pthread_mutexattr_destroy( &attr );
+
+    shm->type = type;
+    shm->options = opt;
+    shm->waiters = 0;
+    shm->unlinked = FALSE;
+    shm->delete_on_last_close = FALSE;
+    memset( shm->opener, 0, sizeof( shm->opener ) );
+
+    __atomic_store_n( &(shm->magic), SHM_MAGIC, __ATOMIC_RELEASE );
+}
+
+/*****************************************************************************
+** stale_shm_sema4 - called when the shared memory object open on fd has not
+**                   been initialized in time.  Returns TRUE, having unlinked
+**                   it, if its creator is gone (the flock is free) and it
+**                   is still uninitialized; FALSE if the creator is still
+**                   at work, or has finished after all.
+*****************************************************************************/
+static int
+   stale_shm_sema4( int fd, const char *shm_name )
+{
+    v2pt_shm_sema4_t *shm;
+    struct stat info;
+    struct stat named;
+    int stale;
+    int name_fd;
+
+    if ( flock( fd, LOCK_EX | LOCK_NB ) != 0 )
+        return( FALSE );
+
+    stale = FALSE;
+    if ( fstat( fd, &info ) == 0 )
+    {
+        stale = TRUE;
+        if ( info.st_size >= sizeof( v2pt_shm_sema4_t ) )
+        {
+            shm = (v2pt_shm_sema4_t *)mmap( NULL, sizeof( v2pt_shm_sema4_t ),
+                                            PROT_READ, MAP_SHARED, fd, 0 );
+            if ( (shm == (v2pt_shm_sema4_t *)MAP_FAILED) ||
+                 (__atomic_load_n( &(shm->magic), __ATOMIC_ACQUIRE ) ==
+                  SHM_MAGIC) )
+                stale = FALSE;
+            if ( shm != (v2pt_shm_sema4_t *)MAP_FAILED )
+                munmap( shm, sizeof( v2pt_shm_sema4_t ) );
+        }
+    }
+
+    /*
+    **  Another process may have unlinked the object already and created a
+    **  new one under the name; unlink the name only if it is still ours.
+    */
+    if ( stale )
+    {
+        name_fd = shm_open( shm_name, O_RDWR, 0 );
+        stale = ((name_fd >= 0) && (fstat( name_fd, &named ) == 0) &&
+                 (named.st_dev == info.st_dev) &&
+                 (named.st_ino == info.st_ino));
+        if ( name_fd >= 0 )
+            close( name_fd );
+        if ( stale )
+            shm_unlink( shm_name );
+    }
+
+    flock( fd, LOCK_UN );
+    return( stale );
+}
+
+/*****************************************************************************
+** map_shm_sema4 - opens the shared memory object for a named semaphore,
+**                 creating and initializing it if mode allows, and maps it.
+**                 Returns NULL, with errno set, on failure.
+*****************************************************************************/
+static v2pt_shm_sema4_t *
+   map_shm_sema4( const char *shm_name, int type, int state, int opt,
+                  int mode )
+{
+    v2pt_shm_sema4_t *shm;
+    struct stat info;
+    int created;
+    int tries;
+    int fd;
+
+    /*
+    **  Create the object if asked to, unless it exists already.
+    */
+    created = FALSE;
+    fd = -1;
+    if ( mode & OM_CREATE )
+    {
+        fd = shm_open( shm_name, O_RDWR | O_CREAT | O_EXCL, 0666 );
+        if ( fd >= 0 )
+        {
+            created = TRUE;
+            flock( fd, LOCK_EX );
+        }
+        else if ( errno != EEXIST )
+            return( (v2pt_shm_sema4_t *)NULL );
+        else if ( mode & OM_EXCL )
+        {
+            errno = S_objLib_OBJ_NAME_CLASH;
+            return( (v2pt_shm_sema4_t *)NULL );
+        }
+    }
+    if ( fd < 0 )
+    {
+        fd = shm_open( shm_name, O_RDWR, 0 );
+        if ( fd < 0 )
+        {
+            if ( errno == ENOENT )
+                errno = S_objLib_OBJ_NOT_FOUND;
+            return( (v2pt_shm_sema4_t *)NULL );
+        }
+    }
+
+    /*
+    **  The creator sizes the object; anyone else waits until it has.
+    */
+    if ( created )
+    {
+        if ( ftruncate( fd, sizeof( v2pt_shm_sema4_t ) ) != 0 )
+        {
+            close( fd );
+            shm_unlink( shm_name );
+            return( (v2pt_shm_sema4_t *)NULL );
+        }
+    }
+    else
+    {
+        for ( tries = 0; tries < SHM_OPEN_TRIES; tries++ )
+        {
+            if ( (fstat( fd, &info ) == 0) &&
+                 (info.st_size >= sizeof( v2pt_shm_sema4_t )) )
+                break;
+            usleep( 1000 );
+        }
+        if ( tries == SHM_OPEN_TRIES )
+        {
+            /*
+            **  If the creator died before sizing the object, start over.
+            */
+            if ( stale_shm_sema4( fd, shm_name ) )
+            {
+                close( fd );
+                return( map_shm_sema4( shm_name, type, state, opt, mode ) );
+            }
+            close( fd );
+            errno = S_objLib_OBJ_NOT_FOUND;
+            return( (v2pt_shm_sema4_t *)NULL );
+        }
+    }
+
+    shm = (v2pt_shm_sema4_t *)mmap( NULL, sizeof( v2pt_shm_sema4_t ),
+                                    PROT_READ | PROT_WRITE, MAP_SHARED,
+                                    fd, 0 );
+    if ( shm == (v2pt_shm_sema4_t *)MAP_FAILED )
+    {
+        if ( created )
+            shm_unlink( shm_name );
+        close( fd );
+        return( (v2pt_shm_sema4_t *)NULL );
+    }
+
+    if ( created )
+        init_shm_sema4( shm, type, state, opt );
+    else
+    {
+        for ( tries = 0; tries < SHM_OPEN_TRIES; tries++ )
+        {
+            if ( __atomic_load_n( &(shm->magic), __ATOMIC_ACQUIRE ) ==
+                 SHM_MAGIC )
+                break;
+            usleep( 1000 );
+        }
+        if ( tries == SHM_OPEN_TRIES )
+        {
+            munmap( shm, sizeof( v2pt_shm_sema4_t ) );
+
+            /*
+            **  If the creator died before initializing the object, start
+            **  over.
+            */
+            if ( stale_shm_sema4( fd, shm_name ) )
+            {
+                close( fd );
+                return( map_shm_sema4( shm_name, type, state, opt, mode ) );
+            }
+            close( fd );
+            errno = S_objLib_OBJ_NOT_FOUND;
+            return( (v2pt_shm_sema4_t *)NULL );
+        }
+    }
+
+    /*
+    **  Closing the object also releases the creator's flock.
+    */
+    close( fd );
+    return( shm );
+}
+
+/*****************************************************************************
+** attach_shm_sema4 - enters the calling process in the opener table of a
+**                    named semaphore it has mapped.  Returns the table
+**                    entry, or -1 with errno set if the semaphore is of
+**                    another type or the table is full.
+*****************************************************************************/
+static int
+   attach_shm_sema4( v2pt_shm_sema4_t *shm, int type, int mode )
+{
+    int opener;
+    int i;
+
+    opener = -1;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(shm->open_lock) );
+    lock_shm_sema4( shm );
+
+    if ( shm->type != type )
+        errno = S_objLib_OBJ_NAME_CLASH;
+    else
+    {
+        reap_openers( shm );
+        for ( i = 0; i < V2LIN_SEM_OPENERS; i++ )
+        {
+            if ( shm->opener[i] == 0 )
+            {
+                shm->opener[i] = getpid();
+                opener = i;
+                break;
+            }
+        }
+        if ( opener < 0 )
+            errno = S_objLib_OBJ_UNAVAILABLE;
+        else if ( mode & OM_DELETE_ON_LAST_CLOSE )
+            shm->delete_on_last_close = TRUE;
+    }
+
+    pthread_mutex_unlock( &(shm->open_lock) );
+    pthread_cleanup_pop( 0 );
+
+    return( opener );
+}
+
+/*****************************************************************************
+** detach_shm_sema4 - removes the calling process from the opener table of a
+**                    named semaphore, removing the name as well if this was
+**                    the last open and it was opened with
+**                    OM_DELETE_ON_LAST_CLOSE, then unmaps the semaphore.
+*****************************************************************************/
+static void
+   detach_shm_sema4( v2pt_shm_sema4_t *shm, int opener, const char *shm_name )
+{
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&(shm->open_lock) );
+    lock_shm_sema4( shm );
+
+    shm->opener[opener] = 0;
+    if ( (reap_openers( shm ) == 0) && shm->delete_on_last_close &&
+         !shm->unlinked )
+    {
+        shm_unlink( shm_name );
+        shm->unlinked = TRUE;
+    }
+
+    pthread_mutex_unlock( &(shm->open_lock) );
+    pthread_cleanup_pop( 0 );
+
+    munmap( shm, sizeof( v2pt_shm_sema4_t ) );
+}
+
+/*****************************************************************************
+** enter_named - counts a task into a take or give of a named semaphore.
+**               Returns FALSE if the semaphore is no longer open under the
+**               specified ID, in which case the task is not counted.
+*****************************************************************************/
+static int
+   enter_named( v2pt_named_sema4_t *named, v2pt_sema4_id_t semid )
+{
+    if ( named == (v2pt_named_sema4_t *)NULL )
+        return( FALSE );
+
+    __atomic_add_fetch( &(named->users), 1, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &(named->semid), __ATOMIC_SEQ_CST ) != semid )
+    {
+        __atomic_sub_fetch( &(named->users), 1, __ATOMIC_SEQ_CST );
+        return( FALSE );
+    }
+
+    return( TRUE );
+}
+
+/*****************************************************************************
+** leave_named - counts a task out of a take or give of a named semaphore.
+**               Also used as a cleanup handler.
+*****************************************************************************/
+static void
+   leave_named( void *named )
+{
+    __atomic_sub_fetch( &(((v2pt_named_sema4_t *)named)->users), 1,
+                        __ATOMIC_SEQ_CST );
+}
+
+/*****************************************************************************
+** leave_token_wait - counts a task out of the waiters for tokens from a
+**                    named semaphore.  Also used as a cleanup handler.
+*****************************************************************************/
+static void
+   leave_token_wait( void *shm )
+{
+    __atomic_sub_fetch( &(((v2pt_shm_sema4_t *)shm)->waiters), 1,
+                        __ATOMIC_SEQ_CST );
+}
+
+/*****************************************************************************
+** wait_on_word - blocks the calling task while a futex word shared between
+**                processes holds the specified value, until it is woken or
+**                the CLOCK_MONOTONIC deadline (if any) passes.  The task
+**                may be deleted while it waits.  Returns 0, ETIMEDOUT or
+**                another reason for waking early.
+*****************************************************************************/
+static int
+   wait_on_word( int *word, int value, const struct timespec *deadline )
+{
+    int oldtype;
+    long result;
+
+    /*
+    **  The futex call is not a cancellation point, so let taskDelete act
+    **  at once while the task is blocked in it.  Nothing is held here.
+    */
+    pthread_setcanceltype( PTHREAD_CANCEL_ASYNCHRONOUS, &oldtype );
+    result = syscall( SYS_futex, word, FUTEX_WAIT_BITSET, value, deadline,
+                      NULL, FUTEX_BITSET_MATCH_ANY );
+    pthread_setcanceltype( oldtype, (int *)NULL );
+
+    return( (result == 0) ? 0 : errno );
+}
+
+/*****************************************************************************
+** wake_word - wakes up to count tasks waiting on a futex word shared between
+**             processes.
+*****************************************************************************/
+static void
+   wake_word( int *word, int count )
+{
+    syscall( SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0 );
+}
+
+/*****************************************************************************
+** take_named_token - takes a token from a named binary or counting
+**                    semaphore, waiting up to max_wait ticks for one, or
+**                    until the CLOCK_MONOTONIC deadline if one is given.
+*****************************************************************************/
+static STATUS
+   take_named_token( v2pt_named_sema4_t *named, v2pt_sema4_id_t semid,
+                     int max_wait, const struct timespec *deadline )
+{
+    v2pt_shm_sema4_t *shm;
+    struct timespec timeout;
+    STATUS error;
+    int count;
+
+    shm = named->shm;
+    if ( (max_wait != NO_WAIT) && (max_wait != WAIT_FOREVER) &&
+         (deadline == (const struct timespec *)NULL) )
+    {
+        deadline_after_ticks( max_wait, &timeout );
+        deadline = &timeout;
+    }
+
+    error = OK;
+    for ( ;; )
+    {
+        count = __atomic_load_n( &(shm->token_count), __ATOMIC_SEQ_CST );
+        if ( count > 0 )
+        {
+            if ( __atomic_compare_exchange_n( &(shm->token_count), &count,
+                                              count - 1, FALSE,
+                                              __ATOMIC_SEQ_CST,
+                                              __ATOMIC_SEQ_CST ) )
+                break;
+            continue;
+        }
+        if ( max_wait == NO_WAIT )
+        {
+            error = S_objLib_OBJ_UNAVAILABLE;
+            break;
+        }
+
+        /*
+        **  semClose wakes the task to find the semaphore closed.
+        */
+        if ( __atomic_load_n( &(named->semid), __ATOMIC_SEQ_CST ) != semid )
+        {
+            error = S_objLib_OBJ_ID_ERROR;
+            break;
+        }
+
+        /*
+        **  Count the task among the waiters before it looks at the token
+        **  count again (in the kernel), so that a give cannot miss it.
+        */
+        __atomic_add_fetch( &(shm->waiters), 1, __ATOMIC_SEQ_CST );
+        pthread_cleanup_push( leave_token_wait, (void *)shm );
+        if ( wait_on_word( &(shm->token_count), 0, deadline ) == ETIMEDOUT )
+            error = S_objLib_OBJ_TIMEOUT;
+        pthread_cleanup_pop( 1 );
+        if ( error != OK )
+            break;
+    }
+
+    return( error );
+}
+
+/*****************************************************************************
+** give_named_token - gives a token to a named binary or counting semaphore
+**                    and wakes one waiting task, in whichever process.  The
+**                    kernel wakes the highest priority waiter first.
+*****************************************************************************/
+static void
+   give_named_token( v2pt_shm_sema4_t *shm )
+{
+    if ( shm->type == SEM_TYPE_BINARY )
+        __atomic_store_n( &(shm->token_count), 1, __ATOMIC_SEQ_CST );
+    else
+        __atomic_add_fetch( &(shm->token_count), 1, __ATOMIC_SEQ_CST );
+
+    if ( __atomic_load_n( &(shm->waiters), __ATOMIC_SEQ_CST ) > 0 )
+        wake_word( &(shm->token_count), 1 );
+}
+
+/*****************************************************************************
+** take_named_mutex - takes a named mutex, waiting up to max_wait ticks, or
+**                    until the CLOCK_MONOTONIC deadline if one is given.
+**                    A mutex left locked by a task or process which died
+**                    is recovered for the caller.
+*****************************************************************************/
+static STATUS
+   take_named_mutex( v2pt_named_sema4_t *named, v2pt_sema4_id_t semid,
+                     int max_wait, const struct timespec *deadline )
+{
+    v2pt_shm_sema4_t *shm;
+    struct timespec timeout;
+    STATUS error;
+    int retcode;
+
+    shm = named->shm;
+    retcode = pthread_mutex_trylock( &(shm->mutex) );
+    if ( (retcode == EBUSY) && (max_wait != NO_WAIT) )
+    {
+        if ( (max_wait != WAIT_FOREVER) &&
+             (deadline == (const struct timespec *)NULL) )
+        {
+            deadline_after_ticks( max_wait, &timeout );
+            deadline = &timeout;
+        }
+
+        /*
+        **  Waiting in slices lets taskDelete act on the task meanwhile.
+        */
+        retcode = lock_mutex_until( &(shm->mutex), deadline );
+    }
+
+    if ( retcode == EOWNERDEAD )
+    {
+        pthread_mutex_consistent( &(shm->mutex) );
+        retcode = 0;
+    }
+
+    error = OK;
+    if ( retcode == 0 )
+    {
+        /*
+        **  semClose waits for the task to get the mutex; give it back.
+        */
+        if ( __atomic_load_n( &(named->semid), __ATOMIC_SEQ_CST ) != semid )
+        {
+            pthread_mutex_unlock( &(shm->mutex) );
+            error = S_objLib_OBJ_ID_ERROR;
+        }
+    }
+    else if ( retcode == EBUSY )
+        error = S_objLib_OBJ_UNAVAILABLE;
+    else if ( retcode == ETIMEDOUT )
+        error = S_objLib_OBJ_TIMEOUT;
+    else
+        error = S_semLib_INVALID_OPERATION;
+
+    return( error );
+}
+
+/*****************************************************************************
+** named_sema4_take - takes a named semaphore for semTake, for up to max_wait
+**                    ticks or until deadline if one is given.  Returns OK
+**                    or an error code.
+*****************************************************************************/
+STATUS
+   named_sema4_take( void *named_sema4, v2pt_sema4_id_t semid, int max_wait,
+                     const struct timespec *deadline )
+{
+    v2pt_named_sema4_t *named;
+    STATUS error;
+
+    named = (v2pt_named_sema4_t *)named_sema4;
+    if ( !enter_named( named, semid ) )
+        return( S_objLib_OBJ_ID_ERROR );
+
+    pthread_cleanup_push( leave_named, (void *)named );
+    if ( named->shm->type == SEM_TYPE_MUTEX )
+        error = take_named_mutex( named, semid, max_wait, deadline );
+    else
+        error = take_named_token( named, semid, max_wait, deadline );
+    pthread_cleanup_pop( 1 );
+
+    return( error );
+}
+
+/*****************************************************************************
+** named_sema4_give - gives a named semaphore for semGive.  Returns OK or an
+**                    error code.
+*****************************************************************************/
+STATUS
+   named_sema4_give( void *named_sema4, v2pt_sema4_id_t semid )
+{
+    v2pt_named_sema4_t *named;
+    STATUS error;
+
+    named = (v2pt_named_sema4_t *)named_sema4;
+    if ( !enter_named( named, semid ) )
+        return( S_objLib_OBJ_ID_ERROR );
+
+    error = OK;
+    if ( named->shm->type == SEM_TYPE_MUTEX )
+    {
+        if ( pthread_mutex_unlock( &(named->shm->mutex) ) != 0 )
+            error = S_semLib_INVALID_OPERATION;  /* Not owner of mutex */
+    }
+    else
+        give_named_token( named->shm );
+    leave_named( (void *)named );
+
+    return( error );
+}
+
+/*****************************************************************************
+** named_sema4_state - reports the type, options, tokens available and tasks
+**                     waiting (in all processes) of a named semaphore, for
+**                     semInfoGet.  The caller holds the semaphore's local
+**                     control block, so it cannot be closed meanwhile.
+*****************************************************************************/
+void
+   named_sema4_state( void *named_sema4, int *type, int *options, int *count,
+                      int *pended )
+{
+    v2pt_shm_sema4_t *shm;
+
+    shm = ((v2pt_named_sema4_t *)named_sema4)->shm;
+    *type = shm->type;
+    *options = shm->options;
+    *count = __atomic_load_n( &(shm->token_count), __ATOMIC_RELAXED );
+    *pended = __atomic_load_n( &(shm->waiters), __ATOMIC_RELAXED );
+}
+
+/*****************************************************************************
+** semOpen - opens a named semaphore, shared with every process on the host
+**           which opens the same name, creating it if mode allows.  Each
+**           open by this process returns the same SEM_ID.
+*****************************************************************************/
+v2pt_sema4_id_t
+   semOpen( const char *name, int type, int initial_state, int opt, int mode,
+            void *context )
+{
+    char shm_name[NAME_MAX + 1];
+    v2pt_named_sema4_t *named;
+    v2pt_named_sema4_t *spare;
+    v2pt_shm_sema4_t *shm;
+    v2pt_sema4_id_t semid;
+
+    if ( !shm_name_for( name, shm_name ) ||
+         ((type != SEM_TYPE_BINARY) && (type != SEM_TYPE_MUTEX) &&
+          (type != SEM_TYPE_COUNTING)) ||
+         ((type == SEM_TYPE_COUNTING) && (initial_state < 0)) )
+    {
+        errno = EINVAL;
+        return( NULL );
+    }
+    if ( (opt & ~(SEM_Q_PRIORITY | SEM_INVERSION_SAFE)) ||
+         ((opt & SEM_INVERSION_SAFE) && (type != SEM_TYPE_MUTEX)) )
+    {
+        errno = ENOSYS;
+        return( NULL );
+    }
+
+    semid = (v2pt_sema4_id_t)NULL;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&named_list_lock );
+    pthread_mutex_lock( &named_list_lock );
+
+    /*
+    **  A semaphore this process has open already is opened once more.
+    */
+    spare = (v2pt_named_sema4_t *)NULL;
+    for ( named = named_list; named != (v2pt_named_sema4_t *)NULL;
+          named = named->nxt_named )
+    {
+        if ( named->shm == (v2pt_shm_sema4_t *)NULL )
+        {
+            if ( spare == (v2pt_named_sema4_t *)NULL )
+                spare = named;
+            continue;
+        }
+        if ( (named->semid != (v2pt_sema4_id_t)NULL) &&
+             !named->shm->unlinked &&
+             (strcmp( named->shm_name, shm_name ) == 0) )
+            break;
+    }
+
+    if ( named != (v2pt_named_sema4_t *)NULL )
+    {
+        if ( ((mode & (OM_CREATE | OM_EXCL)) == (OM_CREATE | OM_EXCL)) ||
+             (named->shm->type != type) )
+            errno = S_objLib_OBJ_NAME_CLASH;
+        else
+        {
+            if ( mode & OM_DELETE_ON_LAST_CLOSE )
+                named->shm->delete_on_last_close = TRUE;
+            named->opens++;
+            semid = named->semid;
+        }
+    }
+    else
+    {
+        /*
+        **  Otherwise map the semaphore into this process, and give it a
+        **  local control block and ID.
+        */
+        named = spare;
+        if ( named == (v2pt_named_sema4_t *)NULL )
+        {
+            named = (v2pt_named_sema4_t *)ts_malloc(
+                                             sizeof( v2pt_named_sema4_t ) );
+            if ( named != (v2pt_named_sema4_t *)NULL )
+            {
+                named->shm = (v2pt_shm_sema4_t *)NULL;
+                named->semid = (v2pt_sema4_id_t)NULL;
+                named->users = 0;
+                named->nxt_named = named_list;
+                named_list = named;
+            }
+            else
+                errno = S_memLib_NOT_ENOUGH_MEMORY;
+        }
+
+        shm = (v2pt_shm_sema4_t *)NULL;
+        if ( named != (v2pt_named_sema4_t *)NULL )
+            shm = map_shm_sema4( shm_name, type, initial_state, opt, mode );
+        if ( shm != (v2pt_shm_sema4_t *)NULL )
+        {
+            named->opener = attach_shm_sema4( shm, type, mode );
+            if ( named->opener >= 0 )
+            {
+                strcpy( named->shm_name, shm_name );
+                named->shm = shm;
+                named->opens = 1;
+                semid = bind_named_sema4( (void *)named, shm->options );
+                if ( semid != (v2pt_sema4_id_t)NULL )
+                    __atomic_store_n( &(named->semid), semid,
+                                      __ATOMIC_SEQ_CST );
+                else
+                {
+                    named->shm = (v2pt_shm_sema4_t *)NULL;
+                    detach_shm_sema4( shm, named->opener, shm_name );
+                    errno = S_memLib_NOT_ENOUGH_MEMORY;
+                }
+            }
+            else
+                munmap( shm, sizeof( v2pt_shm_sema4_t ) );
+        }
+    }
+
+    pthread_mutex_unlock( &named_list_lock );
+    pthread_cleanup_pop( 0 );
+
+#ifdef DIAG_PRINTFS 
+    printf( "\r\nsemOpen %s - id %p", shm_name, semid );
+#endif
+
+    return( semid );
+}
+
+/*****************************************************************************
+** semClose - closes a named semaphore opened by semOpen.  The last close in
+**            this process takes its SEM_ID out of service, releasing tasks
+**            of this process waiting on it (a task waiting for a mutex is
+**            released once it gets it), and unmaps it.
+*****************************************************************************/
+STATUS
+   semClose( v2pt_sema4_id_t semid )
+{
+    v2pt_named_sema4_t *named;
+    struct timespec pause;
+    STATUS error;
+    int last;
+
+    named = (v2pt_named_sema4_t *)named_sema4_for( semid );
+    if ( named == (v2pt_named_sema4_t *)NULL )
+        return( ERROR );
+
+    error = OK;
+    last = FALSE;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&named_list_lock );
+    pthread_mutex_lock( &named_list_lock );
+
+    if ( named->semid != semid )
+        error = S_objLib_OBJ_ID_ERROR;       /* Closed meanwhile */
+    else if ( --(named->opens) == 0 )
+    {
+        __atomic_store_n( &(named->semid), NULL, __ATOMIC_SEQ_CST );
+        last = TRUE;
+    }
+
+    pthread_mutex_unlock( &named_list_lock );
+    pthread_cleanup_pop( 0 );
+
+    if ( last )
+    {
+        release_named_sema4( semid );
+
+        /*
+        **  Wake waiting tasks until every one of ours has gone.  A wake
+        **  reaching another process's task only sends it back to sleep.
+        */
+        pause.tv_sec = 0;
+        pause.tv_nsec = 1000000;
+        while ( __atomic_load_n( &(named->users), __ATOMIC_SEQ_CST ) > 0 )
+        {
+            if ( named->shm->type != SEM_TYPE_MUTEX )
+                wake_word( &(named->shm->token_count), INT_MAX );
+            nanosleep( &pause, (struct timespec *)NULL );
+        }
+
+        detach_shm_sema4( named->shm, named->opener, named->shm_name );
+
+        /*
+        **  The entry may now be reused.
+        */
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&named_list_lock );
+        pthread_mutex_lock( &named_list_lock );
+        named->shm = (v2pt_shm_sema4_t *)NULL;
+        pthread_mutex_unlock( &named_list_lock );
+        pthread_cleanup_pop( 0 );
+    }
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+
+    return( error );
+}
+
+/*****************************************************************************
+** semUnlink - removes the name of a named semaphore.  Processes which have
+**             it open go on using it; a semOpen of the name afterward finds
+**             it gone, or creates a new semaphore.
+*****************************************************************************/
+STATUS
+   semUnlink( const char *name )
+{
+    char shm_name[NAME_MAX + 1];
+    v2pt_shm_sema4_t *shm;
+    STATUS error;
+    int fd;
+
+    if ( !shm_name_for( name, shm_name ) )
+    {
+        errno = EINVAL;
+        return( ERROR );
+    }
+
+    error = OK;
+    fd = shm_open( shm_name, O_RDWR, 0 );
+    if ( fd < 0 )
+        error = (errno == ENOENT) ? S_objLib_OBJ_NOT_FOUND : errno;
+    else
+    {
+        shm = (v2pt_shm_sema4_t *)mmap( NULL, sizeof( v2pt_shm_sema4_t ),
+                                        PROT_READ | PROT_WRITE, MAP_SHARED,
+                                        fd, 0 );
+        close( fd );
+
+        /*
+        **  Mark the semaphore unlinked so that its last close does not
+        **  remove a new semaphore of the same name.  One whose creator died
+        **  before it was initialized is simply removed.
+        */
+        if ( (shm != (v2pt_shm_sema4_t *)MAP_FAILED) &&
+             (__atomic_load_n( &(shm->magic), __ATOMIC_ACQUIRE ) ==
+              SHM_MAGIC) )
+        {
+            pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                                  (void *)&(shm->open_lock) );
+            lock_shm_sema4( shm );
+            if ( !shm->unlinked )
+            {
+                shm_unlink( shm_name );
+                shm->unlinked = TRUE;
+            }
+            else
+                error = S_objLib_OBJ_NOT_FOUND;
+            pthread_mutex_unlock( &(shm->open_lock) );
+            pthread_cleanup_pop( 0 );
+        }
+        else
+            shm_unlink( shm_name );
+        if ( shm != (v2pt_shm_sema4_t *)MAP_FAILED )
+            munmap( shm, sizeof( v2pt_shm_sema4_t ) );
+    }
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+
+    return( error );
+}
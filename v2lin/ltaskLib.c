@@ -28,10 +28,48 @@
 #include <stdio.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <time.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 #include "v2pthread.h"
 #include "vxw_defs.h"
 
+/*
+**  SCHED_DEADLINE is set through the sched_setattr system call, which
+**  older C libraries do not wrap.  The attribute block below mirrors the
+**  kernel's struct sched_attr.
+*/
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+#endif
+
+/*
+**  V2LIN_CANCEL_POLL_MS is the longest time, in milliseconds, for which a
+**                       task waiting in lock_mutex_until goes without
+**                       seeing that it has been deleted, and the interval
+**                       at which deleted tasks still unwinding are reaped.
+*/
+#ifndef V2LIN_CANCEL_POLL_MS
+#define V2LIN_CANCEL_POLL_MS 10
+#endif
+
+struct v2pt_sched_attr
+{
+    unsigned int       size;
+    unsigned int       sched_policy;
+    unsigned long long sched_flags;
+    int                sched_nice;
+    unsigned int       sched_priority;
+    unsigned long long sched_runtime;
+    unsigned long long sched_deadline;
+    unsigned long long sched_period;
+};
+
 /*
 **  selfRestart is a system function used by a task to restart itself.
 **              The function creates a temporary watchdog timer which restarts 
@@ -42,6 +80,8 @@ extern void
 
 extern BOOL
    roundRobinIsEnabled( void );
+extern BOOL
+   unprivilegedModeIsEnabled( void );
 
 /*****************************************************************************
 **  v2pthread Global Data Structures
@@ -89,8 +129,68 @@ static unsigned long
 static pthread_cond_t
     taskLock_change = PTHREAD_COND_INITIALIZER;
 
+/*
+**  cached_tcb remembers the calling pthread's own task control block
+**             once my_tcb has found it.
+*/
+static __thread v2pthread_cb_t *
+    cached_tcb = (v2pthread_cb_t *)NULL;
+
+/*
+**  taskLock_start records when the outermost taskLock call took the
+**                 scheduler lock, and taskLock_max_hold the longest time in
+**                 nanoseconds any thread has held it since the last reset.
+**                 Both are protected by v2pthread_task_lock.
+*/
+static struct timespec
+    taskLock_start;
+static unsigned long long
+    taskLock_max_hold = 0;
+
+/*
+**  reap_list is a FIFO of deleted tasks whose pthreads have been cancelled
+**            but not yet joined.  Each one is joined once it has unwound,
+**            and its task control block then freed, so that taskDelete
+**            does not have to wait for the victim while holding taskLock.
+*/
+typedef struct v2pt_reap_node
+{
+    pthread_t
+        pthrid;
+    v2pthread_cb_t *
+        tcb;
+    struct v2pt_reap_node *
+        nxt_reap;
+} v2pt_reap_node_t;
+
+static v2pt_reap_node_t *
+    reap_list = (v2pt_reap_node_t *)NULL;
+static v2pt_reap_node_t *
+    reap_tail = (v2pt_reap_node_t *)NULL;
+
+/*
+**  reap_lock serializes access to reap_list, and reap_pending signals the
+**            reaper thread that reap_list is no longer empty.
+*/
+static pthread_mutex_t
+    reap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t
+    reap_pending = PTHREAD_COND_INITIALIZER;
+
+/*
+**  reaper_once starts the reaper thread on the first asynchronous delete,
+**              and reaper_started records whether that succeeded.
+*/
+static pthread_once_t
+    reaper_once = PTHREAD_ONCE_INIT;
+static BOOL
+    reaper_started = FALSE;
+
 /*****************************************************************************
 **  thread-safe malloc
+**
+**  Blocks are aligned on a cache line boundary so that the cache-aligned
+**  sections of the v2pthread control blocks land where they were laid out.
 *****************************************************************************/
 void *ts_malloc( size_t blksize )
 {
@@ -102,7 +202,8 @@ void *ts_malloc( size_t blksize )
                           (void *)&malloc_lock );
     pthread_mutex_lock( &malloc_lock );
 
-    blkaddr = malloc( blksize );
+    if ( posix_memalign( &blkaddr, V2PT_CACHE_LINE, blksize ) != 0 )
+        blkaddr = (void *)NULL;
 
     pthread_cleanup_pop( 1 );
 
@@ -126,6 +227,102 @@ void ts_free( void *blkaddr )
 
     pthread_cleanup_pop( 1 );
 }
+
+/*****************************************************************************
+** deadline_after_ns - sets deadline to the CLOCK_MONOTONIC time ns
+**                     nanoseconds from now.  Timed waits throughout v2lin
+**                     wait for such deadlines, on condition variables made
+**                     by init_monotonic_cond, so that setting the time of
+**                     day neither shortens nor stretches them.
+*****************************************************************************/
+void
+   deadline_after_ns( long long ns, struct timespec *deadline )
+{
+    clock_gettime( CLOCK_MONOTONIC, deadline );
+    deadline->tv_sec += ns / 1000000000LL;
+    deadline->tv_nsec += ns % 1000000000LL;
+    if ( deadline->tv_nsec >= 1000000000L )
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+    else if ( deadline->tv_nsec < 0 )
+    {
+        deadline->tv_sec--;
+        deadline->tv_nsec += 1000000000L;
+    }
+}
+
+/*****************************************************************************
+** deadline_after_ticks - sets deadline to the CLOCK_MONOTONIC time ticks
+**                        v2pthread scheduler ticks from now.
+*****************************************************************************/
+void
+   deadline_after_ticks( int ticks, struct timespec *deadline )
+{
+    deadline_after_ns( (long long)ticks * V2PT_TICK * 1000000LL, deadline );
+}
+
+/*****************************************************************************
+** deadline_passed - returns nonzero once the CLOCK_MONOTONIC time reaches
+**                   the specified deadline.
+*****************************************************************************/
+int
+   deadline_passed( const struct timespec *deadline )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return( (now.tv_sec > deadline->tv_sec) ||
+            ((now.tv_sec == deadline->tv_sec) &&
+             (now.tv_nsec >= deadline->tv_nsec)) );
+}
+
+/*****************************************************************************
+** lock_mutex_until - locks a pthreads mutex, waiting until it is free or
+**                    the CLOCK_MONOTONIC deadline (if any) passes.  Locking
+**                    a mutex is not a cancellation point, so the task
+**                    waits in slices of V2LIN_CANCEL_POLL_MS, acting on a
+**                    pending taskDelete between them.  Returns what
+**                    pthread_mutex_clocklock returned for the last slice.
+*****************************************************************************/
+int
+   lock_mutex_until( pthread_mutex_t *mutex, const struct timespec *deadline )
+{
+    struct timespec slice;
+    int retcode;
+
+    for ( ;; )
+    {
+        deadline_after_ns( V2LIN_CANCEL_POLL_MS * 1000000LL, &slice );
+        if ( (deadline != (const struct timespec *)NULL) &&
+             ((deadline->tv_sec < slice.tv_sec) ||
+              ((deadline->tv_sec == slice.tv_sec) &&
+               (deadline->tv_nsec < slice.tv_nsec))) )
+            slice = *deadline;
+        retcode = pthread_mutex_clocklock( mutex, CLOCK_MONOTONIC, &slice );
+        if ( (retcode != ETIMEDOUT) ||
+             ((deadline != (const struct timespec *)NULL) &&
+              deadline_passed( deadline )) )
+            return( retcode );
+        pthread_testcancel();
+    }
+}
+
+/*****************************************************************************
+** init_monotonic_cond - initializes a condition variable whose timed waits
+**                       take CLOCK_MONOTONIC deadlines.
+*****************************************************************************/
+void
+   init_monotonic_cond( pthread_cond_t *cond )
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( cond, &attr );
+    pthread_condattr_destroy( &attr );
+}
     
 /*****************************************************************************
 **  my_tcb - returns a pointer to the task control block for the calling task
@@ -141,6 +338,15 @@ v2pthread_cb_t *
     */
     my_pthrid = pthread_self();
 
+    /*
+    **  A task's pthread finds its own tcb without a list scan once it has
+    **  been cached.  The cache is per pthread, so a restarted task starts
+    **  afresh, and the pthread ID check catches a tcb re-used by taskInit.
+    */
+    if ( (cached_tcb != (v2pthread_cb_t *)NULL) &&
+         (cached_tcb->pthrid == my_pthrid) )
+        return( cached_tcb );
+
     /*
     **  If the task_list contains tasks, scan it for the tcb
     **  whose thread id matches the one to be deleted.  No locking
@@ -160,6 +366,7 @@ v2pthread_cb_t *
                 /*
                 **  Found the task control_block.
                 */
+                cached_tcb = current_tcb;
                 return( current_tcb );
             }
         }
@@ -192,7 +399,7 @@ v2pthread_cb_t *
                   current_tcb != (v2pthread_cb_t *)NULL;
                   current_tcb = current_tcb->nxt_task )
             {
-                if ( current_tcb->taskid == taskid )
+                if ( (current_tcb->taskid == taskid) && !(current_tcb->dying) )
                 {
                     found_taskid = TRUE;
                     break;
@@ -210,6 +417,48 @@ v2pthread_cb_t *
     return( current_tcb );
 }
 
+/*****************************************************************************
+** note_taskLock_release - updates the worst-case taskLock hold time as the
+**                         outermost lock is released.  The caller must hold
+**                         v2pthread_task_lock.
+*****************************************************************************/
+static void
+   note_taskLock_release( void )
+{
+    struct timespec now;
+    unsigned long long held;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    held = (unsigned long long)(now.tv_sec - taskLock_start.tv_sec) *
+           1000000000ULL;
+    held += now.tv_nsec;
+    held -= taskLock_start.tv_nsec;
+    if ( held > taskLock_max_hold )
+        taskLock_max_hold = held;
+}
+
+/*****************************************************************************
+** taskLockHoldMax - returns the longest time in nanoseconds for which any
+**                   thread has held the scheduler lock, measured from the
+**                   outermost taskLock to the matching taskUnlock.  If reset
+**                   is TRUE the measurement starts over after it is read.
+*****************************************************************************/
+unsigned long long
+   taskLockHoldMax( BOOL reset )
+{
+    unsigned long long max_hold;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&v2pthread_task_lock );
+    pthread_mutex_lock( &v2pthread_task_lock );
+    max_hold = taskLock_max_hold;
+    if ( reset )
+        taskLock_max_hold = 0;
+    pthread_cleanup_pop( 1 );
+
+    return( max_hold );
+}
+
 /*****************************************************************************
 ** taskLock - 'locks the scheduler' to prevent preemption of the current task
 **           by other task-level code.  Because we cannot actually lock the
@@ -264,6 +513,8 @@ void
             taskLock_level++;
             if ( taskLock_level == 0L )
                 taskLock_level--;
+            if ( taskLock_level == 1L )
+                clock_gettime( CLOCK_MONOTONIC, &taskLock_start );
             got_lock = TRUE;
             pthread_cond_broadcast( &taskLock_change );
 #ifdef DIAG_PRINTFS 
@@ -288,6 +539,15 @@ void
         pthread_cleanup_pop( 0 );
     } while ( got_lock == FALSE );
 
+    /*
+    **  In unprivileged mode there is no real-time priority to raise.  The
+    **  scheduler_locked ownership taken above is then the whole of taskLock:
+    **  it excludes every other taskLock caller, which is also all that the
+    **  priority boost guarantees once more than one CPU is online.
+    */
+    if ( unprivilegedModeIsEnabled() )
+        return;
+
     /*
     **  task_list_lock prevents other v2pthread pthreads from modifying
     **  the v2pthread pthread task list while we're searching it and modifying
@@ -297,7 +557,13 @@ void
                           (void *)&task_list_lock );
     pthread_mutex_lock( &task_list_lock );
     tcb = my_tcb();
-    if ( tcb != (v2pthread_cb_t *)NULL )
+
+    /*
+    **  A SCHED_DEADLINE task already preempts every SCHED_FIFO and SCHED_RR
+    **  thread, and pthread_setschedparam would drop it out of the deadline
+    **  class, so its priority is left alone.
+    */
+    if ( (tcb != (v2pthread_cb_t *)NULL) && !(tcb->dl_active) )
     {
 	struct sched_param schedparam;
         pthread_attr_getschedpolicy( &(tcb->attr), &sched_policy );
@@ -343,13 +609,17 @@ void
             /*
             **  task_list_lock prevents other v2pthread pthreads from modifying
             **  the v2pthread pthread task list while we're searching it and
-            **  modifying the calling task's priority level.
+            **  modifying the calling task's priority level.  (There is no
+            **  boosted priority to restore in unprivileged mode.)
             */
             pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
                                   (void *)&task_list_lock );
             pthread_mutex_lock( &task_list_lock );
-            tcb = my_tcb();
-            if ( tcb != (v2pthread_cb_t *)NULL )
+            if ( unprivilegedModeIsEnabled() )
+                tcb = (v2pthread_cb_t *)NULL;
+            else
+                tcb = my_tcb();
+            if ( (tcb != (v2pthread_cb_t *)NULL) && !(tcb->dl_active) )
             {
 		struct sched_param schedparam;
                 pthread_attr_getschedpolicy( &(tcb->attr), &sched_policy );
@@ -362,6 +632,7 @@ void
             }
             pthread_cleanup_pop( 1 );
 
+            note_taskLock_release();
             scheduler_locked = (pthread_t)NULL;
             pthread_cond_broadcast( &taskLock_change );
         }
@@ -380,102 +651,387 @@ void
 }
 
 /*****************************************************************************
-** link_susp_tcb - appends a new tcb pointer to a linked list of tcb pointers
-**                 for tasks suspended on the object owning the list.
+** link_susp_tcb - appends a new tcb pointer to the pended task list of the
+**                 object the task is suspending on.  The caller holds the
+**                 lock of the object owning the list.
 *****************************************************************************/
 void
-   link_susp_tcb( v2pthread_cb_t **list_head, v2pthread_cb_t *new_entry )
+   link_susp_tcb( v2pt_pend_list_t *list, v2pthread_cb_t *new_entry )
 {
-    v2pthread_cb_t *nxt_entry;
-
-    if ( list_head != (v2pthread_cb_t **)NULL )
+    if ( list != (v2pt_pend_list_t *)NULL )
     {
-        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                              (void *)&task_list_lock );
-        pthread_mutex_lock( &task_list_lock );
         new_entry->nxt_susp = (v2pthread_cb_t *)NULL;
-        if ( *list_head != (v2pthread_cb_t *)NULL )
-        {
-            for ( nxt_entry = *list_head; 
-                  nxt_entry->nxt_susp != (v2pthread_cb_t *)NULL;
-                  nxt_entry = nxt_entry->nxt_susp ) ;
-            nxt_entry->nxt_susp = new_entry;
-#ifdef DIAG_PRINTFS 
-            printf( "\r\nadd susp_tcb @ %p to list @ %p", new_entry,
-                    nxt_entry );
-#endif
-        }
+        new_entry->prv_susp = list->tail;
+        new_entry->suspend_index = (v2pt_prio_index_t *)NULL;
+        if ( list->tail != (v2pthread_cb_t *)NULL )
+            list->tail->nxt_susp = new_entry;
         else
-        {
-            *list_head = new_entry;
+            list->head = new_entry;
+        list->tail = new_entry;
 #ifdef DIAG_PRINTFS 
-            printf( "\r\nadd susp_tcb @ %p to list @ %p", new_entry,
-                    list_head );
+        printf( "\r\nadd susp_tcb @ %p to list @ %p", new_entry, list );
 #endif
-        }
+
         /*
         **  Initialize the suspended task's pointer back to suspend list
         **  This is used for cleanup during task deletion.
         */
-        new_entry->suspend_list = list_head;
+        new_entry->suspend_list = list;
 
         /*
         **  Update the task state.
         */
         new_entry->state |= PEND;
+    }
+}
 
-        pthread_cleanup_pop( 1 );
+/*****************************************************************************
+** prio_level_at_or_above - returns the highest-numbered level no higher
+**                          than the specified level at which any task is
+**                          queued in the specified priority index, i.e.
+**                          the nearest queued priority at or above the
+**                          specified one, or -1 if there is none.
+**                          At most V2PT_PRIO_MAP_WORDS words are examined.
+*****************************************************************************/
+static int
+   prio_level_at_or_above( v2pt_prio_index_t *index, int level )
+{
+    unsigned long bits;
+    int word;
+
+    word = level / V2PT_PRIO_MAP_BITS;
+    bits = index->level_map[word] &
+           (~0UL >> (V2PT_PRIO_MAP_BITS - 1 - (level % V2PT_PRIO_MAP_BITS)));
+    while ( bits == 0 )
+    {
+        if ( word == 0 )
+            return( -1 );
+        bits = index->level_map[--word];
     }
+    return( (word * V2PT_PRIO_MAP_BITS) +
+            (V2PT_PRIO_MAP_BITS - 1 - __builtin_clzl( bits )) );
 }
 
 /*****************************************************************************
-** unlink_susp_tcb - removes tcb pointer from a linked list of tcb pointers
-**                   for tasks suspended on the object owning the list.
+** enqueue_prio_tcb - inserts a tcb into a priority-ordered pended task list
+**                    behind the last task of the same or higher priority.
+**                    The caller holds the lock of the object owning the list.
 *****************************************************************************/
-void
-   unlink_susp_tcb( v2pthread_cb_t **list_head, v2pthread_cb_t *entry )
+static void
+   enqueue_prio_tcb( v2pt_pend_list_t *list, v2pt_prio_index_t *index,
+                     v2pthread_cb_t *entry )
 {
-    v2pthread_cb_t *current_tcb;
+    v2pthread_cb_t *prv_entry;
+    int level, above;
+
+    level = entry->vxw_priority;
+    if ( level < MAX_V2PT_PRIORITY )
+        level = MAX_V2PT_PRIORITY;
+    if ( level > MIN_V2PT_PRIORITY )
+        level = MIN_V2PT_PRIORITY;
+
+    /*
+    **  The new entry follows the last task queued at the nearest occupied
+    **  level of equal or higher priority, or heads the list if none.
+    */
+    prv_entry = (v2pthread_cb_t *)NULL;
+    above = prio_level_at_or_above( index, level );
+    if ( above >= 0 )
+        prv_entry = index->level_tail[above];
 
-    if ( list_head != (v2pthread_cb_t **)NULL )
+    entry->prv_susp = prv_entry;
+    if ( prv_entry != (v2pthread_cb_t *)NULL )
     {
-        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                              (void *)&task_list_lock );
-        pthread_mutex_lock( &task_list_lock );
-        if ( *list_head == entry )
+        entry->nxt_susp = prv_entry->nxt_susp;
+        prv_entry->nxt_susp = entry;
+    }
+    else
+    {
+        entry->nxt_susp = list->head;
+        list->head = entry;
+    }
+    if ( entry->nxt_susp != (v2pthread_cb_t *)NULL )
+        entry->nxt_susp->prv_susp = entry;
+    else
+        list->tail = entry;
+
+    index->level_tail[level] = entry;
+    index->level_map[level / V2PT_PRIO_MAP_BITS] |=
+        1UL << (level % V2PT_PRIO_MAP_BITS);
+    entry->pend_priority = level;
+    entry->suspend_index = index;
+}
+
+/*****************************************************************************
+** dequeue_tcb - removes a tcb from the pended task list it is queued on,
+**               and from the list's priority index if it has one.  The
+**               caller holds the lock of the object owning the list.
+*****************************************************************************/
+static void
+   dequeue_tcb( v2pt_pend_list_t *list, v2pthread_cb_t *entry )
+{
+    v2pt_prio_index_t *index;
+    int level;
+
+    if ( entry->prv_susp != (v2pthread_cb_t *)NULL )
+        entry->prv_susp->nxt_susp = entry->nxt_susp;
+    else
+        list->head = entry->nxt_susp;
+    if ( entry->nxt_susp != (v2pthread_cb_t *)NULL )
+        entry->nxt_susp->prv_susp = entry->prv_susp;
+    else
+        list->tail = entry->prv_susp;
+
+    /*
+    **  If the entry was the last at its level, the level's new last task is
+    **  the one ahead of it, provided that task is at the same level.
+    */
+    index = entry->suspend_index;
+    if ( index != (v2pt_prio_index_t *)NULL )
+    {
+        level = entry->pend_priority;
+        if ( index->level_tail[level] == entry )
         {
-            *list_head = entry->nxt_susp;
+            if ( (entry->prv_susp != (v2pthread_cb_t *)NULL) &&
+                 (entry->prv_susp->pend_priority == level) )
+                index->level_tail[level] = entry->prv_susp;
+            else
+            {
+                index->level_tail[level] = (v2pthread_cb_t *)NULL;
+                index->level_map[level / V2PT_PRIO_MAP_BITS] &=
+                    ~(1UL << (level % V2PT_PRIO_MAP_BITS));
+            }
+        }
+    }
+
+    entry->nxt_susp = (v2pthread_cb_t *)NULL;
+    entry->prv_susp = (v2pthread_cb_t *)NULL;
+    entry->suspend_index = (v2pt_prio_index_t *)NULL;
+}
+
+/*****************************************************************************
+** link_prio_susp_tcb - inserts a new tcb pointer into the priority-ordered
+**                      pended task list of the object the task is
+**                      suspending on, and into its priority index.  The
+**                      caller holds the lock of the object owning the list.
+*****************************************************************************/
+void
+   link_prio_susp_tcb( v2pt_pend_list_t *list, v2pt_prio_index_t *index,
+                       v2pthread_cb_t *new_entry )
+{
+    if ( list != (v2pt_pend_list_t *)NULL )
+    {
+        enqueue_prio_tcb( list, index, new_entry );
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nadd susp_tcb @ %p priority %d to list @ %p", new_entry,
+                new_entry->pend_priority, list );
+#endif
+        /*
+        **  Initialize the suspended task's pointer back to suspend list
+        **  This is used for cleanup during task deletion.
+        */
+        new_entry->suspend_list = list;
+
+        /*
+        **  Update the task state.
+        */
+        new_entry->state |= PEND;
+    }
+}
+
+/*****************************************************************************
+** unlink_susp_tcb - removes tcb pointer from the pended task list of the
+**                   object the task was suspended on, if it is still
+**                   there.  The caller holds the lock of the object owning
+**                   the list.
+*****************************************************************************/
+void
+   unlink_susp_tcb( v2pt_pend_list_t *list, v2pthread_cb_t *entry )
+{
+    if ( (list != (v2pt_pend_list_t *)NULL) &&
+         (entry->suspend_list == list) )
+    {
+        dequeue_tcb( list, entry );
 #ifdef DIAG_PRINTFS 
-            printf( "\r\ndel susp_tcb @ %p from list @ %p - newlist head %p",
-                    entry, list_head, *list_head );
+        printf( "\r\ndel susp_tcb @ %p from list @ %p - newlist head %p",
+                entry, list, list->head );
 #endif
+
+        /*
+        **  Update the task state.
+        */
+        entry->state &= ~PEND;
+    }
+}
+
+/*****************************************************************************
+** lock_susp_list - locks the pended task list a task other than the caller
+**                  is suspended on, and returns it, or returns NULL if the
+**                  task is not pended.  The list may change hands until its
+**                  lock is held, so it is looked up again under the lock.
+**                  The control blocks of semaphores are never freed, and a
+**                  queue or task is not freed while a task remains on its
+**                  list, so the lock can be taken safely.  A list without a
+**                  lock is guarded by taskLock, which the caller holds.
+*****************************************************************************/
+static v2pt_pend_list_t *
+   lock_susp_list( v2pthread_cb_t *tcb )
+{
+    v2pt_pend_list_t *list;
+
+    for ( ;; )
+    {
+        list = __atomic_load_n( &(tcb->suspend_list), __ATOMIC_ACQUIRE );
+        if ( (list == (v2pt_pend_list_t *)NULL) ||
+             (list->lock == (pthread_mutex_t *)NULL) )
+            break;
+        pthread_mutex_lock( list->lock );
+        if ( tcb->suspend_list == list )
+            break;
+        pthread_mutex_unlock( list->lock );
+    }
+    return( list );
+}
+
+/*****************************************************************************
+** unlock_susp_list - unlocks a list locked by lock_susp_list.
+*****************************************************************************/
+static void
+   unlock_susp_list( void *list )
+{
+    if ( (list != NULL) &&
+         (((v2pt_pend_list_t *)list)->lock != (pthread_mutex_t *)NULL) )
+        pthread_mutex_unlock( ((v2pt_pend_list_t *)list)->lock );
+}
+
+/*****************************************************************************
+** unpend_tcb - removes a task other than the caller from the pended task
+**              list of whatever object it is suspended on, if any, taking
+**              the lock of the object owning the list.
+*****************************************************************************/
+static void
+   unpend_tcb( v2pthread_cb_t *tcb )
+{
+    v2pt_pend_list_t *list;
+
+    list = lock_susp_list( tcb );
+    pthread_cleanup_push( unlock_susp_list, (void *)list );
+    if ( list != (v2pt_pend_list_t *)NULL )
+    {
+        unlink_susp_tcb( list, tcb );
+        tcb->suspend_list = (v2pt_pend_list_t *)NULL;
+    }
+    pthread_cleanup_pop( 1 );
+}
+
+/*****************************************************************************
+** requeue_susp_tcb - moves a task pended on a priority-ordered list to the
+**                    place for its current priority, after a priority change.
+*****************************************************************************/
+static void
+   requeue_susp_tcb( v2pthread_cb_t *tcb )
+{
+    v2pt_pend_list_t *list;
+    v2pt_prio_index_t *index;
+
+    list = lock_susp_list( tcb );
+    pthread_cleanup_push( unlock_susp_list, (void *)list );
+    if ( list != (v2pt_pend_list_t *)NULL )
+    {
+        index = tcb->suspend_index;
+        if ( (index != (v2pt_prio_index_t *)NULL) &&
+             (tcb->pend_priority != tcb->vxw_priority) )
+        {
+            dequeue_tcb( list, tcb );
+            enqueue_prio_tcb( list, index, tcb );
         }
-        else
+    }
+    pthread_cleanup_pop( 1 );
+}
+
+/*****************************************************************************
+** select_susp_tcb - removes the task to be readied next from the specified
+**                   'pended task list' according to the specified pend
+**                   order, and returns its tcb (or NULL if the list is
+**                   empty).  Among tasks of equal priority the one which
+**                   has waited longest is selected.  A list linked with
+**                   link_prio_susp_tcb is already in that order, so its
+**                   head is taken without a scan.  The caller holds the
+**                   lock of the object owning the list.
+*****************************************************************************/
+v2pthread_cb_t *
+   select_susp_tcb( v2pt_pend_list_t *list, int pend_order )
+{
+    v2pthread_cb_t *selected_tcb;
+    v2pthread_cb_t *current_tcb;
+
+    selected_tcb = (v2pthread_cb_t *)NULL;
+    if ( list != (v2pt_pend_list_t *)NULL )
+    {
+        selected_tcb = list->head;
+
+        /*
+        **  A priority-ordered list always has the task to be readied at
+        **  its head.
+        */
+        if ( (selected_tcb != (v2pthread_cb_t *)NULL) &&
+             (selected_tcb->suspend_index == (v2pt_prio_index_t *)NULL) &&
+             (pend_order != 0) )
         {
-            for ( current_tcb = *list_head;
+            for ( current_tcb = selected_tcb->nxt_susp;
                   current_tcb != (v2pthread_cb_t *)NULL;
                   current_tcb = current_tcb->nxt_susp )
             {
-                if ( current_tcb->nxt_susp == entry )
-                {
-                    current_tcb->nxt_susp = entry->nxt_susp;
+                if ( current_tcb->vxw_priority < selected_tcb->vxw_priority )
+                    selected_tcb = current_tcb;
+            }
+        }
+
+        if ( selected_tcb != (v2pthread_cb_t *)NULL )
+        {
+            dequeue_tcb( list, selected_tcb );
+            selected_tcb->suspend_list = (v2pt_pend_list_t *)NULL;
+            selected_tcb->state &= ~PEND;
 #ifdef DIAG_PRINTFS 
-                    printf( "\r\ndel susp_tcb @ %p from list @ %p", entry,
-                    current_tcb );
+            printf( "\r\nselect_susp_tcb - tcb @ %p from list @ %p",
+                    selected_tcb, list );
 #endif
-                }
-            }
         }
-        entry->nxt_susp = (v2pthread_cb_t *)NULL;
+    }
 
-        /*
-        **  Update the task state.
-        */
-        entry->state &= (!PEND);
+    return( selected_tcb );
+}
 
-        pthread_cleanup_pop( 1 );
+/*****************************************************************************
+** release_susp_tcbs - removes every task from the specified 'pended task
+**                     list', stamps each with the reason for its release
+**                     and signals it to wake.  The released tasks need not
+**                     acknowledge, and never touch the list or the object
+**                     owning it again.  The caller holds the lock of the
+**                     object owning the list.  Returns the number of tasks
+**                     released.
+*****************************************************************************/
+int
+   release_susp_tcbs( v2pt_pend_list_t *list, int release )
+{
+    v2pthread_cb_t *current_tcb;
+    int count;
+
+    count = 0;
+    if ( list != (v2pt_pend_list_t *)NULL )
+    {
+        while ( (current_tcb = list->head) != (v2pthread_cb_t *)NULL )
+        {
+            dequeue_tcb( list, current_tcb );
+            current_tcb->suspend_list = (v2pt_pend_list_t *)NULL;
+            current_tcb->state &= ~PEND;
+            current_tcb->pend_release = release;
+            pthread_cond_signal( &(current_tcb->pend_wake) );
+            count++;
+        }
     }
 
+    return( count );
 }
 
 /*****************************************************************************
@@ -488,7 +1044,7 @@ void
 **                      modified and a zero result is returned.
 *****************************************************************************/
 int
-   signal_for_my_task( v2pthread_cb_t **list_head, int pend_order )
+   signal_for_my_task( v2pt_pend_list_t *list, int pend_order )
 {
     v2pthread_cb_t *signalled_task;
     v2pthread_cb_t *current_tcb;
@@ -496,11 +1052,11 @@ int
 
     result = FALSE;
 #ifdef DIAG_PRINTFS 
-    printf( "\r\nsignal_for_my_task - list head = %p", *list_head );
+    printf( "\r\nsignal_for_my_task - list head = %p", list->head );
 #endif
-    if ( list_head != (v2pthread_cb_t **)NULL )
+    if ( list != (v2pt_pend_list_t *)NULL )
     {
-        signalled_task = *list_head;
+        signalled_task = list->head;
 
         /*
         **  First determine which task is being signalled
@@ -509,19 +1065,19 @@ int
         {
             /*
             **  Tasks pend in priority order... locate the highest priority
-            **  task in the pended list.
+            **  task in the pended list.  The v2pthread priority is compared
+            **  rather than the pthreads priority, which is the same for all
+            **  tasks in unprivileged mode.
             */
-            for ( current_tcb = *list_head;
+            for ( current_tcb = list->head;
                   current_tcb != (v2pthread_cb_t *)NULL;
                   current_tcb = current_tcb->nxt_susp )
             {
-                if ( (current_tcb->prv_priority).sched_priority >
-                     (signalled_task->prv_priority).sched_priority )
+                if ( current_tcb->vxw_priority < signalled_task->vxw_priority )
                     signalled_task = current_tcb;
 #ifdef DIAG_PRINTFS 
                 printf( "\r\nsignal_for_my_task - tcb @ %p priority %d",
-                        current_tcb,
-                        (current_tcb->prv_priority).sched_priority );
+                        current_tcb, current_tcb->vxw_priority );
 #endif
             }
         }
@@ -618,6 +1174,13 @@ static int
     if ( (v2pthread_priority > MIN_V2PT_PRIORITY) | 
          (v2pthread_priority < MAX_V2PT_PRIORITY) )
         *errp = S_taskLib_ILLEGAL_PRIORITY;
+
+    /*
+    **  SCHED_OTHER (unprivileged mode) has the single static priority zero;
+    **  relative priority is expressed through translate_nice instead.
+    */
+    if ( sched_policy == SCHED_OTHER )
+        return( 0 );
  
     /*
     **  Translate the v2pthread priority into a pthreads priority.
@@ -657,6 +1220,121 @@ static int
     return( pthread_priority );
 }
 
+/*****************************************************************************
+** task_sched_priority - returns the pthreads priority at which a task of the
+**                       specified v2pthread priority runs (under SCHED_FIFO
+**                       or SCHED_RR, whose priority ranges are the same).
+*****************************************************************************/
+int
+   task_sched_priority( int v2pthread_priority )
+{
+    int error;
+
+    error = OK;
+    return( translate_priority( v2pthread_priority, SCHED_FIFO, &error ) );
+}
+
+/*****************************************************************************
+** translate_nice - translates a v2pthread priority into a nice value for
+**                  unprivileged mode.  An unprivileged thread may only raise
+**                  its nice value, so the v2pthread range (0-255) is mapped
+**                  proportionally onto nice 0 (highest) through 19 (lowest).
+*****************************************************************************/
+static int
+   translate_nice( int v2pthread_priority )
+{
+    if ( v2pthread_priority < MAX_V2PT_PRIORITY )
+        v2pthread_priority = MAX_V2PT_PRIORITY;
+    if ( v2pthread_priority > MIN_V2PT_PRIORITY )
+        v2pthread_priority = MIN_V2PT_PRIORITY;
+
+    return( (v2pthread_priority * 20) / (MIN_V2PT_PRIORITY + 1) );
+}
+
+/*****************************************************************************
+** apply_nice - sets the nice value of a running task's thread in unprivileged
+**              mode.  This is best effort: lowering a nice value (raising a
+**              task's priority) fails without CAP_SYS_NICE or RLIMIT_NICE
+**              headroom, and the task then simply keeps its current value.
+*****************************************************************************/
+static void
+   apply_nice( v2pthread_cb_t *tcb )
+{
+    if ( tcb->kernel_tid != 0 )
+    {
+        if ( setpriority( PRIO_PROCESS, (id_t)tcb->kernel_tid,
+                          tcb->nice_level ) != 0 )
+        {
+#ifdef DIAG_PRINTFS 
+            perror( "\r\napply_nice setpriority returned error:" );
+#endif
+        }
+    }
+}
+
+/*****************************************************************************
+** apply_deadline - places the task's pthread under SCHED_DEADLINE using the
+**                  runtime, deadline and period saved in its TCB.  Returns
+**                  zero on success or the kernel's errno on failure, in which
+**                  case the task keeps its scheduling as it was: at its
+**                  fixed priority, or under the deadline parameters it had.
+*****************************************************************************/
+static int
+   apply_deadline( v2pthread_cb_t *tcb )
+{
+    struct v2pt_sched_attr attr;
+    int result;
+
+    memset( (void *)&attr, 0, sizeof( attr ) );
+    attr.size = sizeof( attr );
+    attr.sched_policy = SCHED_DEADLINE;
+
+    /*
+    **  Threads created by a deadline task must not inherit its bandwidth
+    **  reservation (the kernel refuses to clone one that would).
+    */
+    attr.sched_flags = SCHED_FLAG_RESET_ON_FORK;
+    attr.sched_runtime = tcb->dl_runtime;
+    attr.sched_deadline = tcb->dl_deadline;
+    attr.sched_period = tcb->dl_period;
+
+#ifdef SYS_sched_setattr
+    if ( syscall( SYS_sched_setattr, tcb->kernel_tid, &attr, 0 ) == 0 )
+        result = 0;
+    else
+        result = errno;
+#else
+    result = ENOSYS;
+#endif
+
+    if ( result == 0 )
+        tcb->dl_active = TRUE;
+#ifdef DIAG_PRINTFS 
+    else
+        printf( "\r\napply_deadline - tcb @ %p refused by kernel, errno %d",
+                tcb, result );
+#endif
+
+    return( result );
+}
+
+/*****************************************************************************
+** leave_deadline - returns a SCHED_DEADLINE task to its fixed priority.
+*****************************************************************************/
+static void
+   leave_deadline( v2pthread_cb_t *tcb )
+{
+    int sched_policy;
+
+    if ( tcb->dl_active )
+    {
+        tcb->dl_active = FALSE;
+        pthread_attr_getschedpolicy( &(tcb->attr), &sched_policy );
+        pthread_setschedparam( tcb->pthrid, sched_policy,
+                               &(tcb->prv_priority) );
+    }
+}
+
 /*****************************************************************************
 ** tcb_delete - deletes a pthread task control block from the task_list
 **              and frees the memory allocated for the tcb
@@ -681,7 +1359,7 @@ static void
                 tcb->suspend_list );
         fflush( stdout );
 #endif
-        unlink_susp_tcb( tcb->suspend_list, tcb );
+        unpend_tcb( tcb );
         pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
                               (void *)&task_list_lock );
         pthread_mutex_lock( &task_list_lock );
@@ -714,14 +1392,178 @@ static void
         pthread_cleanup_pop( 1 );
     }
 
-    /* Release the memory occupied by the tcb being deleted. */
-    if ( tcb->taskname != (char *)NULL )
-    {
-        ts_free( (void *)tcb->taskname );
+    /* Release the memory occupied by the tcb being deleted. */
+    if ( tcb->taskname != (char *)NULL )
+    {
+        ts_free( (void *)tcb->taskname );
+    }
+
+    if ( !(tcb->static_tcb) )
+        ts_free( (void *)tcb );
+}
+
+/*****************************************************************************
+** reap_finished - joins, without blocking, every deleted task on reap_list
+**                 whose pthread has finished unwinding, and frees its task
+**                 control block.  Tasks still unwinding stay on the list.
+*****************************************************************************/
+static void
+   reap_finished( void )
+{
+    v2pt_reap_node_t *done;
+    v2pt_reap_node_t *node;
+    v2pt_reap_node_t **link;
+
+    done = (v2pt_reap_node_t *)NULL;
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&reap_lock );
+    pthread_mutex_lock( &reap_lock );
+    reap_tail = (v2pt_reap_node_t *)NULL;
+    link = &reap_list;
+    while ( (node = *link) != (v2pt_reap_node_t *)NULL )
+    {
+        if ( pthread_tryjoin_np( node->pthrid, (void **)NULL ) == EBUSY )
+        {
+            reap_tail = node;
+            link = &(node->nxt_reap);
+        }
+        else
+        {
+            *link = node->nxt_reap;
+            node->nxt_reap = done;
+            done = node;
+        }
+    }
+    pthread_cleanup_pop( 1 );
+
+    if ( done == (v2pt_reap_node_t *)NULL )
+        return;
+
+    /*
+    **  Task list walks and tcb_for callers rely on the scheduler lock to
+    **  keep the tcbs they look at from being freed under them, so free
+    **  the finished tasks' tcbs only while holding it.
+    */
+    taskLock();
+    while ( done != (v2pt_reap_node_t *)NULL )
+    {
+        node = done;
+        done = node->nxt_reap;
+        tcb_delete( node->tcb );
+        ts_free( (void *)node );
+    }
+    taskUnlock();
+}
+
+/*****************************************************************************
+** reaper_thread - reaps deleted tasks as they finish unwinding.  A victim
+**                 may not reach a cancellation point for some time, so
+**                 none is waited for; the list is swept again each
+**                 V2LIN_CANCEL_POLL_MS while any remain.  It runs under
+**                 SCHED_OTHER, below every real-time task, so this work
+**                 never delays a task which is ready to run; reap_tcb also
+**                 sweeps the list, so that tasks are reaped even while
+**                 real-time tasks keep the reaper from running.
+*****************************************************************************/
+static void *
+   reaper_thread( void *arg )
+{
+    struct timespec timeout;
+
+    setpriority( PRIO_PROCESS, (id_t)syscall( SYS_gettid ), 19 );
+    for ( ;; )
+    {
+        pthread_mutex_lock( &reap_lock );
+        if ( reap_list == (v2pt_reap_node_t *)NULL )
+            pthread_cond_wait( &reap_pending, &reap_lock );
+        else
+        {
+            clock_gettime( CLOCK_MONOTONIC, &timeout );
+            timeout.tv_nsec += V2LIN_CANCEL_POLL_MS * 1000000L;
+            if ( timeout.tv_nsec >= 1000000000L )
+            {
+                timeout.tv_sec++;
+                timeout.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_clockwait( &reap_pending, &reap_lock,
+                                    CLOCK_MONOTONIC, &timeout );
+        }
+        pthread_mutex_unlock( &reap_lock );
+
+        reap_finished();
     }
 
-    if ( !(tcb->static_tcb) )
-        ts_free( (void *)tcb );
+    return( (void *)NULL );
+}
+
+/*****************************************************************************
+** start_reaper - creates the detached reaper thread (called once)
+*****************************************************************************/
+static void
+   start_reaper( void )
+{
+    pthread_attr_t attr;
+    struct sched_param schedparam;
+    pthread_t reaper;
+
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    pthread_attr_setinheritsched( &attr, PTHREAD_EXPLICIT_SCHED );
+    pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
+    schedparam.sched_priority = 0;
+    pthread_attr_setschedparam( &attr, &schedparam );
+    if ( pthread_create( &reaper, &attr, reaper_thread, (void *)NULL ) == 0 )
+        reaper_started = TRUE;
+    pthread_attr_destroy( &attr );
+}
+
+/*****************************************************************************
+** reap_tcb - hands a tcb and its cancelled pthread to the reaper.
+**            The tcb stays on the task_list, so that the victim can still
+**            find it while it unwinds, but is marked dying so that it can
+**            no longer be found by task ID or name.  Returns FALSE if the
+**            reaper is unavailable, in which case the caller must join the
+**            pthread and delete the tcb itself.
+*****************************************************************************/
+static BOOL
+   reap_tcb( v2pthread_cb_t *tcb )
+{
+    v2pt_reap_node_t *node;
+
+    pthread_once( &reaper_once, start_reaper );
+    if ( !reaper_started )
+        return( FALSE );
+
+    reap_finished();
+
+    node = (v2pt_reap_node_t *)ts_malloc( sizeof( v2pt_reap_node_t ) );
+    if ( node == (v2pt_reap_node_t *)NULL )
+        return( FALSE );
+    node->pthrid = tcb->pthrid;
+    node->tcb = tcb;
+    node->nxt_reap = (v2pt_reap_node_t *)NULL;
+
+    /*
+    **  Take the victim off any suspend list now, so that no token or
+    **  message is handed to a task which will never consume it.  If the
+    **  victim pends again before it reaches a cancellation point, the
+    **  reaper's tcb_delete unlinks it once more.
+    */
+    unpend_tcb( tcb );
+    tcb->dying = TRUE;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&reap_lock );
+    pthread_mutex_lock( &reap_lock );
+    if ( reap_tail != (v2pt_reap_node_t *)NULL )
+        reap_tail->nxt_reap = node;
+    else
+        reap_list = node;
+    reap_tail = node;
+    pthread_cond_signal( &reap_pending );
+    pthread_cleanup_pop( 1 );
+
+    return( TRUE );
 }
 
 /*****************************************************************************
@@ -783,7 +1625,7 @@ void
     printf( "\r\nnotify_task_delete - wait till pended tasks respond @ tcb %p",
             tcb );
 #endif
-    while ( tcb->first_susp != (v2pthread_cb_t *)NULL )
+    while ( tcb->pend_list.head != (v2pthread_cb_t *)NULL )
         pthread_cond_wait( &(tcb->delete_bcplt), &(tcb->dbcst_lock) );
 
 #ifdef DIAG_PRINTFS 
@@ -850,7 +1692,7 @@ STATUS
         **  Found the task being deleted... first ensure that we
         **  awaken any other tasks pended on deletion of this task
         */
-        if ( current_tcb->first_susp != (v2pthread_cb_t *)NULL )
+        if ( current_tcb->pend_list.head != (v2pthread_cb_t *)NULL )
         {
             notify_task_delete( current_tcb );
         }
@@ -868,16 +1710,23 @@ STATUS
         {
             /*
             **  Task being deleted is not the current task.
-            **  Kill the task pthread and wait for it to die.
-            **  Then de-allocate its data structures.
+            **  Kill the task pthread.  Waiting for it to die and then
+            **  de-allocating its data structures is left to the reaper
+            **  thread, since the victim may take a while to unwind and we
+            **  hold the scheduler lock here.  A caller-supplied (static)
+            **  tcb is still joined in line, because the caller owns that
+            **  memory once we return.
             */
 #ifdef DIAG_PRINTFS 
             printf( "\r\ntaskDeleteForce - other tcb @ %p", current_tcb );
             fflush( stdout );
 #endif
             pthread_cancel( current_tcb->pthrid );
-            pthread_join( current_tcb->pthrid, (void **)NULL );
-            tcb_delete( current_tcb );
+            if ( current_tcb->static_tcb || !reap_tcb( current_tcb ) )
+            {
+                pthread_join( current_tcb->pthrid, (void **)NULL );
+                tcb_delete( current_tcb );
+            }
         }
         else
         {
@@ -927,8 +1776,10 @@ static void
 
     if ( scheduler_locked == pthread_self() )
     {
+        note_taskLock_release();
         taskLock_level = 0;
         scheduler_locked = (pthread_t)NULL;
+        pthread_cond_broadcast( &taskLock_change );
     }
     pthread_mutex_unlock( &v2pthread_task_lock );
 }
@@ -985,6 +1836,19 @@ void *
     	printf("task_wrapper() PATCH! task (%s) wait for tcb->pthrid to get its value... \n", tcb->taskname ? tcb->taskname : "no-name");
 #endif
     }
+
+    /*
+    **  Record our kernel thread ID, and if the task was given deadline
+    **  parameters, move this thread under SCHED_DEADLINE before running
+    **  the task.  If the kernel refuses, the task runs at its fixed priority.
+    */
+    tcb->dl_active = FALSE;
+    tcb->kernel_tid = (pid_t)syscall( SYS_gettid );
+    if ( unprivilegedModeIsEnabled() )
+        apply_nice( tcb );
+    if ( tcb->dl_runtime != 0 )
+        apply_deadline( tcb );
+
     (*(tcb->entry_point))( tcb->parms[0], tcb->parms[1], tcb->parms[2],
                            tcb->parms[3], tcb->parms[4], tcb->parms[5],
                            tcb->parms[6], tcb->parms[7], tcb->parms[8],
@@ -1119,7 +1983,7 @@ int
               current_tcb != (v2pthread_cb_t *)NULL;
               current_tcb = current_tcb->nxt_task )
         {
-            if ( count < maxIds )
+            if ( (count < maxIds) && !(current_tcb->dying) )
             {
                 list[count] = current_tcb->taskid;
                 count++;
@@ -1272,13 +2136,18 @@ STATUS
         pthread_attr_getschedparam( &(tcb->attr), &(tcb->prv_priority) );
 
         /*
-        **  Determine whether round-robin time-slicing is to be used or not
+        **  Determine whether round-robin time-slicing is to be used or not.
+        **  Unprivileged mode uses the normal time-sharing policy, with the
+        **  task priority expressed as a nice value.
         */
-        if ( roundRobinIsEnabled() )
+        if ( unprivilegedModeIsEnabled() )
+            sched_policy = SCHED_OTHER;
+        else if ( roundRobinIsEnabled() )
             sched_policy = SCHED_RR;
         else
             sched_policy = SCHED_FIFO;
         pthread_attr_setschedpolicy( &(tcb->attr), sched_policy );
+        tcb->nice_level = translate_nice( pri );
 
         /*
         **  Translate the v2pthread priority into a pthreads priority
@@ -1289,6 +2158,12 @@ STATUS
         (tcb->prv_priority).sched_priority = new_priority;
         pthread_attr_setschedparam( &(tcb->attr), &(tcb->prv_priority) );
 
+        /*
+        **  Start the task's pthread with the policy and priority above,
+        **  rather than those of the (possibly taskLock-boosted) creator.
+        */
+        pthread_attr_setinheritsched( &(tcb->attr), PTHREAD_EXPLICIT_SCHED );
+
         /*
         ** Entry point for task
         */
@@ -1309,14 +2184,47 @@ STATUS
         */
         tcb->state = DEAD;
 
-        tcb->suspend_list = (v2pthread_cb_t **)NULL;
+        tcb->suspend_list = (v2pt_pend_list_t *)NULL;
         tcb->nxt_susp = (v2pthread_cb_t *)NULL;
+        tcb->prv_susp = (v2pthread_cb_t *)NULL;
+        tcb->suspend_index = (v2pt_prio_index_t *)NULL;
         tcb->nxt_task = (v2pthread_cb_t *)NULL;
 
         /*
         ** Nesting level for number of taskSafe calls
         */
         tcb->delete_safe_count = 0;
+        tcb->dying = FALSE;
+
+        /*
+        ** No deadline scheduling unless taskDeadlineSet is called
+        */
+        tcb->kernel_tid = 0;
+        tcb->dl_active = FALSE;
+        tcb->dl_runtime = 0;
+        tcb->dl_deadline = 0;
+        tcb->dl_period = 0;
+
+        /*
+        ** Flag and Condition variable for direct wakeup while pended
+        */
+        tcb->pend_granted = FALSE;
+        tcb->pend_release = 0;
+        init_monotonic_cond( &(tcb->pend_wake) );
+
+        /*
+        ** Wake word, Mutex and Condition variable for objWaitAny
+        */
+        tcb->wake_seq = 0;
+        pthread_mutex_init( &(tcb->wake_lock),
+                            (pthread_mutexattr_t *)NULL );
+        init_monotonic_cond( &(tcb->wake_cond) );
+
+        /*
+        ** No events sent to the task yet
+        */
+        tcb->events = 0;
+        tcb->events_wanted = 0;
 
         /*
         ** Mutex and Condition variable for task delete 'pend'
@@ -1338,7 +2246,9 @@ STATUS
         ** First task control block in list of tasks waiting on this task
         ** (for deletion purposes)
         */
-        tcb->first_susp = (v2pthread_cb_t *)NULL;
+        tcb->pend_list.head = (v2pthread_cb_t *)NULL;
+        tcb->pend_list.tail = (v2pthread_cb_t *)NULL;
+        tcb->pend_list.lock = (pthread_mutex_t *)NULL;
 
         /*
         **  Save the caller's task arguments in the task control block
@@ -1521,15 +2431,17 @@ STATUS
 }
 
 /*****************************************************************************
-** taskSpawn -   initializes the requisite data structures to support v2pthread 
-**               task behavior not directly supported by Posix threads and
-**               creates a pthread to contain the specified v2pthread task.
+** spawn_task -  common body of taskSpawn and taskSpawnDeadline.  Allocates
+**               and initializes a task control block, records any deadline
+**               parameters, and creates a pthread to contain the task.
 *****************************************************************************/
-int
-    taskSpawn( char *name, int pri, int opts, int stksize,
-               int (*funcptr)( int,int,int,int,int,int,int,int,int,int ),
-               int arg1, int arg2, int arg3, int arg4, int arg5,
-               int arg6, int arg7, int arg8, int arg9, int arg10 )
+static int
+    spawn_task( char *name, int pri, int opts, int stksize,
+                int (*funcptr)( int,int,int,int,int,int,int,int,int,int ),
+                unsigned long long runtime, unsigned long long deadline,
+                unsigned long long period,
+                int arg1, int arg2, int arg3, int arg4, int arg5,
+                int arg6, int arg7, int arg8, int arg9, int arg10 )
 {
     v2pthread_cb_t *tcb;
     int my_tid;
@@ -1574,6 +2486,14 @@ int
             */
             tcb->static_tcb = 0;
 
+            /*
+            ** Deadline parameters are applied by the task's own pthread
+            ** as soon as it starts.
+            */
+            tcb->dl_runtime = runtime;
+            tcb->dl_deadline = deadline;
+            tcb->dl_period = period;
+
             pthread_mutex_unlock( &task_list_lock );
             pthread_cleanup_pop( 0 );
 
@@ -1603,6 +2523,170 @@ int
     return( my_tid );
 }
 
+/*****************************************************************************
+** taskSpawn -   initializes the requisite data structures to support v2pthread 
+**               task behavior not directly supported by Posix threads and
+**               creates a pthread to contain the specified v2pthread task.
+*****************************************************************************/
+int
+    taskSpawn( char *name, int pri, int opts, int stksize,
+               int (*funcptr)( int,int,int,int,int,int,int,int,int,int ),
+               int arg1, int arg2, int arg3, int arg4, int arg5,
+               int arg6, int arg7, int arg8, int arg9, int arg10 )
+{
+    return( spawn_task( name, pri, opts, stksize, funcptr, 0, 0, 0,
+                        arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8,
+                        arg9, arg10 ) );
+}
+
+/*****************************************************************************
+** deadline_params_valid - checks that runtime <= deadline <= period, as
+**                         required by SCHED_DEADLINE.  A zero period means
+**                         the period equals the deadline.
+*****************************************************************************/
+static int
+   deadline_params_valid( unsigned long long runtime,
+                          unsigned long long deadline,
+                          unsigned long long period )
+{
+    if ( runtime == 0 )
+        return( TRUE );
+    if ( (deadline == 0) || (runtime > deadline) )
+        return( FALSE );
+    if ( (period != 0) && (deadline > period) )
+        return( FALSE );
+    return( TRUE );
+}
+
+/*****************************************************************************
+** taskSpawnDeadline - spawns a v2pthread task which runs under SCHED_DEADLINE
+**                     with the specified runtime, deadline and period (in
+**                     nanoseconds).  If the kernel refuses the reservation
+**                     the task runs at the fixed priority 'pri' instead.
+*****************************************************************************/
+int
+    taskSpawnDeadline( char *name, int pri, int opts, int stksize,
+                       int (*funcptr)( int,int,int,int,int,int,int,int,int,int ),
+                       unsigned long long runtime,
+                       unsigned long long deadline,
+                       unsigned long long period,
+                       int arg1, int arg2, int arg3, int arg4, int arg5,
+                       int arg6, int arg7, int arg8, int arg9, int arg10 )
+{
+    if ( !deadline_params_valid( runtime, deadline, period ) )
+    {
+        errno = S_taskLib_ILLEGAL_OPERATION;
+        return( ERROR );
+    }
+
+    return( spawn_task( name, pri, opts, stksize, funcptr,
+                        runtime, deadline, period,
+                        arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8,
+                        arg9, arg10 ) );
+}
+
+/*****************************************************************************
+** taskDeadlineSet - sets (or with a zero runtime, clears) the SCHED_DEADLINE
+**                   parameters for the specified task.  For a task which has
+**                   not started yet the parameters take effect when it does.
+**                   For a running task they take effect immediately; if the
+**                   kernel refuses them (e.g. for want of bandwidth) the task
+**                   keeps the scheduling and parameters it had, and
+**                   S_objLib_OBJ_UNAVAILABLE is returned.
+*****************************************************************************/
+STATUS
+    taskDeadlineSet( int tid, unsigned long long runtime,
+                     unsigned long long deadline, unsigned long long period )
+{
+    unsigned long long old_runtime;
+    unsigned long long old_deadline;
+    unsigned long long old_period;
+    v2pthread_cb_t *tcb;
+    STATUS error;
+
+    error = OK;
+
+    if ( !deadline_params_valid( runtime, deadline, period ) )
+    {
+        errno = S_taskLib_ILLEGAL_OPERATION;
+        return( ERROR );
+    }
+
+    taskLock();
+
+    if ( tid == 0 )
+        tcb = my_tcb();
+    else
+        tcb = tcb_for( tid );
+
+    if ( tcb != (v2pthread_cb_t *)NULL )
+    {
+        old_runtime = tcb->dl_runtime;
+        old_deadline = tcb->dl_deadline;
+        old_period = tcb->dl_period;
+        tcb->dl_runtime = runtime;
+        tcb->dl_deadline = deadline;
+        tcb->dl_period = period;
+
+        /*
+        **  If the task's pthread is already running, change its policy now.
+        **  The kernel leaves the thread as it was if it refuses.
+        */
+        if ( tcb->kernel_tid != 0 )
+        {
+            if ( runtime == 0 )
+                leave_deadline( tcb );
+            else if ( apply_deadline( tcb ) != 0 )
+            {
+                tcb->dl_runtime = old_runtime;
+                tcb->dl_deadline = old_deadline;
+                tcb->dl_period = old_period;
+                error = S_objLib_OBJ_UNAVAILABLE;
+            }
+        }
+    }
+    else
+        error = S_objLib_OBJ_ID_ERROR;
+
+    taskUnlock();
+
+    if ( error != OK )
+    {
+        errno = (int)error;
+        error = ERROR;
+    }
+    return( error );
+}
+
+/*****************************************************************************
+** taskIsDeadline - indicates if the specified task is currently running
+**                  under SCHED_DEADLINE
+*****************************************************************************/
+BOOL
+   taskIsDeadline( int taskid )
+{
+    v2pthread_cb_t *tcb;
+    BOOL result;
+
+    result = (BOOL)FALSE;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&task_list_lock );
+    pthread_mutex_lock( &task_list_lock );
+
+    if ( taskid == 0 )
+        tcb = my_tcb();
+    else
+        tcb = tcb_for( taskid );
+
+    if ( tcb != (v2pthread_cb_t *)NULL )
+        result = (BOOL)tcb->dl_active;
+
+    pthread_cleanup_pop( 1 );
+
+    return( result );
+}
+
 
 /*****************************************************************************
 ** taskSuspend - suspends the specified v2pthread task
@@ -1695,14 +2779,28 @@ STATUS
         */
         tcb->vxw_priority = pri;
         (tcb->prv_priority).sched_priority = new_priority;
+        tcb->nice_level = translate_nice( pri );
+
+        /*
+        **  A task pended in priority order moves to its new place in line.
+        */
+        requeue_susp_tcb( tcb );
 
         /*
-        **  If the selected task is not the currently-executing task,
-        **  modify the pthread's priority now.  If the selected task
+        **  In unprivileged mode, adjust the nice value of the task's thread
+        **  (including the calling task - there is no taskLock boost for
+        **  taskUnlock to undo).
+        */
+        /*
+        **  Otherwise, if the selected task is not the currently-executing
+        **  task, modify the pthread's priority now.  If the selected task
         **  IS the currently-executing task, the taskUnlock operation
-        **  will restore this task to the new priority level.
+        **  will restore this task to the new priority level.  A task under
+        **  SCHED_DEADLINE keeps the new level as its fallback priority.
         */
-        if ( (tid != 0) && (tcb != my_tcb()) )
+        if ( unprivilegedModeIsEnabled() )
+            apply_nice( tcb );
+        else if ( (tid != 0) && (tcb != my_tcb()) && !(tcb->dl_active) )
         {
 	    struct sched_param schedparam;
             pthread_attr_setschedparam( &(tcb->attr), &(tcb->prv_priority) );
@@ -1783,7 +2881,8 @@ int
               current_tcb != (v2pthread_cb_t *)NULL;
               current_tcb = current_tcb->nxt_task )
         {
-            if ( (strcmp( name, current_tcb->taskname )) == 0 )
+            if ( !(current_tcb->dying) &&
+                 ((strcmp( name, current_tcb->taskname )) == 0) )
             {
                 /*
                 **  A matching name was found... return its TID
@@ -1841,7 +2940,8 @@ STATUS
                               (void *)&( current_tcb->tdelete_lock));
         pthread_mutex_lock( &( current_tcb->tdelete_lock) );
 
-        if ( current_tcb->delete_safe_count > 0 )
+        if ( __atomic_load_n( &(current_tcb->delete_safe_count),
+                              __ATOMIC_SEQ_CST ) > 0 )
             task_deletable = FALSE;
         else
             task_deletable = TRUE;
@@ -1880,9 +2980,16 @@ STATUS
                 */
 #ifdef DIAG_PRINTFS 
                 printf( "\r\ntask @ %p wait on task-delete list @ %p", self_tcb,
-                        &(current_tcb->first_susp) );
+                        &(current_tcb->pend_list) );
 #endif
-                link_susp_tcb( &(current_tcb->first_susp), self_tcb );
+                link_susp_tcb( &(current_tcb->pend_list), self_tcb );
+
+                /*
+                **  The task may have dropped its deletion safety since we
+                **  looked; delete_unprotect takes no lock, so order our
+                **  appearance on its list before the recheck below.
+                */
+                __atomic_thread_fence( __ATOMIC_SEQ_CST );
 
                 /*
                 **  Lock mutex for task delete_safe_count & condition variable
@@ -1908,7 +3015,8 @@ STATUS
                 printf( "\r\ntaskDelete - wait till task @ tcb %p deletable",
                         current_tcb );
 #endif
-                while ( current_tcb->delete_safe_count > 0 )
+                while ( __atomic_load_n( &(current_tcb->delete_safe_count),
+                                         __ATOMIC_SEQ_CST ) > 0 )
                 {
                     pthread_cond_wait( &(current_tcb->t_deletable),
                                        &(current_tcb->tdelete_lock) );
@@ -1926,15 +3034,15 @@ STATUS
                 **  suspend list pointer since the TCB it was suspended on is
                 **  being deleted and deallocated.
                 */
-                unlink_susp_tcb( &(current_tcb->first_susp), self_tcb );
-                self_tcb->suspend_list = (v2pthread_cb_t **)NULL;
+                unlink_susp_tcb( &(current_tcb->pend_list), self_tcb );
+                self_tcb->suspend_list = (v2pt_pend_list_t *)NULL;
 
                 /*
                 **  If our task was the last one pended, signal the task
                 **  which enabled the deletion and indicate that all pended
                 **  tasks have been awakened.
                 */
-                if ( current_tcb->first_susp == (v2pthread_cb_t *)NULL )
+                if ( current_tcb->pend_list.head == (v2pthread_cb_t *)NULL )
                 {
                     /*
                     ** Lock mutex for task delete broadcast completion
@@ -2056,7 +3164,7 @@ STATUS
                 current_tcb->suspend_list );
         fflush( stdout );
 #endif
-        unlink_susp_tcb( current_tcb->suspend_list, current_tcb );
+        unpend_tcb( current_tcb );
 
         if ( current_tcb != self_tcb )
         {
@@ -2075,6 +3183,7 @@ STATUS
             **  Start a new pthread using the existing task control block.
             */
             current_tcb->pthrid = (pthread_t)NULL;
+            current_tcb->kernel_tid = 0;
             current_tcb->state = READY;
             if ( pthread_create( &(current_tcb->pthrid), &(current_tcb->attr),
                                  task_wrapper, (void *)current_tcb ) != 0 )
@@ -2130,51 +3239,86 @@ STATUS
 }
 
 /*****************************************************************************
-** taskSafe - marks the calling task as safe from explicit deletion.
+** delete_protect - adds one level of deletion safety to the specified task.
+**                  A single atomic increment: no lock is needed, since
+**                  taskDelete rereads the count under tdelete_lock after
+**                  pending, and delete_unprotect wakes it once the count
+**                  drops to zero.  Mutexes created with SEM_DELETE_SAFE
+**                  call this directly as they are acquired.
 *****************************************************************************/
-STATUS
-   taskSafe( void )
+void
+   delete_protect( v2pthread_cb_t *tcb )
 {
-    v2pthread_cb_t *current_tcb;
-
-    taskLock();
-
-    /*
-    **  Get pointer to TCB for current task
-    */
-    current_tcb = my_tcb();
+    int count;
 
-    /*
-    **  Lock mutex for task delete_safe_count & condition variable
-    */
-    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                          (void *)&(current_tcb->tdelete_lock));
-    pthread_mutex_lock( &(current_tcb->tdelete_lock) );
 #ifdef DIAG_PRINTFS 
-    printf( "\r\ntaskSafe - lock delete cond var mutex @ tcb %p", current_tcb );
+    printf( "\r\ndelete_protect - task @ tcb %p", tcb );
 #endif
-
     /*
-    **  Increment task delete_safe_count and adjust for any overflow.
+    **  Increment task delete_safe_count, saturating rather than letting
+    **  it overflow.
     */
-    current_tcb->delete_safe_count++;
-    if ( current_tcb->delete_safe_count <= 0 )
-        current_tcb->delete_safe_count--;
-#ifdef DIAG_PRINTFS 
-    printf( "\r\ntaskSafe - new delete_safe_count %d @ tcb %p",
-            current_tcb->delete_safe_count, current_tcb );
-#endif
+    count = __atomic_load_n( &(tcb->delete_safe_count), __ATOMIC_RELAXED );
+    do
+    {
+        if ( count == INT_MAX )
+            return;
+    } while ( !__atomic_compare_exchange_n( &(tcb->delete_safe_count),
+                                            &count, count + 1, FALSE,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED ) );
+}
 
-    /*
-    **  Unlock the mutex for the condition variable and clean up.
-    */
+/*****************************************************************************
+** delete_unprotect - removes one level of deletion safety from the specified
+**                    task.  Only when the count reaches zero while some
+**                    task is pended to delete this one are any locks taken.
+**                    The pended deleter links itself to pend_list before
+**                    rechecking the count, so either it sees the count at
+**                    zero or we see it on the list.
+*****************************************************************************/
+void
+   delete_unprotect( v2pthread_cb_t *tcb )
+{
+    int count;
+
+    count = __atomic_load_n( &(tcb->delete_safe_count), __ATOMIC_RELAXED );
+    do
+    {
+        if ( count <= 0 )
+            return;
+    } while ( !__atomic_compare_exchange_n( &(tcb->delete_safe_count),
+                                            &count, count - 1, FALSE,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED ) );
 #ifdef DIAG_PRINTFS 
-    printf( "\r\ntaskSafe - unlock delete cond var mutex @ tcb %p",
-            current_tcb );
+    printf( "\r\ndelete_unprotect - new delete_safe_count %d @ tcb %p",
+            count - 1, tcb );
 #endif
-    pthread_cleanup_pop( 1 );
 
-    taskUnlock();
+    if ( (count == 1) &&
+         (__atomic_load_n( &(tcb->pend_list.head), __ATOMIC_SEQ_CST ) !=
+          (v2pthread_cb_t *)NULL) )
+    {
+        /*
+        **  Task just made deletable... ensure that we awaken any
+        **  other tasks pended on deletion of this task
+        */
+        notify_task_delete( tcb );
+    }
+}
+
+/*****************************************************************************
+** taskSafe - marks the calling task as safe from explicit deletion.
+*****************************************************************************/
+STATUS
+   taskSafe( void )
+{
+    v2pthread_cb_t *current_tcb;
+
+    current_tcb = my_tcb();
+    if ( current_tcb != (v2pthread_cb_t *)NULL )
+        delete_protect( current_tcb );
 
     return( (STATUS)OK );
 }
@@ -2186,64 +3330,10 @@ STATUS
    taskUnsafe( void )
 {
     v2pthread_cb_t *current_tcb;
-    int task_made_deletable;
-
-    taskLock();
 
-    /*
-    **  Get pointer to TCB for current task
-    */
     current_tcb = my_tcb();
-
-    task_made_deletable = FALSE;
-
-    /*
-    **  Lock mutex for task delete_safe_count & condition variable
-    */
-#ifdef DIAG_PRINTFS 
-    printf( "\r\ntaskUnsafe - lock delete cond var mutex @ tcb %p",
-            current_tcb );
-#endif
-    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
-                          (void *)&(current_tcb->tdelete_lock));
-    pthread_mutex_lock( &(current_tcb->tdelete_lock) );
-
-    /*
-    **  Decrement task delete_safe_count
-    */
-    if ( current_tcb->delete_safe_count > 0 )
-    {
-        current_tcb->delete_safe_count--;
-        if ( current_tcb->delete_safe_count == 0 )
-            task_made_deletable = TRUE;
-    }
-#ifdef DIAG_PRINTFS 
-    printf( "\r\ntaskUnsafe - new delete_safe_count %d @ tcb %p",
-            current_tcb->delete_safe_count, current_tcb );
-#endif
-
-    /*
-    **  Unlock the mutex for the condition variable and clean up.
-    */
-#ifdef DIAG_PRINTFS 
-    printf( "\r\ntaskUnsafe - unlock delete cond var mutex @ tcb %p",
-            current_tcb );
-#endif
-    pthread_cleanup_pop( 1 );
-
-    taskUnlock();
-
-    if ( task_made_deletable )
-    {
-        /*
-        **  Task just made deletable... ensure that we awaken any
-        **  other tasks pended on deletion of this task
-        */
-        if ( current_tcb->first_susp != (v2pthread_cb_t *)NULL )
-        {
-            notify_task_delete( current_tcb );
-        }
-    }
+    if ( current_tcb != (v2pthread_cb_t *)NULL )
+        delete_unprotect( current_tcb );
 
     return( (STATUS)OK );
 }
@@ -0,0 +1,387 @@
+/*****************************************************************************
+ * waitLib.c - defines the wrapper functions and data structures needed
+ *             to let a v2pthread task wait on several semaphores and
+ *             message queues at once in a POSIX Threads environment.
+ *
+ * Copyright (C) 2000, 2001  MontaVista Software Inc.
+ *
+ * Author : Gary S. Robertson
+ *
+ * VxWorks is a registered trademark of Wind River Systems, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ ****************************************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include "v2pthread.h"
+#include "vxw_defs.h"
+
+/*****************************************************************************
+**  Object descriptor for objWaitAny (WAIT_OBJ in vxw_hdrs.h)
+*****************************************************************************/
+typedef struct v2pt_wait_obj
+{
+        /*
+        ** Object type (WAIT_OBJ_SEM or WAIT_OBJ_MSG_Q)
+        */
+    int
+        type;
+
+        /*
+        ** Semaphore or message queue ID
+        */
+    void *
+        id;
+
+        /*
+        ** Buffer and buffer length for a message received from a queue
+        */
+    char *
+        msgbuf;
+    uint
+        buflen;
+
+        /*
+        ** Length of the message received from a queue
+        */
+    int
+        msglen;
+} v2pt_wait_obj_t;
+
+/*****************************************************************************
+**  Watch set for a task in objWaitAny, passed to its cleanup handler
+*****************************************************************************/
+typedef struct v2pt_watch_set
+{
+    v2pt_wait_obj_t *
+        objs;
+    int
+        count;
+    v2pt_watch_t
+        watch[WAIT_OBJS_MAX];
+} v2pt_watch_set_t;
+
+/*****************************************************************************
+**  External function and data references
+*****************************************************************************/
+extern v2pthread_cb_t *
+   my_tcb( void );
+extern void
+   deadline_after_ticks( int ticks, struct timespec *deadline );
+extern STATUS
+   semTake( void *semid, int max_wait );
+extern int
+   msgQReceive( void *queue, char *msgbuf, uint buflen, int max_wait );
+extern STATUS
+   sema4_watch( void *semid, v2pt_watch_t *watch );
+extern void
+   sema4_unwatch( void *semid, v2pt_watch_t *watch );
+extern STATUS
+   mqueue_watch( void *queue, v2pt_watch_t *watch );
+extern void
+   mqueue_unwatch( void *queue, v2pt_watch_t *watch );
+
+/*****************************************************************************
+** link_watch - adds a watch record to the head of an object's watch list.
+**              The caller must hold the object's lock.
+*****************************************************************************/
+void
+   link_watch( v2pt_watch_t **list_head, v2pt_watch_t *watch )
+{
+    watch->prv_watch = (v2pt_watch_t *)NULL;
+    watch->nxt_watch = *list_head;
+    if ( *list_head != (v2pt_watch_t *)NULL )
+        (*list_head)->prv_watch = watch;
+    *list_head = watch;
+}
+
+/*****************************************************************************
+** unlink_watch - removes a watch record from an object's watch list, unless
+**                the object has already dropped it.  The caller must hold
+**                the object's lock.  Returns TRUE if the record was removed.
+*****************************************************************************/
+int
+   unlink_watch( v2pt_watch_t **list_head, v2pt_watch_t *watch )
+{
+    if ( watch->object == NULL )
+        return( FALSE );
+
+    if ( watch->prv_watch != (v2pt_watch_t *)NULL )
+        watch->prv_watch->nxt_watch = watch->nxt_watch;
+    else
+        *list_head = watch->nxt_watch;
+    if ( watch->nxt_watch != (v2pt_watch_t *)NULL )
+        watch->nxt_watch->prv_watch = watch->prv_watch;
+    watch->object = NULL;
+    return( TRUE );
+}
+
+/*****************************************************************************
+** wake_watcher - bumps a task's wake word and wakes the task if it sleeps
+**                in objWaitAny.
+*****************************************************************************/
+static void
+   wake_watcher( v2pthread_cb_t *tcb )
+{
+    pthread_mutex_lock( &(tcb->wake_lock) );
+    __atomic_add_fetch( &(tcb->wake_seq), 1, __ATOMIC_RELEASE );
+    pthread_cond_signal( &(tcb->wake_cond) );
+    pthread_mutex_unlock( &(tcb->wake_lock) );
+}
+
+/*****************************************************************************
+** wake_watchers - wakes every task watching an object which may have become
+**                 ready.  Each one retries the object itself, so a wakeup
+**                 for a token or message which another task gets first is
+**                 harmless.  The caller must hold the object's lock.
+*****************************************************************************/
+void
+   wake_watchers( v2pt_watch_t **list_head )
+{
+    v2pt_watch_t *watch;
+
+    for ( watch = *list_head; watch != (v2pt_watch_t *)NULL;
+          watch = watch->nxt_watch )
+    {
+#ifdef DIAG_PRINTFS 
+        printf( "\r\nobject @ %p wakes watching task @ %p", watch->object,
+                watch->tcb );
+#endif
+        wake_watcher( watch->tcb );
+    }
+}
+
+/*****************************************************************************
+** drop_watchers - lets go of every task watching an object which is being
+**                 deleted, and wakes each one to find the object gone.
+**                 The caller must hold the object's lock.
+*****************************************************************************/
+void
+   drop_watchers( v2pt_watch_t **list_head )
+{
+    v2pt_watch_t *watch;
+    v2pthread_cb_t *tcb;
+
+    while ( *list_head != (v2pt_watch_t *)NULL )
+    {
+        watch = *list_head;
+        *list_head = watch->nxt_watch;
+        tcb = watch->tcb;
+
+        /*
+        **  The record lives on the watching task's stack; once its object
+        **  pointer is cleared the task may leave objWaitAny at any time.
+        */
+        __atomic_store_n( &(watch->object), NULL, __ATOMIC_RELEASE );
+        wake_watcher( tcb );
+    }
+}
+
+/*****************************************************************************
+** try_wait_obj - makes one attempt, without waiting, to take a token from
+**                (or receive a message from) the specified object.
+*****************************************************************************/
+static STATUS
+   try_wait_obj( v2pt_wait_obj_t *obj )
+{
+    STATUS error;
+
+    if ( obj->type == WAIT_OBJ_SEM )
+        error = semTake( obj->id, NO_WAIT );
+    else
+    {
+        obj->msglen = msgQReceive( obj->id, obj->msgbuf, obj->buflen,
+                                   NO_WAIT );
+        error = (obj->msglen == (int)ERROR) ? ERROR : OK;
+    }
+    return( error );
+}
+
+/*****************************************************************************
+** try_wait_objs - tries each object in turn.  Returns the index of the first
+**                 one taken, or ERROR with *error set to the reason:
+**                 S_objLib_OBJ_UNAVAILABLE if none was ready, or the
+**                 error from the first object which is no longer usable.
+*****************************************************************************/
+static int
+   try_wait_objs( v2pt_wait_obj_t *objs, int nobjs, STATUS *error )
+{
+    int i;
+
+    for ( i = 0; i < nobjs; i++ )
+    {
+        if ( try_wait_obj( &(objs[i]) ) == OK )
+            return( i );
+        if ( errno != S_objLib_OBJ_UNAVAILABLE )
+        {
+            *error = (STATUS)errno;
+            return( (int)ERROR );
+        }
+    }
+    *error = S_objLib_OBJ_UNAVAILABLE;
+    return( (int)ERROR );
+}
+
+/*****************************************************************************
+** unwatch_objs - takes the calling task's watch records out of the objects'
+**                watch lists.  Also the cleanup handler for a task killed
+**                in objWaitAny.
+*****************************************************************************/
+static void
+   unwatch_objs( void *arg )
+{
+    v2pt_watch_set_t *set;
+    int i;
+
+    set = (v2pt_watch_set_t *)arg;
+    for ( i = 0; i < set->count; i++ )
+    {
+        if ( set->objs[i].type == WAIT_OBJ_SEM )
+            sema4_unwatch( set->objs[i].id, &(set->watch[i]) );
+        else
+            mqueue_unwatch( set->objs[i].id, &(set->watch[i]) );
+    }
+    set->count = 0;
+}
+
+/*****************************************************************************
+** objWaitAny - blocks the calling task until any one of the specified
+**              semaphores and message queues is ready, and takes a token
+**              from (or receives a message from) that one object only.
+**              Returns the index of the object taken, or ERROR.
+**              The calling task watches every object instead of pending on
+**              any of them: each object bumps the task's wake word when it
+**              may have become ready, and the task then tries the objects
+**              in order.  Objects earlier in the list are thus preferred
+**              when several are ready at once.
+*****************************************************************************/
+int
+   objWaitAny( v2pt_wait_obj_t *objs, int nobjs, int max_wait )
+{
+    v2pthread_cb_t *our_tcb;
+    v2pt_watch_set_t set;
+    struct timespec timeout;
+    unsigned int seq;
+    int retcode;
+    STATUS error;
+    int index;
+    int i;
+
+    error = OK;
+
+    if ( (objs == (v2pt_wait_obj_t *)NULL) || (nobjs < 1) ||
+         (nobjs > WAIT_OBJS_MAX) )
+    {
+        errno = EINVAL;
+        return( (int)ERROR );
+    }
+    for ( i = 0; i < nobjs; i++ )
+    {
+        if ( (objs[i].type != WAIT_OBJ_SEM) &&
+             (objs[i].type != WAIT_OBJ_MSG_Q) )
+        {
+            errno = EINVAL;
+            return( (int)ERROR );
+        }
+    }
+
+    /*
+    **  Take whichever object is ready already, if any, without watching.
+    */
+    index = try_wait_objs( objs, nobjs, &error );
+    our_tcb = my_tcb();
+    if ( (index != (int)ERROR) || (error != S_objLib_OBJ_UNAVAILABLE) ||
+         (max_wait == NO_WAIT) || (our_tcb == (v2pthread_cb_t *)NULL) )
+    {
+        if ( index == (int)ERROR )
+            errno = (int)error;
+        return( index );
+    }
+
+    /*
+    **  Calculate the CLOCK_MONOTONIC deadline, if one applies.
+    */
+    if ( max_wait != WAIT_FOREVER )
+        deadline_after_ticks( max_wait, &timeout );
+
+    /*
+    **  Watch every object.  The cleanup handler takes the watch records out
+    **  of the objects' lists again if our task is killed while waiting.
+    */
+    set.objs = objs;
+    set.count = 0;
+    pthread_cleanup_push( unwatch_objs, (void *)&set );
+    for ( i = 0; i < nobjs; i++ )
+    {
+        set.watch[i].tcb = our_tcb;
+        if ( objs[i].type == WAIT_OBJ_SEM )
+            error = sema4_watch( objs[i].id, &(set.watch[i]) );
+        else
+            error = mqueue_watch( objs[i].id, &(set.watch[i]) );
+        if ( error != OK )
+            break;
+        set.count++;
+    }
+
+    retcode = 0;
+    index = (int)ERROR;
+    while ( error == OK )
+    {
+        /*
+        **  Note the wake word before trying the objects, so that an object
+        **  becoming ready at any time after the attempt is not missed.
+        */
+        seq = __atomic_load_n( &(our_tcb->wake_seq), __ATOMIC_ACQUIRE );
+        index = try_wait_objs( objs, nobjs, &error );
+        if ( index != (int)ERROR )
+            break;
+        if ( error != S_objLib_OBJ_UNAVAILABLE )
+            break;
+        error = OK;
+        if ( retcode == ETIMEDOUT )
+        {
+            error = S_objLib_OBJ_TIMEOUT;
+            break;
+        }
+
+        /*
+        **  Sleep until a watched object bumps the wake word or the timeout
+        **  expires.  Once timed out, the objects get one more try.
+        */
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&(our_tcb->wake_lock) );
+        pthread_mutex_lock( &(our_tcb->wake_lock) );
+        while ( (our_tcb->wake_seq == seq) && (retcode != ETIMEDOUT) )
+        {
+            if ( max_wait == WAIT_FOREVER )
+                pthread_cond_wait( &(our_tcb->wake_cond),
+                                   &(our_tcb->wake_lock) );
+            else
+                retcode = pthread_cond_timedwait( &(our_tcb->wake_cond),
+                                                  &(our_tcb->wake_lock),
+                                                  &timeout );
+        }
+        pthread_cleanup_pop( 1 );
+    }
+
+    /*
+    **  Stop watching the objects.
+    */
+    pthread_cleanup_pop( 1 );
+
+    if ( index == (int)ERROR )
+        errno = (int)error;
+    return( index );
+}
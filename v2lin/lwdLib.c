@@ -37,8 +37,12 @@
 **  These watchdog timers provide a means of executing delayed or cyclic
 **  functions.  They are inherently 'one-shot' timers.  For cyclic operation,
 **  the timeout handler function must call wdStart to restart the timer.
-**  In the v2pthreads environment, these timers execute from the
-**  context of the system exception task rather tha the timer interrupt.
+**  In the v2pthreads environment, these timers are serviced by the
+**  system exception task rather than the timer interrupt, and their
+**  timeout functions run in an exception job worker task (excJobAdd),
+**  one at a time and in the order the timers expired.  An expired timer
+**  waits on the expired list until its timeout function runs; wdStart,
+**  wdCancel and wdDelete withdraw it from that list.
 *****************************************************************************/
 typedef struct v2pt_wdog
 {
@@ -68,6 +72,20 @@ typedef struct v2pt_wdog
         */
     struct v2pt_wdog *
         nxt_wdog;
+
+        /*
+        ** Flags indicating that the timeout function is due to run, and
+        ** that the watchdog is linked into the expired list.  Both are
+        ** protected by wdog_expired_lock.
+        */
+    int expired;
+    int queued;
+
+        /*
+        ** Pointer to next watchdog control block in expired list.
+        */
+    struct v2pt_wdog *
+        nxt_expired;
 } v2pt_wdog_t;
 
 /*****************************************************************************
@@ -83,6 +101,9 @@ extern void
    taskUnlock( void );
 extern v2pthread_cb_t *
    tcb_for( int taskid );
+extern STATUS
+   excJobAdd( void (*func)( int, int, int, int, int, int ), int arg1,
+              int arg2, int arg3, int arg4, int arg5, int arg6 );
 void *
     task_wrapper( void *arg );
 
@@ -103,6 +124,32 @@ static v2pt_wdog_t *
 static pthread_mutex_t
     wdog_list_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+**  wdog_expired is a FIFO list of watchdogs whose timeout functions are
+**               waiting to be run by an exception job worker, and
+**               wdog_expired_tail the last watchdog in that list.
+*/
+static v2pt_wdog_t *
+    wdog_expired;
+static v2pt_wdog_t *
+    wdog_expired_tail;
+
+/*
+**  wdog_jobs_running is set while an exception job worker is running the
+**                    timeout functions in the expired list, so that no
+**                    other worker runs them concurrently.
+*/
+static int
+    wdog_jobs_running;
+
+/*
+**  wdog_expired_lock is a mutex used to serialize access to the expired
+**                    list.  It may be taken while holding a watchdog's
+**                    mutex, but not the other way around.
+*/
+static pthread_mutex_t
+    wdog_expired_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 /*****************************************************************************
 **  wdog_valid - verifies whether the specified watchdog still exists, and if
@@ -284,6 +331,171 @@ static v2pt_wdog_t *
     return( selected_wdog );
 }
 
+/*****************************************************************************
+** expire_wdog - marks the specified watchdog's timeout function as due to
+**               run and appends the watchdog to the expired list if it is
+**               not already there.  The caller holds the watchdog's mutex.
+*****************************************************************************/
+static void
+   expire_wdog( v2pt_wdog_t *wdId )
+{
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&wdog_expired_lock );
+    pthread_mutex_lock( &wdog_expired_lock );
+
+    wdId->expired = TRUE;
+    if ( !wdId->queued )
+    {
+        wdId->queued = TRUE;
+        wdId->nxt_expired = (v2pt_wdog_t *)NULL;
+        if ( wdog_expired_tail != (v2pt_wdog_t *)NULL )
+            wdog_expired_tail->nxt_expired = wdId;
+        else
+            wdog_expired = wdId;
+        wdog_expired_tail = wdId;
+    }
+
+    pthread_mutex_unlock( &wdog_expired_lock );
+    pthread_cleanup_pop( 0 );
+}
+
+/*****************************************************************************
+** withdraw_wdog - removes the specified watchdog from the expired list, so
+**                 that a timeout function not yet run is not run at all.
+**                 The caller holds the watchdog's mutex.
+*****************************************************************************/
+static void
+   withdraw_wdog( v2pt_wdog_t *wdId )
+{
+    v2pt_wdog_t *current_wdog;
+    v2pt_wdog_t *prev_wdog;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&wdog_expired_lock );
+    pthread_mutex_lock( &wdog_expired_lock );
+
+    wdId->expired = FALSE;
+    if ( wdId->queued )
+    {
+        prev_wdog = (v2pt_wdog_t *)NULL;
+        for ( current_wdog = wdog_expired;
+              current_wdog != wdId;
+              current_wdog = current_wdog->nxt_expired )
+            prev_wdog = current_wdog;
+        if ( prev_wdog != (v2pt_wdog_t *)NULL )
+            prev_wdog->nxt_expired = wdId->nxt_expired;
+        else
+            wdog_expired = wdId->nxt_expired;
+        if ( wdog_expired_tail == wdId )
+            wdog_expired_tail = prev_wdog;
+        wdId->queued = FALSE;
+    }
+
+    pthread_mutex_unlock( &wdog_expired_lock );
+    pthread_cleanup_pop( 0 );
+}
+
+/*****************************************************************************
+** next_expired_wdog - removes and returns the first watchdog in the expired
+**                     list, or clears wdog_jobs_running and returns NULL if
+**                     the list is empty.  The caller holds the expired list
+**                     mutex.
+*****************************************************************************/
+static v2pt_wdog_t *
+   next_expired_wdog( void )
+{
+    v2pt_wdog_t *wdId;
+
+    wdId = wdog_expired;
+    if ( wdId != (v2pt_wdog_t *)NULL )
+    {
+        wdog_expired = wdId->nxt_expired;
+        if ( wdog_expired == (v2pt_wdog_t *)NULL )
+            wdog_expired_tail = (v2pt_wdog_t *)NULL;
+        wdId->queued = FALSE;
+    }
+    else
+        wdog_jobs_running = FALSE;
+
+    return( wdId );
+}
+
+/*****************************************************************************
+** run_expired_wdogs - exception job which runs the timeout functions of the
+**                     watchdogs in the expired list, in order.  If another
+**                     worker is already doing so, it will also run any
+**                     watchdogs queued since, so this job does nothing.
+*****************************************************************************/
+static void
+   run_expired_wdogs( int dummy1, int dummy2, int dummy3, int dummy4,
+                      int dummy5, int dummy6 )
+{
+    v2pt_wdog_t *wdId;
+    void (*timeout_func)( int );
+    int timeout_parm;
+
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&wdog_expired_lock );
+    pthread_mutex_lock( &wdog_expired_lock );
+    if ( wdog_jobs_running )
+        wdId = (v2pt_wdog_t *)NULL;
+    else
+    {
+        wdog_jobs_running = TRUE;
+        wdId = next_expired_wdog();
+    }
+    pthread_mutex_unlock( &wdog_expired_lock );
+    pthread_cleanup_pop( 0 );
+
+    while ( wdId != (v2pt_wdog_t *)NULL )
+    {
+        timeout_func = (void (*)( int ))NULL;
+        timeout_parm = 0;
+
+        /*
+        **  The watchdog may have been deleted, or withdrawn by wdStart or
+        **  wdCancel, since it was taken off the expired list.  Only run
+        **  its timeout function if it still exists and is still expired.
+        */
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&(wdId->wdog_lock));
+        if ( wdog_valid( wdId ) )
+        {
+            pthread_mutex_lock( &wdog_expired_lock );
+            if ( wdId->expired )
+            {
+                wdId->expired = FALSE;
+                timeout_func = wdId->timeout_func;
+                timeout_parm = wdId->timeout_parm;
+            }
+            pthread_mutex_unlock( &wdog_expired_lock );
+
+            /*
+            **  Unlock the watchdog mutex so the timeout handler can call
+            **  wdStart or wdDelete if desired.
+            */
+            pthread_mutex_unlock( &(wdId->wdog_lock) );
+        }
+        pthread_cleanup_pop( 0 );
+
+        if ( timeout_func != (void (*)( int ))NULL )
+        {
+#ifdef DIAG_PRINTFS 
+            printf( "\r\nwatchdog @ %p calling function @ %p", wdId,
+                    timeout_func );
+#endif
+            (*timeout_func)( timeout_parm );
+        }
+
+        pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                              (void *)&wdog_expired_lock );
+        pthread_mutex_lock( &wdog_expired_lock );
+        wdId = next_expired_wdog();
+        pthread_mutex_unlock( &wdog_expired_lock );
+        pthread_cleanup_pop( 0 );
+    }
+}
+
 /*****************************************************************************
 ** process_tick_for - performs service on the specified watchdog timer after
 **                    a system timer tick has elapsed.  Returns the address
@@ -329,30 +541,22 @@ static v2pt_wdog_t *
             if ( (wdId->ticks_remaining == 0) &&
                  (wdId->timeout_func != (void (*)( int ))NULL) )
             {
-                /*
-                **  Unlock the queue mutex so the timeout handler can call
-                **  wdStart if desired.  This would create a race condition,
-                **  but (1) the task executing this function cannot be
-                **  preempted at this point by other v2pthread tasks, and
-                **  (2) the timer list itself is locked at this point. 
-                */
-                pthread_mutex_unlock( &(wdId->wdog_lock) );
-
 #ifdef DIAG_PRINTFS 
-                printf( "\r\nwatchdog @ %p calling function @ %p", wdId,
+                printf( "\r\nwatchdog @ %p queueing function @ %p", wdId,
                         wdId->timeout_func );
 #endif
                 /*
-                **  Execute the timeout handler, passing it the
-                **  timer handler parameter.
+                **  Leave the timeout handler for an exception job worker,
+                **  which runs it after the rest of the timer list has
+                **  been serviced.
                 */
-                (*(wdId->timeout_func))( wdId->timeout_parm );
+                expire_wdog( wdId );
             }
-            else
-                /*
-                **  Unlock the queue mutex. 
-                */
-                pthread_mutex_unlock( &(wdId->wdog_lock) );
+
+            /*
+            **  Unlock the queue mutex. 
+            */
+            pthread_mutex_unlock( &(wdId->wdog_lock) );
         }
         else
         {
@@ -390,6 +594,7 @@ void
    process_timer_list( void )
 {
     v2pt_wdog_t *nxt_wdog;
+    int pending;
 
     if ( wdog_list != (v2pt_wdog_t *)NULL )
     {
@@ -405,6 +610,22 @@ void
             nxt_wdog = process_tick_for( nxt_wdog );
         }
     }
+
+    /*
+    **  Queue a job to run the timeout functions of any expired watchdogs,
+    **  unless a worker is already running them.  If the job queue is full,
+    **  run them here as before.
+    */
+    pthread_cleanup_push( (void(*)(void *))pthread_mutex_unlock,
+                          (void *)&wdog_expired_lock );
+    pthread_mutex_lock( &wdog_expired_lock );
+    pending = ((wdog_expired != (v2pt_wdog_t *)NULL) && !wdog_jobs_running);
+    pthread_mutex_unlock( &wdog_expired_lock );
+    pthread_cleanup_pop( 0 );
+
+    if ( pending &&
+         (excJobAdd( run_expired_wdogs, 0, 0, 0, 0, 0, 0 ) != OK) )
+        run_expired_wdogs( 0, 0, 0, 0, 0, 0 );
 }
 
 /*****************************************************************************
@@ -429,9 +650,11 @@ STATUS
     {
 
         /*
-        **  Zero the ticks remaining without executing the timeout function.
+        **  Zero the ticks remaining without executing the timeout function,
+        **  and withdraw the timeout function if it is waiting to run.
         */
         wdId->ticks_remaining = 0; 
+        withdraw_wdog( wdId );
 
         /*
         **  Unlock the queue mutex. 
@@ -481,6 +704,8 @@ v2pt_wdog_t *
          **  Zero ticks remaining until timeout so watchdog is inactive.
          */
          new_wdog->ticks_remaining = 0;
+         new_wdog->expired = FALSE;
+         new_wdog->queued = FALSE;
 
          /*
          **  Link the new watchdog control block into the watchdog timer list.
@@ -514,6 +739,7 @@ STATUS
         **  First remove the watchdog from the watchdog list
         */
         unlink_wdog( wdId );
+        withdraw_wdog( wdId );
 
         /*
         **  Finally delete the watchdog control block itself;
@@ -571,6 +797,11 @@ STATUS
         if ( wdId->ticks_remaining < 1 )
             wdId->ticks_remaining = 1;
 
+        /*
+        ** Withdraw the previous timeout function if it is waiting to run.
+        */
+        withdraw_wdog( wdId );
+
         /*
         ** Function to be executed when ticks remaining decrements to zero.
         */
@@ -606,21 +837,20 @@ STATUS
 }
 
 /*****************************************************************************
-** self_starter - called from a task-restart watchdog timer.  Starts a new
-**                pthread for the specified task and deletes the watchdog.
+** self_starter - called from an exception job worker task.  Starts a new
+**                pthread for the specified task.
 *****************************************************************************/
-static v2pt_wdog_t *restart_wdog;
-
 static void
    self_starter( int taskid )
 {
     v2pthread_cb_t *tcb;
 
     /*
-    **  Delete the task restart watchdog regardless of the success or failure
-    **  of the restart operation.
+    **  The terminating task still holds the scheduler lock until its
+    **  pthread has exited far enough to release it.  Taking the lock here
+    **  ensures the old pthread is finished with the tcb before we reuse it.
     */
-    wdDelete( restart_wdog );
+    taskLock();
 
     /*
     **  Get the address of the task control block for the specified task ID.
@@ -634,9 +864,31 @@ static void
         */
         tcb->state = READY;
         tcb->pthrid = (pthread_t)NULL;
+        tcb->kernel_tid = 0;
         pthread_create( &(tcb->pthrid), &(tcb->attr), task_wrapper,
                         (void *)tcb );
     }
+
+    taskUnlock();
+}
+
+/*****************************************************************************
+** wd_self_starter - called from a task-restart watchdog timer when the
+**                   restart could not be queued directly.  Deletes the
+**                   watchdog and then restarts the specified task.
+*****************************************************************************/
+static v2pt_wdog_t *restart_wdog;
+
+static void
+   wd_self_starter( int taskid )
+{
+    /*
+    **  Delete the task restart watchdog regardless of the success or failure
+    **  of the restart operation.
+    */
+    wdDelete( restart_wdog );
+
+    self_starter( taskid );
 }
 
 /*****************************************************************************
@@ -647,7 +899,15 @@ void
    selfRestart( v2pthread_cb_t *restart_tcb )
 {
     /*
-    **  First create a watchdog timer to handle the restart operation.
+    **  Queue the restart for an exception job worker.
+    */
+    if ( excJobAdd( (void (*)( int, int, int, int, int, int ))self_starter,
+                    restart_tcb->taskid, 0, 0, 0, 0, 0 ) == OK )
+        return;
+
+    /*
+    **  The job queue is full or not running... fall back to a watchdog
+    **  timer to handle the restart operation.
     */
     restart_wdog = wdCreate();
 
@@ -655,10 +915,10 @@ void
     {
         /*
         **  Start the watchdog timer to expire after one tick and to call
-        **  a function which will first restart the specified task and
-        **  then delete the restart watchdog timer.
+        **  a function which will first delete the restart watchdog timer
+        **  and then restart the specified task.
         */
-        wdStart( restart_wdog, 1, self_starter, restart_tcb->taskid );
+        wdStart( restart_wdog, 1, wd_self_starter, restart_tcb->taskid );
     }
 }
 
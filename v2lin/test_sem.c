@@ -7,6 +7,9 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <sched.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <limits.h>
 
 #include "vxw_hdrs.h"
 #include "v2pthread.h"
@@ -49,6 +52,161 @@ typedef enum
     MUTEX_OPPOSITE_GIVE,/* other gives the mutex back */
 
     MUTEX_UNBLOCK,		/* the second thread gives, and the main is able to take again */
+
+    /****************/
+
+    FLUSH_WAKE,			/* TEST_WAITERS threads blocked on a binary semaphore are all
+                           woken with OK by semFlush */
+
+    DELETE_WAKE,		/* TEST_WAITERS threads blocked on a binary semaphore are all
+                           woken with S_objLib_OBJ_ID_ERROR by semDelete */
+
+    /****************/
+
+    WAIT_ANY_TIMEOUT,	/* main waits on an empty semaphore and queue with objWaitAny,
+                           and times out after TEST_WAIT_TICKS */
+
+    WAIT_ANY_READY,		/* sender thread sends to the queue, and main receives the
+                           message from it alone; then both are ready, and main
+                           takes the semaphore, which comes first */
+
+    /****************/
+
+    EVENT_MASKS,		/* main sends itself events and receives them with each
+                           combination of mask and option in turn */
+
+    EVENT_OTHER,		/* sender thread sends main the event it waits for, and a
+                           semaphore registered with semEvStart sends another on
+                           semGive; then a wait for an unsent event times out */
+
+    /****************/
+
+    NAMED_OTHER_PROCESS,/* main gives a named semaphore to a second test_sem process
+                           blocked on it, which gives back another (not in the
+                           _USR_SYS_INIT_KILL build) */
+
+    /****************/
+
+    RATE_BURST,			/* a rate-limiter semaphore starts with TEST_RATE_BURST
+                           tokens, which main takes without a wait, and no more */
+
+    RATE_REFILL,		/* main takes TEST_RATE_TAKES more tokens, waiting for each to
+                           come due at TEST_RATE tokens per second */
+
+    /****************/
+
+    TASK_REAP_LIST,		/* main spawns and deletes TEST_REAP_TASKS tasks while a lister
+                           thread keeps calling taskIdListGet */
+
+    TASK_REAP_ASYNC,	/* main deletes a spinning thread which cannot unwind yet, and
+                           taskDelete returns without waiting for it */
+
+    /****************/
+
+    STALE_ID,			/* a semaphore is deleted and another created in its place;
+                           gives and takes by the old ID fail and leave the new
+                           semaphore alone */
+
+    /****************/
+
+    ADAPTIVE_BLOCK,		/* a thread taking a SEM_ADAPTIVE mutex which main holds
+                           throughout cannot get it by spinning, and blocks */
+
+    /****************/
+
+    PRIORITY_ORDER,		/* TEST_WAITERS threads of different priorities, blocked on a
+                           SEM_Q_PRIORITY semaphore lowest priority first, are
+                           woken one at a time highest priority first */
+
+    /****************/
+
+    COUNTING_GIVE_N,	/* semCGiveN wakes exactly as many of TEST_WAITERS threads
+                           blocked on a counting semaphore as it gives tokens,
+                           and refuses to take the count past INT_MAX */
+
+    COUNTING_TAKE_N,	/* semCTakeN returns the number of tokens it took, up to
+                           the number asked for */
+
+    /****************/
+
+    DEADLINE_FALLBACK,	/* a task spawned under SCHED_DEADLINE asking for the whole
+                           CPU, which the kernel refuses, runs at its priority */
+
+    /****************/
+
+    EXC_JOB_ORDER,		/* jobs queued by excJobAdd behind one blocking the job
+                           worker run in the order queued once it is released,
+                           and excJobAdd fails while the queue is full */
+
+    /****************/
+
+    FAST_PATH,			/* two threads give and take a counting semaphore
+                           TEST_FAST_OPS times each, which leaves no token over,
+                           and main takes and gives a mutex it already owns */
+
+    /****************/
+
+    HANDOFF,			/* main gives a binary semaphore to a lower-priority thread
+                           blocked on it, cannot take the token back, and is
+                           answered in under a tick */
+
+    /****************/
+
+    INVERSION_BOOST,	/* a lower-priority thread owning an inversion-safe mutex
+                           runs at a higher priority while main waits for it,
+                           and at its own once it gives the mutex */
+
+    /****************/
+
+    DELETE_SAFE,		/* taskDelete of a thread owning a SEM_DELETE_SAFE mutex
+                           returns only after the owner gives the mutex */
+
+    /****************/
+
+    SLAB_REUSE,			/* TEST_SLAB_SEMS semaphores are created, deleted and
+                           created again, many times over; each new one works,
+                           and none is known by an ID already used */
+
+    /****************/
+
+    RW_READERS,			/* TEST_WAITERS threads hold a reader-writer semaphore for
+                           reading at once, and main's write take waits for all
+                           of them to give it */
+
+    RW_WRITER,			/* while main holds it for writing, a reader waits, and
+                           gets in once main gives it */
+
+    /****************/
+
+    INFO_STATS,			/* with statistics on, semInfoGet reports a counting
+                           semaphore's count, its pended tasks, takes and
+                           timeouts, and a mutex's owner */
+
+    /****************/
+
+    CEILING,			/* a thread runs at a ceiling mutex's ceiling priority while
+                           it holds it, and main, above the ceiling, may not
+                           take it */
+
+    /****************/
+
+    CALLER_STORAGE,		/* a semaphore built in caller storage cannot be built
+                           again while in service, wakes its waiters when
+                           deleted, and the storage then holds another */
+
+    /****************/
+
+    NS_TIMEOUT,			/* semTakeNs and msgQReceiveNs time out after TEST_NS_TIMEOUT
+                           nanoseconds, well under a tick */
+
+    UNTIL_TIMEOUT,		/* semTakeUntil times out at its deadline, and takes an
+                           available semaphore whatever the deadline */
+
+    /****************/
+
+    PEND_LISTS,			/* threads pended on two semaphores are woken only by their
+                           own, and a deleted thread is taken off its list, so
+                           a token given for it is left for the next taker */
 }  e_TestState;
 
 e_TestState g_state = INITIAL_STATE;
@@ -59,12 +217,70 @@ e_TestState g_state = INITIAL_STATE;
 #define	TEST_SEM_INIT_COUNT		25
 #define	TEST_SEM_MAX_COUNT		50
 #define TEST_MUTEX_MAX			32000
+#define TEST_WAITERS			3
+#define TEST_WAIT_TICKS			20
+#define TEST_MSG				0x5a5a
+#define TEST_EVENT_A			0x01
+#define TEST_EVENT_B			0x02
+#define TEST_EVENT_C			0x04
+#define TEST_NAMED_CHILD		"-named-child"
+#define TEST_RATE				100
+#define TEST_RATE_BURST			5
+#define TEST_RATE_TAKES			20
+#define TEST_REAP_TASKS			50
+#define TEST_REAP_IDS			64
+#define TEST_SPIN_PRIORITY		100
+#define TEST_LOW_PRIORITY		30
+#define TEST_DL_PERIOD			10000000ULL
+#define TEST_CEILING			(TEST_LOW_PRIORITY - 10)
+#define TEST_JOBS_MAX			10000
+#define TEST_NS_TIMEOUT			1000000LL
+#define TEST_FAST_OPS			10000
+#define TEST_SLAB_SEMS			100
+#define TEST_SLAB_ROUNDS		100
 
 unsigned cGive,cTake, cTakeTimeout, cTakeErr, cGiveErr;
 
 SEM_ID s_binary;
 SEM_ID s_counting;
 SEM_ID s_mutex;
+SEM_ID s_wake;
+SEM_ID s_any;
+MSG_Q_ID q_any;
+SEM_ID s_ev;
+SEM_ID s_rate;
+SEM_ID s_stale;
+SEM_ID s_fresh;
+SEM_ID s_adaptive;
+SEM_ID s_prio;
+SEM_ID s_job;
+SEM_ID s_fast;
+SEM_ID s_reply;
+SEM_ID s_pi;
+SEM_ID s_safe;
+SEM_ID s_slab[TEST_SLAB_SEMS];
+SEM_ID s_slab_old[TEST_SLAB_SEMS];
+SEM_ID s_rw;
+SEM_ID s_ceiling;
+SEM_ID s_pend[2];
+VX_BINARY_SEMAPHORE( sem_storage );
+int main_task;
+
+unsigned cWokenOk, cWokenDeleted, cWokenErr;
+volatile int g_listing, g_spinning;
+unsigned cListed;
+unsigned cAdaptive;
+int woken_prio[TEST_WAITERS];
+unsigned cWokenPrio;
+unsigned cDeadlineRan;
+BOOL dl_active;
+int job_order[TEST_JOBS_MAX];
+unsigned cJobs;
+unsigned cFastErr;
+int pi_prio[3];
+volatile int safe_given;
+unsigned cReaders, cReadersMax, cReadsDone;
+unsigned cPendWoken[2], cPendDeleted[2];
 
 int RandomizerThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
 {
@@ -118,6 +334,258 @@ int RandomizerThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7,
     } //while(1)
 }
 
+int WaiterThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    if( semTake( s_wake, WAIT_FOREVER ) == OK )
+        cWokenOk++;
+    else if( errno == S_objLib_OBJ_ID_ERROR )
+        cWokenDeleted++;
+    else
+        cWokenErr++;
+    return 0;
+}
+
+void SpawnWaiters( void )
+{
+    int i;
+
+    cWokenOk = cWokenDeleted = cWokenErr = 0;
+    for( i = 0; i < TEST_WAITERS; i++ )
+        taskSpawn( "waiter", 0, 0, 0, WaiterThreadFunc,
+                0,0,0,0,0,0,0,0,0,0 );
+    taskDelay( 10 ); //to ensure the waiters are blocked well
+}
+
+int SenderThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    int msg = TEST_MSG;
+
+    taskDelay( 5 ); //to ensure the main is blocked well
+    if( msgQSend( q_any, (char *)&msg, sizeof( msg ), NO_WAIT, MSG_PRI_NORMAL ) != OK )
+        perror( "Error sending in WAIT_ANY_READY state" );
+    return 0;
+}
+
+int EventSenderThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    taskDelay( 5 ); //to ensure the main is blocked well
+    if( eventSend( main_task, TEST_EVENT_B ) != OK )
+        perror( "Error sending events in EVENT_OTHER state" );
+    return 0;
+}
+
+int ListerThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    int ids[TEST_REAP_IDS];
+
+    while( g_listing )
+    {
+        if( taskIdListGet( ids, TEST_REAP_IDS ) > 0 )
+            cListed++;
+        taskDelay( 0 );
+    }
+    return 0;
+}
+
+int VictimThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    for( ;; )
+        taskDelay( 0 );
+    return 0;
+}
+
+int SpinnerThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    g_spinning = 1;
+    while( g_spinning ) //no cancellation point in here
+        ;
+    taskDelay( 1 );
+    return 0;
+}
+
+int AdaptiveThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    if( semTake( s_adaptive, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error taking in ADAPTIVE_BLOCK state" );
+    else
+    {
+        cAdaptive++;
+        semGive( s_adaptive );
+    }
+    return 0;
+}
+
+int PrioWaiterThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    if( semTake( s_prio, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error taking in PRIORITY_ORDER state" );
+    else if( cWokenPrio < TEST_WAITERS )
+        woken_prio[cWokenPrio++] = p1;
+    return 0;
+}
+
+int DeadlineThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    dl_active = taskIsDeadline( 0 );
+    cDeadlineRan++;
+    taskDelay( 10 );
+    return 0;
+}
+
+void BlockingJob( int p1, int p2, int p3, int p4, int p5, int p6 )
+{
+    if( semTake( s_job, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error taking in EXC_JOB_ORDER state" );
+}
+
+void OrderedJob( int p1, int p2, int p3, int p4, int p5, int p6 )
+{
+    if( cJobs < TEST_JOBS_MAX )
+        job_order[cJobs++] = p1;
+}
+
+int FastThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    int i;
+
+    for( i = 0; i < TEST_FAST_OPS; i++ )
+    {
+        if( semGive( s_fast ) != OK )
+            cFastErr++;
+        if( (i % 16) == 0 )
+            taskDelay( 0 );
+        if( semTake( s_fast, TEST_SEM_TIMEOUT ) != OK )
+            cFastErr++;
+    }
+    return 0;
+}
+
+int HandoffThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    if( semTake( s_wake, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error taking in HANDOFF state" );
+    else
+        semGive( s_reply );
+    return 0;
+}
+
+int KernelPriority( void ) //the boosted priority, from /proc
+{
+    char buf[512], *fields;
+    int prio = 0;
+    FILE *stat;
+
+    stat = fopen( "/proc/thread-self/stat", "r" );
+    if( stat == NULL )
+        return 0;
+    if( fgets( buf, sizeof( buf ), stat ) != NULL
+        && (fields = strrchr( buf, ')' )) != NULL )
+        sscanf( fields + 2, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %d",
+                &prio );
+    fclose( stat );
+    return -1 - prio; //the real-time priority
+}
+
+int OwnerThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    if( semTake( s_pi, NO_WAIT ) != OK )
+        perror( "Error taking in INVERSION_BOOST state" );
+    pi_prio[0] = KernelPriority();
+    semGive( s_reply );
+    taskDelay( 5 ); //to ensure the main is blocked well
+    pi_prio[1] = KernelPriority();
+    semGive( s_pi );
+    pi_prio[2] = KernelPriority();
+    return 0;
+}
+
+int SafeOwnerThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    if( semTake( s_safe, NO_WAIT ) != OK )
+        perror( "Error taking in DELETE_SAFE state" );
+    semGive( s_reply );
+    taskDelay( 10 ); //to ensure the main is blocked in taskDelete well
+    safe_given = 1;
+    semGive( s_safe );
+    for( ;; )
+        taskDelay( 1 );
+    return 0;
+}
+
+int ReaderThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    if( semRTake( s_rw, TEST_SEM_TIMEOUT ) != OK )
+    {
+        perror( "Error taking for reading in RW state" );
+        return 0;
+    }
+    if( ++cReaders > cReadersMax )
+        cReadersMax = cReaders;
+    taskDelay( 5 );
+    cReaders--;
+    cReadsDone++;
+    semGive( s_rw );
+    return 0;
+}
+
+int CeilingThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    int prio;
+
+    pi_prio[0] = KernelPriority();
+    if( semTake( s_ceiling, NO_WAIT ) != OK )
+        perror( "Error taking in CEILING state" );
+    pi_prio[1] = KernelPriority();
+    if( taskPriorityGet( taskIdSelf(), &prio ) != OK || prio != TEST_LOW_PRIORITY )
+        printf( "Error in CEILING: the task priority changed to %d\n", prio );
+    semGive( s_ceiling );
+    pi_prio[2] = KernelPriority();
+    return 0;
+}
+
+int PendThreadFunc(int p1, int p2, int p3, int p4, int p5, int p6, int p7, int p8, int p9, int p10)
+{
+    if( semTake( s_pend[p1], WAIT_FOREVER ) == OK )
+        cPendWoken[p1]++;
+    else if( errno == S_objLib_OBJ_ID_ERROR )
+        cPendDeleted[p1]++;
+    else
+        perror( "Error taking in PEND_LISTS state" );
+    return 0;
+}
+
+#ifndef _USR_SYS_INIT_KILL
+int NamedChild( const char *ping_name, const char *pong_name )
+{
+    SEM_ID ping, pong;
+    int result = 1;
+
+    ping = semOpen( ping_name, SEM_TYPE_BINARY, 0, 0, 0, NULL );
+    pong = semOpen( pong_name, SEM_TYPE_BINARY, 0, 0, 0, NULL );
+    if( ping == NULL || pong == NULL )
+        perror( "Error opening in NAMED_OTHER_PROCESS state" );
+    else if( semTake( ping, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error taking in NAMED_OTHER_PROCESS state" );
+    else if( semGive( pong ) != OK )
+        perror( "Error giving in NAMED_OTHER_PROCESS state" );
+    else
+        result = 0;
+    if( ping != NULL )
+        semClose( ping );
+    if( pong != NULL )
+        semClose( pong );
+    return result;
+}
+#endif
+
+long NowMs( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
 void Go2State( e_TestState state, const char *state_name )
 {
     printf( "\nEntering %s state ", state_name );
@@ -197,9 +665,28 @@ int main ( int argc, char **argv )
     int randomizer_thread1, randomizer_thread2;
     int other_thread;
     int i;
+    WAIT_OBJ objs[2];
+    int msg;
+    long start;
+    unsigned int events;
+    int victim;
+    int ids[TEST_REAP_IDS];
+    unsigned long spun, blocked;
+    int pass;
+    SEM_INFO info;
+    BOOL stats_on;
+    struct timespec deadline;
+#ifndef _USR_SYS_INIT_KILL
+    char ping_name[32], pong_name[32];
+    SEM_ID ping, pong;
+    pid_t child;
+    int status;
+#endif
 
 #ifndef _USR_SYS_INIT_KILL
     v2lin_init();
+    if( argc == 4 && strcmp( argv[1], TEST_NAMED_CHILD ) == 0 )
+        return NamedChild( argv[2], argv[3] );
 #endif
     s_binary = semBCreate( SEM_Q_FIFO, 0 );
     s_counting = semCCreate( SEM_Q_FIFO, TEST_SEM_INIT_COUNT );
@@ -269,6 +756,614 @@ int main ( int argc, char **argv )
     Go2State( MUTEX_UNBLOCK, "MUTEX_UNBLOCK" );
 
     sleep(1); // to let the other thread finish
+    while( taskIdVerify( other_thread ) == OK )
+        taskDelay( 1 );
+
+    Go2State( FLUSH_WAKE, "FLUSH_WAKE" );
+    s_wake = semBCreate( SEM_Q_FIFO, 0 );
+    SpawnWaiters();
+    if( semFlush( s_wake ) != OK )
+        perror( "Error flushing in FLUSH_WAKE state" );
+    taskDelay( 10 );
+    if( cWokenOk != TEST_WAITERS || cWokenErr != 0 )
+        printf( "Error in FLUSH_WAKE: %u of %u waiters woken\n",
+                cWokenOk, TEST_WAITERS );
+    if( semTake( s_wake, NO_WAIT ) == OK )
+        printf( "Error in FLUSH_WAKE: semFlush must leave the semaphore empty\n" );
+
+    Go2State( DELETE_WAKE, "DELETE_WAKE" );
+    SpawnWaiters();
+    if( semDelete( s_wake ) != OK )
+        perror( "Error deleting in DELETE_WAKE state" );
+    taskDelay( 10 );
+    if( cWokenDeleted != TEST_WAITERS || cWokenErr != 0 )
+        printf( "Error in DELETE_WAKE: %u of %u waiters told of the deletion\n",
+                cWokenDeleted, TEST_WAITERS );
+
+    Go2State( WAIT_ANY_TIMEOUT, "WAIT_ANY_TIMEOUT" );
+    s_any = semBCreate( SEM_Q_FIFO, 0 );
+    q_any = msgQCreate( 1, sizeof( msg ), MSG_Q_FIFO );
+    objs[0].type = WAIT_OBJ_SEM;
+    objs[0].id = s_any;
+    objs[1].type = WAIT_OBJ_MSG_Q;
+    objs[1].id = q_any;
+    objs[1].msgbuf = (char *)&msg;
+    objs[1].buflen = sizeof( msg );
+    if( objWaitAny( objs, 2, NO_WAIT ) != ERROR || errno != S_objLib_OBJ_UNAVAILABLE )
+        printf( "Error in WAIT_ANY_TIMEOUT: NO_WAIT must fail with S_objLib_OBJ_UNAVAILABLE\n" );
+    start = NowMs();
+    if( objWaitAny( objs, 2, TEST_WAIT_TICKS ) != ERROR || errno != S_objLib_OBJ_TIMEOUT )
+        printf( "Error in WAIT_ANY_TIMEOUT: wait must fail with S_objLib_OBJ_TIMEOUT\n" );
+    if( NowMs() - start < TEST_WAIT_TICKS * V2PT_TICK )
+        printf( "Error in WAIT_ANY_TIMEOUT: timed out after %ld of %d msec\n",
+                NowMs() - start, TEST_WAIT_TICKS * V2PT_TICK );
+
+    Go2State( WAIT_ANY_READY, "WAIT_ANY_READY" );
+    msg = 0;
+    taskSpawn( "sender", 0, 0, 0, SenderThreadFunc, 0,0,0,0,0,0,0,0,0,0 );
+    if( objWaitAny( objs, 2, TEST_SEM_TIMEOUT ) != 1 )
+        perror( "Error waiting in WAIT_ANY_READY state" );
+    else if( objs[1].msglen != sizeof( msg ) || msg != TEST_MSG )
+        printf( "Error in WAIT_ANY_READY: received %d bytes (%#x)\n",
+                objs[1].msglen, msg );
+    msg = TEST_MSG;
+    msgQSend( q_any, (char *)&msg, sizeof( msg ), NO_WAIT, MSG_PRI_NORMAL );
+    semGive( s_any );
+    if( objWaitAny( objs, 2, NO_WAIT ) != 0 )
+        printf( "Error in WAIT_ANY_READY: the semaphore must be taken first\n" );
+    if( msgQReceive( q_any, (char *)&msg, sizeof( msg ), NO_WAIT ) != sizeof( msg ) )
+        printf( "Error in WAIT_ANY_READY: the message must be left in the queue\n" );
+    semDelete( s_any );
+    msgQDelete( q_any );
+
+    Go2State( EVENT_MASKS, "EVENT_MASKS" );
+    main_task = taskIdSelf();
+    eventClear();
+    eventSend( 0, TEST_EVENT_A | TEST_EVENT_C );
+    if( eventReceive( TEST_EVENT_A | TEST_EVENT_B, EVENTS_WAIT_ALL, NO_WAIT, &events ) != ERROR
+        || errno != S_eventLib_NOT_ALL_EVENTS || events != TEST_EVENT_A )
+        printf( "Error in EVENT_MASKS: waiting for all must fail, having %#x\n", events );
+    if( eventReceive( TEST_EVENT_A | TEST_EVENT_B, EVENTS_WAIT_ANY | EVENTS_KEEP_UNWANTED,
+                      NO_WAIT, &events ) != OK || events != TEST_EVENT_A )
+        printf( "Error in EVENT_MASKS: waiting for any received %#x\n", events );
+    if( eventReceive( 0, EVENTS_FETCH, NO_WAIT, &events ) != OK || events != TEST_EVENT_C )
+        printf( "Error in EVENT_MASKS: unwanted event not kept, pending %#x\n", events );
+    eventSend( 0, TEST_EVENT_A );
+    if( eventReceive( TEST_EVENT_A, EVENTS_WAIT_ALL | EVENTS_RETURN_ALL, NO_WAIT,
+                      &events ) != OK || events != (TEST_EVENT_A | TEST_EVENT_C) )
+        printf( "Error in EVENT_MASKS: returning all received %#x\n", events );
+    if( eventReceive( 0, EVENTS_FETCH, NO_WAIT, &events ) != OK || events != 0 )
+        printf( "Error in EVENT_MASKS: events must all be cleared, pending %#x\n", events );
+
+    Go2State( EVENT_OTHER, "EVENT_OTHER" );
+    taskSpawn( "evsender", 0, 0, 0, EventSenderThreadFunc, 0,0,0,0,0,0,0,0,0,0 );
+    if( eventReceive( TEST_EVENT_B, EVENTS_WAIT_ALL, TEST_SEM_TIMEOUT, &events ) != OK
+        || events != TEST_EVENT_B )
+        perror( "Error receiving in EVENT_OTHER state" );
+    s_ev = semBCreate( SEM_Q_FIFO, 0 );
+    if( semEvStart( s_ev, TEST_EVENT_C, EVENTS_SEND_ONCE ) != OK )
+        perror( "Error registering in EVENT_OTHER state" );
+    semGive( s_ev );
+    if( eventReceive( TEST_EVENT_C, EVENTS_WAIT_ALL, NO_WAIT, &events ) != OK )
+        printf( "Error in EVENT_OTHER: semGive must send the registered event\n" );
+    semTake( s_ev, NO_WAIT );
+    semGive( s_ev );
+    if( eventReceive( TEST_EVENT_C, EVENTS_WAIT_ALL, NO_WAIT, &events ) != ERROR )
+        printf( "Error in EVENT_OTHER: EVENTS_SEND_ONCE must send only once\n" );
+    semDelete( s_ev );
+    if( eventReceive( TEST_EVENT_A, EVENTS_WAIT_ALL, TEST_WAIT_TICKS, &events ) != ERROR
+        || errno != S_eventLib_TIMEOUT )
+        printf( "Error in EVENT_OTHER: wait for an unsent event must time out\n" );
+
+#ifndef _USR_SYS_INIT_KILL
+    Go2State( NAMED_OTHER_PROCESS, "NAMED_OTHER_PROCESS" );
+    sprintf( ping_name, "test_sem.%d.ping", (int)getpid() );
+    sprintf( pong_name, "test_sem.%d.pong", (int)getpid() );
+    ping = semOpen( ping_name, SEM_TYPE_BINARY, 0, 0, OM_CREATE | OM_EXCL, NULL );
+    pong = semOpen( pong_name, SEM_TYPE_BINARY, 0, 0, OM_CREATE | OM_EXCL, NULL );
+    if( ping == NULL || pong == NULL )
+        perror( "Error creating in NAMED_OTHER_PROCESS state" );
+    else
+    {
+        child = fork();
+        if( child == 0 )
+        {
+            execl( "/proc/self/exe", argv[0], TEST_NAMED_CHILD, ping_name, pong_name,
+                   (char *)NULL );
+            _exit( 1 );
+        }
+        taskDelay( 20 ); //to ensure the second process is blocked well
+        if( semGive( ping ) != OK )
+            perror( "Error giving in NAMED_OTHER_PROCESS state" );
+        if( semTake( pong, TEST_SEM_TIMEOUT ) != OK )
+            perror( "Error taking in NAMED_OTHER_PROCESS state" );
+        if( child < 0 || waitpid( child, &status, 0 ) != child
+            || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+            printf( "Error in NAMED_OTHER_PROCESS: second process failed\n" );
+    }
+    if( ping != NULL )
+        semClose( ping );
+    if( pong != NULL )
+        semClose( pong );
+    semUnlink( ping_name );
+    semUnlink( pong_name );
+#endif
+
+    Go2State( RATE_BURST, "RATE_BURST" );
+    s_rate = semRateCreate( SEM_Q_FIFO, TEST_RATE, TEST_RATE_BURST );
+    for( i = 0; i < TEST_RATE_BURST; i++ )
+        if( semTake( s_rate, NO_WAIT ) != OK )
+            perror( "Error taking in RATE_BURST state" );
+    if( semTake( s_rate, NO_WAIT ) == OK || errno != S_objLib_OBJ_UNAVAILABLE )
+        printf( "Error in RATE_BURST: the bucket must be empty after %d takes\n",
+                TEST_RATE_BURST );
+    if( semGive( s_rate ) == OK )
+        printf( "Error in RATE_BURST: a rate-limiter semaphore must not be given\n" );
+
+    Go2State( RATE_REFILL, "RATE_REFILL" );
+    start = NowMs();
+    for( i = 0; i < TEST_RATE_TAKES; i++ )
+        if( semTake( s_rate, TEST_SEM_TIMEOUT ) != OK )
+            perror( "Error taking in RATE_REFILL state" );
+    start = NowMs() - start;
+    if( start < (TEST_RATE_TAKES - 1) * 1000L / TEST_RATE
+        || start > 2 * TEST_RATE_TAKES * 1000L / TEST_RATE )
+        printf( "Error in RATE_REFILL: %d tokens took %ld msec at %d per second\n",
+                TEST_RATE_TAKES, start, TEST_RATE );
+    semDelete( s_rate );
+
+    Go2State( TASK_REAP_LIST, "TASK_REAP_LIST" );
+    cListed = 0;
+    g_listing = 1;
+    other_thread = taskSpawn( "lister", 0, 0, 0, ListerThreadFunc, 0,0,0,0,0,0,0,0,0,0 );
+    for( i = 0; i < TEST_REAP_TASKS; i++ )
+    {
+        victim = taskSpawn( "victim", 0, 0, 0, VictimThreadFunc, 0,0,0,0,0,0,0,0,0,0 );
+        taskDelay( 1 ); //to let the victim and the lister run
+        if( taskDelete( victim ) != OK )
+            perror( "Error deleting in TASK_REAP_LIST state" );
+        else if( taskIdVerify( victim ) == OK )
+            printf( "Error in TASK_REAP_LIST: deleted task %#x still exists\n", victim );
+    }
+    g_listing = 0;
+    while( taskIdVerify( other_thread ) == OK )
+        taskDelay( 1 );
+    if( cListed == 0 )
+        printf( "Error in TASK_REAP_LIST: the lister never listed any task\n" );
+
+    Go2State( TASK_REAP_ASYNC, "TASK_REAP_ASYNC" );
+    g_spinning = 0;
+    victim = taskSpawn( "spinner", TEST_SPIN_PRIORITY, 0, 0, SpinnerThreadFunc,
+                        0,0,0,0,0,0,0,0,0,0 );
+    while( !g_spinning )
+        taskDelay( 1 );
+    start = NowMs();
+    if( taskDelete( victim ) != OK )
+        perror( "Error deleting in TASK_REAP_ASYNC state" );
+    if( NowMs() - start > TEST_WAIT_TICKS * V2PT_TICK )
+        printf( "Error in TASK_REAP_ASYNC: taskDelete waited %ld msec\n", NowMs() - start );
+    if( taskIdVerify( victim ) == OK )
+        printf( "Error in TASK_REAP_ASYNC: deleted task %#x still exists\n", victim );
+    for( i = taskIdListGet( ids, TEST_REAP_IDS ) - 1; i >= 0; i-- )
+        if( ids[i] == victim )
+            printf( "Error in TASK_REAP_ASYNC: deleted task %#x is still listed\n", victim );
+    g_spinning = 0; //let the spinner reach a cancellation point and unwind
+    taskDelay( 1 );
+
+    Go2State( STALE_ID, "STALE_ID" );
+    s_stale = semCCreate( SEM_Q_FIFO, 0 );
+    semDelete( s_stale );
+    s_fresh = semCCreate( SEM_Q_FIFO, 0 );
+    if( semGive( s_stale ) != ERROR || errno != S_objLib_OBJ_ID_ERROR )
+        printf( "Error in STALE_ID: giving by a deleted ID must fail with S_objLib_OBJ_ID_ERROR\n" );
+    if( semTake( s_fresh, NO_WAIT ) != ERROR )
+        printf( "Error in STALE_ID: the new semaphore was given by the deleted ID\n" );
+    semGive( s_fresh );
+    if( semTake( s_stale, NO_WAIT ) != ERROR || errno != S_objLib_OBJ_ID_ERROR )
+        printf( "Error in STALE_ID: taking by a deleted ID must fail with S_objLib_OBJ_ID_ERROR\n" );
+    if( semTake( s_fresh, NO_WAIT ) != OK )
+        printf( "Error in STALE_ID: the new semaphore was taken by the deleted ID\n" );
+    semDelete( s_fresh );
+
+    Go2State( ADAPTIVE_BLOCK, "ADAPTIVE_BLOCK" );
+    s_adaptive = semMCreate( SEM_Q_FIFO | SEM_ADAPTIVE );
+    cAdaptive = 0;
+    semTake( s_adaptive, NO_WAIT );
+    taskSpawn( "adaptive", 0, 0, 0, AdaptiveThreadFunc, 0,0,0,0,0,0,0,0,0,0 );
+    taskDelay( 5 ); //to ensure the other thread is blocked well
+    if( cAdaptive != 0 )
+        printf( "Error in ADAPTIVE_BLOCK: the mutex was taken from its owner\n" );
+    semGive( s_adaptive );
+    taskDelay( 5 );
+    if( cAdaptive != 1 )
+        printf( "Error in ADAPTIVE_BLOCK: the other thread did not get the mutex\n" );
+    if( semMSpinStats( s_adaptive, &spun, &blocked, TRUE ) != OK
+        || spun != 0 || blocked != 1 )
+        printf( "Error in ADAPTIVE_BLOCK: %lu takes spun and %lu blocked, not 0 and 1\n",
+                spun, blocked );
+    if( semMSpinStats( s_adaptive, &spun, &blocked, FALSE ) != OK
+        || spun != 0 || blocked != 0 )
+        printf( "Error in ADAPTIVE_BLOCK: the counts were not restarted\n" );
+    semDelete( s_adaptive );
+
+    Go2State( PRIORITY_ORDER, "PRIORITY_ORDER" );
+    s_prio = semBCreate( SEM_Q_PRIORITY, SEM_EMPTY );
+    cWokenPrio = 0;
+    for( i = 0; i < TEST_WAITERS; i++ )
+    {
+        taskSpawn( "prio", TEST_LOW_PRIORITY - i, 0, 0, PrioWaiterThreadFunc,
+                   TEST_LOW_PRIORITY - i, 0,0,0,0,0,0,0,0,0 );
+        taskDelay( 2 ); //to ensure each waiter is blocked before the next
+    }
+    for( i = 0; i < TEST_WAITERS; i++ )
+    {
+        semGive( s_prio );
+        taskDelay( 1 );
+    }
+    if( cWokenPrio != TEST_WAITERS )
+        printf( "Error in PRIORITY_ORDER: %u of %d waiters woken\n", cWokenPrio, TEST_WAITERS );
+    for( i = 0; i < (int)cWokenPrio; i++ )
+        if( woken_prio[i] != TEST_LOW_PRIORITY - TEST_WAITERS + 1 + i )
+            printf( "Error in PRIORITY_ORDER: waiter %d woken at priority %d\n",
+                    i, woken_prio[i] );
+    semDelete( s_prio );
+
+    Go2State( COUNTING_GIVE_N, "COUNTING_GIVE_N" );
+    s_wake = semCCreate( SEM_Q_FIFO, 0 );
+    SpawnWaiters();
+    if( semCGiveN( s_wake, TEST_WAITERS - 1 ) != OK )
+        perror( "Error giving in COUNTING_GIVE_N state" );
+    taskDelay( 5 );
+    if( cWokenOk != TEST_WAITERS - 1 || cWokenDeleted != 0 || cWokenErr != 0 )
+        printf( "Error in COUNTING_GIVE_N: %u woken by %d tokens\n", cWokenOk,
+                TEST_WAITERS - 1 );
+    semCGiveN( s_wake, 1 );
+    taskDelay( 5 );
+    if( cWokenOk != TEST_WAITERS )
+        printf( "Error in COUNTING_GIVE_N: %u of %d woken\n", cWokenOk, TEST_WAITERS );
+    if( semTake( s_wake, NO_WAIT ) != ERROR )
+        printf( "Error in COUNTING_GIVE_N: a token was left over\n" );
+    semDelete( s_wake );
+    s_wake = semCCreate( SEM_Q_FIFO, INT_MAX - 1 );
+    if( semCGiveN( s_wake, 2 ) != ERROR || errno != S_semLib_INVALID_OPERATION )
+        printf( "Error in COUNTING_GIVE_N: giving past INT_MAX must fail with S_semLib_INVALID_OPERATION\n" );
+    if( semCGiveN( s_wake, 1 ) != OK )
+        perror( "Error giving up to INT_MAX in COUNTING_GIVE_N state" );
+    semDelete( s_wake );
+
+    Go2State( COUNTING_TAKE_N, "COUNTING_TAKE_N" );
+    s_wake = semCCreate( SEM_Q_FIFO, 0 );
+    semCGiveN( s_wake, TEST_WAITERS + 2 );
+    if( semCTakeN( s_wake, TEST_WAITERS, NO_WAIT ) != TEST_WAITERS )
+        printf( "Error in COUNTING_TAKE_N: %d tokens not all taken\n", TEST_WAITERS );
+    if( semCTakeN( s_wake, TEST_WAITERS, NO_WAIT ) != 2 )
+        printf( "Error in COUNTING_TAKE_N: the 2 tokens left were not taken\n" );
+    if( semCTakeN( s_wake, TEST_WAITERS, NO_WAIT ) != ERROR
+        || errno != S_objLib_OBJ_UNAVAILABLE )
+        printf( "Error in COUNTING_TAKE_N: taking none must fail with S_objLib_OBJ_UNAVAILABLE\n" );
+    semDelete( s_wake );
+
+    Go2State( DEADLINE_FALLBACK, "DEADLINE_FALLBACK" );
+    cDeadlineRan = 0;
+    if( taskSpawnDeadline( "deadline", TEST_LOW_PRIORITY, 0, 0, DeadlineThreadFunc,
+                           TEST_DL_PERIOD + 1, TEST_DL_PERIOD, TEST_DL_PERIOD,
+                           0,0,0,0,0,0,0,0,0,0 ) != ERROR
+        || errno != S_taskLib_ILLEGAL_OPERATION )
+        printf( "Error in DEADLINE_FALLBACK: runtime over the deadline must fail with S_taskLib_ILLEGAL_OPERATION\n" );
+    victim = taskSpawnDeadline( "deadline", TEST_LOW_PRIORITY, 0, 0, DeadlineThreadFunc,
+                                TEST_DL_PERIOD, TEST_DL_PERIOD, TEST_DL_PERIOD,
+                                0,0,0,0,0,0,0,0,0,0 );
+    if( victim == ERROR )
+        perror( "Error spawning in DEADLINE_FALLBACK state" );
+    taskDelay( 5 );
+    if( cDeadlineRan != 1 || dl_active || taskIsDeadline( victim ) )
+        printf( "Error in DEADLINE_FALLBACK: the task did not run at its priority\n" );
+    else if( taskPriorityGet( victim, &i ) != OK || i != TEST_LOW_PRIORITY )
+        printf( "Error in DEADLINE_FALLBACK: the task runs at priority %d, not %d\n",
+                i, TEST_LOW_PRIORITY );
+    while( taskIdVerify( victim ) == OK )
+        taskDelay( 1 );
+
+    Go2State( EXC_JOB_ORDER, "EXC_JOB_ORDER" );
+    s_job = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    cJobs = 0;
+    if( excJobAdd( BlockingJob, 0,0,0,0,0,0 ) != OK )
+        perror( "Error queueing in EXC_JOB_ORDER state" );
+    taskDelay( 5 ); //to ensure the job worker is blocked well
+    for( i = 0; i < TEST_JOBS_MAX; i++ )
+        if( excJobAdd( OrderedJob, i, 0,0,0,0,0 ) != OK )
+            break;
+    if( i == TEST_JOBS_MAX || errno != S_objLib_OBJ_UNAVAILABLE )
+        printf( "Error in EXC_JOB_ORDER: a full queue must fail with S_objLib_OBJ_UNAVAILABLE\n" );
+    semGive( s_job );
+    taskDelay( 10 );
+    if( cJobs != (unsigned)i )
+        printf( "Error in EXC_JOB_ORDER: %u of %d jobs ran\n", cJobs, i );
+    for( i = 0; i < (int)cJobs; i++ )
+        if( job_order[i] != i )
+        {
+            printf( "Error in EXC_JOB_ORDER: job %d ran in place %d\n", job_order[i], i );
+            break;
+        }
+    semDelete( s_job );
+
+    Go2State( FAST_PATH, "FAST_PATH" );
+    s_fast = semCCreate( SEM_Q_FIFO, 0 );
+    cFastErr = 0;
+    other_thread = taskSpawn( "fast1", TEST_LOW_PRIORITY, 0, 0, FastThreadFunc,
+                              0,0,0,0,0,0,0,0,0,0 );
+    victim = taskSpawn( "fast2", TEST_LOW_PRIORITY, 0, 0, FastThreadFunc,
+                        0,0,0,0,0,0,0,0,0,0 );
+    while( taskIdVerify( other_thread ) == OK || taskIdVerify( victim ) == OK )
+        taskDelay( 1 );
+    if( cFastErr != 0 )
+        printf( "Error in FAST_PATH: %u gives and takes failed\n", cFastErr );
+    if( semTake( s_fast, NO_WAIT ) != ERROR )
+        printf( "Error in FAST_PATH: a token was left over\n" );
+    semDelete( s_fast );
+    s_fast = semMCreate( SEM_Q_FIFO );
+    for( i = 0; i < TEST_WAITERS; i++ )
+        if( semTake( s_fast, NO_WAIT ) != OK )
+            perror( "Error taking in FAST_PATH state" );
+    for( i = 0; i < TEST_WAITERS; i++ )
+        if( semGive( s_fast ) != OK )
+            perror( "Error giving in FAST_PATH state" );
+    if( semGive( s_fast ) != ERROR || errno != S_semLib_INVALID_OPERATION )
+        printf( "Error in FAST_PATH: giving a mutex not owned must fail with S_semLib_INVALID_OPERATION\n" );
+    semDelete( s_fast );
+
+    Go2State( HANDOFF, "HANDOFF" );
+    s_wake = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    s_reply = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    taskSpawn( "handoff", TEST_LOW_PRIORITY, 0, 0, HandoffThreadFunc, 0,0,0,0,0,0,0,0,0,0 );
+    taskDelay( 5 ); //to ensure the other thread is blocked well
+    start = NowMs();
+    semGive( s_wake );
+    if( semTake( s_wake, NO_WAIT ) != ERROR )
+        printf( "Error in HANDOFF: the token given to the waiter was taken back\n" );
+    if( semTake( s_reply, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error taking in HANDOFF state" );
+    else if( NowMs() - start >= V2PT_TICK )
+        printf( "Error in HANDOFF: the waiter answered after %ld msec\n", NowMs() - start );
+    semDelete( s_wake );
+    semDelete( s_reply );
+
+    Go2State( INVERSION_BOOST, "INVERSION_BOOST" );
+    s_pi = semMCreate( SEM_Q_PRIORITY | SEM_INVERSION_SAFE );
+    s_reply = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    taskSpawn( "owner", TEST_LOW_PRIORITY, 0, 0, OwnerThreadFunc, 0,0,0,0,0,0,0,0,0,0 );
+    if( semTake( s_reply, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error waiting in INVERSION_BOOST state" );
+    if( semTake( s_pi, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error taking in INVERSION_BOOST state" );
+    semGive( s_pi );
+    taskDelay( 1 ); //to let the owner finish
+    if( pi_prio[1] <= pi_prio[0] || pi_prio[2] != pi_prio[0] )
+        printf( "Error in INVERSION_BOOST: the owner ran at %d, %d while main waited, then %d\n",
+                pi_prio[0], pi_prio[1], pi_prio[2] );
+    semDelete( s_pi );
+    semDelete( s_reply );
+
+    Go2State( DELETE_SAFE, "DELETE_SAFE" );
+    s_safe = semMCreate( SEM_Q_FIFO | SEM_DELETE_SAFE );
+    s_reply = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    safe_given = 0;
+    victim = taskSpawn( "safe", TEST_LOW_PRIORITY, 0, 0, SafeOwnerThreadFunc,
+                        0,0,0,0,0,0,0,0,0,0 );
+    if( semTake( s_reply, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error waiting in DELETE_SAFE state" );
+    if( taskDelete( victim ) != OK )
+        perror( "Error deleting in DELETE_SAFE state" );
+    if( !safe_given )
+        printf( "Error in DELETE_SAFE: the owner was deleted holding the mutex\n" );
+    if( taskIdVerify( victim ) == OK )
+        printf( "Error in DELETE_SAFE: the owner was not deleted\n" );
+    if( semTake( s_safe, NO_WAIT ) != OK )
+        printf( "Error in DELETE_SAFE: the mutex was not given back\n" );
+    semGive( s_safe );
+    semDelete( s_safe );
+    semDelete( s_reply );
+
+    Go2State( SLAB_REUSE, "SLAB_REUSE" );
+    for( i = 0; i < TEST_SLAB_SEMS; i++ )
+        s_slab[i] = semCCreate( SEM_Q_FIFO, i );
+    for( pass = 0; pass < TEST_SLAB_ROUNDS; pass++ )
+    {
+        for( i = 0; i < TEST_SLAB_SEMS; i++ )
+        {
+            s_slab_old[i] = s_slab[i];
+            semDelete( s_slab[i] );
+        }
+        for( i = 0; i < TEST_SLAB_SEMS; i++ )
+        {
+            s_slab[i] = semCCreate( SEM_Q_FIFO, i );
+            if( s_slab[i] == NULL )
+                perror( "Error creating in SLAB_REUSE state" );
+            else if( i > 0 && semCTakeN( s_slab[i], TEST_SLAB_SEMS, NO_WAIT ) != i )
+                printf( "Error in SLAB_REUSE: a new semaphore did not start with %d tokens\n", i );
+        }
+        for( i = 0; i < TEST_SLAB_SEMS * TEST_SLAB_SEMS; i++ )
+            if( s_slab[i % TEST_SLAB_SEMS] == s_slab_old[i / TEST_SLAB_SEMS] )
+            {
+                printf( "Error in SLAB_REUSE: a new semaphore has a deleted one's ID\n" );
+                pass = TEST_SLAB_ROUNDS;
+                break;
+            }
+    }
+    for( i = 0; i < TEST_SLAB_SEMS; i++ )
+    {
+        if( semGive( s_slab_old[i] ) != ERROR || errno != S_objLib_OBJ_ID_ERROR )
+            printf( "Error in SLAB_REUSE: a deleted ID is still in service\n" );
+        semDelete( s_slab[i] );
+    }
+
+    Go2State( RW_READERS, "RW_READERS" );
+    s_rw = semRWCreate( SEM_Q_FIFO, TEST_WAITERS );
+    cReaders = cReadersMax = cReadsDone = 0;
+    for( i = 0; i < TEST_WAITERS; i++ )
+        taskSpawn( "reader", TEST_LOW_PRIORITY, 0, 0, ReaderThreadFunc,
+                   0,0,0,0,0,0,0,0,0,0 );
+    taskDelay( 2 ); //to ensure the readers hold it well
+    if( semWTake( s_rw, TEST_SEM_TIMEOUT ) != OK )
+        perror( "Error taking for writing in RW_READERS state" );
+    else if( cReadersMax != TEST_WAITERS || cReaders != 0 || cReadsDone != TEST_WAITERS )
+        printf( "Error in RW_READERS: %u readers at once, %u still reading, %u done\n",
+                cReadersMax, cReaders, cReadsDone );
+
+    Go2State( RW_WRITER, "RW_WRITER" );
+    taskSpawn( "reader", TEST_LOW_PRIORITY, 0, 0, ReaderThreadFunc, 0,0,0,0,0,0,0,0,0,0 );
+    taskDelay( 10 );
+    if( cReadsDone != TEST_WAITERS || cReadersMax != TEST_WAITERS )
+        printf( "Error in RW_WRITER: a reader got in while main held it for writing\n" );
+    semGive( s_rw );
+    taskDelay( 10 );
+    if( cReadsDone != TEST_WAITERS + 1 )
+        printf( "Error in RW_WRITER: the reader did not get in after main gave it\n" );
+    semDelete( s_rw );
+
+    Go2State( INFO_STATS, "INFO_STATS" );
+    stats_on = semStatsEnable( TRUE );
+    s_wake = semCCreate( SEM_Q_FIFO, 2 );
+    if( semInfoGet( s_wake, &info ) != OK || info.type != SEM_TYPE_COUNTING
+        || info.count != 2 || info.pended != 0 )
+        printf( "Error in INFO_STATS: a new semaphore reports count %d, %d pended\n",
+                info.count, info.pended );
+    semTake( s_wake, NO_WAIT );
+    semTake( s_wake, NO_WAIT );
+    SpawnWaiters();
+    if( semInfoGet( s_wake, &info ) != OK || info.count != 0
+        || info.pended != TEST_WAITERS || info.max_pended != TEST_WAITERS )
+        printf( "Error in INFO_STATS: count %d, %d pended (at most %d), not %d\n",
+                info.count, info.pended, info.max_pended, TEST_WAITERS );
+    semCGiveN( s_wake, TEST_WAITERS );
+    taskDelay( 5 );
+    if( semTake( s_wake, 1 ) != ERROR )
+        printf( "Error in INFO_STATS: the semaphore must be empty\n" );
+    if( semInfoGet( s_wake, &info ) != OK || info.pended != 0
+        || info.max_pended != TEST_WAITERS || info.takes != 2 + TEST_WAITERS
+        || info.contended < TEST_WAITERS || info.timeouts != 1 )
+        printf( "Error in INFO_STATS: %lu takes, %lu contended, %lu timed out, %d pended\n",
+                info.takes, info.contended, info.timeouts, info.pended );
+    semDelete( s_wake );
+    s_wake = semMCreate( SEM_Q_FIFO );
+    semTake( s_wake, NO_WAIT );
+    if( semInfoGet( s_wake, &info ) != OK || info.type != SEM_TYPE_MUTEX
+        || info.owner != taskIdSelf() )
+        printf( "Error in INFO_STATS: the mutex owner is %#x, not %#x\n",
+                info.owner, taskIdSelf() );
+    semGive( s_wake );
+    semDelete( s_wake );
+    semStatsEnable( stats_on );
+
+    Go2State( CEILING, "CEILING" );
+    s_ceiling = semMCeilingCreate( SEM_Q_PRIORITY, TEST_CEILING );
+    if( s_ceiling == NULL )
+        perror( "Error creating in CEILING state" );
+    memset( pi_prio, 0, sizeof( pi_prio ) );
+    victim = taskSpawn( "ceiling", TEST_LOW_PRIORITY, 0, 0, CeilingThreadFunc,
+                        0,0,0,0,0,0,0,0,0,0 );
+    while( taskIdVerify( victim ) == OK )
+        taskDelay( 1 );
+    if( pi_prio[1] <= pi_prio[0] || pi_prio[2] != pi_prio[0] )
+        printf( "Error in CEILING: the owner ran at %d, %d holding the mutex, then %d\n",
+                pi_prio[0], pi_prio[1], pi_prio[2] );
+    if( semTake( s_ceiling, NO_WAIT ) != ERROR || errno != S_semLib_INVALID_OPERATION )
+        printf( "Error in CEILING: a task above the ceiling must fail with S_semLib_INVALID_OPERATION\n" );
+    semDelete( s_ceiling );
+
+    Go2State( CALLER_STORAGE, "CALLER_STORAGE" );
+    s_wake = semBInitialize( sem_storage, SEM_Q_FIFO, SEM_EMPTY );
+    if( s_wake == NULL )
+        perror( "Error initializing in CALLER_STORAGE state" );
+    if( semBInitialize( sem_storage, SEM_Q_FIFO, SEM_FULL ) != NULL || errno != EINVAL )
+        printf( "Error in CALLER_STORAGE: storage in service must not be initialized again\n" );
+    SpawnWaiters();
+    if( semDelete( s_wake ) != OK )
+        perror( "Error deleting in CALLER_STORAGE state" );
+    taskDelay( 1 );
+    if( cWokenDeleted != TEST_WAITERS || cWokenOk != 0 || cWokenErr != 0 )
+        printf( "Error in CALLER_STORAGE: %u of %d waiters woken by semDelete\n",
+                cWokenDeleted, TEST_WAITERS );
+    s_stale = s_wake;
+    s_wake = semCInitialize( sem_storage, SEM_Q_FIFO, 2 );
+    if( s_wake == NULL )
+        perror( "Error initializing again in CALLER_STORAGE state" );
+    else if( semCTakeN( s_wake, TEST_WAITERS, NO_WAIT ) != 2 )
+        printf( "Error in CALLER_STORAGE: the storage does not hold the new semaphore\n" );
+    if( semGive( s_stale ) != ERROR || errno != S_objLib_OBJ_ID_ERROR )
+        printf( "Error in CALLER_STORAGE: the deleted semaphore is still in service\n" );
+    semDelete( s_wake );
+
+    Go2State( NS_TIMEOUT, "NS_TIMEOUT" );
+    s_wake = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    q_any = msgQCreate( 1, sizeof( msg ), MSG_Q_FIFO );
+    if( semTakeNs( s_wake, 0 ) != ERROR || errno != S_objLib_OBJ_UNAVAILABLE )
+        printf( "Error in NS_TIMEOUT: a zero timeout must fail with S_objLib_OBJ_UNAVAILABLE\n" );
+    start = NowMs();
+    if( semTakeNs( s_wake, TEST_NS_TIMEOUT ) != ERROR || errno != S_objLib_OBJ_TIMEOUT )
+        printf( "Error in NS_TIMEOUT: semTakeNs must fail with S_objLib_OBJ_TIMEOUT\n" );
+    if( NowMs() - start >= V2PT_TICK / 2 )
+        printf( "Error in NS_TIMEOUT: semTakeNs timed out after %ld msec\n", NowMs() - start );
+    start = NowMs();
+    if( msgQReceiveNs( q_any, (char *)&msg, sizeof( msg ), TEST_NS_TIMEOUT ) != ERROR
+        || errno != S_objLib_OBJ_TIMEOUT )
+        printf( "Error in NS_TIMEOUT: msgQReceiveNs must fail with S_objLib_OBJ_TIMEOUT\n" );
+    if( NowMs() - start >= V2PT_TICK / 2 )
+        printf( "Error in NS_TIMEOUT: msgQReceiveNs timed out after %ld msec\n", NowMs() - start );
+    msg = TEST_MSG;
+    msgQSend( q_any, (char *)&msg, sizeof( msg ), NO_WAIT, MSG_PRI_NORMAL );
+    msg = 0;
+    if( msgQReceiveNs( q_any, (char *)&msg, sizeof( msg ), TEST_NS_TIMEOUT ) != sizeof( msg )
+        || msg != TEST_MSG )
+        printf( "Error in NS_TIMEOUT: msgQReceiveNs received %#x\n", msg );
+    msgQDelete( q_any );
+
+    Go2State( UNTIL_TIMEOUT, "UNTIL_TIMEOUT" );
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+    deadline.tv_nsec += TEST_WAIT_TICKS * V2PT_TICK * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    start = NowMs();
+    if( semTakeUntil( s_wake, &deadline ) != ERROR || errno != S_objLib_OBJ_TIMEOUT )
+        printf( "Error in UNTIL_TIMEOUT: semTakeUntil must fail with S_objLib_OBJ_TIMEOUT\n" );
+    if( NowMs() - start < TEST_WAIT_TICKS * V2PT_TICK - 1 )
+        printf( "Error in UNTIL_TIMEOUT: timed out after %ld of %d msec\n",
+                NowMs() - start, TEST_WAIT_TICKS * V2PT_TICK );
+    semGive( s_wake );
+    if( semTakeUntil( s_wake, &deadline ) != OK )
+        printf( "Error in UNTIL_TIMEOUT: an available semaphore must be taken after the deadline\n" );
+    semDelete( s_wake );
+
+    Go2State( PEND_LISTS, "PEND_LISTS" );
+    s_pend[0] = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    s_pend[1] = semBCreate( SEM_Q_FIFO, SEM_EMPTY );
+    memset( cPendWoken, 0, sizeof( cPendWoken ) );
+    memset( cPendDeleted, 0, sizeof( cPendDeleted ) );
+    victim = taskSpawn( "pend", TEST_LOW_PRIORITY, 0, 0, PendThreadFunc, 0, 0,0,0,0,0,0,0,0,0 );
+    for( i = 0; i < TEST_WAITERS; i++ )
+        taskSpawn( "pend", TEST_LOW_PRIORITY, 0, 0, PendThreadFunc, i % 2, 0,0,0,0,0,0,0,0,0 );
+    taskDelay( 5 ); //to ensure the waiters are blocked well
+    if( taskDelete( victim ) != OK )
+        perror( "Error deleting in PEND_LISTS state" );
+    semGive( s_pend[0] );
+    taskDelay( 1 );
+    if( cPendWoken[0] != 1 || cPendWoken[1] != 0 )
+        printf( "Error in PEND_LISTS: one give woke %u and %u waiters\n",
+                cPendWoken[0], cPendWoken[1] );
+    semGive( s_pend[0] );
+    taskDelay( 1 );
+    if( cPendWoken[0] != (TEST_WAITERS + 1) / 2 )
+        printf( "Error in PEND_LISTS: %u of %d waiters woken\n", cPendWoken[0],
+                (TEST_WAITERS + 1) / 2 );
+    semGive( s_pend[0] );
+    if( semTake( s_pend[0], NO_WAIT ) != OK )
+        printf( "Error in PEND_LISTS: a token was given to the deleted thread\n" );
+    semDelete( s_pend[1] );
+    taskDelay( 1 );
+    if( cPendDeleted[1] != TEST_WAITERS / 2 || cPendDeleted[0] != 0 || cPendWoken[1] != 0 )
+        printf( "Error in PEND_LISTS: semDelete woke %u and %u waiters\n",
+                cPendDeleted[0], cPendDeleted[1] );
+    semDelete( s_pend[0] );
 
     //========================================= RANDOM TEST ===========================================
     printf("\n\nRandom test - press ^C to stop\n");
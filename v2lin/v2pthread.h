@@ -62,68 +62,131 @@ extern "C" {
 #define RDY_MSK 0x008f
 
 /*****************************************************************************
-**  Control block for pthread wrapper for v2pthread task
+**  Cache line geometry
+**
+**  Control blocks which are touched by tasks running on different CPUs are
+**  split into sections, each beginning on its own cache line, so that
+**  writes to one section do not invalidate the line holding another.
 *****************************************************************************/
-typedef struct v2pt_pthread_ctl_blk
+#ifndef V2PT_CACHE_LINE
+#define V2PT_CACHE_LINE 64
+#endif
+
+#define V2PT_CACHE_ALIGNED __attribute__ (( aligned( V2PT_CACHE_LINE ) ))
+
+/*****************************************************************************
+**  Priority index for a priority-ordered pended task list
+**
+**  A list of tasks pended in priority order is kept sorted, highest priority
+**  first and FIFO within each priority level, so that the task to be readied
+**  is always at the head.  The index records the last task queued at each
+**  of the 256 v2pthread priority levels, plus a bitmap of the levels which
+**  are occupied, so that a task is queued or removed in constant time no
+**  matter how many tasks are waiting.
+*****************************************************************************/
+#define V2PT_PRIO_LEVELS   (MIN_V2PT_PRIORITY + 1)
+#define V2PT_PRIO_MAP_BITS (8 * sizeof( unsigned long ))
+#define V2PT_PRIO_MAP_WORDS \
+    ((V2PT_PRIO_LEVELS + V2PT_PRIO_MAP_BITS - 1) / V2PT_PRIO_MAP_BITS)
+
+typedef struct v2pt_prio_index
 {
         /*
-        ** Task ID for task
+        ** Bit n is set while any task is pended at priority level n
         */
-    int
-        taskid;
+    unsigned long
+        level_map[V2PT_PRIO_MAP_WORDS];
 
         /*
-        ** Task Name
+        ** Last task pended at each priority level
         */
-    char
-        *taskname;
+    struct v2pt_pthread_ctl_blk *
+        level_tail[V2PT_PRIO_LEVELS];
+} v2pt_prio_index_t;
 
+/*****************************************************************************
+**  Pended task list of a semaphore, queue or task
+**
+**  Each object which tasks pend on owns its list, and the list is guarded
+**  by the object's own lock, so that tasks pending on unrelated objects
+**  never contend.  Tasks are linked in both directions through nxt_susp
+**  and prv_susp, and the tail pointer lets a FIFO list grow without a walk.
+**  The lock pointer lets task deletion, restart and priority changes find
+**  the lock for the list a task is pended on; it is NULL for the list of
+**  tasks waiting to delete a task, which taskLock guards instead.
+*****************************************************************************/
+typedef struct v2pt_pend_list
+{
         /*
-        ** Thread ID for task
+        ** First and last tasks in the list
         */
-    pthread_t pthrid;
+    struct v2pt_pthread_ctl_blk *
+        head;
+    struct v2pt_pthread_ctl_blk *
+        tail;
 
         /*
-        ** Thread attributes for task
+        ** Lock of the object owning the list
         */
-    pthread_attr_t
-        attr;
+    pthread_mutex_t *
+        lock;
+} v2pt_pend_list_t;
 
+/*****************************************************************************
+**  Control block for pthread wrapper for v2pthread task
+**
+**  The control block is laid out in three cache-aligned sections:
+**      - identity fields read by every scan of the task list,
+**      - scheduling and pend state written as the task blocks and wakes,
+**      - cold fields used only when the task is created, deleted or
+**        restarted.
+**  The section alignment carries over to the type itself, so static TCBs
+**  are placed correctly by the compiler and ts_malloc returns cache-aligned
+**  blocks for dynamically allocated ones.
+*****************************************************************************/
+typedef struct v2pt_pthread_ctl_blk
+{
+    /*
+    **  ---- Identity section (read-mostly) ----
+    */
         /*
-        ** Previous scheduler priority for task
+        ** Thread ID for task
         */
-    struct sched_param
-        prv_priority;
+    pthread_t pthrid;
 
         /*
-        ** Execution entry point address for task
+        ** Next task control block in list
         */
-    int (*entry_point)( int, int, int, int, int, int, int, int, int, int );
+    struct v2pt_pthread_ctl_blk *
+        nxt_task;
 
         /*
-        ** Task parameter block address
+        ** Task ID for task
         */
-    int 
-        parms[10];
+    int
+        taskid;
 
         /*
-        ** Flag indicating if task control block allocated dynamically ( == 0 )
-        ** or statically ( == 1 )
+        ** Option flags for task
         */
     int
-        static_tcb;
+        flags;
 
         /*
-        ** Option flags for task
+        ** Set once the task has been deleted and its pthread cancelled,
+        ** while the tcb waits for the reaper to join and free it.
         */
     int
-        flags;
+        dying;
 
+    /*
+    **  ---- Scheduling and pend state section (written on block/wake) ----
+    */
         /*
         ** Task state
         */
     int
-        state;
+        state V2PT_CACHE_ALIGNED;
 
         /*
         ** Task v2pthread priority level
@@ -131,23 +194,150 @@ typedef struct v2pt_pthread_ctl_blk
     int
         vxw_priority;
 
+        /*
+        ** Previous scheduler priority for task
+        */
+    struct sched_param
+        prv_priority;
+
+        /*
+        ** Nesting level for number of taskSafe calls
+        */
+    int
+        delete_safe_count;
+
+        /*
+        ** Non-zero while the task's thread runs under SCHED_DEADLINE
+        */
+    int
+        dl_active;
+
         /*
         ** Pointer to suspended task list for object task is waiting on
         */
-    struct v2pt_pthread_ctl_blk **
+    v2pt_pend_list_t *
         suspend_list;
 
         /*
-        ** Next task control block in list of tasks waiting on object
+        ** Next and previous task control blocks in list of tasks waiting
+        ** on object
         */
     struct v2pt_pthread_ctl_blk *
         nxt_susp;
+    struct v2pt_pthread_ctl_blk *
+        prv_susp;
 
         /*
-        ** Nesting level for number of taskSafe calls
+        ** Priority index and priority level at which the task was queued,
+        ** while it waits on a priority-ordered list (suspend_index is NULL
+        ** on a FIFO list)
         */
+    v2pt_prio_index_t *
+        suspend_index;
     int
-        delete_safe_count;
+        pend_priority;
+
+        /*
+        ** Set by the task which hands this task a semaphore token while it
+        ** waits, under that semaphore's lock.
+        */
+    int
+        pend_granted;
+
+        /*
+        ** Set (non-zero) by the task which releases this task from its wait
+        ** without a token, by flushing or deleting the object it waits on.
+        ** The releasing task has already removed it from the pend list.
+        */
+    int
+        pend_release;
+
+        /*
+        ** Condition variable signalled to wake this task alone when it is
+        ** handed a token (or the object it waits on is flushed or deleted)
+        */
+    pthread_cond_t
+        pend_wake;
+
+        /*
+        ** Wake word for a task in objWaitAny: bumped, under wake_lock, by
+        ** any object the task watches when it may have become ready, and
+        ** wake_cond signalled.
+        */
+    unsigned int
+        wake_seq;
+    pthread_mutex_t
+        wake_lock;
+    pthread_cond_t
+        wake_cond;
+
+        /*
+        ** Event word, set bit by bit by eventSend, and the events the task
+        ** waits for in eventReceive (zero while it is not waiting).  A
+        ** sender takes wake_lock and signals wake_cond only while the
+        ** task waits.
+        */
+    unsigned int
+        events;
+    unsigned int
+        events_wanted;
+
+    /*
+    **  ---- Cold section (create / delete / restart only) ----
+    */
+        /*
+        ** Task Name
+        */
+    char
+        *taskname V2PT_CACHE_ALIGNED;
+
+        /*
+        ** Thread attributes for task
+        */
+    pthread_attr_t
+        attr;
+
+        /*
+        ** Execution entry point address for task
+        */
+    int (*entry_point)( int, int, int, int, int, int, int, int, int, int );
+
+        /*
+        ** Task parameter block address
+        */
+    int 
+        parms[10];
+
+        /*
+        ** Flag indicating if task control block allocated dynamically ( == 0 )
+        ** or statically ( == 1 )
+        */
+    int
+        static_tcb;
+
+        /*
+        ** Nice value used for the task in unprivileged (SCHED_OTHER) mode
+        */
+    int
+        nice_level;
+
+        /*
+        ** Kernel thread ID of the task's pthread (zero until it starts)
+        */
+    pid_t
+        kernel_tid;
+
+        /*
+        ** SCHED_DEADLINE runtime, relative deadline and period in
+        ** nanoseconds.  A zero runtime means the task runs under its
+        ** fixed SCHED_FIFO / SCHED_RR priority.
+        */
+    unsigned long long
+        dl_runtime;
+    unsigned long long
+        dl_deadline;
+    unsigned long long
+        dl_period;
 
         /*
         ** Mutex and Condition variable for task delete 'pend'
@@ -166,18 +356,72 @@ typedef struct v2pt_pthread_ctl_blk
         delete_bcplt;
 
         /*
-        ** First task control block in list of tasks waiting on this task
-        ** (for deletion purposes)
+        ** List of tasks waiting on this task (for deletion purposes)
         */
-    struct v2pt_pthread_ctl_blk *
-        first_susp;
+    v2pt_pend_list_t
+        pend_list;
+} v2pthread_cb_t;
 
+/*****************************************************************************
+**  Watch record for a task waiting on several objects at once
+**
+**  objWaitAny links one of these, from its own stack, into the watch list
+**  of each semaphore or queue it waits on, under the object's own lock.
+**  The object wakes every watching task whenever it may have become ready
+**  (see wake_watchers) and lets go of all of them when it is deleted, by
+**  clearing their object pointers (see drop_watchers).
+*****************************************************************************/
+typedef struct v2pt_watch
+{
         /*
-        ** Next task control block in list
+        ** Watching task
         */
-    struct v2pt_pthread_ctl_blk *
-        nxt_task;
-} v2pthread_cb_t;
+    v2pthread_cb_t *
+        tcb;
+
+        /*
+        ** Object watched, or NULL once the object has dropped the record
+        */
+    void *
+        object;
+
+        /*
+        ** Next and previous records in the object's watch list
+        */
+    struct v2pt_watch *
+        nxt_watch;
+    struct v2pt_watch *
+        prv_watch;
+} v2pt_watch_t;
+
+/*****************************************************************************
+**  Event registration for a semaphore or queue (semEvStart / msgQEvStart)
+**
+**  At most one task at a time is registered with an object, to be sent the
+**  registered events whenever the object becomes available with no task
+**  pended on it (see post_events).  The record lives in the object's
+**  control block and is read and written under the object's own lock.
+*****************************************************************************/
+typedef struct v2pt_ev_reg
+{
+        /*
+        ** Task ID of registered task, or zero if none is registered
+        */
+    int
+        taskid;
+
+        /*
+        ** Events sent to the registered task
+        */
+    unsigned int
+        events;
+
+        /*
+        ** Registration options (EVENTS_SEND_ONCE, EVENTS_ALLOW_OVERWRITE)
+        */
+    int
+        options;
+} v2pt_ev_reg_t;
 
 #if __cplusplus
 }
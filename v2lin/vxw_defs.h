@@ -39,18 +39,28 @@ extern "C" {
 **  Miscellaneous error codes
 */
 #define TASK_ERRS                       0x00030000
+#define EVENT_ERRS                      0x00560000
 #define MEM_ERRS                        0x00110000
 #define MSGQ_ERRS                       0x00410000
 #define OBJ_ERRS                        0x003d0000
 #define SEM_ERRS                        0x00160000
 #define SM_OBJ_ERRS                     0x00580000
 
+#define S_eventLib_TIMEOUT              (EVENT_ERRS + 1)
+#define S_eventLib_NOT_ALL_EVENTS       (EVENT_ERRS + 2)
+#define S_eventLib_ALREADY_REGISTERED   (EVENT_ERRS + 3)
+#define S_eventLib_EVENTSEND_FAILED     (EVENT_ERRS + 4)
+#define S_eventLib_ZERO_EVENTS          (EVENT_ERRS + 5)
+#define S_eventLib_TASK_NOT_REGISTERED  (EVENT_ERRS + 6)
+
 #define S_memLib_NOT_ENOUGH_MEMORY      (MEM_ERRS + 1)
 
 #define S_msgQLib_INVALID_MSG_LENGTH    (MSGQ_ERRS + 1)
 
 #define S_objLib_OBJ_DELETED            (OBJ_ERRS + 3)
 #define S_objLib_OBJ_ID_ERROR           (OBJ_ERRS + 1)
+#define S_objLib_OBJ_NAME_CLASH         (OBJ_ERRS + 8)
+#define S_objLib_OBJ_NOT_FOUND          (OBJ_ERRS + 16)
 #define S_objLib_OBJ_TIMEOUT            (OBJ_ERRS + 4)
 #define S_objLib_OBJ_UNAVAILABLE        (OBJ_ERRS + 2)
 
@@ -59,6 +69,12 @@ extern "C" {
 #define S_smObjLib_NOT_INITIALIZED      (SM_OBJ_ERRS + 1)
 
 #define S_taskLib_ILLEGAL_PRIORITY      (TASK_ERRS + 0x00000065)
+#define S_taskLib_ILLEGAL_OPERATION     (TASK_ERRS + 0x0000006f)
+
+/*
+**  v2lin_init_opts Option Flags
+*/
+#define V2LIN_INIT_UNPRIVILEGED         0x0001
 
 /*
 **  Timeout options
@@ -83,6 +99,56 @@ extern "C" {
 #define SEM_Q_PRIORITY                  0x01
 #define SEM_DELETE_SAFE                 0x04
 #define SEM_INVERSION_SAFE              0x08
+#define SEM_ADAPTIVE                    0x100
+#define SEM_RW_READER_PRIORITY          0x200
+#define SEM_PRIO_CEILING                0x400
+
+/*
+**  semOpen Mode Flags
+*/
+#define OM_CREATE                       0x10000000
+#define OM_EXCL                         0x20000000
+#define OM_DELETE_ON_LAST_CLOSE         0x40000000
+
+/*
+**  Caller Storage for semBInitialize, semCInitialize and semMInitialize
+*/
+#define VX_SEMAPHORE_SIZE               3072
+#define VX_SEMAPHORE_ALIGN              64
+
+/*
+**  Semaphore Types and Statistics (semInfoGet)
+*/
+#define SEM_TYPE_BINARY                 0
+#define SEM_TYPE_MUTEX                  1
+#define SEM_TYPE_COUNTING               2
+#define SEM_TYPE_RW                     3
+#define SEM_TYPE_RATE                   4
+#define SEM_HIST_BUCKETS                16
+
+/*
+**  objWaitAny Object Types
+*/
+#define WAIT_OBJ_SEM                    1
+#define WAIT_OBJ_MSG_Q                  2
+#define WAIT_OBJS_MAX                   32
+
+/*
+**  eventReceive Option Flags
+*/
+#define EVENTS_WAIT_ALL                 0x00
+#define EVENTS_WAIT_ANY                 0x01
+#define EVENTS_RETURN_ALL               0x02
+#define EVENTS_KEEP_UNWANTED            0x04
+#define EVENTS_FETCH                    0x80
+
+/*
+**  semEvStart / msgQEvStart Option Flags
+*/
+#define EVENTS_OPTIONS_NONE             0x00
+#define EVENTS_SEND_ONCE                0x01
+#define EVENTS_ALLOW_OVERWRITE          0x02
+#define EVENTS_SEND_IF_FREE             0x04
 
 #if __cplusplus
 }
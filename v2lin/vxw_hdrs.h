@@ -30,6 +30,7 @@ extern "C" {
 #endif
 
 #include <sys/types.h>
+#include <time.h>
 #include "vxw_defs.h"
 
 /*
@@ -49,13 +50,35 @@ typedef void     WIND_TCB;
 typedef int      SEM_B_STATE;
 typedef void     *FUNCPTR;
 
+/*
+**  Storage for a semaphore built by semBInitialize, semCInitialize or
+**  semMInitialize
+*/
+#define VX_SEMAPHORE_STORAGE(name) \
+    char name[VX_SEMAPHORE_SIZE] \
+        __attribute__ (( aligned( VX_SEMAPHORE_ALIGN ) ))
+#define VX_BINARY_SEMAPHORE(name)   VX_SEMAPHORE_STORAGE(name)
+#define VX_COUNTING_SEMAPHORE(name) VX_SEMAPHORE_STORAGE(name)
+#define VX_MUTEX_SEMAPHORE(name)    VX_SEMAPHORE_STORAGE(name)
+
 
 /*
 **
-** This function must be called ASAP in main()
+** One of these functions must be called ASAP in main()
 **
+** v2lin_init_opts takes V2LIN_INIT_xxx option flags selecting system-wide
+** modes; v2lin_init is equivalent to v2lin_init_opts( 0 ).
+**
+** V2LIN_INIT_UNPRIVILEGED runs all tasks under the normal time-sharing
+** policy (SCHED_OTHER) so no CAP_SYS_NICE privilege is needed.  VxWorks
+** priorities 0-255 map proportionally onto nice values 0-19; since an
+** unprivileged thread cannot lower its nice value, raising a task's
+** priority with taskPrioritySet is best effort.  taskLock still excludes
+** other taskLock callers but does not raise the caller's priority.
 */
 extern int v2lin_init( void );
+extern int v2lin_init_opts( int options );
+extern BOOL unprivilegedModeIsEnabled( void );
 
 /*
 **  Round-Robin Scheduling Control
@@ -111,8 +134,52 @@ extern BOOL      taskIsSuspended( int taskId );
 extern WIND_TCB  *taskTcb( int taskId );
 extern int       taskIdListGet( int list[], int maxIds );
 
+/*
+**  Deadline Scheduling Control
+**
+**  The following functions are unique to v2pthreads.  They place a task
+**  under the Linux SCHED_DEADLINE policy, which guarantees the task
+**  'runtime' nanoseconds of CPU time in every 'period' nanoseconds, to be
+**  delivered within 'deadline' nanoseconds of the start of the period, and
+**  caps the task at that share.  A period of zero means period == deadline;
+**  a runtime of zero returns the task to its fixed priority.
+**  If the kernel refuses the request (no CAP_SYS_NICE, admission control,
+**  or an old kernel) the task keeps running as it was: normally at its
+**  VxWorks priority, or under the parameters it already had.
+**  taskIsDeadline reports whether the task runs under SCHED_DEADLINE.
+*/
+extern int       taskSpawnDeadline( char *name, int pri, int opts, int stksize,
+                                    FUNCPTR entry,
+                                    unsigned long long runtime,
+                                    unsigned long long deadline,
+                                    unsigned long long period,
+                                    int arg1, int arg2, int arg3,
+                                    int arg4, int arg5, int arg6, int arg7,
+                                    int arg8, int arg9, int arg10 );
+extern STATUS    taskDeadlineSet( int taskId, unsigned long long runtime,
+                                  unsigned long long deadline,
+                                  unsigned long long period );
+extern BOOL      taskIsDeadline( int taskId );
+
+/*
+**  taskLock Instrumentation
+**
+**  taskLockHoldMax is unique to v2pthreads.  It returns the longest time,
+**  in nanoseconds, that any task has held the scheduler lock (outermost
+**  taskLock to the matching taskUnlock), and optionally restarts the
+**  measurement.
+*/
+extern unsigned long long taskLockHoldMax( BOOL reset );
+
 /*
 **  msgQLib Function Prototypes
+**
+**  msgQReceiveNs and msgQReceiveUntil are unique to v2pthreads.  They wait
+**  like msgQReceive, but for timeout_ns nanoseconds (zero means NO_WAIT,
+**  and a negative count WAIT_FOREVER) or until an absolute deadline on
+**  CLOCK_MONOTONIC (NULL means WAIT_FOREVER), rather than whole ticks.
+**  All timed waits run on CLOCK_MONOTONIC, so setting the time of day
+**  does not change when they expire.
 */
 extern MSG_Q_ID  msgQCreate( int max_msgs, int msglen, int opt );
 extern STATUS    msgQDelete( MSG_Q_ID queue );
@@ -120,19 +187,242 @@ extern STATUS    msgQSend( MSG_Q_ID queue, char *msg, uint msglen,
                            int wait, int pri );
 extern int       msgQReceive( MSG_Q_ID queue, char *msgbuf, uint buflen,
                               int max_wait );
+extern int       msgQReceiveNs( MSG_Q_ID queue, char *msgbuf, uint buflen,
+                                long long timeout_ns );
+extern int       msgQReceiveUntil( MSG_Q_ID queue, char *msgbuf, uint buflen,
+                                   const struct timespec *deadline );
 extern int       msgQNumMsgs( MSG_Q_ID queue );
 
 /*
 **  semLib Function Prototypes
+**
+**  A SEM_ID is an opaque handle, not the address of the semaphore.  IDs
+**  are checked in constant time, and the ID of a deleted semaphore (or a
+**  garbage value) is rejected with S_objLib_OBJ_ID_ERROR.
+**
+**  A SEM_INVERSION_SAFE mutex is a Linux priority-inheritance mutex: the
+**  kernel boosts its owner (and, through chains of such mutexes, their
+**  owners) while higher-priority tasks wait.  semDelete of one which
+**  another task owns returns only after the owner gives it (or is
+**  deleted).  A task waiting for an inversion-safe or ceiling mutex can
+**  be deleted, within V2LIN_CANCEL_POLL_MS (10) milliseconds.  Owning a
+**  SEM_DELETE_SAFE mutex makes a task safe from deletion, as if by
+**  taskSafe, until it gives the mutex back.  taskSafe and taskUnsafe cost
+**  one atomic operation unless a deleter is waiting.
+**
+**  semMCeilingCreate is unique to v2pthreads.  It creates a mutex which
+**  uses the priority ceiling protocol instead: a task taking it runs at
+**  (at least) the ceiling priority until it gives it back, whether or
+**  not other tasks wait, so its worst-case blocking can be bounded
+**  without chains of boosts.  A task whose priority is above the ceiling,
+**  or a thread which is not a task running under SCHED_FIFO or SCHED_RR,
+**  may not take it (S_semLib_INVALID_OPERATION).  Unlike an inversion-
+**  safe mutex, it could not be recovered from an owner which was deleted,
+**  so its owner is always deletion-safe, as if it were SEM_DELETE_SAFE.
+**  It is not available in unprivileged mode.
+**
+**  SEM_ADAPTIVE is unique to v2pthreads.  A semTake on a SEM_ADAPTIVE mutex
+**  held by another task, with no task yet pended on it, first polls the
+**  mutex for a while (V2LIN_MUTEX_SPIN_LIMIT polls, set when v2lin is
+**  built) on the expectation that the owner, running on another CPU, gives
+**  it soon.  With one CPU online it blocks at once.  semMSpinStats
+**  reports how many contended takes got the mutex by spinning and how many
+**  had to block, and optionally restarts the counts.  SEM_ADAPTIVE has no
+**  effect on an inversion-safe mutex.
+**
+**  A reader-writer semaphore (semRWCreate) is held by any number of tasks
+**  taking it with semRTake, or by one taking it with semWTake (or semTake),
+**  and is given back with semGive.  Readers of an uncontended one touch
+**  only a counter belonging to their CPU, so they do not slow each other
+**  down.  By default a waiting writer keeps new readers out, so it cannot
+**  be starved; SEM_RW_READER_PRIORITY lets readers in ahead of waiting
+**  writers instead.  A reader may take the semaphore again while it holds
+**  it, even while a writer waits, as may the writer; a reader may not go
+**  on to take it for writing.  At most max_readers tasks (at least 1, or
+**  semRWCreate fails with EINVAL) hold it for reading at once; further
+**  readers wait for one to give it back, as they would for a writer.  A
+**  task can hold up to V2LIN_RW_HOLDS (16 unless v2lin is built with
+**  another value) reader-writer semaphores for reading at once; taking
+**  one more fails with S_semLib_INVALID_OPERATION.
+**
+**  semRateCreate is unique to v2pthreads.  It creates a rate-limiter
+**  semaphore: a token bucket holding up to burst tokens, refilled at rate
+**  tokens per second, from which semTake (or semTakeNs or semTakeUntil)
+**  takes one token.  The bucket starts full.  No timer refills it; each
+**  take works out from the monotonic clock whether a token is due, and a
+**  task which finds none blocks until the next one is due (or until its
+**  timeout).  Waiting tasks get tokens in FIFO or priority order.  The
+**  rate may be up to one billion tokens per second.  A rate-limiter
+**  semaphore cannot be given, flushed, watched by objWaitAny or send
+**  events; semInfoGet reports the tokens in the bucket as its count.
+**
+**  semBInitialize, semCInitialize and semMInitialize build a semaphore in
+**  storage provided by the caller, such as a static or a structure member
+**  declared with VX_BINARY_SEMAPHORE, VX_COUNTING_SEMAPHORE or
+**  VX_MUTEX_SEMAPHORE, and allocate no memory.  The semaphore is used
+**  through its SEM_ID like any other.  semDelete returns once every other
+**  task using the semaphore (the waiters it wakes among them) is done with
+**  the storage, which then belongs to the caller again; storage holding a
+**  semaphore still in service may not be initialized again (EINVAL).
+**
+**  semCGiveN and semCTakeN are unique to v2pthreads.  semCGiveN gives a
+**  counting semaphore count tokens in one call, and wakes one pended task
+**  for each; it fails (S_semLib_INVALID_OPERATION), giving none, if that
+**  would take the semaphore past INT_MAX tokens.  semCTakeN blocks like
+**  semTake until it can take one token from a counting semaphore, then
+**  takes up to count - 1 more if they are there, and returns how many it
+**  took (or ERROR).
+**
+**  semOpen opens a named binary, mutex or counting semaphore (type
+**  SEM_TYPE_BINARY, SEM_TYPE_MUTEX or SEM_TYPE_COUNTING), shared with every
+**  process on the host which opens the same name; the leading '/' of a
+**  name is optional and all names are public.  With OM_CREATE it creates
+**  the semaphore if the name is not in use, and with OM_EXCL as well it
+**  fails (S_objLib_OBJ_NAME_CLASH) if it is; without OM_CREATE a name not
+**  in use fails with S_objLib_OBJ_NOT_FOUND.  Each process gets a SEM_ID
+**  of its own, for semTake and semGive only, and each semOpen needs a
+**  semClose.  semUnlink removes the name; processes which have the
+**  semaphore open go on using it, and it is freed once all have closed it.
+**  OM_DELETE_ON_LAST_CLOSE unlinks it when the last process closes it.
+**  A process which dies counts as having closed it, and a name left half
+**  created by a process which died is reclaimed by the next semOpen,
+**  after it has waited a second for the creator.  A named mutex left
+**  taken by a task or process which died is taken over by the next task
+**  to take it.  Tasks waiting for a named semaphore are woken highest
+**  priority first; SEM_INVERSION_SAFE gives a named mutex priority
+**  inheritance across processes.  The context argument is not used.
+**
+**  semTakeNs and semTakeUntil take any semaphore as semTake does, but wait
+**  for timeout_ns nanoseconds (zero means NO_WAIT, and a negative count
+**  WAIT_FOREVER) or until an absolute CLOCK_MONOTONIC deadline (NULL means
+**  WAIT_FOREVER) instead of whole ticks.  Sub-tick timeouts work, and no
+**  semaphore timeout moves when the time of day is set.
 */
 extern STATUS    semGive( SEM_ID semaphore );
 extern STATUS    semTake( SEM_ID semaphore, int max_wait );
+extern STATUS    semTakeNs( SEM_ID semaphore, long long timeout_ns );
+extern STATUS    semTakeUntil( SEM_ID semaphore,
+                               const struct timespec *deadline );
 extern STATUS    semFlush( SEM_ID semaphore );
 extern STATUS    semDelete( SEM_ID semaphore );
 extern SEM_ID    semBCreate( int opt, SEM_B_STATE initial_state );
 extern SEM_ID    semCCreate( int opt, int initial_count );
 extern SEM_ID    semMCreate( int opt );
+extern SEM_ID    semBInitialize( char *pSemMem, int opt,
+                                 SEM_B_STATE initial_state );
+extern SEM_ID    semCInitialize( char *pSemMem, int opt, int initial_count );
+extern SEM_ID    semMInitialize( char *pSemMem, int opt );
+extern SEM_ID    semMCeilingCreate( int opt, int ceiling );
+extern SEM_ID    semRWCreate( int opt, int max_readers );
+extern SEM_ID    semRateCreate( int opt, int rate, int burst );
+extern STATUS    semRTake( SEM_ID semaphore, int max_wait );
+extern STATUS    semWTake( SEM_ID semaphore, int max_wait );
+extern STATUS    semCGiveN( SEM_ID semaphore, int count );
+extern int       semCTakeN( SEM_ID semaphore, int count, int max_wait );
 extern STATUS    semMGiveForce( SEM_ID semaphore );
+extern STATUS    semMSpinStats( SEM_ID semaphore, unsigned long *spun,
+                                unsigned long *blocked, BOOL reset );
+extern SEM_ID    semOpen( const char *name, int type, int initial_state,
+                          int opt, int mode, void *context );
+extern STATUS    semClose( SEM_ID semaphore );
+extern STATUS    semUnlink( const char *name );
+
+/*
+**  Semaphore Statistics
+**
+**  semStatsEnable( TRUE ) starts v2pthreads counting, for every semaphore,
+**  the takes, the takes which had to wait (by blocking or, for a
+**  SEM_ADAPTIVE mutex, by spinning), the waits which timed out, and the
+**  most tasks ever waiting at once, with histograms of how long takes
+**  waited and, for mutexes, how long they were held.  Each count costs a
+**  relaxed atomic add; timing a wait or a hold costs a clock read.  It
+**  returns the previous setting.  Counts restart when a semaphore is
+**  created.  semInfoGet fills in a SEM_INFO for a semaphore, semShow
+**  prints one (with the histograms if level is 1 or more), and
+**  semTopShow prints the max_sems semaphores with the most contended
+**  takes.  Histogram bucket 0 counts times under 1 microsecond, bucket n
+**  times from 2^(n-1) up to 2^n microseconds, and the last bucket all
+**  longer times.
+*/
+typedef struct sem_info
+{
+    int      type;          /* SEM_TYPE_BINARY, _MUTEX, _COUNTING or _RW */
+    int      options;       /* options given when it was created */
+    int      count;         /* tokens available, or readers holding it */
+    int      owner;         /* task ID of the mutex owner or writer, or 0 */
+    int      pended;        /* tasks waiting for it now */
+    int      max_pended;    /* most tasks ever waiting for it at once */
+    unsigned long takes;    /* successful takes */
+    unsigned long contended;/* takes which had to wait */
+    unsigned long timeouts; /* waits which timed out */
+    unsigned long wait_hist[SEM_HIST_BUCKETS];  /* wait times */
+    unsigned long hold_hist[SEM_HIST_BUCKETS];  /* mutex hold times */
+} SEM_INFO;
+
+extern BOOL      semStatsEnable( BOOL enable );
+extern STATUS    semInfoGet( SEM_ID semaphore, SEM_INFO *info );
+extern STATUS    semShow( SEM_ID semaphore, int level );
+extern STATUS    semTopShow( int max_sems );
+
+/*
+**  Multiple Object Wait
+**
+**  objWaitAny is unique to v2pthreads.  It blocks the calling task until
+**  any one of up to WAIT_OBJS_MAX semaphores and message queues is ready,
+**  or max_wait ticks pass, and then takes a token from (or receives a
+**  message into msgbuf from) that one object only.  It returns the index
+**  of that object in objs[], with msglen set for a queue, or ERROR with
+**  errno S_objLib_OBJ_TIMEOUT (S_objLib_OBJ_UNAVAILABLE for NO_WAIT).
+**  If an object is invalid or is deleted meanwhile, it returns ERROR with
+**  the error semTake or msgQReceive gives for it.  When several objects
+**  are ready at once the earliest in objs[] is taken.  The waiting task
+**  does not pend on the objects, so tasks blocked in semTake or
+**  msgQReceive on the same object are served first.
+*/
+typedef struct wait_obj
+{
+    int      type;          /* WAIT_OBJ_SEM or WAIT_OBJ_MSG_Q */
+    void     *id;           /* SEM_ID or MSG_Q_ID */
+    char     *msgbuf;       /* queue: buffer for the message received */
+    uint     buflen;        /* queue: size of msgbuf */
+    int      msglen;        /* queue: length of the message received */
+} WAIT_OBJ;
+
+extern int       objWaitAny( WAIT_OBJ objs[], int nobjs, int max_wait );
+
+/*
+**  eventLib Function Prototypes
+**
+**  Each task has 32 event flags.  eventSend sets events for a task (0 for
+**  the calling task) and costs one atomic operation unless the task is
+**  waiting for events.  eventReceive waits up to max_wait ticks for all
+**  (EVENTS_WAIT_ALL) or any (EVENTS_WAIT_ANY) of the events given, then
+**  returns them in *received and clears them; with EVENTS_RETURN_ALL it
+**  returns every pending event, and unless EVENTS_KEEP_UNWANTED is given
+**  it clears them all.  EVENTS_FETCH returns the pending events at once
+**  and clears none.  A wait which fails returns ERROR with errno
+**  S_eventLib_TIMEOUT (S_eventLib_NOT_ALL_EVENTS for NO_WAIT), and
+**  *received holds whichever of the events did arrive.
+**
+**  semEvStart and msgQEvStart register the calling task to be sent events
+**  when a semaphore is given, or a message sent to a queue, and no task is
+**  pended on it.  One task at a time may be registered with an object;
+**  EVENTS_ALLOW_OVERWRITE lets another task take over.  EVENTS_SEND_ONCE
+**  ends the registration after the first send, and EVENTS_SEND_IF_FREE
+**  sends the events at once if the object is available already.  A task
+**  registered with a semaphore makes each give of it take the semaphore's
+**  lock.  Deleting the object ends the registration without sending.
+*/
+extern STATUS    eventSend( int taskId, unsigned int events );
+extern STATUS    eventReceive( unsigned int events, int options, int max_wait,
+                               unsigned int *received );
+extern STATUS    eventClear( void );
+extern STATUS    semEvStart( SEM_ID semaphore, unsigned int events,
+                             int options );
+extern STATUS    semEvStop( SEM_ID semaphore );
+extern STATUS    msgQEvStart( MSG_Q_ID queue, unsigned int events,
+                              int options );
+extern STATUS    msgQEvStop( MSG_Q_ID queue );
 
 /*
 **  wdLib Function Prototypes
@@ -142,6 +432,22 @@ extern WDOG_ID   wdCreate( void );
 extern STATUS    wdDelete( WDOG_ID wdId );
 extern STATUS    wdStart( WDOG_ID wdId, int delay, FUNCPTR funcptr, int parm );
 
+/*
+**  excLib Function Prototypes
+**
+**  excJobAdd queues a call to func( arg1, ..., arg6 ) to be made at task
+**  level by an exception job worker, without blocking the caller.
+**  Watchdog timeout functions are run the same way, one at a time; a
+**  timeout function not yet run is dropped if its watchdog is restarted,
+**  cancelled or deleted first.  The number of worker tasks and queue slots
+**  are set when v2lin is built, through V2LIN_EXC_JOB_WORKERS (default 1)
+**  and V2LIN_EXC_JOB_SLOTS (default 128).
+**  If the queue is full, excJobAdd fails with S_objLib_OBJ_UNAVAILABLE.
+*/
+extern STATUS    excJobAdd( void (*func)( int, int, int, int, int, int ),
+                            int arg1, int arg2, int arg3,
+                            int arg4, int arg5, int arg6 );
+
 #if __cplusplus
 }
 #endif